@@ -76,9 +76,11 @@ PATH_TO_THIS_SCRIPT=`vastrealpath $0`
 PATH_TO_LIB_DIR=`dirname $PATH_TO_THIS_SCRIPT`
 #
 MARCH=`"$PATH_TO_LIB_DIR"/set_good_march.sh`
+# The detection filter convolution in our copy of SExtractor may run in parallel threads
+OPENMP_FLAGS=`"$PATH_TO_LIB_DIR"/set_openmp.sh`
 #CFLAGS="-O2 -Wno-error $MARCH"
 # -fcommon is needed on Ubuntu 20.10 to compile SExtractor
-CFLAGS="-O2 -Wno-error -fcommon $MARCH"
+CFLAGS="-O2 -Wno-error -fcommon $MARCH $OPENMP_FLAGS"
 #
 
 echo " "
@@ -17,6 +17,11 @@
 # This holds for NMW because filenames contain timestamps
 # (e.g. Gem03Q1b1x1_2025-12-18_22-15-52_001.fits).
 #
+# Independently of this script, autodetect_aperture() keeps a content-addressed
+# cache in $VAST_SEXTRACTOR_CACHE_DIR/by_content/ keyed by a hash of the image
+# content, the SExtractor command-line parameters and the configuration files,
+# so it does not rely on unique filenames.
+#
 # This script is a no-op if VAST_SEXTRACTOR_CACHE_DIR is not set — there is
 # zero overhead for non-cache users.
 
@@ -89,6 +89,221 @@ int find_catalog_in_vast_images_catalogs_log( char *fitsfilename, char *catalogf
 }
 */
 
+// Shared content-addressed SExtractor catalog cache.
+// If VAST_SEXTRACTOR_CACHE_DIR is set, the catalog and the aperture produced by
+// autodetect_aperture() in the aperture-photometry mode are stored under
+// VAST_SEXTRACTOR_CACHE_DIR/by_content/ with the name derived from a hash of
+// everything that affects them: the image pixels (the whole file), the flag and
+// weight images, default.sex with the files it refers to, the parameter files,
+// bad_region.lst, the gain and saturation level passed on the command line,
+// and the fixed aperture. A change in any of these results in a different name,
+// so a stale catalog is never picked up.
+// Files are written under a temporary name and rename()'d into place, so
+// concurrent runs see either a complete entry or none.
+#define SEXTRACTOR_CACHE_SUBDIR "by_content"
+#define SEXTRACTOR_CACHE_FNV_OFFSET 14695981039346656037ULL
+#define SEXTRACTOR_CACHE_FNV_PRIME 1099511628211ULL
+
+static void sextractor_cache_hash_bytes( const unsigned char *bytes, size_t n, unsigned long long *hash ) {
+ size_t i;
+ unsigned long long h;
+ h= ( *hash );
+ for ( i= 0; i < n; i++ ) {
+  h^= (unsigned long long)bytes[i];
+  h*= SEXTRACTOR_CACHE_FNV_PRIME;
+ }
+ ( *hash )= h;
+}
+
+static void sextractor_cache_hash_string( const char *str, unsigned long long *hash ) {
+ // include the terminating '\0' so "ab"+"c" and "a"+"bc" differ
+ sextractor_cache_hash_bytes( (const unsigned char *)str, strlen( str ) + 1, hash );
+}
+
+// Hash the file content; a missing file is hashed as such
+static void sextractor_cache_hash_file_content( const char *filename, unsigned long long *hash ) {
+ FILE *f;
+ unsigned char *buffer;
+ size_t n;
+ f= fopen( filename, "rb" );
+ if ( NULL == f ) {
+  sextractor_cache_hash_string( "(missing file)", hash );
+  return;
+ }
+ buffer= malloc( 1048576 );
+ if ( NULL == buffer ) {
+  fprintf( stderr, "ERROR: in sextractor_cache_hash_file() can't allocate memory for buffer\n" );
+  exit( EXIT_FAILURE );
+ }
+ while ( 0 < ( n= fread( buffer, 1, 1048576, f ) ) ) {
+  sextractor_cache_hash_bytes( buffer, n, hash );
+ }
+ free( buffer );
+ fclose( f );
+}
+
+// Hash the file name and the file content
+static void sextractor_cache_hash_file( const char *filename, unsigned long long *hash ) {
+ sextractor_cache_hash_string( filename, hash );
+ sextractor_cache_hash_file_content( filename, hash );
+}
+
+// Hash the filter and neural-network files default.sex refers to
+static void sextractor_cache_hash_files_referenced_in_default_sex( unsigned long long *hash ) {
+ FILE *f;
+ char str[MAX_STRING_LENGTH_IN_SEXTARCTOR_CAT];
+ char key[MAX_STRING_LENGTH_IN_SEXTARCTOR_CAT];
+ char value[MAX_STRING_LENGTH_IN_SEXTARCTOR_CAT];
+ char filename[FILENAME_LENGTH];
+ f= fopen( "default.sex", "r" );
+ if ( NULL == f ) {
+  return;
+ }
+ while ( NULL != fgets( str, MAX_STRING_LENGTH_IN_SEXTARCTOR_CAT, f ) ) {
+  if ( 2 != sscanf( str, "%s %s", key, value ) ) {
+   continue;
+  }
+  if ( 0 == strcmp( key, "FILTER_NAME" ) || 0 == strcmp( key, "STARNNW_NAME" ) ) {
+   safely_encode_user_input_string( filename, value, FILENAME_LENGTH - 1 );
+   sextractor_cache_hash_file( filename, hash );
+  }
+ }
+ fclose( f );
+}
+
+// Returns 0 and the cached catalog name (without the directory creation) if the cache is enabled, 1 otherwise
+static int get_sextractor_cache_catalog_filename( char *fitsfilename, int is_flag_image_used, char *flag_image_filename, char *weight_image_filename,
+                                                  char *gain_sextractor_cl_parameter_string, char *saturation_limitsextractor_cl_parameter_string,
+                                                  double fixed_aperture, char *cache_catalog_filename ) {
+ char *cache_dir;
+ char cache_subdir[FILENAME_LENGTH];
+ double numeric_parameters[6];
+ unsigned long long hash;
+
+ cache_dir= getenv( "VAST_SEXTRACTOR_CACHE_DIR" );
+ if ( NULL == cache_dir || cache_dir[0] == '\0' ) {
+  return 1;
+ }
+ snprintf( cache_subdir, FILENAME_LENGTH, "%s/%s", cache_dir, SEXTRACTOR_CACHE_SUBDIR );
+ if ( 0 != mkdir( cache_subdir, 0775 ) && 0 != access( cache_subdir, W_OK ) ) {
+  fprintf( stderr, "WARNING: cannot use the SExtractor catalog cache directory %s\n", cache_subdir );
+  return 1;
+ }
+
+ hash= SEXTRACTOR_CACHE_FNV_OFFSET;
+ // for the images only the content matters, not the file names
+ sextractor_cache_hash_file_content( fitsfilename, &hash );
+ if ( is_flag_image_used == 1 ) {
+  sextractor_cache_hash_file_content( flag_image_filename, &hash );
+  sextractor_cache_hash_file_content( weight_image_filename, &hash );
+ }
+ sextractor_cache_hash_file( "default.sex", &hash );
+ sextractor_cache_hash_files_referenced_in_default_sex( &hash );
+ sextractor_cache_hash_file( "default.param", &hash );
+ sextractor_cache_hash_file( "default_flag.param", &hash );
+ sextractor_cache_hash_file( "autodetect_aper.param", &hash );
+ sextractor_cache_hash_file( "autodetect_aper_flag.param", &hash );
+ sextractor_cache_hash_file( "bad_region.lst", &hash );
+ // each parameter is hashed on its own, so none of them may be cut short
+ sextractor_cache_hash_string( gain_sextractor_cl_parameter_string, &hash );
+ sextractor_cache_hash_string( saturation_limitsextractor_cl_parameter_string, &hash );
+ sextractor_cache_hash_bytes( (const unsigned char *)&is_flag_image_used, sizeof( is_flag_image_used ), &hash );
+ numeric_parameters[0]= fixed_aperture;
+ numeric_parameters[1]= (double)CONST;
+ numeric_parameters[2]= (double)AP01;
+ numeric_parameters[3]= (double)AP02;
+ numeric_parameters[4]= (double)AP03;
+ numeric_parameters[5]= (double)AP04;
+ sextractor_cache_hash_bytes( (const unsigned char *)numeric_parameters, sizeof( numeric_parameters ), &hash );
+
+ if ( FILENAME_LENGTH <= snprintf( cache_catalog_filename, FILENAME_LENGTH, "%s/%016llx.cat", cache_subdir, hash ) ) {
+  fprintf( stderr, "WARNING: the SExtractor catalog cache path %s is too long, the cache is not used\n", cache_subdir );
+  return 1;
+ }
+ return 0;
+}
+
+// Copy a file through a temporary name in the destination directory; returns 0 on success
+static int copy_file_atomically( const char *source_filename, const char *destination_filename ) {
+ FILE *source;
+ FILE *destination;
+ char tmp_filename[FILENAME_LENGTH + 64];
+ char buffer[65536];
+ size_t n;
+ int write_error= 0;
+ source= fopen( source_filename, "rb" );
+ if ( NULL == source ) {
+  return 1;
+ }
+ snprintf( tmp_filename, sizeof( tmp_filename ), "%s.tmp.%d", destination_filename, (int)getpid() );
+ destination= fopen( tmp_filename, "wb" );
+ if ( NULL == destination ) {
+  fclose( source );
+  return 1;
+ }
+ while ( 0 < ( n= fread( buffer, 1, sizeof( buffer ), source ) ) ) {
+  if ( n != fwrite( buffer, 1, n, destination ) ) {
+   write_error= 1;
+   break;
+  }
+ }
+ fclose( source );
+ if ( 0 != fclose( destination ) ) {
+  write_error= 1;
+ }
+ if ( write_error != 0 || 0 != rename( tmp_filename, destination_filename ) ) {
+  unlink( tmp_filename );
+  return 1;
+ }
+ return 0;
+}
+
+// Restore the catalog and the aperture; returns 0 on success
+static int restore_catalog_from_sextractor_cache( const char *cache_catalog_filename, char *output_sextractor_catalog, double *aperture ) {
+ char cache_aperture_filename[FILENAME_LENGTH + 16];
+ FILE *aperture_file;
+ snprintf( cache_aperture_filename, sizeof( cache_aperture_filename ), "%s.aperture", cache_catalog_filename );
+ aperture_file= fopen( cache_aperture_filename, "r" );
+ if ( NULL == aperture_file ) {
+  return 1;
+ }
+ if ( 1 != fscanf( aperture_file, "%lf", aperture ) ) {
+  fclose( aperture_file );
+  return 1;
+ }
+ fclose( aperture_file );
+ if ( ( *aperture ) < 1.0 ) {
+  return 1;
+ }
+ return copy_file_atomically( cache_catalog_filename, output_sextractor_catalog );
+}
+
+// Save the catalog and the aperture; the aperture goes first as the catalog marks a complete entry.
+// The aperture is stored with full precision so a restored run returns exactly the same value.
+static void save_catalog_to_sextractor_cache( const char *cache_catalog_filename, char *output_sextractor_catalog, double aperture ) {
+ char cache_aperture_filename[FILENAME_LENGTH + 16];
+ char tmp_filename[FILENAME_LENGTH + 64];
+ FILE *aperture_file;
+ snprintf( cache_aperture_filename, sizeof( cache_aperture_filename ), "%s.aperture", cache_catalog_filename );
+ snprintf( tmp_filename, sizeof( tmp_filename ), "%s.tmp.%d", cache_aperture_filename, (int)getpid() );
+ aperture_file= fopen( tmp_filename, "w" );
+ if ( NULL == aperture_file ) {
+  fprintf( stderr, "WARNING: cannot write to the SExtractor catalog cache %s\n", tmp_filename );
+  return;
+ }
+ fprintf( aperture_file, "%.17g\n", aperture );
+ if ( 0 != fclose( aperture_file ) || 0 != rename( tmp_filename, cache_aperture_filename ) ) {
+  unlink( tmp_filename );
+  fprintf( stderr, "WARNING: cannot write to the SExtractor catalog cache %s\n", cache_aperture_filename );
+  return;
+ }
+ if ( 0 != copy_file_atomically( output_sextractor_catalog, cache_catalog_filename ) ) {
+  fprintf( stderr, "WARNING: cannot save %s to the SExtractor catalog cache %s\n", output_sextractor_catalog, cache_catalog_filename );
+  return;
+ }
+ fprintf( stderr, "SExtractor catalog cache: saved %s as %s\n", output_sextractor_catalog, cache_catalog_filename );
+}
+
 double autodetect_aperture( char *fitsfilename, char *output_sextractor_catalog, int force_recompute, int do_PSF_fitting, double fixed_aperture, double X_im_size, double Y_im_size, int guess_saturation_limit_operation_mode, int flag_image_use_mode ) {
 
  FILE *psfex_compatible_sextractor_parameters_file;
@@ -143,6 +358,9 @@ double autodetect_aperture( char *fitsfilename, char *output_sextractor_catalog,
  char psfex_XML_check_filename[512];
  char psfex_log_entry_filename[512];
 
+ char cache_catalog_filename[FILENAME_LENGTH];
+ int is_sextractor_cache_used= 0;
+
  /* Check if the file has already been processed */
  if ( 0 == find_catalog_in_vast_images_catalogs_log( fitsfilename, output_sextractor_catalog ) ) {
   sprintf( aperture_filename, "%s.aperture", output_sextractor_catalog );
@@ -207,6 +425,33 @@ double autodetect_aperture( char *fitsfilename, char *output_sextractor_catalog,
 
  sprintf( sextractor_messages_filename, "%s.sex_log", output_sextractor_catalog );
 
+ // Look for the result of the very same SExtractor run in the shared catalog cache
+ if ( do_PSF_fitting == 0 ) {
+  if ( 0 == get_sextractor_cache_catalog_filename( fitsfilename, is_flag_image_used, flag_image_filename, weight_image_filename, gain_sextractor_cl_parameter_string, saturation_limitsextractor_cl_parameter_string, fixed_aperture, cache_catalog_filename ) ) {
+   is_sextractor_cache_used= 1;
+   if ( 0 == restore_catalog_from_sextractor_cache( cache_catalog_filename, output_sextractor_catalog, &APERTURE ) ) {
+    aperture_file= fopen( aperture_filename, "w" );
+    if ( aperture_file == NULL ) {
+     fprintf( stderr, "ERROR: cannot open for writing %s\n", aperture_filename );
+     return 99.0;
+    }
+    fprintf( aperture_file, "%.1lf", APERTURE );
+    fclose( aperture_file );
+    fprintf( stderr, "SExtractor catalog cache: restored %s catalog from %s\n", fitsfilename, cache_catalog_filename );
+    write_string_to_individual_image_log( output_sextractor_catalog, "autodetect_aperture(): ", "restored the catalog from the SExtractor catalog cache ", cache_catalog_filename );
+#ifdef REMOVE_FLAG_IMAGES_TO_SAVE_SPACE
+    if ( is_flag_image_used == 1 ) {
+     if ( 0 != unlink( flag_image_filename ) )
+      fprintf( stderr, "WARNING! Cannot delete temporary file %s\n", flag_image_filename );
+     if ( 0 != unlink( weight_image_filename ) )
+      fprintf( stderr, "WARNING! Cannot delete temporary file %s\n", weight_image_filename );
+    }
+#endif
+    return APERTURE;
+   }
+  }
+ }
+
  // Set fixed aperture size if we whant to use one
  if ( fixed_aperture != 0.0 ) {
   APERTURE= fixed_aperture;
@@ -411,6 +656,8 @@ double autodetect_aperture( char *fitsfilename, char *output_sextractor_catalog,
   if ( 0 != system( command ) ) {
    fprintf( stderr, "ERROR: the following command returned a non-zero exit code:\n%s\n", command );
    write_string_to_individual_image_log( output_sextractor_catalog, "autodetect_aperture(): ", "ERROR: running SExtractor ", command );
+  } else if ( is_sextractor_cache_used == 1 ) {
+   save_catalog_to_sextractor_cache( cache_catalog_filename, output_sextractor_catalog, APERTURE );
   }
  }
  if ( do_PSF_fitting == 1 ) {
@@ -3,6 +3,12 @@
 #include <string.h>
 #include <math.h>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "../vast_limits.h" // for TRANSIENT_BRIGHTER_THAN_CATALOG_MAG_THRESHOLD
 
 // #define VSX_SEARCH_RADIUS_DEG 35.0 / 3600.0
@@ -330,6 +336,310 @@ static double vsx_record_brightening_warn_threshold( const char *type_string, co
  return TRANSIENT_BRIGHTER_THAN_CATALOG_MAG_THRESHOLD;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Declination-zone index of the offline catalogs.
+//
+// Instead of scanning the whole multi-hundred-megabyte catalog for every
+// query, the catalog is scanned once and the (Dec, file offset) pairs of all
+// its records are stored sorted by Dec in a binary file next to the catalog
+// (lib/catalogs/vsx.dat.decindex, lib/catalogs/asassnv.csv.decindex).
+// The index is memory-mapped and a query only reads the catalog lines
+// within the Dec strip of the search radius. The index is rebuilt
+// automatically whenever the catalog size or modification time changes
+// (i.e. after lib/update_offline_catalogs.sh has updated the catalog).
+// The candidate lines are processed in their original file order and the
+// line parsing code is unchanged, so the output is identical to the one of
+// the full catalog scan.
+////////////////////////////////////////////////////////////////////////////////
+
+#define CATALOG_DEC_INDEX_MAGIC "VaST catalog Dec index v1"
+#define CATALOG_DEC_INDEX_SUFFIX ".decindex"
+
+struct Catalog_dec_index_header {
+ char magic[32];
+ long long catalog_size;
+ long long catalog_mtime;
+ long long n_records;
+ int line_buffer_length; // the catalog lines are read with fgets() using this buffer length
+ int padding;
+};
+
+struct Catalog_dec_index_record {
+ double dec;
+ long offset; // position of the line in the catalog file
+ int format;  // catalog format flag that applies to this line (see asassnv_line_dec())
+ int padding;
+};
+
+struct Catalog_dec_index {
+ FILE *catalog;
+ int line_buffer_length;
+ long n_records;
+ struct Catalog_dec_index_record *record;
+ void *mmap_start;
+ size_t mmap_length;
+};
+
+// Extract Dec of the catalog line for the index. The function may update the
+// format flag if the line is a header line. Returns 1 if the line should be
+// indexed, 0 if the search code would skip the line anyway.
+typedef int ( *catalog_line_dec_function )( const char *string, int *format, double *dec );
+
+static int compare_catalog_dec_index_records_by_dec( const void *a, const void *b ) {
+ const struct Catalog_dec_index_record *ra= (const struct Catalog_dec_index_record *)a;
+ const struct Catalog_dec_index_record *rb= (const struct Catalog_dec_index_record *)b;
+ if ( ra->dec < rb->dec ) {
+  return -1;
+ }
+ if ( ra->dec > rb->dec ) {
+  return 1;
+ }
+ if ( ra->offset < rb->offset ) {
+  return -1;
+ }
+ if ( ra->offset > rb->offset ) {
+  return 1;
+ }
+ return 0;
+}
+
+static int compare_catalog_dec_index_records_by_offset( const void *a, const void *b ) {
+ const struct Catalog_dec_index_record *ra= (const struct Catalog_dec_index_record *)a;
+ const struct Catalog_dec_index_record *rb= (const struct Catalog_dec_index_record *)b;
+ if ( ra->offset < rb->offset ) {
+  return -1;
+ }
+ if ( ra->offset > rb->offset ) {
+  return 1;
+ }
+ return 0;
+}
+
+// Scan the whole catalog and return the array of index records sorted by Dec
+static struct Catalog_dec_index_record *build_catalog_dec_index( FILE *catalog, int line_buffer_length, catalog_line_dec_function line_dec, long *n_records ) {
+ struct Catalog_dec_index_record *record;
+ struct Catalog_dec_index_record *new_record;
+ long n_allocated;
+ long offset;
+ char *string;
+ int format;
+ double dec;
+
+ string= malloc( line_buffer_length + 1 );
+ if ( NULL == string ) {
+  fprintf( stderr, "ERROR allocating memory in build_catalog_dec_index()\n" );
+  return NULL;
+ }
+ n_allocated= 1024 * 1024;
+ record= malloc( n_allocated * sizeof( struct Catalog_dec_index_record ) );
+ if ( NULL == record ) {
+  fprintf( stderr, "ERROR allocating memory in build_catalog_dec_index()\n" );
+  free( string );
+  return NULL;
+ }
+ memset( string, '\0', line_buffer_length + 1 );
+ ( *n_records )= 0;
+ format= 0;
+ rewind( catalog );
+ offset= ftell( catalog );
+ while ( NULL != fgets( string, line_buffer_length, catalog ) ) {
+  if ( 1 == line_dec( string, &format, &dec ) ) {
+   if ( ( *n_records ) == n_allocated ) {
+    n_allocated*= 2;
+    new_record= realloc( record, n_allocated * sizeof( struct Catalog_dec_index_record ) );
+    if ( NULL == new_record ) {
+     fprintf( stderr, "ERROR allocating memory in build_catalog_dec_index()\n" );
+     free( record );
+     free( string );
+     return NULL;
+    }
+    record= new_record;
+   }
+   record[( *n_records )].dec= dec;
+   record[( *n_records )].offset= offset;
+   record[( *n_records )].format= format;
+   record[( *n_records )].padding= 0;
+   ( *n_records )++;
+  }
+  offset= ftell( catalog );
+ }
+ free( string );
+ qsort( record, ( *n_records ), sizeof( struct Catalog_dec_index_record ), compare_catalog_dec_index_records_by_dec );
+ return record;
+}
+
+// Try to map an existing up-to-date index file. Returns 0 on success.
+static int map_catalog_dec_index_file( const char *index_filename, struct Catalog_dec_index_header *expected_header, struct Catalog_dec_index *index ) {
+ int fd;
+ struct stat index_stat;
+ void *mmap_start;
+ struct Catalog_dec_index_header *header;
+
+ fd= open( index_filename, O_RDONLY );
+ if ( fd < 0 ) {
+  return 1;
+ }
+ if ( 0 != fstat( fd, &index_stat ) || index_stat.st_size < (off_t)sizeof( struct Catalog_dec_index_header ) ) {
+  close( fd );
+  return 1;
+ }
+ mmap_start= mmap( NULL, (size_t)index_stat.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+ close( fd );
+ if ( MAP_FAILED == mmap_start ) {
+  return 1;
+ }
+ header= (struct Catalog_dec_index_header *)mmap_start;
+ if ( 0 != memcmp( header->magic, expected_header->magic, sizeof( header->magic ) ) || header->catalog_size != expected_header->catalog_size || header->catalog_mtime != expected_header->catalog_mtime || header->line_buffer_length != expected_header->line_buffer_length || header->n_records < 0 || (off_t)( sizeof( struct Catalog_dec_index_header ) + header->n_records * sizeof( struct Catalog_dec_index_record ) ) != index_stat.st_size ) {
+  munmap( mmap_start, (size_t)index_stat.st_size );
+  return 1;
+ }
+ index->n_records= (long)header->n_records;
+ index->record= (struct Catalog_dec_index_record *)( (char *)mmap_start + sizeof( struct Catalog_dec_index_header ) );
+ index->mmap_start= mmap_start;
+ index->mmap_length= (size_t)index_stat.st_size;
+ return 0;
+}
+
+// Write the index file (via a temporary file so a concurrently running
+// instance never sees a partially written index). Returns 0 on success.
+static int write_catalog_dec_index_file( const char *index_filename, struct Catalog_dec_index_header *header, struct Catalog_dec_index_record *record ) {
+ FILE *indexfile;
+ char tmp_index_filename[FILENAME_MAX + 32];
+ int is_error;
+
+ snprintf( tmp_index_filename, FILENAME_MAX + 32, "%s.tmp%d", index_filename, (int)getpid() );
+ indexfile= fopen( tmp_index_filename, "wb" );
+ if ( NULL == indexfile ) {
+  return 1;
+ }
+ is_error= 0;
+ if ( 1 != fwrite( header, sizeof( struct Catalog_dec_index_header ), 1, indexfile ) ) {
+  is_error= 1;
+ }
+ if ( 0 == is_error && header->n_records > 0 ) {
+  if ( (size_t)header->n_records != fwrite( record, sizeof( struct Catalog_dec_index_record ), (size_t)header->n_records, indexfile ) ) {
+   is_error= 1;
+  }
+ }
+ if ( 0 != fclose( indexfile ) ) {
+  is_error= 1;
+ }
+ if ( 0 == is_error ) {
+  if ( 0 != rename( tmp_index_filename, index_filename ) ) {
+   is_error= 1;
+  }
+ }
+ if ( 0 != is_error ) {
+  unlink( tmp_index_filename );
+ }
+ return is_error;
+}
+
+// Open the catalog and its Dec index, (re)building the index if needed.
+// If the index file cannot be written (read-only installation),
+// the index is kept in memory only.
+static struct Catalog_dec_index *open_catalog_dec_index( const char *catalog_filename, int line_buffer_length, catalog_line_dec_function line_dec ) {
+ struct Catalog_dec_index *index;
+ struct Catalog_dec_index_header header;
+ struct Catalog_dec_index_record *record;
+ struct stat catalog_stat;
+ char index_filename[FILENAME_MAX];
+ long n_records;
+
+ index= malloc( sizeof( struct Catalog_dec_index ) );
+ if ( NULL == index ) {
+  fprintf( stderr, "ERROR allocating memory in open_catalog_dec_index()\n" );
+  return NULL;
+ }
+ index->catalog= fopen( catalog_filename, "r" );
+ if ( NULL == index->catalog ) {
+  free( index );
+  return NULL;
+ }
+ index->line_buffer_length= line_buffer_length;
+ index->mmap_start= NULL;
+ index->mmap_length= 0;
+
+ memset( &header, 0, sizeof( struct Catalog_dec_index_header ) );
+ strncpy( header.magic, CATALOG_DEC_INDEX_MAGIC, sizeof( header.magic ) - 1 );
+ header.line_buffer_length= line_buffer_length;
+ if ( 0 == fstat( fileno( index->catalog ), &catalog_stat ) ) {
+  header.catalog_size= (long long)catalog_stat.st_size;
+  header.catalog_mtime= (long long)catalog_stat.st_mtime;
+ }
+
+ snprintf( index_filename, FILENAME_MAX, "%s%s", catalog_filename, CATALOG_DEC_INDEX_SUFFIX );
+ if ( 0 == map_catalog_dec_index_file( index_filename, &header, index ) ) {
+  return index;
+ }
+
+ record= build_catalog_dec_index( index->catalog, line_buffer_length, line_dec, &n_records );
+ if ( NULL == record ) {
+  fclose( index->catalog );
+  free( index );
+  return NULL;
+ }
+ header.n_records= (long long)n_records;
+ if ( 0 == write_catalog_dec_index_file( index_filename, &header, record ) ) {
+  if ( 0 == map_catalog_dec_index_file( index_filename, &header, index ) ) {
+   free( record );
+   return index;
+  }
+ }
+ index->n_records= n_records;
+ index->record= record;
+ return index;
+}
+
+// Select the index records with target_Dec_deg - search_radius_deg <= Dec <= target_Dec_deg + search_radius_deg
+// and return them sorted in the catalog file order (the caller should free() the returned array).
+// The Dec strip is slightly widened to guard against rounding; the search code applies the exact cut.
+static long select_catalog_dec_index_candidates( struct Catalog_dec_index *index, double target_Dec_deg, double search_radius_deg, struct Catalog_dec_index_record **candidate ) {
+ long first, last, middle;
+ long n_candidates;
+ double min_dec, max_dec;
+
+ min_dec= target_Dec_deg - search_radius_deg - 1e-9;
+ max_dec= target_Dec_deg + search_radius_deg + 1e-9;
+
+ // find the first record with dec >= min_dec
+ first= 0;
+ last= index->n_records;
+ while ( first < last ) {
+  middle= first + ( last - first ) / 2;
+  if ( index->record[middle].dec < min_dec ) {
+   first= middle + 1;
+  } else {
+   last= middle;
+  }
+ }
+ for ( last= first; last < index->n_records && index->record[last].dec <= max_dec; last++ )
+  ;
+ n_candidates= last - first;
+
+ ( *candidate )= malloc( MAX( n_candidates, 1 ) * sizeof( struct Catalog_dec_index_record ) );
+ if ( NULL == ( *candidate ) ) {
+  fprintf( stderr, "ERROR allocating memory in select_catalog_dec_index_candidates()\n" );
+  return 0;
+ }
+ if ( n_candidates > 0 ) {
+  memcpy( ( *candidate ), &index->record[first], n_candidates * sizeof( struct Catalog_dec_index_record ) );
+  qsort( ( *candidate ), n_candidates, sizeof( struct Catalog_dec_index_record ), compare_catalog_dec_index_records_by_offset );
+ }
+ return n_candidates;
+}
+
+// Read the catalog line referenced by the index record into string. Returns 0 on success.
+static int read_catalog_dec_index_line( struct Catalog_dec_index *index, struct Catalog_dec_index_record *record, char *string ) {
+ if ( 0 != fseek( index->catalog, record->offset, SEEK_SET ) ) {
+  return 1;
+ }
+ if ( NULL == fgets( string, index->line_buffer_length, index->catalog ) ) {
+  return 1;
+ }
+ return 0;
+}
+
 int search_myMDV( double target_RA_deg, double target_Dec_deg, double search_radius_deg, int be_silent_if_not_found, int html_output ) {
  FILE *mymdvfile;
  char name[32];
@@ -412,8 +722,25 @@ int search_myMDV( double target_RA_deg, double target_Dec_deg, double search_rad
  return is_found;
 }
 
+// Dec of a vsx.dat line for the index (same columns as parsed by search_vsx())
+static int vsx_line_dec( const char *string, int *format, double *dec ) {
+ char Dec_char[32];
+ int i, j;
+ if ( strlen( string ) < 52 ) {
+  // the Dec columns are not there
+  return 0;
+ }
+ for ( j= 0, i= 51; i < 60 && string[i] != '\0'; i++, j++ )
+  Dec_char[j]= string[i];
+ Dec_char[j]= '\0';
+ ( *dec )= atof( Dec_char );
+ return 1;
+}
+
 int search_vsx( double target_RA_deg, double target_Dec_deg, double search_radius_deg, int be_silent_if_not_found, int html_output, double measured_mag_of_transient ) {
- FILE *vsx_dat;
+ static struct Catalog_dec_index *vsx_index= NULL;
+ struct Catalog_dec_index_record *candidate;
+ long n_candidates, candidate_counter;
  char name[32];
  char RA_char[32];
  char Dec_char[32];
@@ -466,12 +793,19 @@ int search_vsx( double target_RA_deg, double target_Dec_deg, double search_radiu
  memset( compat_best_descr, '\0', 128 );
 
  // download_vsx();
- vsx_dat= fopen( "lib/catalogs/vsx.dat", "r" );
- if ( NULL == vsx_dat ) {
+ // The catalog and its index are opened once and reused by all the subsequent queries
+ if ( NULL == vsx_index ) {
+  vsx_index= open_catalog_dec_index( "lib/catalogs/vsx.dat", 256, vsx_line_dec );
+ }
+ if ( NULL == vsx_index ) {
   fprintf( stderr, "ERROR: Cannot open vsx.dat\n" );
   return -1;
  }
- while ( NULL != fgets( string, 256, vsx_dat ) ) {
+ n_candidates= select_catalog_dec_index_candidates( vsx_index, target_Dec_deg, search_radius_deg, &candidate );
+ for ( candidate_counter= 0; candidate_counter < n_candidates; candidate_counter++ ) {
+  if ( 0 != read_catalog_dec_index_line( vsx_index, &candidate[candidate_counter], string ) ) {
+   continue;
+  }
 
   for ( j= 0, i= 51; i < 60; i++, j++ )
    Dec_char[j]= string[i];
@@ -651,7 +985,7 @@ int search_vsx( double target_RA_deg, double target_Dec_deg, double search_radiu
   }
  }
 
- fclose( vsx_dat );
+ free( candidate );
 
  return is_found;
 }
@@ -669,8 +1003,58 @@ const char *getfield_from_csv_string( char *line, int num ) {
  return whitespace; // Return pointer to 31 white space on failure
 }
 
+// Dec of an asassnv.csv line for the index. Replicates the header detection
+// and the Dec sanity checks of search_asassnv(): the lines it would skip before
+// testing Dec are not indexed. The format flag is set to 1 once the header
+// line of the new file format is encountered.
+static int asassnv_line_dec( const char *string, int *format, double *dec ) {
+ char string_noemptycells[4096];
+ char string_to_be_ruined_by_strtok[4096];
+ int i, j;
+ int asassn_name_token;
+ double Dec_deg;
+
+ if ( strlen( string ) < 180 ) {
+  return 0;
+ }
+ asassn_name_token= ( 1 == ( *format ) ) ? 2 : 1;
+ // Same as in search_asassnv(): fix the first part of string for strtok()
+ for ( i= 0, j= 0; i < 100; i++, j++ ) {
+  string_noemptycells[j]= string[i];
+  if ( string[i] == ',' ) {
+   if ( string[i + 1] == ',' ) {
+    j++;
+    string_noemptycells[j]= ' '; // add empty cell
+   }
+  }
+ }
+ string_noemptycells[j]= '\0';
+
+ strncpy( string_to_be_ruined_by_strtok, string_noemptycells, 4096 - 1 );
+ string_to_be_ruined_by_strtok[4096 - 1]= '\0';
+ if ( 0 == strncmp( "ASAS-SN Name", getfield_from_csv_string( string_to_be_ruined_by_strtok, asassn_name_token ), strlen( "ASAS-SN Name" ) ) ) {
+  return 0;
+ }
+ strncpy( string_to_be_ruined_by_strtok, string_noemptycells, 4096 - 1 );
+ string_to_be_ruined_by_strtok[4096 - 1]= '\0';
+ if ( 0 == strncmp( "source_id", getfield_from_csv_string( string_to_be_ruined_by_strtok, asassn_name_token ), strlen( "source_id" ) ) ) {
+  ( *format )= 1;
+  return 0;
+ }
+ strncpy( string_to_be_ruined_by_strtok, string_noemptycells, 4096 - 1 );
+ string_to_be_ruined_by_strtok[4096 - 1]= '\0';
+ Dec_deg= atof( getfield_from_csv_string( string_to_be_ruined_by_strtok, 5 ) );
+ if ( Dec_deg < -90.0 || Dec_deg > +90.0 || Dec_deg == 0.0 ) {
+  return 0;
+ }
+ ( *dec )= Dec_deg;
+ return 1;
+}
+
 int search_asassnv( double target_RA_deg, double target_Dec_deg, double search_radius_deg, int be_silent_if_not_found, int html_output, double measured_mag_of_transient ) {
- FILE *asassnv_csv;
+ static struct Catalog_dec_index *asassnv_index= NULL;
+ struct Catalog_dec_index_record *candidate;
+ long n_candidates, candidate_counter;
  char name[32];
  double RA_deg, Dec_deg, RA1_rad, RA2_rad, DEC1_rad, DEC2_rad;
  char type[32];
@@ -696,12 +1080,26 @@ int search_asassnv( double target_RA_deg, double target_Dec_deg, double search_r
  int amplitude_token= 7;
  int period_token= 8;
 
- asassnv_csv= fopen( "lib/catalogs/asassnv.csv", "r" );
- if ( NULL == asassnv_csv ) {
+ if ( NULL == asassnv_index ) {
+  asassnv_index= open_catalog_dec_index( "lib/catalogs/asassnv.csv", 4096 - 1, asassnv_line_dec );
+ }
+ if ( NULL == asassnv_index ) {
   fprintf( stderr, "ERROR: Cannot open asassnv.csv\n" );
   exit( EXIT_FAILURE );
  }
- while ( NULL != fgets( string, 4096 - 1, asassnv_csv ) ) {
+ n_candidates= select_catalog_dec_index_candidates( asassnv_index, target_Dec_deg, search_radius_deg, &candidate );
+ for ( candidate_counter= 0; candidate_counter < n_candidates; candidate_counter++ ) {
+  if ( 0 != read_catalog_dec_index_line( asassnv_index, &candidate[candidate_counter], string ) ) {
+   continue;
+  }
+  // The header lines are not indexed, the index remembers which file format they declared
+  if ( 1 == candidate[candidate_counter].format ) {
+   asassn_name_token= 2;
+   type_token= 11;
+   meanmag_token= 8;
+   amplitude_token= 9;
+   period_token= 10;
+  }
   if ( strlen( string ) < 180 ) {
    // That happens all too often!
    //   fprintf(stderr,"WARNING from search_asassnv() a string in lib/catalogs/asassnv.csv is too short:\n%s\n",string);
@@ -899,11 +1297,118 @@ int search_asassnv( double target_RA_deg, double target_Dec_deg, double search_r
   }
  }
 
- fclose( asassnv_csv );
+ free( candidate );
+
+ return is_found;
+}
+
+// Run the standard sequence of catalog searches for one position.
+// Returns 1 if the object is found in any of the catalogs.
+int search_all_catalogs( double target_RA_deg, double target_Dec_deg, int html_output, double measured_mag_of_transient ) {
+ int is_found;
+
+ is_found= 0; // init
+
+ // The use of the reduced search radius is a silly attempt to handle the situation where
+ // multiple known variables are within the search radius and ideally we want the nearest one to the search position.
+
+ if ( measured_mag_of_transient > MEASURED_MAG_NOT_PROVIDED + 1.0 ) {
+  // With a measured magnitude available, search_vsx() itself prefers the
+  // nearest brightness-compatible match over the full search radius, so the
+  // small-radius pre-pass must not run: it would lock in a faint nearest
+  // match and hide a compatible brighter variable sitting at 7-15" (common
+  // in crowded galactic-plane fields).
+  is_found= search_vsx( target_RA_deg, target_Dec_deg, VSX_SEARCH_RADIUS_DEG, 0, html_output, measured_mag_of_transient );
+  if ( is_found != 1 ) {
+   is_found= search_asassnv( target_RA_deg, target_Dec_deg, ASASSN_SEARCH_RADIUS_DEG / 5.0, 1, html_output, measured_mag_of_transient );
+  }
+  if ( is_found != 1 ) {
+   is_found= search_asassnv( target_RA_deg, target_Dec_deg, ASASSN_SEARCH_RADIUS_DEG, 0, html_output, measured_mag_of_transient );
+  }
+ } else {
+  // First try small search radius
+  // was 3.0 an caused problems with the STANDALONEDBSCRIPT_MULTCLOSEVAR test, 5 is not cutting it
+  // is_found= search_vsx( target_RA_deg, target_Dec_deg, VSX_SEARCH_RADIUS_DEG / 5.0, 1, html_output, measured_mag_of_transient );
+  is_found= search_vsx( target_RA_deg, target_Dec_deg, 6.0 / 3600, 1, html_output, measured_mag_of_transient );
+  if ( is_found != 1 ) {
+   is_found= search_asassnv( target_RA_deg, target_Dec_deg, ASASSN_SEARCH_RADIUS_DEG / 5.0, 1, html_output, measured_mag_of_transient );
+  }
+  // If nothing found - try a larger search radius
+  if ( is_found != 1 ) {
+   is_found= search_vsx( target_RA_deg, target_Dec_deg, VSX_SEARCH_RADIUS_DEG, 0, html_output, measured_mag_of_transient );
+  }
+  if ( is_found != 1 ) {
+   is_found= search_asassnv( target_RA_deg, target_Dec_deg, ASASSN_SEARCH_RADIUS_DEG, 0, html_output, measured_mag_of_transient );
+  }
+ }
+ if ( is_found != 1 ) {
+  is_found= search_myMDV( target_RA_deg, target_Dec_deg, VSX_SEARCH_RADIUS_DEG, 0, html_output );
+ }
 
  return is_found;
 }
 
+// Batch mode: process the list of positions, one "RA Dec [mag]" per line
+// (decimal degrees), in one run so the catalogs are updated, opened and
+// their indexes mapped only once. The output for each position is preceded
+// by the line '# RA Dec' echoing the input position and followed by the
+// line '# found' or '# not found'.
+int search_all_catalogs_batch( const char *positions_filename, int html_output ) {
+ FILE *positionsfile;
+ char string[1024];
+ char RA_string[256];
+ char Dec_string[256];
+ char mag_string[256];
+ int n_fields;
+ double target_RA_deg;
+ double target_Dec_deg;
+ double measured_mag;
+ char *endptr;
+ int is_found;
+
+ positionsfile= fopen( positions_filename, "r" );
+ if ( NULL == positionsfile ) {
+  fprintf( stderr, "ERROR: cannot open the list of positions %s\n", positions_filename );
+  return 1;
+ }
+ while ( NULL != fgets( string, 1024, positionsfile ) ) {
+  if ( string[0] == '#' ) {
+   continue;
+  }
+  n_fields= sscanf( string, "%255s %255s %255s", RA_string, Dec_string, mag_string );
+  if ( n_fields < 2 ) {
+   continue;
+  }
+  if ( strchr( RA_string, ':' ) != NULL || strchr( Dec_string, ':' ) != NULL ) {
+   fprintf( stderr, "WARNING: skipping the position '%s %s' - only decimal degrees are supported!\n", RA_string, Dec_string );
+   continue;
+  }
+  target_RA_deg= atof( RA_string );
+  target_Dec_deg= atof( Dec_string );
+  if ( target_RA_deg < 0.0 || target_RA_deg > 360.0 || target_Dec_deg < -90.0 || target_Dec_deg > 90.0 ) {
+   fprintf( stderr, "WARNING: skipping the out-of-range position '%s %s'\n", RA_string, Dec_string );
+   continue;
+  }
+  measured_mag= MEASURED_MAG_NOT_PROVIDED;
+  if ( n_fields == 3 ) {
+   measured_mag= strtod( mag_string, &endptr );
+   if ( endptr == mag_string || *endptr != '\0' || measured_mag < -2.0 || measured_mag > 30.0 ) {
+    fprintf( stderr, "WARNING: ignoring the measured transient magnitude '%s' that does not look like a valid magnitude value\n", mag_string );
+    measured_mag= MEASURED_MAG_NOT_PROVIDED;
+   }
+  }
+  fprintf( stdout, "# %s %s\n", RA_string, Dec_string );
+  is_found= search_all_catalogs( target_RA_deg, target_Dec_deg, html_output, measured_mag );
+  if ( is_found == 1 ) {
+   fprintf( stdout, "# found\n" );
+  } else {
+   fprintf( stdout, "# not found\n" );
+  }
+ }
+ fclose( positionsfile );
+ return 0;
+}
+
 int main( int argc, char **argv ) {
 
  int html_output= 0; // 0 - no, 1 - yes
@@ -918,10 +1423,23 @@ int main( int argc, char **argv ) {
  measured_mag= MEASURED_MAG_NOT_PROVIDED;
 
  if ( argc < 3 ) {
-  fprintf( stderr, "Usage: %s 12.345 67.890\nor\n%s 12.345 67.890 H  # for HTML output\nor\n%s 12.345 67.890 H 12.3  # HTML output + comparison of the measured transient mag 12.3 with the catalog record", argv[0], argv[0], argv[0] );
+  fprintf( stderr, "Usage: %s 12.345 67.890\nor\n%s 12.345 67.890 H  # for HTML output\nor\n%s 12.345 67.890 H 12.3  # HTML output + comparison of the measured transient mag 12.3 with the catalog record\nor\n%s --batch positions.txt [H]  # search all the positions listed in the file as 'RA Dec [mag]'\n", argv[0], argv[0], argv[0], argv[0] );
   return 1;
  }
 
+ if ( 0 == strcmp( argv[1], "--batch" ) ) {
+  if ( argc >= 4 ) {
+   if ( argv[3][0] == 'H' ) {
+    html_output= 1;
+   }
+  }
+  // see the comment about lib/update_offline_catalogs.sh below
+  if ( 0 != system( "lib/update_offline_catalogs.sh all" ) ) {
+   fprintf( stderr, "WARNING: an error occured while updating the catalogs with lib/update_offline_catalogs.sh\n" );
+  }
+  return search_all_catalogs_batch( argv[2], html_output );
+ }
+
  if ( strchr( argv[1], ':' ) != NULL || strchr( argv[2], ':' ) != NULL ) {
   fprintf( stderr, "ERROR: The input RA contains a colon ':'.\nOnly decimal degrees are supported by this binary! Sorry!\n" );
   return 2;
@@ -968,43 +1486,7 @@ int main( int argc, char **argv ) {
   fprintf( stderr, "WARNING: an error occured while updating the catalogs with lib/update_offline_catalogs.sh\n" );
  }
 
- is_found= 0; // init
-
- // The use of the reduced search radius is a silly attempt to handle the situation where
- // multiple known variables are within the search radius and ideally we want the nearest one to the search position.
-
- if ( measured_mag > MEASURED_MAG_NOT_PROVIDED + 1.0 ) {
-  // With a measured magnitude available, search_vsx() itself prefers the
-  // nearest brightness-compatible match over the full search radius, so the
-  // small-radius pre-pass must not run: it would lock in a faint nearest
-  // match and hide a compatible brighter variable sitting at 7-15" (common
-  // in crowded galactic-plane fields).
-  is_found= search_vsx( target_RA_deg, target_Dec_deg, VSX_SEARCH_RADIUS_DEG, 0, html_output, measured_mag );
-  if ( is_found != 1 ) {
-   is_found= search_asassnv( target_RA_deg, target_Dec_deg, ASASSN_SEARCH_RADIUS_DEG / 5.0, 1, html_output, measured_mag );
-  }
-  if ( is_found != 1 ) {
-   is_found= search_asassnv( target_RA_deg, target_Dec_deg, ASASSN_SEARCH_RADIUS_DEG, 0, html_output, measured_mag );
-  }
- } else {
-  // First try small search radius
-  // was 3.0 an caused problems with the STANDALONEDBSCRIPT_MULTCLOSEVAR test, 5 is not cutting it
-  // is_found= search_vsx( target_RA_deg, target_Dec_deg, VSX_SEARCH_RADIUS_DEG / 5.0, 1, html_output, measured_mag );
-  is_found= search_vsx( target_RA_deg, target_Dec_deg, 6.0 / 3600, 1, html_output, measured_mag );
-  if ( is_found != 1 ) {
-   is_found= search_asassnv( target_RA_deg, target_Dec_deg, ASASSN_SEARCH_RADIUS_DEG / 5.0, 1, html_output, measured_mag );
-  }
-  // If nothing found - try a larger search radius
-  if ( is_found != 1 ) {
-   is_found= search_vsx( target_RA_deg, target_Dec_deg, VSX_SEARCH_RADIUS_DEG, 0, html_output, measured_mag );
-  }
-  if ( is_found != 1 ) {
-   is_found= search_asassnv( target_RA_deg, target_Dec_deg, ASASSN_SEARCH_RADIUS_DEG, 0, html_output, measured_mag );
-  }
- }
- if ( is_found != 1 ) {
-  is_found= search_myMDV( target_RA_deg, target_Dec_deg, VSX_SEARCH_RADIUS_DEG, 0, html_output );
- }
+ is_found= search_all_catalogs( target_RA_deg, target_Dec_deg, html_output, measured_mag );
 
  // Return 0 if the source is found
  if ( is_found == 1 ) {
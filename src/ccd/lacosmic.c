@@ -37,6 +37,25 @@
 #define DEFAULT_NEIGHBOR_THRESHOLD 2.0f
 #define DEFAULT_MAXITER 2
 
+/* Largest median filter window used by the algorithm (7x7) */
+#define MAX_MEDIAN_FILTER_SIZE 7
+/* Median filter windows are padded up to a power of two for the sorting network */
+#define MAX_MEDIAN_NETWORK_INPUTS 64
+/* Comparators in the full odd-even merge sorting network for 64 inputs */
+#define MAX_MEDIAN_NETWORK_COMPARATORS 543
+/* Number of pixels whose medians are computed together */
+#define MEDIAN_NETWORK_LANES 8
+/* Largest window used to find unmasked neighbours when cleaning (21x21) */
+#define MAX_CLEAN_WINDOW_SIZE 21
+
+/* Sorting network that selects the median of n_inputs values */
+struct Median_network {
+ int n_inputs;
+ int median_index;
+ int n_comparators;
+ unsigned char comparator[MAX_MEDIAN_NETWORK_COMPARATORS][2];
+};
+
 /* Function prototypes */
 static void print_usage( const char *prog_name );
 static int read_fits_image( const char *filename, float **data, long *naxes,
@@ -51,17 +70,15 @@ static void check_and_remove_file( const char *filename );
 
 /* Core algorithm functions */
 static long mirror_index( long i, long max );
-static void block_replicate_2x( const float *input, float *output, long width, long height );
-static void block_reduce_2x( const float *input, float *output, long width, long height );
-static void laplacian_filter( const float *input, float *output, long width, long height );
+static void laplacian_2x_filter( const float *input, float *output, long width, long height );
 static void median_filter( const float *input, float *output, long width, long height,
-                           int filter_size, float *work_buffer );
+                           int filter_size );
 static void compute_noise_model( const float *median5_image, float *noise,
                                  long width, long height, float gain, float readnoise );
 static void binary_dilate_3x3( const unsigned char *input, unsigned char *output,
                                long width, long height );
 static void clean_masked_pixels( float *image, const unsigned char *mask,
-                                 long width, long height, float *work_buffer );
+                                 long width, long height );
 static int lacosmic_process( float *image, unsigned char *crmask, long width, long height,
                              float gain, float readnoise, float contrast,
                              float cr_threshold, float neighbor_threshold, int maxiter );
@@ -112,59 +129,49 @@ static long mirror_index( long i, long max ) {
  return i;
 }
 
-/* Block replicate: upsample image by factor 2 */
-static void block_replicate_2x( const float *input, float *output, long width, long height ) {
- long x, y;
- long new_width= 2 * width;
- float val;
-
- for ( y= 0; y < height; y++ ) {
-  for ( x= 0; x < width; x++ ) {
-   val= input[y * width + x];
-   output[( 2 * y ) * new_width + ( 2 * x )]= val;
-   output[( 2 * y ) * new_width + ( 2 * x + 1 )]= val;
-   output[( 2 * y + 1 ) * new_width + ( 2 * x )]= val;
-   output[( 2 * y + 1 ) * new_width + ( 2 * x + 1 )]= val;
-  }
- }
-}
-
-/* Block reduce: downsample image by factor 2 (average 2x2 blocks) */
-static void block_reduce_2x( const float *input, float *output, long width, long height ) {
- long x, y;
- long in_width= 2 * width;
- float sum;
-
- for ( y= 0; y < height; y++ ) {
-  for ( x= 0; x < width; x++ ) {
-   sum= input[( 2 * y ) * in_width + ( 2 * x )];
-   sum+= input[( 2 * y ) * in_width + ( 2 * x + 1 )];
-   sum+= input[( 2 * y + 1 ) * in_width + ( 2 * x )];
-   sum+= input[( 2 * y + 1 ) * in_width + ( 2 * x + 1 )];
-   output[y * width + x]= sum / 4.0f;
-  }
- }
+/* Clip negative values (L^{2+}) of the Laplacian kernel [[0,-1,0],[-1,4,-1],[0,-1,0]] / 4 */
+static inline float laplacian_clipped( float val ) {
+ val/= 4.0f;
+ return ( val > 0.0f ) ? val : 0.0f;
 }
 
-/* Laplacian filter with mirrored boundaries and negative clipping */
-static void laplacian_filter( const float *input, float *output, long width, long height ) {
+/*
+ * Laplacian of the 2x block-replicated image with mirrored boundaries and negative
+ * clipping, block-reduced back to the original size.
+ * Each of the four subsampled pixels of an input pixel has the pixel itself as two of
+ * its four neighbours and one direct neighbour of the input pixel in each of the other
+ * two directions, so the 4x upsampled image is never stored.
+ */
+static void laplacian_2x_filter( const float *input, float *output, long width, long height ) {
  long x, y;
  long x0, x1, y0, y1;
- float val;
+ float c, up, down, left, right;
+ float sum;
 
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for private( x, x0, x1, y0, y1, c, up, down, left, right, sum ) schedule( static )
+#endif
+#endif
  for ( y= 0; y < height; y++ ) {
+  y0= mirror_index( y - 1, height );
+  y1= mirror_index( y + 1, height );
   for ( x= 0; x < width; x++ ) {
-   y0= mirror_index( y - 1, height );
-   y1= mirror_index( y + 1, height );
    x0= mirror_index( x - 1, width );
    x1= mirror_index( x + 1, width );
 
-   /* Laplacian kernel: [[0,-1,0],[-1,4,-1],[0,-1,0]] / 4 */
-   val= 4.0f * input[y * width + x] - input[y0 * width + x] - input[y1 * width + x] - input[y * width + x0] - input[y * width + x1];
-   val/= 4.0f;
-
-   /* Clip negative values (L^{2+}) */
-   output[y * width + x]= ( val > 0.0f ) ? val : 0.0f;
+   c= input[y * width + x];
+   up= input[y0 * width + x];
+   down= input[y1 * width + x];
+   left= input[y * width + x0];
+   right= input[y * width + x1];
+
+   /* Subsampled pixels in the order (0,0), (0,1), (1,0), (1,1) */
+   sum= laplacian_clipped( 4.0f * c - up - c - left - c );
+   sum+= laplacian_clipped( 4.0f * c - up - c - c - right );
+   sum+= laplacian_clipped( 4.0f * c - c - down - left - c );
+   sum+= laplacian_clipped( 4.0f * c - c - down - c - right );
+   output[y * width + x]= sum / 4.0f;
   }
  }
 }
@@ -233,103 +240,153 @@ static float median_of_n( float *arr, int n ) {
  }
 }
 
-/* Generic NxN median filter with mirrored boundaries */
-static void median_filter( const float *input, float *output, long width, long height,
-                           int filter_size, float *work_buffer ) {
- int half= filter_size / 2;
- long x, y;
- int i, j, idx;
- long xi, yi;
- int window_size= filter_size * filter_size;
- int is_interior;
- float *thread_work_buffer;
-
-#ifdef VAST_ENABLE_OPENMP
-#ifdef _OPENMP
-#pragma omp parallel private( x, i, j, idx, xi, yi, is_interior, thread_work_buffer )
- {
-  /* Each thread gets its own work buffer */
-  thread_work_buffer= malloc( window_size * sizeof( float ) );
-  if ( thread_work_buffer != NULL ) {
-#pragma omp for
-   for ( y= 0; y < height; y++ ) {
-    for ( x= 0; x < width; x++ ) {
-     idx= 0;
-     /* Check if this pixel is in the interior (no boundary issues) */
-     is_interior= ( y >= half && y < height - half && x >= half && x < width - half );
-     if ( is_interior ) {
-      /* Fast path: no boundary checks needed */
-      for ( j= -half; j <= half; j++ ) {
-       for ( i= -half; i <= half; i++ ) {
-        thread_work_buffer[idx++]= input[( y + j ) * width + ( x + i )];
-       }
-      }
-     } else {
-      /* Slow path: need mirror boundary handling */
-      for ( j= -half; j <= half; j++ ) {
-       for ( i= -half; i <= half; i++ ) {
-        yi= mirror_index( y + j, height );
-        xi= mirror_index( x + i, width );
-        thread_work_buffer[idx++]= input[yi * width + xi];
-       }
-      }
+/*
+ * Batcher's odd-even merge sorting network pruned to the comparators that
+ * affect the median. The window is padded with +Inf up to the next power of two;
+ * comparators whose upper input is still a pad value are no-ops and are dropped.
+ */
+static void build_median_network( struct Median_network *network, int n ) {
+ int size, p, k, j, i, a, b, c;
+ int n_all= 0;
+ unsigned char all[MAX_MEDIAN_NETWORK_COMPARATORS][2];
+ int is_pad[MAX_MEDIAN_NETWORK_INPUTS];
+ int is_needed[MAX_MEDIAN_NETWORK_INPUTS];
+ int keep[MAX_MEDIAN_NETWORK_COMPARATORS];
+
+ for ( size= 1; size < n; size*= 2 )
+  ;
+ network->n_inputs= size;
+ network->median_index= n / 2;
+
+ for ( p= 1; p < size; p*= 2 ) {
+  for ( k= p; k >= 1; k/= 2 ) {
+   for ( j= k % p; j + k < size; j+= 2 * k ) {
+    for ( i= 0; i < k && i + j + k < size; i++ ) {
+     if ( ( i + j ) / ( 2 * p ) == ( i + j + k ) / ( 2 * p ) ) {
+      all[n_all][0]= (unsigned char)( i + j );
+      all[n_all][1]= (unsigned char)( i + j + k );
+      n_all++;
      }
-     output[y * width + x]= median_of_n( thread_work_buffer, window_size );
     }
    }
-   free( thread_work_buffer );
   }
  }
-#else
- /* Non-OpenMP fallback */
- for ( y= 0; y < height; y++ ) {
-  for ( x= 0; x < width; x++ ) {
-   idx= 0;
-   is_interior= ( y >= half && y < height - half && x >= half && x < width - half );
-   if ( is_interior ) {
-    for ( j= -half; j <= half; j++ ) {
-     for ( i= -half; i <= half; i++ ) {
-      work_buffer[idx++]= input[( y + j ) * width + ( x + i )];
-     }
-    }
-   } else {
-    for ( j= -half; j <= half; j++ ) {
-     for ( i= -half; i <= half; i++ ) {
-      yi= mirror_index( y + j, height );
-      xi= mirror_index( x + i, width );
-      work_buffer[idx++]= input[yi * width + xi];
-     }
-    }
-   }
-   output[y * width + x]= median_of_n( work_buffer, window_size );
+
+ /* Forward pass: drop comparators with a pad value in the upper input */
+ for ( i= 0; i < size; i++ ) {
+  is_pad[i]= ( i >= n );
+  is_needed[i]= 0;
+ }
+ for ( c= 0; c < n_all; c++ ) {
+  a= all[c][0];
+  b= all[c][1];
+  keep[c]= !is_pad[b];
+  if ( keep[c] && is_pad[a] ) {
+   is_pad[a]= 0;
+   is_pad[b]= 1;
+  }
+ }
+
+ /* Backward pass: drop comparators that cannot reach the median output */
+ is_needed[network->median_index]= 1;
+ for ( c= n_all - 1; c >= 0; c-- ) {
+  if ( !keep[c] )
+   continue;
+  a= all[c][0];
+  b= all[c][1];
+  if ( is_needed[a] || is_needed[b] ) {
+   is_needed[a]= 1;
+   is_needed[b]= 1;
+  } else {
+   keep[c]= 0;
   }
  }
+
+ network->n_comparators= 0;
+ for ( c= 0; c < n_all; c++ ) {
+  if ( keep[c] ) {
+   network->comparator[network->n_comparators][0]= all[c][0];
+   network->comparator[network->n_comparators][1]= all[c][1];
+   network->n_comparators++;
+  }
+ }
+}
+
+/* Compare-exchange MEDIAN_NETWORK_LANES independent windows at once, written to auto-vectorize */
+static inline void compare_exchange_lanes( float *restrict a, float *restrict b ) {
+ float lo[MEDIAN_NETWORK_LANES];
+ float hi[MEDIAN_NETWORK_LANES];
+ int l;
+ for ( l= 0; l < MEDIAN_NETWORK_LANES; l++ ) {
+  lo[l]= ( a[l] < b[l] ) ? a[l] : b[l];
+  hi[l]= ( a[l] < b[l] ) ? b[l] : a[l];
+ }
+ for ( l= 0; l < MEDIAN_NETWORK_LANES; l++ ) {
+  a[l]= lo[l];
+  b[l]= hi[l];
+ }
+}
+
+/*
+ * Generic NxN median filter with mirrored boundaries (filter_size <= MAX_MEDIAN_FILTER_SIZE).
+ * MEDIAN_NETWORK_LANES neighbouring pixels of a row are gathered into a transposed
+ * window and run through the same sorting network together.
+ */
+static void median_filter( const float *input, float *output, long width, long height,
+                           int filter_size ) {
+ int half= filter_size / 2;
+ long x, y;
+ int i, j, c, l, idx;
+ long xi, yi, xl;
+ struct Median_network network;
+ float window[MAX_MEDIAN_NETWORK_INPUTS][MEDIAN_NETWORK_LANES];
+
+ build_median_network( &network, filter_size * filter_size );
+
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for private( x, i, j, c, l, idx, xi, yi, xl, window ) schedule( static )
+#endif
 #endif
-#else
- /* Non-OpenMP fallback */
  for ( y= 0; y < height; y++ ) {
-  for ( x= 0; x < width; x++ ) {
-   idx= 0;
-   is_interior= ( y >= half && y < height - half && x >= half && x < width - half );
-   if ( is_interior ) {
-    for ( j= -half; j <= half; j++ ) {
-     for ( i= -half; i <= half; i++ ) {
-      work_buffer[idx++]= input[( y + j ) * width + ( x + i )];
+  for ( x= 0; x < width; x+= MEDIAN_NETWORK_LANES ) {
+   for ( l= 0; l < MEDIAN_NETWORK_LANES; l++ ) {
+    xl= x + l;
+    idx= 0;
+    if ( xl >= width ) {
+     /* Unused lane past the end of the row */
+     for ( idx= 0; idx < filter_size * filter_size; idx++ ) {
+      window[idx][l]= 0.0f;
      }
-    }
-   } else {
-    for ( j= -half; j <= half; j++ ) {
-     for ( i= -half; i <= half; i++ ) {
-      yi= mirror_index( y + j, height );
-      xi= mirror_index( x + i, width );
-      work_buffer[idx++]= input[yi * width + xi];
+    } else if ( y >= half && y < height - half && xl >= half && xl < width - half ) {
+     /* Fast path: no boundary checks needed */
+     for ( j= -half; j <= half; j++ ) {
+      for ( i= -half; i <= half; i++ ) {
+       window[idx++][l]= input[( y + j ) * width + ( xl + i )];
+      }
+     }
+    } else {
+     /* Slow path: need mirror boundary handling */
+     for ( j= -half; j <= half; j++ ) {
+      for ( i= -half; i <= half; i++ ) {
+       yi= mirror_index( y + j, height );
+       xi= mirror_index( xl + i, width );
+       window[idx++][l]= input[yi * width + xi];
+      }
      }
     }
+    for ( ; idx < network.n_inputs; idx++ ) {
+     window[idx][l]= HUGE_VALF;
+    }
+   }
+   for ( c= 0; c < network.n_comparators; c++ ) {
+    compare_exchange_lanes( window[network.comparator[c][0]], window[network.comparator[c][1]] );
+   }
+   for ( l= 0; l < MEDIAN_NETWORK_LANES && x + l < width; l++ ) {
+    output[y * width + x + l]= window[network.median_index][l];
    }
-   output[y * width + x]= median_of_n( work_buffer, window_size );
   }
  }
-#endif
 }
 
 /* Compute noise model: N = sqrt(gain * median5(I) + readnoise^2) / gain */
@@ -357,6 +414,11 @@ static void binary_dilate_3x3( const unsigned char *input, unsigned char *output
  long xi, yi;
  unsigned char val;
 
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for private( x, i, j, xi, yi, val ) schedule( static )
+#endif
+#endif
  for ( y= 0; y < height; y++ ) {
   for ( x= 0; x < width; x++ ) {
    val= 0;
@@ -376,17 +438,26 @@ static void binary_dilate_3x3( const unsigned char *input, unsigned char *output
  }
 }
 
-/* Replace masked pixels with local median of unmasked neighbors */
+/*
+ * Replace masked pixels with local median of unmasked neighbors.
+ * Only unmasked pixels are read and only masked ones are written,
+ * so the masked pixels may be processed in any order.
+ */
 static void clean_masked_pixels( float *image, const unsigned char *mask,
-                                 long width, long height, float *work_buffer ) {
+                                 long width, long height ) {
  long x, y;
  int half, size;
  int i, j, idx;
  long xi, yi;
- float median_val;
  long npix= width * height;
  long p;
+ float window[MAX_CLEAN_WINDOW_SIZE * MAX_CLEAN_WINDOW_SIZE];
 
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for private( x, y, half, size, i, j, idx, xi, yi, window ) schedule( dynamic, 4096 )
+#endif
+#endif
  for ( p= 0; p < npix; p++ ) {
   if ( !mask[p] )
    continue;
@@ -395,7 +466,7 @@ static void clean_masked_pixels( float *image, const unsigned char *mask,
   x= p % width;
 
   /* Start with 5x5 window, expand if needed */
-  for ( size= 5; size <= 21; size+= 2 ) {
+  for ( size= 5; size <= MAX_CLEAN_WINDOW_SIZE; size+= 2 ) {
    half= size / 2;
    idx= 0;
 
@@ -405,15 +476,14 @@ static void clean_masked_pixels( float *image, const unsigned char *mask,
      xi= x + i;
      if ( yi >= 0 && yi < height && xi >= 0 && xi < width ) {
       if ( !mask[yi * width + xi] ) {
-       work_buffer[idx++]= image[yi * width + xi];
+       window[idx++]= image[yi * width + xi];
       }
      }
     }
    }
 
    if ( idx > 0 ) {
-    median_val= median_of_n( work_buffer, idx );
-    image[p]= median_val;
+    image[p]= median_of_n( window, idx );
     break;
    }
   }
@@ -425,7 +495,6 @@ static int lacosmic_process( float *image, unsigned char *crmask, long width, lo
                              float gain, float readnoise, float contrast,
                              float cr_threshold, float neighbor_threshold, int maxiter ) {
  long npix= width * height;
- long npix_2x= 4 * npix;
  long i;
  int iter;
  int total_cr= 0;
@@ -434,37 +503,30 @@ static int lacosmic_process( float *image, unsigned char *crmask, long width, lo
  int cond1;
  int cond2;
 
- /* Allocate working arrays */
- float *upsampled= malloc( npix_2x * sizeof( float ) );
- float *laplacian= malloc( npix * sizeof( float ) );
- float *med5_img= malloc( npix * sizeof( float ) );
- float *noise= malloc( npix * sizeof( float ) );
+ /*
+  * Allocate working arrays. Intermediate images are overwritten as soon as
+  * they are no longer needed: the Laplacian becomes the SNR image, med5(I)
+  * becomes the noise model and med7(med3(I)) becomes the fine structure image.
+  */
  float *snr= malloc( npix * sizeof( float ) );
+ float *noise= malloc( npix * sizeof( float ) );
  float *snr_medsub= malloc( npix * sizeof( float ) );
  float *med3_img= malloc( npix * sizeof( float ) );
- float *med7_img= malloc( npix * sizeof( float ) );
  float *fine_struct= malloc( npix * sizeof( float ) );
  unsigned char *iter_mask= malloc( npix * sizeof( unsigned char ) );
  unsigned char *dilated= malloc( npix * sizeof( unsigned char ) );
- float *work_buffer= malloc( 441 * sizeof( float ) ); /* For up to 21x21 window in cleaning */
 
  /* Check allocations */
- if ( !upsampled || !laplacian || !med5_img || !noise || !snr ||
-      !snr_medsub || !med3_img || !med7_img || !fine_struct ||
-      !iter_mask || !dilated || !work_buffer ) {
+ if ( !snr || !noise || !snr_medsub || !med3_img || !fine_struct ||
+      !iter_mask || !dilated ) {
   fprintf( stderr, "ERROR: Couldn't allocate memory for working arrays in lacosmic_process()\n" );
-  free( upsampled );
-  free( laplacian );
-  free( med5_img );
-  free( noise );
   free( snr );
+  free( noise );
   free( snr_medsub );
   free( med3_img );
-  free( med7_img );
   free( fine_struct );
   free( iter_mask );
   free( dilated );
-  free( work_buffer );
   return -1;
  }
 
@@ -472,41 +534,55 @@ static int lacosmic_process( float *image, unsigned char *crmask, long width, lo
  memset( crmask, 0, npix * sizeof( unsigned char ) );
 
  for ( iter= 0; iter < maxiter; iter++ ) {
-  /* Step 1: Block replicate 2x */
-  block_replicate_2x( image, upsampled, width, height );
-
-  /* Step 2: Laplacian convolution (on 2x image) + clip negatives */
-  laplacian_filter( upsampled, upsampled, 2 * width, 2 * height );
-
-  /* Step 3: Block reduce back to original size */
-  block_reduce_2x( upsampled, laplacian, width, height );
+  /* Steps 1-3: Laplacian of the 2x block-replicated image, clipped and block-reduced */
+  laplacian_2x_filter( image, snr, width, height );
 
   /* Step 4: Compute noise model N = sqrt(g*med5(I) + rn^2) / g */
-  median_filter( image, med5_img, width, height, 5, work_buffer );
-  compute_noise_model( med5_img, noise, width, height, gain, readnoise );
+  median_filter( image, noise, width, height, 5 );
+  compute_noise_model( noise, noise, width, height, gain, readnoise );
 
   /* Step 5: SNR image S = L+ / (2 * N) */
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for schedule( static )
+#endif
+#endif
   for ( i= 0; i < npix; i++ ) {
-   snr[i]= laplacian[i] / ( 2.0f * noise[i] );
+   snr[i]= snr[i] / ( 2.0f * noise[i] );
   }
 
   /* Step 6: Remove extended structure S' = S - med5(S) */
-  median_filter( snr, snr_medsub, width, height, 5, work_buffer );
+  median_filter( snr, snr_medsub, width, height, 5 );
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for schedule( static )
+#endif
+#endif
   for ( i= 0; i < npix; i++ ) {
    snr_medsub[i]= snr[i] - snr_medsub[i];
   }
 
   /* Step 7: Fine structure F = (med3(I) - med7(med3(I))) / N */
-  median_filter( image, med3_img, width, height, 3, work_buffer );
-  median_filter( med3_img, med7_img, width, height, 7, work_buffer );
+  median_filter( image, med3_img, width, height, 3 );
+  median_filter( med3_img, fine_struct, width, height, 7 );
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for private( f ) schedule( static )
+#endif
+#endif
   for ( i= 0; i < npix; i++ ) {
-   f= ( med3_img[i] - med7_img[i] ) / noise[i];
+   f= ( med3_img[i] - fine_struct[i] ) / noise[i];
    fine_struct[i]= ( f > 0.01f ) ? f : 0.01f;
   }
 
   /* Step 8: Detection masks */
   /* cr_mask1: S' > cr_threshold */
   /* cr_mask2: S'/F > contrast */
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for private( cond1, cond2 ) schedule( static )
+#endif
+#endif
   for ( i= 0; i < npix; i++ ) {
    cond1= ( snr_medsub[i] > cr_threshold );
    cond2= ( ( snr_medsub[i] / fine_struct[i] ) > contrast );
@@ -542,22 +618,17 @@ static int lacosmic_process( float *image, unsigned char *crmask, long width, lo
    break;
 
   /* Step 11: Clean masked pixels */
-  clean_masked_pixels( image, crmask, width, height, work_buffer );
+  clean_masked_pixels( image, crmask, width, height );
  }
 
  /* Free working arrays */
- free( upsampled );
- free( laplacian );
- free( med5_img );
- free( noise );
  free( snr );
+ free( noise );
  free( snr_medsub );
  free( med3_img );
- free( med7_img );
  free( fine_struct );
  free( iter_mask );
  free( dilated );
- free( work_buffer );
 
  return total_cr;
 }
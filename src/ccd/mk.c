@@ -4,12 +4,22 @@
 #include <stdlib.h>
 #include <math.h>
 #include <unistd.h> // for unlink()
+#include <errno.h>
+#include <sys/resource.h> // for getrlimit()
 #include <libgen.h> // for basename()
 #include <gsl/gsl_sort.h>
 #include <gsl/gsl_statistics.h>
 
 #include "../fitsio.h"
 
+// Include omp.h ONLY if VaST compiler flag is requesting it
+#ifdef VAST_ENABLE_OPENMP
+// Include omp.h ONLY if the compiler supports OpenMP
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#endif
+
 #include "../vast_limits.h"
 
 #define FALLBACK_CCD_TEMP_VALUE 100
@@ -20,81 +30,209 @@
 #define MAX_CENTER_MEDIAN 55000
 #define CENTER_BOX_SIZE 64
 
-// Toggle median implementation:
-// - Set to 1 for GSL sort-based median.
-// - Set to 0 for quickselect-based median.
-//
-// The test shows that quickselect-based median is inappropriate for background-dominated astronomical images
-// as it tends to hit O(n^2) worst-case performance.
-//
-#define USE_GSL_MEDIAN 1
-
 // char *beztochki( char * );
 
-/* Quickselect partition: rearrange so elements < pivot are left, > pivot are right */
-static int quickselect_partition( double *arr, int left, int right, int pivot_idx ) {
- double pivot_val= arr[pivot_idx];
- double tmp;
- int store_idx;
+// The images are median-combined in strips of rows read from all the input files at once,
+// so the memory needed is (strip size) x (number of images) rather than (image size) x (number of images).
+// The strip height is chosen to fit the input strips of all the images within this budget.
+#define MK_STRIP_MEMORY_BUDGET_BYTES ( 256L * 1024L * 1024L )
+// The images are kept open during the second pass, except for these many file descriptors
+// left for the standard streams, the output image and whatever the libraries may need
+#define MK_RESERVED_FILE_DESCRIPTORS 64
+// CFITSIO cannot have more than NMAXFILES (10000) files open at once
+#define MK_MAX_OPEN_IMAGES 9000
+// If the limit is hit anyway, this many images are closed again
+#define MK_FILE_DESCRIPTORS_TO_RELEASE 16
+
+// The median of the pixel values across the images is computed with a counting
+// histogram over the value range if the range is smaller than this, and with
+// the two-pass (high byte, then low byte) radix selection otherwise.
+// Both are exact for the integer ADU data and, unlike quickselect, have
+// no bad cases for the background-dominated astronomical images.
+#define MK_PIXEL_HISTOGRAM_BINS 4096
+
+// Median of the whole image from its 16-bit histogram (same result as sorting the pixel values)
+static double median_from_histogram_u16( const unsigned long *hist, long n ) {
+ long target1= ( n - 1 ) / 2;
+ long target2= n / 2;
+ long cum= 0;
+ int v1= -1;
+ int v2= -1;
  int i;
-
- /* Move pivot to end */
- tmp= arr[pivot_idx];
- arr[pivot_idx]= arr[right];
- arr[right]= tmp;
-
- store_idx= left;
- for ( i= left; i < right; i++ ) {
-  if ( arr[i] < pivot_val ) {
-   tmp= arr[store_idx];
-   arr[store_idx]= arr[i];
-   arr[i]= tmp;
-   store_idx++;
+ for ( i= 0; i < 65536; i++ ) {
+  cum+= hist[i];
+  if ( v1 < 0 && cum > target1 ) {
+   v1= i;
+  }
+  if ( cum > target2 ) {
+   v2= i;
+   break;
   }
  }
-
- /* Move pivot to its final place */
- tmp= arr[store_idx];
- arr[store_idx]= arr[right];
- arr[right]= tmp;
-
- return store_idx;
+ if ( v1 < 0 ) {
+  v1= 0;
+ }
+ if ( v2 < 0 ) {
+  v2= v1;
+ }
+ return 0.5 * ( (double)v1 + (double)v2 );
 }
 
-/* Quickselect: find k-th smallest element in O(n) average time */
-static double quickselect( double *arr, int left, int right, int k ) {
- int pivot_idx;
- int pivot_new_idx;
+// Find the k-th and (k+1)-th smallest values (counting from 0) of n unsigned short values
+// using the radix selection: first on the high byte, then on the low byte.
+// hist should have room for 256 elements.
+static void radix_select_two_u16( const unsigned short *values, int n, int k, unsigned int *hist, unsigned short *kth, unsigned short *kth_plus_one ) {
+ int i, byte_value, remaining;
+ int target[2];
+ unsigned short result[2];
+ int t;
+ target[0]= k;
+ target[1]= MIN( k + 1, n - 1 );
+ for ( t= 0; t < 2; t++ ) {
+  // high byte
+  memset( hist, 0, 256 * sizeof( unsigned int ) );
+  for ( i= 0; i < n; i++ ) {
+   hist[values[i] >> 8]++;
+  }
+  remaining= target[t];
+  for ( byte_value= 0; byte_value < 255 && remaining >= (int)hist[byte_value]; byte_value++ ) {
+   remaining-= hist[byte_value];
+  }
+  result[t]= (unsigned short)( byte_value << 8 );
+  // low byte among the values with the selected high byte
+  memset( hist, 0, 256 * sizeof( unsigned int ) );
+  for ( i= 0; i < n; i++ ) {
+   if ( ( values[i] >> 8 ) == ( result[t] >> 8 ) ) {
+    hist[values[i] & 0xFF]++;
+   }
+  }
+  for ( byte_value= 0; byte_value < 255 && remaining >= (int)hist[byte_value]; byte_value++ ) {
+   remaining-= hist[byte_value];
+  }
+  result[t]|= (unsigned short)byte_value;
+ }
+ ( *kth )= result[0];
+ ( *kth_plus_one )= result[1];
+}
 
- while ( left < right ) {
-  /* Choose middle element as pivot for better average performance */
-  pivot_idx= left + ( right - left ) / 2;
-  pivot_new_idx= quickselect_partition( arr, left, right, pivot_idx );
+// Median of n unsigned short values rounded to the nearest integer,
+// the result is the same as for gsl_sort() + gsl_stats_median_from_sorted_data().
+// hist should have room for MK_PIXEL_HISTOGRAM_BINS elements.
+static unsigned short median_combine_pixel_u16( const unsigned short *values, int n, unsigned int *hist ) {
+ unsigned short min_value, max_value, lower, upper;
+ int i, range, cum, k;
+ double val;
 
-  if ( k == pivot_new_idx ) {
-   return arr[k];
-  } else if ( k < pivot_new_idx ) {
-   right= pivot_new_idx - 1;
+ min_value= max_value= values[0];
+ for ( i= 1; i < n; i++ ) {
+  if ( values[i] < min_value ) {
+   min_value= values[i];
+  }
+  if ( values[i] > max_value ) {
+   max_value= values[i];
+  }
+ }
+ range= (int)max_value - (int)min_value + 1;
+ // for odd n, lower and upper are the same middle value
+ k= ( n - 1 ) / 2;
+ if ( range <= MK_PIXEL_HISTOGRAM_BINS ) {
+  memset( hist, 0, range * sizeof( unsigned int ) );
+  for ( i= 0; i < n; i++ ) {
+   hist[values[i] - min_value]++;
+  }
+  cum= 0;
+  for ( i= 0; cum + (int)hist[i] <= k; i++ ) {
+   cum+= hist[i];
+  }
+  lower= (unsigned short)( min_value + i );
+  if ( n % 2 == 1 || cum + (int)hist[i] > k + 1 ) {
+   upper= lower;
   } else {
-   left= pivot_new_idx + 1;
+   for ( i++; hist[i] == 0; i++ )
+    ;
+   upper= (unsigned short)( min_value + i );
+  }
+ } else {
+  radix_select_two_u16( values, n, k, hist, &lower, &upper );
+  if ( n % 2 == 1 ) {
+   upper= lower;
   }
  }
- return arr[left];
+ val= 0.5 * ( (double)lower + (double)upper );
+ return (unsigned short)( val + 0.5 );
 }
 
-/* Find median of n doubles using quickselect - O(n) average time */
-static double median_of_n( double *arr, int n ) {
- double lower;
- double upper;
+// Read the image in strips of rows to compute its median from the 16-bit histogram
+// (if need_image_median is set) and read the central box to compute its median (if the image is large enough).
+static int compute_image_and_center_box_medians( fitsfile *fptr, long *naxes, int need_image_median, long strip_rows, unsigned short *strip_buffer, double *image_median, double *center_median ) {
+ unsigned long *hist;
+ long first_row, n_rows, n_pixels, i;
+ long cx, cy, x0, y0, x1, y1, bx, by;
+ long fpixel_box[2], lpixel_box[2], inc_box[2];
+ unsigned short nullval;
+ unsigned short center_box_ushort[CENTER_BOX_SIZE * CENTER_BOX_SIZE];
+ double center_box[CENTER_BOX_SIZE * CENTER_BOX_SIZE];
+ long center_box_count;
+ int anynul;
+ int status;
+
+ status= 0;
+ nullval= 0;
+ anynul= 0;
+ ( *image_median )= 0.0;
+ ( *center_median )= 0.0;
 
- if ( n % 2 == 1 ) {
-  return quickselect( arr, 0, n - 1, n / 2 );
+ if ( need_image_median ) {
+  hist= calloc( 65536, sizeof( unsigned long ) );
+  if ( hist == NULL ) {
+   fprintf( stderr, "ERROR: Couldn't allocate memory for the image histogram\n" );
+   exit( EXIT_FAILURE );
+  }
+  for ( first_row= 0; first_row < naxes[1]; first_row+= strip_rows ) {
+   n_rows= MIN( strip_rows, naxes[1] - first_row );
+   n_pixels= n_rows * naxes[0];
+   fits_read_img( fptr, TUSHORT, first_row * naxes[0] + 1, n_pixels, &nullval, strip_buffer, &anynul, &status );
+   if ( status != 0 ) {
+    free( hist );
+    return status;
+   }
+   for ( i= 0; i < n_pixels; i++ ) {
+    hist[strip_buffer[i]]++;
+   }
+  }
+  ( *image_median )= median_from_histogram_u16( hist, naxes[0] * naxes[1] );
+  free( hist );
+ }
+
+ if ( naxes[0] >= CENTER_BOX_SIZE && naxes[1] >= CENTER_BOX_SIZE ) {
+  cx= naxes[0] / 2;
+  cy= naxes[1] / 2;
+  x0= cx - CENTER_BOX_SIZE / 2;
+  y0= cy - CENTER_BOX_SIZE / 2;
+  x1= x0 + CENTER_BOX_SIZE;
+  y1= y0 + CENTER_BOX_SIZE;
+  // FITS pixel numbering starts from 1
+  fpixel_box[0]= x0 + 1;
+  fpixel_box[1]= y0 + 1;
+  lpixel_box[0]= x1;
+  lpixel_box[1]= y1;
+  inc_box[0]= inc_box[1]= 1;
+  fits_read_subset( fptr, TUSHORT, fpixel_box, lpixel_box, inc_box, &nullval, center_box_ushort, &anynul, &status );
+  if ( status != 0 ) {
+   return status;
+  }
+  center_box_count= 0;
+  for ( by= y0; by < y1; by++ ) {
+   for ( bx= x0; bx < x1; bx++ ) {
+    center_box[center_box_count]= center_box_ushort[center_box_count];
+    center_box_count++;
+   }
+  }
+  gsl_sort( center_box, 1, center_box_count );
+  ( *center_median )= gsl_stats_median_from_sorted_data( center_box, 1, center_box_count );
  }
 
- /* For even n, find both middle elements */
- lower= quickselect( arr, 0, n - 1, n / 2 - 1 );
- upper= quickselect( arr, 0, n - 1, n / 2 );
- return 0.5 * ( lower + upper );
+ return 0;
 }
 
 void check_and_remove_duplicate_keywords( const char *filename ) {
@@ -211,6 +349,18 @@ static int is_meaningful_keyword_value( const char *value ) {
  return 1;
 }
 
+// The number of images that may be kept open at once during the second pass;
+// the other images are re-opened for each strip
+static int get_max_number_of_open_images( void ) {
+ struct rlimit file_descriptor_limit;
+ long max_open_images;
+ max_open_images= MK_MAX_OPEN_IMAGES;
+ if ( 0 == getrlimit( RLIMIT_NOFILE, &file_descriptor_limit ) && file_descriptor_limit.rlim_cur != RLIM_INFINITY ) {
+  max_open_images= MIN( max_open_images, (long)file_descriptor_limit.rlim_cur - MK_RESERVED_FILE_DESCRIPTORS );
+ }
+ return (int)MAX( 0, max_open_images );
+}
+
 void handle_error( const char *message, int status ) {
  fprintf( stderr, "ERROR: %s\n", message );
  fits_report_error( stderr, status );
@@ -228,14 +378,20 @@ int main( int argc, char *argv[] ) {
  int status;
  int anynul;
  unsigned short nullval;
- unsigned short **image_array;
- unsigned short *combined_array;
- double y[MAX_NUMBER_OF_OBSERVATIONS];
- double *yy;
- double val;
+ unsigned short *strip_buffer;
+ unsigned short **strip_array;
+ unsigned short *combined_strip;
+ fitsfile **good_fptr;
+ fitsfile *reopened_fptr;
+ int max_open_images;
+ char **good_file_name;
+ double *good_file_index;
+ long strip_rows, first_row, n_rows, n_pixels, pixel_counter;
+ unsigned short *pixel_values;
+ unsigned int *pixel_hist;
  double ref_index;
  double cur_index;
- int i, j;
+ int j;
  int bitpix2;
  int file_counter;
  int ref_file_index;
@@ -249,9 +405,6 @@ int main( int argc, char *argv[] ) {
  FILE *filedescriptor_for_opening_test;
  long img_size;
  double center_median;
- double *center_box;
- long center_box_count;
- long cx, cy, x0, y0, x1, y1, bx, by;
 
  char telescop_ref[FLEN_VALUE];
  char telescop_cur[FLEN_VALUE];
@@ -401,24 +554,20 @@ int main( int argc, char *argv[] ) {
   fprintf( stderr, "ERROR: The image size cannot be negative\n" );
   exit( EXIT_FAILURE );
  }
- combined_array= malloc( img_size * sizeof( short ) );
- if ( combined_array == NULL ) {
-  fprintf( stderr, "ERROR: Couldn't allocate memory for combined_array\n" );
+ // Strip height for the first pass that reads one image at a time
+ strip_rows= MK_STRIP_MEMORY_BUDGET_BYTES / ( naxes_ref[0] * (long)sizeof( unsigned short ) );
+ strip_rows= MAX( 1, MIN( strip_rows, naxes_ref[1] ) );
+ strip_buffer= malloc( strip_rows * naxes_ref[0] * sizeof( unsigned short ) );
+ good_file_name= malloc( argc * sizeof( char * ) );
+ good_file_index= malloc( argc * sizeof( double ) );
+ if ( strip_buffer == NULL || good_file_name == NULL || good_file_index == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for the list of images\n" );
   exit( EXIT_FAILURE );
  }
- //
-
- image_array= NULL;
-
- /*
-  image_array= malloc( sizeof( unsigned short * ) ); // this will be realloc'ed before use anyhow
-  if ( image_array == NULL ) {
-   fprintf( stderr, "ERROR in mk: Couldn't allocate memory for image array (0)\n" );
-   exit( EXIT_FAILURE );
-  }
- */
+ good_file_counter= 0;
 
- // Reading the input files
+ // First pass: check the input files and compute the image medians (for scaling and rejection)
+ // reading one strip of rows at a time
  for ( file_counter= 1; file_counter < argc; file_counter++ ) {
   fits_open_file( &fptr, argv[file_counter], 0, &status );
   if ( status != 0 ) {
@@ -504,14 +653,6 @@ int main( int argc, char *argv[] ) {
     }
    }
   }
-  //
-  // Allocate memory for the input images
-  image_array= realloc( image_array, ( loaded_file_counter + 1 ) * sizeof( unsigned short * ) );
-  image_array[loaded_file_counter]= malloc( img_size * sizeof( unsigned short ) );
-  if ( image_array[loaded_file_counter] == NULL ) {
-   fprintf( stderr, "ERROR in mk: Couldn't allocate memory for image array\n Current image: %s\n", argv[file_counter] );
-   exit( EXIT_FAILURE );
-  }
 
   // Reading FITS header keywords from the first image we'll need to remember
   fits_get_img_type( fptr, &bitpix2, &status );
@@ -520,38 +661,15 @@ int main( int argc, char *argv[] ) {
    fprintf( stderr, "ERROR: BITPIX = %d.  Only SHORT_IMG (BITPIX = %d) images are currently supported.\n", bitpix2, SHORT_IMG );
    exit( EXIT_FAILURE );
   }
-  fits_read_img( fptr, TUSHORT, 1, naxes[0] * naxes[1], &nullval, image_array[loaded_file_counter], &anynul, &status );
+  status= compute_image_and_center_box_medians( fptr, naxes, !skip_scaling, strip_rows, strip_buffer, &cur_index, &center_median );
   fits_close_file( fptr, &status );
   fits_report_error( stderr, status ); // print out any error messages
   if ( status != 0 ) {
    exit( EXIT_FAILURE );
   }
   loaded_file_counter++;
- }
-
- yy= malloc( img_size * sizeof( double ) );
- if ( yy == NULL ) {
-  fprintf( stderr, "ERROR: Couldn't allocate memory for yy array\n" );
-  exit( EXIT_FAILURE );
- };
-
- if ( loaded_file_counter < 2 ) {
-  fprintf( stderr, "ERROR: only %d images were successfully loaded!\n", loaded_file_counter );
-  exit( EXIT_FAILURE );
- }
 
- good_file_counter= 0;
- for ( file_counter= 0; file_counter < loaded_file_counter; file_counter++ ) {
   if ( !skip_scaling ) {
-   for ( i= 0; i < img_size; i++ ) {
-    yy[i]= image_array[file_counter][i];
-   }
-#if USE_GSL_MEDIAN
-   gsl_sort( yy, 1, img_size );
-   cur_index= gsl_stats_median_from_sorted_data( yy, 1, img_size );
-#else
-   cur_index= median_of_n( yy, (int)img_size );
-#endif
    fprintf( stderr, "cur_index=%lf\n", cur_index );
 
    // Reject obviously bad images from the flat-field stack
@@ -570,27 +688,6 @@ int main( int argc, char *argv[] ) {
   // Check median of center box for high vignetting:
   // a vignetted flat may have low overall median but saturated center
   if ( naxes_ref[0] >= CENTER_BOX_SIZE && naxes_ref[1] >= CENTER_BOX_SIZE ) {
-   cx= naxes_ref[0] / 2;
-   cy= naxes_ref[1] / 2;
-   x0= cx - CENTER_BOX_SIZE / 2;
-   y0= cy - CENTER_BOX_SIZE / 2;
-   x1= x0 + CENTER_BOX_SIZE;
-   y1= y0 + CENTER_BOX_SIZE;
-   center_box= malloc( CENTER_BOX_SIZE * CENTER_BOX_SIZE * sizeof( double ) );
-   if ( center_box == NULL ) {
-    fprintf( stderr, "ERROR: Couldn't allocate memory for center_box\n" );
-    exit( EXIT_FAILURE );
-   }
-   center_box_count= 0;
-   for ( by= y0; by < y1; by++ ) {
-    for ( bx= x0; bx < x1; bx++ ) {
-     center_box[center_box_count]= image_array[file_counter][by * naxes_ref[0] + bx];
-     center_box_count++;
-    }
-   }
-   gsl_sort( center_box, 1, center_box_count );
-   center_median= gsl_stats_median_from_sorted_data( center_box, 1, center_box_count );
-   free( center_box );
    fprintf( stderr, "center_median=%lf\n", center_median );
    if ( center_median > MAX_CENTER_MEDIAN ) {
     fprintf( stderr, "REJECT (center too bright: vignetting may cause saturated center while overall median is OK)\n" );
@@ -598,42 +695,72 @@ int main( int argc, char *argv[] ) {
    }
   }
 
-  if ( skip_scaling ) {
-   if ( good_file_counter != file_counter ) {
-    for ( ii= 0; ii < img_size; ii++ ) {
-     image_array[good_file_counter][ii]= image_array[file_counter][ii];
-    }
-   }
-  } else {
+  if ( !skip_scaling ) {
    if ( good_file_counter == 0 ) {
     ref_index= cur_index;
     fprintf( stderr, "ref_index=%lf\n", ref_index );
    }
-   for ( ii= 0; ii < img_size; ii++ ) {
-    image_array[good_file_counter][ii]= image_array[file_counter][ii] * ref_index / cur_index;
-   }
   }
+  good_file_name[good_file_counter]= argv[file_counter];
+  good_file_index[good_file_counter]= cur_index;
   good_file_counter++;
  }
- free( yy );
+ free( strip_buffer );
+
+ if ( loaded_file_counter < 2 ) {
+  fprintf( stderr, "ERROR: only %d images were successfully loaded!\n", loaded_file_counter );
+  exit( EXIT_FAILURE );
+ }
 
  if ( good_file_counter < 2 ) {
   fprintf( stderr, "ERROR: only %d images passed the mean count cuts!\n", good_file_counter );
   exit( EXIT_FAILURE );
  }
 
- //
- for ( i= 0; i < img_size; i++ ) {
-  for ( file_counter= 0; file_counter < good_file_counter; file_counter++ ) {
-   y[file_counter]= image_array[file_counter][i];
+ // Second pass: read the same strip of rows from all the good images and median-combine it
+ strip_rows= MK_STRIP_MEMORY_BUDGET_BYTES / ( ( good_file_counter + 1 ) * naxes_ref[0] * (long)sizeof( unsigned short ) );
+ strip_rows= MAX( 1, MIN( strip_rows, naxes_ref[1] ) );
+ fprintf( stderr, "Median-combining %d images in strips of %ld rows\n", good_file_counter, strip_rows );
+ max_open_images= get_max_number_of_open_images();
+ good_fptr= malloc( good_file_counter * sizeof( fitsfile * ) );
+ strip_array= malloc( good_file_counter * sizeof( unsigned short * ) );
+ combined_strip= malloc( strip_rows * naxes_ref[0] * sizeof( unsigned short ) );
+ if ( good_fptr == NULL || strip_array == NULL || combined_strip == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for image strips\n" );
+  exit( EXIT_FAILURE );
+ }
+ for ( file_counter= 0; file_counter < good_file_counter; file_counter++ ) {
+  strip_array[file_counter]= malloc( strip_rows * naxes_ref[0] * sizeof( unsigned short ) );
+  if ( strip_array[file_counter] == NULL ) {
+   fprintf( stderr, "ERROR in mk: Couldn't allocate memory for image strip\n Current image: %s\n", good_file_name[file_counter] );
+   exit( EXIT_FAILURE );
+  }
+  good_fptr[file_counter]= NULL;
+  if ( file_counter >= max_open_images ) {
+   continue;
+  }
+  errno= 0;
+  fits_open_file( &good_fptr[file_counter], good_file_name[file_counter], 0, &status );
+  if ( status != 0 && ( status == TOO_MANY_FILES || errno == EMFILE || errno == ENFILE ) ) {
+   // Out of file descriptors: close a few of the images opened so far to leave descriptors
+   // for the output image and for re-opening, these and the following images will be re-opened for each strip
+   good_fptr[file_counter]= NULL;
+   status= 0;
+   max_open_images= MAX( 0, file_counter - MK_FILE_DESCRIPTORS_TO_RELEASE );
+   for ( j= max_open_images; j < file_counter; j++ ) {
+    fits_close_file( good_fptr[j], &status );
+    good_fptr[j]= NULL;
+   }
+   continue;
+  }
+  if ( status != 0 ) {
+   fprintf( stderr, "ERROR: Cannot re-open file %s\n", good_file_name[file_counter] );
+   fits_report_error( stderr, status );
+   exit( EXIT_FAILURE );
   }
-#if USE_GSL_MEDIAN
-  gsl_sort( y, 1, good_file_counter );
-  val= gsl_stats_median_from_sorted_data( y, 1, good_file_counter );
-#else
-  val= median_of_n( y, good_file_counter );
-#endif
-  combined_array[i]= (unsigned short)( val + 0.5 );
+ }
+ if ( max_open_images < good_file_counter ) {
+  fprintf( stderr, "Too many images to keep them all open: %d of them will be re-opened for each strip\n", good_file_counter - max_open_images );
  }
 
  // Write the output FITS file
@@ -645,9 +772,80 @@ int main( int argc, char *argv[] ) {
   unlink( "median.fit" );
  }
  fits_create_file( &fptr, "median.fit", &status ); /* create new file */
- fits_create_img( fptr, USHORT_IMG, 2, naxes, &status );
- fits_write_img( fptr, TUSHORT, fpixel, img_size, combined_array, &status );
- free( combined_array );
+ fits_create_img( fptr, USHORT_IMG, 2, naxes_ref, &status );
+
+ for ( first_row= 0; first_row < naxes_ref[1] && status == 0; first_row+= strip_rows ) {
+  n_rows= MIN( strip_rows, naxes_ref[1] - first_row );
+  n_pixels= n_rows * naxes_ref[0];
+  // CFITSIO is not thread-safe, so the strips are read sequentially
+  for ( file_counter= 0; file_counter < good_file_counter; file_counter++ ) {
+   if ( good_fptr[file_counter] != NULL ) {
+    fits_read_img( good_fptr[file_counter], TUSHORT, first_row * naxes_ref[0] + 1, n_pixels, &nullval, strip_array[file_counter], &anynul, &status );
+   } else {
+    fits_open_file( &reopened_fptr, good_file_name[file_counter], 0, &status );
+    fits_read_img( reopened_fptr, TUSHORT, first_row * naxes_ref[0] + 1, n_pixels, &nullval, strip_array[file_counter], &anynul, &status );
+    fits_close_file( reopened_fptr, &status );
+   }
+   if ( status != 0 ) {
+    fprintf( stderr, "ERROR reading %s\n", good_file_name[file_counter] );
+    fits_report_error( stderr, status );
+    exit( EXIT_FAILURE );
+   }
+  }
+
+  // Scale the images to the median level of the first good image,
+  // the scaled values are truncated to integers as before combining
+  if ( !skip_scaling ) {
+   for ( file_counter= 1; file_counter < good_file_counter; file_counter++ ) {
+    cur_index= good_file_index[file_counter];
+    for ( pixel_counter= 0; pixel_counter < n_pixels; pixel_counter++ ) {
+     strip_array[file_counter][pixel_counter]= strip_array[file_counter][pixel_counter] * ref_index / cur_index;
+    }
+   }
+  }
+
+  // The pixels of the strip are independent, so they are combined in parallel
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel private( pixel_counter, file_counter, pixel_values, pixel_hist )
+#endif
+#endif
+  {
+   pixel_values= malloc( good_file_counter * sizeof( unsigned short ) );
+   pixel_hist= malloc( MK_PIXEL_HISTOGRAM_BINS * sizeof( unsigned int ) );
+   if ( pixel_values == NULL || pixel_hist == NULL ) {
+    fprintf( stderr, "ERROR: Couldn't allocate memory for pixel_values\n" );
+    exit( EXIT_FAILURE );
+   }
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp for
+#endif
+#endif
+   for ( pixel_counter= 0; pixel_counter < n_pixels; pixel_counter++ ) {
+    for ( file_counter= 0; file_counter < good_file_counter; file_counter++ ) {
+     pixel_values[file_counter]= strip_array[file_counter][pixel_counter];
+    }
+    combined_strip[pixel_counter]= median_combine_pixel_u16( pixel_values, good_file_counter, pixel_hist );
+   }
+   free( pixel_hist );
+   free( pixel_values );
+  }
+
+  fits_write_img( fptr, TUSHORT, first_row * naxes_ref[0] + fpixel, n_pixels, combined_strip, &status );
+ }
+ free( combined_strip );
+
+ for ( file_counter= 0; file_counter < good_file_counter; file_counter++ ) {
+  if ( good_fptr[file_counter] != NULL ) {
+   fits_close_file( good_fptr[file_counter], &status );
+  }
+  free( strip_array[file_counter] );
+ }
+ free( strip_array );
+ free( good_fptr );
+ free( good_file_index );
+ free( good_file_name );
 
  // Write the FITS header
  for ( ii= 1; ii < No_of_keys; ii++ ) {
@@ -678,11 +876,6 @@ int main( int argc, char *argv[] ) {
  fits_report_error( stderr, status ); /* print out any error messages */
  fits_close_file( fptr, &status );
 
- for ( file_counter= 0; file_counter < loaded_file_counter; file_counter++ ) {
-  free( image_array[file_counter] );
- }
- free( image_array );
-
  fprintf( stderr, "Writing output to median.fit \n" );
  fits_report_error( stderr, status ); /* print out any error messages */
 
@@ -139,65 +139,325 @@ void sort_log_file_in_mag() {
  return;
 }
 
-int main() {
- FILE *legacy_data_file;
- FILE *extended_data_file;
+// Statistics computed for one lightcurve and written to data and vast_lightcurve_statistics.log
+struct Lightcurve_statistics {
+ int is_good; // 1 - write the star to the output files, 0 - skip it
+ double m_median;
+ double sigma_series;
+ double x_ref;
+ double y_ref;
+ double weighted_sigma;
+ double skewness;
+ double kurtosis;
+ double I, J, K, L;                     // Stetson's variability indexes
+ double J_clip, L_clip, J_time, L_time; // Modified Stetson's variability indexes
+ double I_sign_only;
+ int points_in_lightcurve;
+ double MAD_scaled_to_sigma;
+ double lag1_autocorrelation;
+ double RoMS;
+ double reduced_chi2;
+ double peak_to_peak_AGN_v;
+ double N3;
+ double excursions;
+ double eta, E_A, SB;
+ double NXS;
+ double IQR;
+};
 
+// Scratch arrays re-used for all the lightcurves processed by one thread,
+// so we don't have to allocate memory for every lightcurve
+struct Lightcurve_statistics_scratch {
+ double *m;
+ double *merr;
+ double *w;
+ double *jday;
+ double *m_sorted; // magnitude-sorted copy of m shared by all the median-based indexes
+ double *AD;       // absolute deviations for MAD
+ size_t *p;        // time-sort index shared by all the indexes that need time sorting
+};
+
+static int allocate_lightcurve_statistics_scratch( struct Lightcurve_statistics_scratch *scratch, int n ) {
+ scratch->m= malloc( n * sizeof( double ) );
+ scratch->merr= malloc( n * sizeof( double ) );
+ scratch->w= malloc( n * sizeof( double ) );
+ scratch->jday= malloc( n * sizeof( double ) );
+ scratch->m_sorted= malloc( n * sizeof( double ) );
+ scratch->AD= malloc( n * sizeof( double ) );
+ scratch->p= malloc( n * sizeof( size_t ) );
+ if ( scratch->m == NULL || scratch->merr == NULL || scratch->w == NULL || scratch->jday == NULL || scratch->m_sorted == NULL || scratch->AD == NULL || scratch->p == NULL ) {
+  fprintf( stderr, "ERROR in create_data.c - cannot allocate memory\n" );
+  return 1;
+ }
+ return 0;
+}
+
+static void free_lightcurve_statistics_scratch( struct Lightcurve_statistics_scratch *scratch ) {
+ free( scratch->m );
+ free( scratch->merr );
+ free( scratch->w );
+ free( scratch->jday );
+ free( scratch->m_sorted );
+ free( scratch->AD );
+ free( scratch->p );
+ return;
+}
+
+static int is_lightcurve_filename( const char *filename ) {
+ size_t filename_length= strlen( filename );
+ if ( filename_length < 8 )
+  return 0; // make sure the filename is not too short for the following tests
+ if ( filename[0] == 'o' && filename[1] == 'u' && filename[2] == 't' && filename[filename_length - 1] == 't' && filename[filename_length - 2] == 'a' && filename[filename_length - 3] == 'd' )
+  return 1;
+ return 0;
+}
+
+// Returns the list of out*.dat files in the current directory in the readdir() order
+// or NULL if the directory cannot be opened
+static char **list_lightcurve_files( int *number_of_lightcurve_files ) {
  DIR *dp;
  struct dirent *ep;
+ char **lightcurve_filenames;
+ char **realloc_lightcurve_filenames;
+ int allocated_filenames;
+
+ ( *number_of_lightcurve_files )= 0;
+
+ dp= opendir( "./" );
+ if ( dp == NULL ) {
+  perror( "Couldn't open the directory" );
+  return NULL;
+ }
+
+ allocated_filenames= 1024;
+ lightcurve_filenames= malloc( allocated_filenames * sizeof( char * ) );
+ if ( lightcurve_filenames == NULL ) {
+  fprintf( stderr, "ERROR in create_data.c - cannot allocate memory\n" );
+  exit( EXIT_FAILURE );
+ }
+
+ while ( ( ep= readdir( dp ) ) != NULL ) {
+  if ( 0 == is_lightcurve_filename( ep->d_name ) )
+   continue;
+  if ( ( *number_of_lightcurve_files ) == allocated_filenames ) {
+   allocated_filenames= 2 * allocated_filenames;
+   realloc_lightcurve_filenames= realloc( lightcurve_filenames, allocated_filenames * sizeof( char * ) );
+   if ( realloc_lightcurve_filenames == NULL ) {
+    fprintf( stderr, "ERROR in create_data.c - cannot allocate memory\n" );
+    exit( EXIT_FAILURE );
+   }
+   lightcurve_filenames= realloc_lightcurve_filenames;
+  }
+  lightcurve_filenames[( *number_of_lightcurve_files )]= strdup( ep->d_name );
+  if ( lightcurve_filenames[( *number_of_lightcurve_files )] == NULL ) {
+   fprintf( stderr, "ERROR in create_data.c - cannot allocate memory\n" );
+   exit( EXIT_FAILURE );
+  }
+  ( *number_of_lightcurve_files )++;
+ }
+ (void)closedir( dp );
 
+ return lightcurve_filenames;
+}
+
+// Read one lightcurve and compute its statistics.
+// Returns 0 on success (stat->is_good tells if the star should be written out) or 1 on a fatal error.
+// The function does not touch any global state, so many lightcurves may be processed in parallel
+// as long as each thread has its own scratch arrays.
+static int compute_lightcurve_statistics( const char *lightcurvefilename, int number_of_measured_images_from_vast_summary_log, struct Lightcurve_statistics_scratch *scratch, struct Lightcurve_statistics *stat ) {
  FILE *lightcurvefile;
  double jd, mag, magerr, x, y, app;
  char string[FILENAME_LENGTH];
 
- int number_of_measured_images_from_vast_summary_log= get_number_of_measured_images_from_vast_summary_log();
  int n_points_to_drop;
 
- // n_points_to_drop was determined based on number_of_measured_images_from_vast_summary_log
- // but we want n_points_to_drop to depend on the number of points in a given lightcurve
-
  double x_ref= 0.0;
  double y_ref= 0.0;
- double m_median, sigma_series;
  int i, j; // just counters
- double *m;
- double *merr;
- double *w;
 
- double m_mean, weighted_sigma, MAD_scaled_to_sigma, lag1_autocorrelation, IQR;
+ double *m= scratch->m;
+ double *merr= scratch->merr;
+ double *w= scratch->w;
+ double *jday= scratch->jday;
+ double *m_sorted= scratch->m_sorted;
 
- double skewness, kurtosis;
+ double m_mean;
 
- double I, J, K, L;                     // Stetson's variability indexes
- double J_clip, L_clip, J_time, L_time; // Modified Stetson's variability indexes
+ stat->is_good= 0;
 
- double I_sign_only;
+ lightcurvefile= fopen( lightcurvefilename, "r" );
+ if ( NULL == lightcurvefile ) {
+  fprintf( stderr, "ERROR: Can't open file %s\n", lightcurvefilename );
+  exit( EXIT_FAILURE );
+ }
+ i= 0;
 
- double *jday;
+ x= y= -1.0; // initialize x and y to obviously wrong values
+ while ( -1 < read_lightcurve_point( lightcurvefile, &jd, &mag, &magerr, &x, &y, &app, string, NULL ) ) {
+  if ( jd == 0.0 ) {
+   continue; // if this line could not be parsed, try the next one
+  }
+  if ( i == 0 ) {
+   x_ref= x;
+   y_ref= y;
+  }
+  if ( 1 == vast_isnormal( mag ) && 1 == vast_isnormal( magerr ) ) {
+   if ( mag != 0.0 && magerr != 0.0 ) {
+    m[i]= mag;
+    merr[i]= magerr;
+    jday[i]= jd;
+    i++;
+    if ( i >= MAX_NUMBER_OF_OBSERVATIONS ) {
+     fprintf( stderr, "ERROR (src/create_data.c): i>=MAX_NUMBER_OF_OBSERVATIONS=%d\n", MAX_NUMBER_OF_OBSERVATIONS );
+     fclose( lightcurvefile );
+     return 1;
+    }
+   }
+  }
+ }
+ fclose( lightcurvefile );
 
- int points_in_lightcurve;
+// defined in src/vast_limits.h
+#ifdef DROP_LIGHTCURVES_WITH_SMALL_NUMBER_OF_POINTS_FROM_ALL_PLOTS
+ // Skip the star if it has insufficient number of measurements
+ //                                                                                                                                                     0.5 is to correctly round off
+ if ( i < MIN( SOFT_MIN_NUMBER_OF_POINTS, (int)( MIN_FRACTION_OF_IMAGES_THE_STAR_SHOULD_APPEAR_IN * (double)number_of_measured_images_from_vast_summary_log + 0.5 ) ) || i < HARD_MIN_NUMBER_OF_POINTS ) {
+#ifdef DEBUGFILES
+  fprintf( stderr, "\rWill not compute variability indexes for %s as the lightcurve has only %5d points. ", lightcurvefilename, i );
+#endif
+  return 0;
+ }
+#endif
 
- double RoMS;
+ // Compute variability indexes: Stetson's indexes and the others that need time sorting of the input lightcurve
+ compute_variability_indexes_that_need_time_sorting_using_index_buffer( jday, m, merr, i, number_of_measured_images_from_vast_summary_log, &stat->I, &stat->J, &stat->K, &stat->L, &stat->J_clip, &stat->L_clip, &stat->J_time, &stat->L_time, &stat->I_sign_only, &stat->N3, &stat->excursions, &stat->eta, &stat->E_A, &stat->SB, scratch->p );
 
- double reduced_chi2;
+ stat->points_in_lightcurve= i;
 
- double peak_to_peak_AGN_v;
+ // Sort a copy of the lightcurve in magnitude once and use it for all the indexes that need the median or quantiles
+ for ( j= 0; j < i; j++ ) {
+  m_sorted[j]= m[j];
+ }
+ gsl_sort( m_sorted, 1, i );
 
- double N3;
+ //////////////////////// Indexes that do not depend on sorting ////////////////////////
+ // compute weights
+ // for(j=0;j<i;j++){w[j]=1.0;} // NO WEIGHTS
+ // for(j=0;j<i;j++){w[j]=1.0/merr[j];}  // NOTE THE UNUSUAL WEIGHTS!!!
+ for ( j= 0; j < i; j++ ) {
+  w[j]= 1.0 / ( merr[j] * merr[j] );
+ } // THE USUAL WEIGHTS
 
- double excursions;
+ stat->weighted_sigma= stat->skewness= stat->kurtosis= 0.0; // set default values
 
- double eta, E_A, SB;
+#ifndef DISABLE_INDEX_WEIGHTED_SIGMA
+ m_mean= gsl_stats_wmean( w, 1, m, 1, i );                       // weighted mean mag.
+ stat->weighted_sigma= gsl_stats_wsd_m( w, 1, m, 1, i, m_mean ); // weighted SD
+#ifndef DISABLE_INDEX_SKEWNESS
+ stat->skewness= gsl_stats_wskew_m_sd( w, 1, m, 1, i, m_mean, stat->weighted_sigma ); // weighted skewness
+#endif
+#ifndef DISABLE_INDEX_KURTOSIS
+ stat->kurtosis= gsl_stats_wkurtosis_m_sd( w, 1, m, 1, i, m_mean, stat->weighted_sigma ); // weighted kurtosis
+#endif
+#endif
 
- double NXS;
+ // Robust Median Statistic, RoMS
+ stat->RoMS= compute_RoMS_with_known_median( m, merr, i, gsl_stats_median_from_sorted_data( m_sorted, 1, i ) );
 
- int star_counter_for_display= 0;
+ //  reduced chi2
+ stat->reduced_chi2= 0.0; // This is in case chi2 computation is disabled at compile time.
+// If needed, we disable chi2 computation here rather than in src/variability_indexes.c
+// since compute_reduced_chi2() may be used as an auxiliary function
+// elsewhere in the code.
+#ifndef DISABLE_INDEX_REDUCED_CHI2
+ stat->reduced_chi2= compute_reduced_chi2( m, merr, i );
+#endif
+
+ // Peak-to-peak AGN-style variability index
+ stat->peak_to_peak_AGN_v= compute_peak_to_peak_AGN_v( m, merr, i );
+
+ /// This thing has to be sorted in time!!!!
+ stat->lag1_autocorrelation= lag1_autocorrelation_of_unsorted_lightcurve( jday, m, i );
+
+ stat->MAD_scaled_to_sigma= 0.0; // This is in case MAD computation is disabled at compile time.
+// If needed, we disable MAD computation here rather than in src/variability_indexes.c
+// since esimate_sigma_from_MAD_of_unsorted_data() may be used as an auxiliary function
+// elsewhere in the code.
+#ifndef DISABLE_INDEX_MAD
+ // Estimate sigma from MAD using the magnitude-sorted copy of the lightcurve
+ if ( i > 1 ) {
+  stat->MAD_scaled_to_sigma= esimate_sigma_from_MAD_of_sorted_data_using_buffer( m_sorted, i, scratch->AD );
+ }
+#endif
 
- // unsigned int p; // for index sorting
+ // Compute normalized excess variance (NXS)
+ stat->NXS= Normalized_excess_variance( m, merr, i );
 
- // fprintf(stderr,"DEBUG03\n");
+ // Compute IQR
+ stat->IQR= 0.0;
+#ifndef DISABLE_INDEX_IQR
+ stat->IQR= estimate_sigma_from_IQR_of_sorted_data( m_sorted, i );
+#endif
 
- // a=b=2;
+ //////////////////////// end of indexes that do not depend on sorting ////////////////////////
+
+ ////////////////////////////// Computations below are needed for backward compatibility with the old way VaST was operating
+
+ // LIGHTCURVE FILTERING BELOW!!!!!
+ /// Drop points (from the magnitude-sorted copy of the lightcurve)
+ if ( i >= STAT_MIN_NUMBER_OF_POINTS_FOR_NDROP ) {
+  //
+  n_points_to_drop= MIN( (int)( 0.05 * i ), STAT_NDROP );
+  //
+  i-= n_points_to_drop;
+  for ( j= 0; j < i; j++ ) {
+   m_sorted[j]= m_sorted[j + n_points_to_drop];
+  }
+  i-= n_points_to_drop;
+ }
+
+ //// Computations for the classical mag-sigma plot ////
+ // note that the median and sigma here are calculated over the filtered lightcurve
+ stat->m_median= gsl_stats_median_from_sorted_data( m_sorted, 1, i );
+ stat->sigma_series= gsl_stats_sd( m_sorted, 1, i );
+
+ ///// Filter-out bad stars - if even the simple statistics canot be computed - we don't want this star to be written in the stat. files
+ // This is the replacement of the old external filter
+ if ( 0 == vast_isnormal( stat->m_median ) )
+  return 0;
+ // Changec check here
+ if ( stat->m_median < BRIGHTEST_STARS )
+  return 0;
+ if ( stat->m_median > FAINTEST_STARS_ANYMAG )
+  return 0;
+ // And this seems to be very dangerous
+ // if( sigma_series>MAX_MAG_ERROR )continue;
+ // No upper limit on the mag scatter - some objects may be vary by *a lot*!
+ //
+ if ( stat->sigma_series == 0.0 || 0 == vast_isnormal( stat->sigma_series ) )
+  return 0;
+
+ stat->x_ref= x_ref;
+ stat->y_ref= y_ref;
+ stat->is_good= 1;
+
+ return 0;
+}
+
+int main() {
+ FILE *legacy_data_file;
+ FILE *extended_data_file;
+
+ int number_of_measured_images_from_vast_summary_log= get_number_of_measured_images_from_vast_summary_log();
+
+ char **lightcurve_filenames;
+ int number_of_lightcurve_files;
+ struct Lightcurve_statistics *stat;
+ struct Lightcurve_statistics_scratch scratch;
+ int lightcurve_counter;
+ int fatal_error_in_statistics_computation;
+
+ int star_counter_for_display= 0;
 
  // A minute of paranoia
  if ( number_of_measured_images_from_vast_summary_log <= 0 ) {
@@ -217,259 +477,83 @@ int main() {
   return 1;
  }
 
- // fprintf(stderr,"DEBUG04\n");
-
- m= malloc( number_of_measured_images_from_vast_summary_log * sizeof( double ) );
- if ( m == NULL ) {
-  fprintf( stderr, "ERROR in create_data.c - cannot allocate memory\n" );
-  return 1;
- }
- merr= malloc( number_of_measured_images_from_vast_summary_log * sizeof( double ) );
- if ( merr == NULL ) {
-  fprintf( stderr, "ERROR in create_data.c - cannot allocate memory\n" );
-  return 1;
- }
- w= malloc( number_of_measured_images_from_vast_summary_log * sizeof( double ) );
- if ( w == NULL ) {
-  fprintf( stderr, "ERROR in create_data.c - cannot allocate memory\n" );
-  return 1;
- }
- jday= malloc( number_of_measured_images_from_vast_summary_log * sizeof( double ) );
- if ( jday == NULL ) {
-  fprintf( stderr, "ERROR in create_data.c - cannot allocate memory\n" );
-  return 1;
- }
- // p=malloc(number_of_measured_images_from_vast_summary_log*sizeof(unsigned int));
- // if( p==NULL ){fprintf(stderr,"ERROR in create_data.c - cannot allocate memory\n");return 1;}
-
- // fprintf(stderr,"DEBUG05\n");
-
 #ifdef DROP_LIGHTCURVES_WITH_SMALL_NUMBER_OF_POINTS_FROM_ALL_PLOTS
  fprintf( stderr, " Will not compute variability indexes for objects having <%d points in lightcurve\nYou may disable this by commenting out the line '#define DROP_LIGHTCURVES_WITH_SMALL_NUMBER_OF_POINTS_FROM_ALL_PLOTS' in src/vast_limits.h an re-compiling VaST with 'make'\n\nComputing, please wait a bit\n", MIN( SOFT_MIN_NUMBER_OF_POINTS, (int)( 0.5 * number_of_measured_images_from_vast_summary_log ) ) );
 #endif
 
- dp= opendir( "./" );
- if ( dp != NULL ) {
-  // fprintf(stderr,"Working...\nPlease, PLEASE, be patient!!!\n");
-  // while( ep=readdir(dp) ){
-  while ( ( ep= readdir( dp ) ) != NULL ) {
-   // fprintf(stderr,"DEBUG: %s\n",ep->d_name); // !!!
-   if ( strlen( ep->d_name ) < 8 )
-    continue; // make sure the filename is not too short for the following tests
-   // if( strlen(ep->d_name)<10 )continue; // make sure the filename is not too short for the following tests
-   if ( ep->d_name[0] == 'o' && ep->d_name[1] == 'u' && ep->d_name[2] == 't' && ep->d_name[strlen( ep->d_name ) - 1] == 't' && ep->d_name[strlen( ep->d_name ) - 2] == 'a' && ep->d_name[strlen( ep->d_name ) - 3] == 'd' ) {
-    // fprintf(stderr,"DEBUG01\n"); // !!!
-    // continue; // !!!!!!!!!!!!!!!!!!!!!!!!!!!!
-    // puts(ep->d_name);
-    lightcurvefile= fopen( ep->d_name, "r" );
-    if ( NULL == lightcurvefile ) {
-     fprintf( stderr, "ERROR: Can't open file %s\n", ep->d_name );
-     exit( EXIT_FAILURE );
-    }
-    // fprintf(stderr,"DEBUG02\n"); // !!!
-    // puts(ep->d_name);
-    i= 0;
-
-    // fprintf(stderr,"DEBUG06 - rading %s\n",ep->d_name);
-    x= y= -1.0; // initialize x and y to obviously wrong values
-    // while(-1<fscanf(lightcurvefile,"%lf %lf %lf %lf %lf %lf %s",&jd,&mag,&magerr,&x,&y,&app,string)){
-    while ( -1 < read_lightcurve_point( lightcurvefile, &jd, &mag, &magerr, &x, &y, &app, string, NULL ) ) {
-     // continue; // !!!
-     // puts(string);
-     if ( jd == 0.0 ) {
-      continue; // if this line could not be parsed, try the next one
-     }
-     if ( i == 0 ) {
-      x_ref= x;
-      y_ref= y;
-     }
-     if ( 1 == vast_isnormal( mag ) && 1 == vast_isnormal( magerr ) ) {
-      if ( mag != 0.0 && magerr != 0.0 ) {
-       m[i]= mag;
-       merr[i]= magerr;
-       jday[i]= jd;
-       i++;
-       if ( i >= MAX_NUMBER_OF_OBSERVATIONS ) {
-        fprintf( stderr, "ERROR (src/create_data.c): i>=MAX_NUMBER_OF_OBSERVATIONS=%d\n", MAX_NUMBER_OF_OBSERVATIONS );
-        fclose( lightcurvefile );
-        return 1;
-       }
-      }
-     }
-    }
-    fclose( lightcurvefile );
-// fprintf(stderr,"DEBUG03\n"); // !!!
-// puts(ep->d_name);
-// continue; // !!!
+ lightcurve_filenames= list_lightcurve_files( &number_of_lightcurve_files );
+ if ( lightcurve_filenames != NULL ) {
+  stat= malloc( ( number_of_lightcurve_files + 1 ) * sizeof( struct Lightcurve_statistics ) );
+  if ( stat == NULL ) {
+   fprintf( stderr, "ERROR in create_data.c - cannot allocate memory\n" );
+   return 1;
+  }
 
-// defined in src/vast_limits.h
-#ifdef DROP_LIGHTCURVES_WITH_SMALL_NUMBER_OF_POINTS_FROM_ALL_PLOTS
-    // Skip the star if it has insufficient number of measurements
-    //                                                                                                                                                     0.5 is to correctly round off
-    if ( i < MIN( SOFT_MIN_NUMBER_OF_POINTS, (int)( MIN_FRACTION_OF_IMAGES_THE_STAR_SHOULD_APPEAR_IN * (double)number_of_measured_images_from_vast_summary_log + 0.5 ) ) || i < HARD_MIN_NUMBER_OF_POINTS ) {
-#ifdef DEBUGFILES
-     fprintf( stderr, "\rWill not compute variability indexes for %s as the lightcurve has only %5d points. ", ep->d_name, i );
+  // The lightcurves are independent, so process them in parallel.
+  // Each thread has its own scratch arrays, the results are stored in stat[]
+  // and written out below in the directory listing order, so the output does not depend on the number of threads.
+  fatal_error_in_statistics_computation= 0;
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel private( scratch, lightcurve_counter )
 #endif
-     continue;
-    }
-    // fprintf(stderr,"i=%d MIN()=%d SOFT_MIN_NUMBER_OF_POINTS=%d number_of_measured_images_from_vast_summary_log=%d\n",i,MIN(SOFT_MIN_NUMBER_OF_POINTS,(int)(0.5*number_of_measured_images_from_vast_summary_log)),SOFT_MIN_NUMBER_OF_POINTS,number_of_measured_images_from_vast_summary_log);
 #endif
-
-    // fprintf(stderr,"DEBUG03.5\n"); // !!!
-    // puts(ep->d_name);
-    // continue; // !!!
-
-    // Compute variability indexes: Stetson's indexes and the others that need time sorting of the input lightcurve
-    compute_variability_indexes_that_need_time_sorting( jday, m, merr, i, number_of_measured_images_from_vast_summary_log, &I, &J, &K, &L, &J_clip, &L_clip, &J_time, &L_time, &I_sign_only, &N3, &excursions, &eta, &E_A, &SB );
-
-    points_in_lightcurve= i;
-
-    // fprintf(stderr,"DEBUG04\n"); // !!!
-    // puts(ep->d_name);
-    // continue; // !!!
-
-    //////////////////////// Indexes that do not depend on sorting ////////////////////////
-    // compute weights
-    // for(j=0;j<i;j++){w[j]=1.0;} // NO WEIGHTS
-    // for(j=0;j<i;j++){w[j]=1.0/merr[j];}  // NOTE THE UNUSUAL WEIGHTS!!!
-    for ( j= 0; j < i; j++ ) {
-     w[j]= 1.0 / ( merr[j] * merr[j] );
-    } // THE USUAL WEIGHTS
-
-    weighted_sigma= skewness= kurtosis= 0.0; // set default values
-
-#ifndef DISABLE_INDEX_WEIGHTED_SIGMA
-    m_mean= gsl_stats_wmean( w, 1, m, 1, i );                 // weighted mean mag.
-    weighted_sigma= gsl_stats_wsd_m( w, 1, m, 1, i, m_mean ); // weighted SD
-#ifndef DISABLE_INDEX_SKEWNESS
-    skewness= gsl_stats_wskew_m_sd( w, 1, m, 1, i, m_mean, weighted_sigma ); // weighted skewness
+  {
+   if ( 0 != allocate_lightcurve_statistics_scratch( &scratch, number_of_measured_images_from_vast_summary_log ) ) {
+    exit( EXIT_FAILURE );
+   }
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp for schedule( dynamic, 16 )
 #endif
-#ifndef DISABLE_INDEX_KURTOSIS
-    kurtosis= gsl_stats_wkurtosis_m_sd( w, 1, m, 1, i, m_mean, weighted_sigma ); // weighted kurtosis
 #endif
+   for ( lightcurve_counter= 0; lightcurve_counter < number_of_lightcurve_files; lightcurve_counter++ ) {
+    if ( 0 != compute_lightcurve_statistics( lightcurve_filenames[lightcurve_counter], number_of_measured_images_from_vast_summary_log, &scratch, &stat[lightcurve_counter] ) ) {
+     stat[lightcurve_counter].is_good= 0;
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp atomic write
 #endif
-
-    // Robust Median Statistic, RoMS
-    RoMS= compute_RoMS( m, merr, i );
-
-    // fprintf(stderr,"DEBUG05\n"); // !!!
-    //  reduced chi2
-    reduced_chi2= 0.0; // This is in case chi2 computation is disabled at compile time.
-// If needed, we disable chi2 computation here rather than in src/variability_indexes.c
-// since compute_reduced_chi2() may be used as an auxiliary function
-// elsewhere in the code.
-#ifndef DISABLE_INDEX_REDUCED_CHI2
-    reduced_chi2= compute_reduced_chi2( m, merr, i );
 #endif
+     fatal_error_in_statistics_computation= 1;
+    }
+   }
+   free_lightcurve_statistics_scratch( &scratch );
+  }
 
-    // Peak-to-peak AGN-style variability index
-    peak_to_peak_AGN_v= compute_peak_to_peak_AGN_v( m, merr, i );
-
-    /// This thing has to be sorted in time!!!!
-    lag1_autocorrelation= lag1_autocorrelation_of_unsorted_lightcurve( jday, m, i );
-
-    // fprintf(stderr,"DEBUG05\n"); // !!!
-
-    MAD_scaled_to_sigma= 0.0; // This is in case MAD computation is disabled at compile time.
-// If needed, we disable MAD computation here rather than in src/variability_indexes.c
-// since esimate_sigma_from_MAD_of_unsorted_data() may be used as an auxiliary function
-// elsewhere in the code.
-#ifndef DISABLE_INDEX_MAD
-                              // Estimate sigma from MAD, the input array doesn't need to be sorted in magnitude
-    MAD_scaled_to_sigma= esimate_sigma_from_MAD_of_unsorted_data( m, i );
-#endif
+  if ( fatal_error_in_statistics_computation != 0 ) {
+   return 1;
+  }
 
-    // Compute normalized excess variance (NXS)
-    NXS= Normalized_excess_variance( m, merr, i );
-
-    // Compute IQR
-    IQR= estimate_sigma_from_IQR_of_unsorted_data( m, i ); // compute_IQR_of_unsorted_data(m, i);
-
-    //////////////////////// end of indexes that do not depend on sorting ////////////////////////
-
-    // fprintf(stderr,"DEBUG06\n"); // !!!
-
-    ////////////////////////////// Computations below are needed for backward compatibility with the old way VaST was operating
-
-    //-----------------------------------------------------------------------------------
-    // Warning! After that point jday[i]-m[i]-merr[i] match is destroyed!
-    // We keep only m[i]-merr[i] match by using gsl_sort2() instead of gsl_sort()
-    gsl_sort2( m, 1, merr, 1, i );
-    // let's compute median from the original (unfiltered lightcurve)
-    // m_median=gsl_stats_median_from_sorted_data(m,1,i);
-
-    // LIGHTCURVE FILTERING BELOW!!!!!
-    /// Drop points
-    // if( i>STAT_MIN_NUMBER_OF_POINTS_FOR_NDROP && i>2*n_points_to_drop ){
-    if ( i >= STAT_MIN_NUMBER_OF_POINTS_FOR_NDROP ) {
-     //
-     n_points_to_drop= MIN( (int)( 0.05 * i ), STAT_NDROP );
-     //
-     i-= n_points_to_drop;
-     for ( j= 0; j < i; j++ ) {
-      m[j]= m[j + n_points_to_drop];
-      merr[j]= merr[j + n_points_to_drop];
-     }
-     i-= n_points_to_drop;
-    }
+  ///// Done with computations, now write-out the results
+  for ( lightcurve_counter= 0; lightcurve_counter < number_of_lightcurve_files; lightcurve_counter++ ) {
+   if ( stat[lightcurve_counter].is_good == 0 )
+    continue;
+   // Write the results in the legacy file data.m_sigma
+   fprintf( legacy_data_file, "%10.6lf %8.6lf %9.3lf %9.3lf %s\n", stat[lightcurve_counter].m_median, stat[lightcurve_counter].sigma_series, stat[lightcurve_counter].x_ref, stat[lightcurve_counter].y_ref, lightcurve_filenames[lightcurve_counter] );
+
+   // Write the results in the new extended file vast_lightcurve_statistics.log
+   ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////   1           2      3    4         5         6              7        8     9  10 11 12   13                   14                   15                 16       17         18          19                20          21     22     23    24    25    26       27 28  29
+   ///////////////////////////  Medag   STD     X       Y     lc  wSTD    skew     kurt      I        J        K        L       Npts  MAD     lag1     RoMS    rCh2    Isgn     Vp2p     Jclp     Lclp     Jtim     Ltim      N3        excr      eta     E_A      S_B       NXS   IQR
+   fprintf( extended_data_file, "%10.6lf %8.6lf %11.7lf %11.7lf %s  %6.6lf  %+12.6lf %+12.6lf  %+12.6lf %+12.6lf %+12.6lf %+12.6lf %5d %12.6lf %+12.6lf  %12.6lf %12.6lf %+12.6lf %12.6lf  %+12.6lf %+12.6lf %+12.6lf %+12.6lf  %+12.6lf  %+12.6lf  %12.6lf %+12.6lf %+12.6lf  %12lg  %12.6lf\n", stat[lightcurve_counter].m_median, stat[lightcurve_counter].sigma_series, stat[lightcurve_counter].x_ref, stat[lightcurve_counter].y_ref, lightcurve_filenames[lightcurve_counter], stat[lightcurve_counter].weighted_sigma, stat[lightcurve_counter].skewness, stat[lightcurve_counter].kurtosis, stat[lightcurve_counter].I, stat[lightcurve_counter].J, stat[lightcurve_counter].K, stat[lightcurve_counter].L, stat[lightcurve_counter].points_in_lightcurve, stat[lightcurve_counter].MAD_scaled_to_sigma, stat[lightcurve_counter].lag1_autocorrelation, stat[lightcurve_counter].RoMS, stat[lightcurve_counter].reduced_chi2, stat[lightcurve_counter].I_sign_only, stat[lightcurve_counter].peak_to_peak_AGN_v, stat[lightcurve_counter].J_clip, stat[lightcurve_counter].L_clip, stat[lightcurve_counter].J_time, stat[lightcurve_counter].L_time, stat[lightcurve_counter].N3, stat[lightcurve_counter].excursions, stat[lightcurve_counter].eta, stat[lightcurve_counter].E_A, stat[lightcurve_counter].SB, stat[lightcurve_counter].NXS, stat[lightcurve_counter].IQR );
+
+   star_counter_for_display++;
+   if ( star_counter_for_display % 100 == 0 )
+    fprintf( stderr, "." );
+  }
 
-    //// Computations for the classical mag-sigma plot ////
-    // note that the median and sigma here are calculated over the filtered lightcurve
-    m_median= gsl_stats_median_from_sorted_data( m, 1, i );
-    sigma_series= gsl_stats_sd( m, 1, i );
-
-    // fprintf(stderr,"DEBUG07\n"); // !!!
-
-    ///// Filter-out bad stars - if even the simple statistics canot be computed - we don't want this star to be written in the stat. files
-    // This is the replacement of the old external filter
-    if ( 0 == vast_isnormal( m_median ) )
-     continue;
-    // Changec check here
-    if ( m_median < BRIGHTEST_STARS )
-     continue;
-    if ( m_median > FAINTEST_STARS_ANYMAG )
-     continue;
-    // And this seems to be very dangerous
-    // if( sigma_series>MAX_MAG_ERROR )continue;
-    // No upper limit on the mag scatter - some objects may be vary by *a lot*!
-    //
-    if ( sigma_series == 0.0 || 0 == vast_isnormal( sigma_series ) )
-     continue;
-
-    ///// Done with computations, now write-out the results
-
-    // Write the results in the legacy file data.m_sigma
-    fprintf( legacy_data_file, "%10.6lf %8.6lf %9.3lf %9.3lf %s\n", m_median, sigma_series, x_ref, y_ref, ep->d_name );
-
-    // Write the results in the new extended file vast_lightcurve_statistics.log
-    ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////   1           2      3    4         5         6              7        8     9  10 11 12   13                   14                   15                 16       17         18          19                20          21     22     23    24    25    26       27 28  29
-    // fprintf(extended_data_file,"%10.6lf %8.6lf %9.3lf %9.3lf %s  %6.6lf  %+12.6lf %+12.6lf  %+12.6lf %+12.6lf %+12.6lf %+12.6lf %5d %12.6lf %+12.6lf  %12.6lf %12.6lf %+12.6lf %12.6lf  %+12.6lf %+12.6lf %+12.6lf %+12.6lf  %+12.6lf  %+12.6lf  %+12.6lf %+12.6lf %+12.6lf  %+lg  %+12.6lf\n",m_median,sigma_series,x_ref,y_ref,ep->d_name, weighted_sigma,skewness,kurtosis,I, J, K, L, points_in_lightcurve,MAD_scaled_to_sigma,lag1_autocorrelation,RoMS,reduced_chi2,I_sign_only,peak_to_peak_AGN_v,J_clip,L_clip,J_time,L_time,N3,excursions,eta,E_A,SB,NXS,IQR);
-    ///////////////////////////  Medag   STD     X       Y     lc  wSTD    skew     kurt      I        J        K        L       Npts  MAD     lag1     RoMS    rCh2    Isgn     Vp2p     Jclp     Lclp     Jtim     Ltim      N3        excr      eta     E_A      S_B       NXS   IQR
-    fprintf( extended_data_file, "%10.6lf %8.6lf %11.7lf %11.7lf %s  %6.6lf  %+12.6lf %+12.6lf  %+12.6lf %+12.6lf %+12.6lf %+12.6lf %5d %12.6lf %+12.6lf  %12.6lf %12.6lf %+12.6lf %12.6lf  %+12.6lf %+12.6lf %+12.6lf %+12.6lf  %+12.6lf  %+12.6lf  %12.6lf %+12.6lf %+12.6lf  %12lg  %12.6lf\n", m_median, sigma_series, x_ref, y_ref, ep->d_name, weighted_sigma, skewness, kurtosis, I, J, K, L, points_in_lightcurve, MAD_scaled_to_sigma, lag1_autocorrelation, RoMS, reduced_chi2, I_sign_only, peak_to_peak_AGN_v, J_clip, L_clip, J_time, L_time, N3, excursions, eta, E_A, SB, NXS, IQR );
-
-    // fprintf(stderr,"DEBUG08\n"); // !!!
-
-    star_counter_for_display++;
-    if ( star_counter_for_display % 100 == 0 )
-     fprintf( stderr, "." );
-
-    // fprintf(stderr,"DEBUG09\n"); // !!!
-   }
+  for ( lightcurve_counter= 0; lightcurve_counter < number_of_lightcurve_files; lightcurve_counter++ ) {
+   free( lightcurve_filenames[lightcurve_counter] );
   }
-  (void)closedir( dp );
+  free( lightcurve_filenames );
+  free( stat );
+
   // And write the file describing the crazy format of vast_lightcurve_statistics.log
   write_vast_lightcurve_statistics_format_log();
- } else {
-  perror( "Couldn't open the directory" );
  }
 
  fprintf( stderr, "\n" ); // final end of line
 
- free( m );
- free( merr );
- free( w );
- free( jday );
-
  fclose( extended_data_file );
  fclose( legacy_data_file );
 
@@ -4,14 +4,23 @@
 //   forced_photometry image.fits center_x center_y aperture_diameter
 // Usage (list mode):
 //   forced_photometry image.fits --list listfile aperture_diameter
+// Usage (batch mode):
+//   forced_photometry --batch imagelist listfile aperture_diameter output_dir
 //
 // List file: one position per line "center_x center_y [label]".
 // Lines starting with '#' or '%' and blank lines are skipped.
 // If label is missing, the 1-based line index is used.
 //
+// Image list (batch mode): one image per line "image.fits JD [listfile [calib]]".
+// The optional per-image listfile gives the pixel positions of the same targets
+// on that image (convert RA/Dec with sky2xy); the optional calib overrides --calib.
+// Each image is read once and all targets are measured on it in parallel;
+// the detections are written to output_dir/out<label>.dat lightcurves.
+//
 // Reads calib.txt_param, bad_region.lst, and default.sex from current directory.
 // Output (single, stdout): cal_mag mag_err status
 // Output (list,   stdout): label center_x center_y cal_mag mag_err status
+// Output (batch,  stdout): label n_detections n_images lightcurve_file
 //
 // Ported Buie/DAOPHOT circle-rectangle overlap algorithm from
 // pixwt_circleaperture.py (D. Jones, based on IDL Astronomy Users Library).
@@ -32,6 +41,7 @@
 #include "vast_limits.h"
 #include "count_lines_in_ASCII_file.h"
 #include "quickselect.h"
+#include "lightcurve_io.h"
 
 // From exclude_region.c (linked as exclude_region.o)
 int read_bad_CCD_regions_lst( double *X1, double *Y1, double *X2, double *Y2, int *N );
@@ -214,6 +224,7 @@ static int read_calib_param( const char *calib_path,
 // string via the out parameters.  status_str_out must have >= 32 bytes.
 // Scratch buffers (annulus_vals, annulus_copy, abs_dev) must be sized for
 // the given aperture (n_annulus_alloc >= 4 * annulus_outer^2 + 100).
+// The diagnostic messages are printed to stderr only if verbose is non-zero.
 // ------------------------------------------------------------------
 static void photometry_at_position( const double *pix, long naxis1, long naxis2,
                                     double satur_level,
@@ -226,7 +237,8 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
                                     double *annulus_vals, double *annulus_copy, double *abs_dev,
                                     int n_annulus_alloc,
                                     double *cal_mag_out, double *mag_err_out,
-                                    char *status_str_out ) {
+                                    char *status_str_out,
+                                    int verbose ) {
 
  double aperture_radius, annulus_inner, annulus_outer;
  int ix, iy;
@@ -255,9 +267,9 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
  *cal_mag_out= 99.0;
  *mag_err_out= 99.0;
 
- fprintf( stderr, "Forced photometry: center=(%.2f, %.2f) aperture=%.1f\n",
-          center_x, center_y, aperture_diameter );
- fprintf( stderr, "Annulus: inner=%.2f outer=%.2f\n", annulus_inner, annulus_outer );
+ if ( verbose ) fprintf( stderr, "Forced photometry: center=(%.2f, %.2f) aperture=%.1f\n",
+                         center_x, center_y, aperture_diameter );
+ if ( verbose ) fprintf( stderr, "Annulus: inner=%.2f outer=%.2f\n", annulus_inner, annulus_outer );
 
  // ------------------------------------------------------------------
  // Edge check: entire annulus must fit within image
@@ -269,7 +281,7 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
   // not failures: they are reported with the status token the callers act
   // upon, and the stderr notes must not say 'ERROR' - the word would
   // propagate into processing logs that are scanned for real errors.
-  fprintf( stderr, "NOTE: aperture/annulus extends beyond image edge - skipping the measurement\n" );
+  if ( verbose ) fprintf( stderr, "NOTE: aperture/annulus extends beyond image edge - skipping the measurement\n" );
   strncpy( status_str_out, "edge", 31 );
   status_str_out[31]= '\0';
   return;
@@ -280,7 +292,7 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
  // ------------------------------------------------------------------
  if ( 0 != exclude_region( bad_X1, bad_Y1, bad_X2, bad_Y2, n_bad_regions,
                             center_x, center_y, aperture_diameter ) ) {
-  fprintf( stderr, "NOTE: position falls in a bad CCD region (bad_region.lst) - skipping the measurement\n" );
+  if ( verbose ) fprintf( stderr, "NOTE: position falls in a bad CCD region (bad_region.lst) - skipping the measurement\n" );
   strncpy( status_str_out, "bad_region", 31 );
   status_str_out[31]= '\0';
   return;
@@ -307,14 +319,14 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
    pix_idx= ( (long)iy - 1 ) * naxis1 + ( (long)ix - 1 );
    pix_val= pix[pix_idx];
    if ( isnan( pix_val ) || isinf( pix_val ) ) {
-    fprintf( stderr, "NOTE: NaN/Inf pixel at (%d, %d) within aperture - skipping the measurement\n", ix, iy );
+    if ( verbose ) fprintf( stderr, "NOTE: NaN/Inf pixel at (%d, %d) within aperture - skipping the measurement\n", ix, iy );
     strncpy( status_str_out, "nan_pixel", 31 );
     status_str_out[31]= '\0';
     return;
    }
    if ( pix_val >= satur_level ) {
-    fprintf( stderr, "NOTE: saturated pixel at (%d, %d) value=%.1f >= %.1f - skipping the measurement\n",
-             ix, iy, pix_val, satur_level );
+    if ( verbose ) fprintf( stderr, "NOTE: saturated pixel at (%d, %d) value=%.1f >= %.1f - skipping the measurement\n",
+                            ix, iy, pix_val, satur_level );
     strncpy( status_str_out, "saturated", 31 );
     status_str_out[31]= '\0';
     return;
@@ -349,7 +361,7 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
     continue;
    }
    if ( n_annulus >= n_annulus_alloc ) {
-    fprintf( stderr, "WARNING: annulus pixel buffer full at %d pixels\n", n_annulus );
+    if ( verbose ) fprintf( stderr, "WARNING: annulus pixel buffer full at %d pixels\n", n_annulus );
     break;
    }
    annulus_vals[n_annulus]= pix_val;
@@ -358,12 +370,12 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
  }
 
  if ( n_annulus < 5 ) {
-  fprintf( stderr, "NOTE: too few annulus pixels (%d) for background estimation - skipping the measurement\n", n_annulus );
+  if ( verbose ) fprintf( stderr, "NOTE: too few annulus pixels (%d) for background estimation - skipping the measurement\n", n_annulus );
   strncpy( status_str_out, "edge", 31 );
   status_str_out[31]= '\0';
   return;
  }
- fprintf( stderr, "Background annulus: %d pixels\n", n_annulus );
+ if ( verbose ) fprintf( stderr, "Background annulus: %d pixels\n", n_annulus );
 
 #ifdef USE_SEXTRACTOR_BACKGROUND
  // ------------------------------------------------------------------
@@ -406,8 +418,8 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
   }
 
   if ( n_clipped < (int)( 0.3 * (double)n_annulus ) ) {
-   fprintf( stderr, "WARNING: sigma clipping too aggressive at iter %d (%d/%d survived), stopping\n",
-            iter, n_clipped, n_annulus );
+   if ( verbose ) fprintf( stderr, "WARNING: sigma clipping too aggressive at iter %d (%d/%d survived), stopping\n",
+                           iter, n_clipped, n_annulus );
    memcpy( annulus_copy, annulus_vals, n_annulus * sizeof( double ) );
    n_clipped= n_annulus;
    break;
@@ -417,8 +429,8 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
    break;
   }
  }
- fprintf( stderr, "Iterative clipping converged after %d iterations, %d/%d pixels remain\n",
-          iter, n_clipped, n_annulus );
+ if ( verbose ) fprintf( stderr, "Iterative clipping converged after %d iterations, %d/%d pixels remain\n",
+                         iter, n_clipped, n_annulus );
 
  memcpy( abs_dev, annulus_copy, n_clipped * sizeof( double ) );
  clip_median= quickselect_median_double( abs_dev, n_clipped );
@@ -434,16 +446,16 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
  bg_mode= 2.5 * clip_median - 1.5 * clip_mean;
 
  if ( clip_sigma > 0.0 && fabs( bg_mode - clip_median ) / clip_sigma > 0.3 ) {
-  fprintf( stderr, "SExtractor bg: mode=%.2f disagrees with median=%.2f (>0.3*sigma=%.2f), using median\n",
-           bg_mode, clip_median, clip_sigma );
+  if ( verbose ) fprintf( stderr, "SExtractor bg: mode=%.2f disagrees with median=%.2f (>0.3*sigma=%.2f), using median\n",
+                          bg_mode, clip_median, clip_sigma );
   bg_per_pixel= clip_median;
  } else {
   bg_per_pixel= bg_mode;
  }
  sigma_bg= clip_sigma;
 
- fprintf( stderr, "SExtractor background: mode=%.2f median=%.2f mean=%.2f sigma=%.2f -> bg=%.2f (%d pixels)\n",
-          bg_mode, clip_median, clip_mean, clip_sigma, bg_per_pixel, n_clipped );
+ if ( verbose ) fprintf( stderr, "SExtractor background: mode=%.2f median=%.2f mean=%.2f sigma=%.2f -> bg=%.2f (%d pixels)\n",
+                         bg_mode, clip_median, clip_mean, clip_sigma, bg_per_pixel, n_clipped );
 
 #else
  // ------------------------------------------------------------------
@@ -458,8 +470,8 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
  }
  bg_mad= quickselect_median_double( abs_dev, n_annulus );
  sigma_mad= 1.4826 * bg_mad;
- fprintf( stderr, "Background before clipping: median=%.2f MAD=%.2f sigma_MAD=%.2f\n",
-          bg_median, bg_mad, sigma_mad );
+ if ( verbose ) fprintf( stderr, "Background before clipping: median=%.2f MAD=%.2f sigma_MAD=%.2f\n",
+                         bg_median, bg_mad, sigma_mad );
 
  n_clipped= 0;
  for ( i= 0; i < n_annulus; i++ ) {
@@ -470,8 +482,8 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
  }
 
  if ( n_clipped < (int)( 0.3 * (double)n_annulus ) ) {
-  fprintf( stderr, "WARNING: sigma clipping too aggressive (%d/%d survived), using all pixels\n",
-           n_clipped, n_annulus );
+  if ( verbose ) fprintf( stderr, "WARNING: sigma clipping too aggressive (%d/%d survived), using all pixels\n",
+                          n_clipped, n_annulus );
   memcpy( annulus_copy, annulus_vals, n_annulus * sizeof( double ) );
   n_clipped= n_annulus;
  }
@@ -484,8 +496,8 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
  }
  sigma_bg= 1.4826 * quickselect_median_double( abs_dev, n_clipped );
 
- fprintf( stderr, "Background after clipping: median=%.2f sigma=%.2f (%d pixels)\n",
-          bg_per_pixel, sigma_bg, n_clipped );
+ if ( verbose ) fprintf( stderr, "Background after clipping: median=%.2f sigma=%.2f (%d pixels)\n",
+                         bg_per_pixel, sigma_bg, n_clipped );
 #endif
 
  // ------------------------------------------------------------------
@@ -514,7 +526,7 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
   }
  }
 
- fprintf( stderr, "Aperture sum=%.2f N_eff=%.4f\n", sum_aperture, n_eff );
+ if ( verbose ) fprintf( stderr, "Aperture sum=%.2f N_eff=%.4f\n", sum_aperture, n_eff );
 
  // ------------------------------------------------------------------
  // Net flux and detection decision
@@ -522,8 +534,8 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
  net_flux= sum_aperture - bg_per_pixel * n_eff;
  noise= sigma_bg * sqrt( n_eff );
 
- fprintf( stderr, "Net flux=%.2f noise=%.2f SNR=%.2f\n",
-          net_flux, noise, ( noise > 0.0 ) ? net_flux / noise : 0.0 );
+ if ( verbose ) fprintf( stderr, "Net flux=%.2f noise=%.2f SNR=%.2f\n",
+                         net_flux, noise, ( noise > 0.0 ) ? net_flux / noise : 0.0 );
 
  if ( net_flux > 3.0 * noise ) {
   inst_mag= -2.5 * log10( net_flux );
@@ -548,15 +560,466 @@ static void photometry_at_position( const double *pix, long naxis1, long naxis2,
  }
  status_str_out[31]= '\0';
 
- fprintf( stderr, "Instrumental magnitude: %.4f\n", inst_mag );
+ if ( verbose ) fprintf( stderr, "Instrumental magnitude: %.4f\n", inst_mag );
 
  cal_mag= calib_p2 * inst_mag * inst_mag + calib_p1 * inst_mag + calib_p0;
- fprintf( stderr, "Calibrated magnitude: %.4f\n", cal_mag );
+ if ( verbose ) fprintf( stderr, "Calibrated magnitude: %.4f\n", cal_mag );
 
  *cal_mag_out= cal_mag;
  *mag_err_out= mag_err;
 }
 
+// ------------------------------------------------------------------
+// Batch mode: many images x many targets
+// ------------------------------------------------------------------
+
+// Status codes stored in the batch result table (index into the name list)
+#define FORCED_PHOTOMETRY_N_STATUS 8
+static const char *forced_photometry_status_names[FORCED_PHOTOMETRY_N_STATUS]= {
+    "edge", "bad_region", "nan_pixel", "saturated", "detection", "upperlimit", "calib_fail", "image_fail" };
+#define FORCED_PHOTOMETRY_STATUS_DETECTION 4
+#define FORCED_PHOTOMETRY_STATUS_CALIB_FAIL 6
+#define FORCED_PHOTOMETRY_STATUS_IMAGE_FAIL 7
+
+struct Forced_photometry_target {
+ double x;
+ double y;
+ char label[64];
+};
+
+struct Forced_photometry_image {
+ char filename[FILENAME_LENGTH];
+ double jd;
+ char targets_filename[FILENAME_LENGTH]; // empty string = use the common target list
+ char calib_filename[FILENAME_LENGTH];   // empty string = use the common calibration
+};
+
+// One (target, image) measurement; kept compact as the table is Ntargets x Nimages
+struct Forced_photometry_result {
+ float mag;
+ float mag_err;
+ float x;
+ float y;
+ unsigned char status;
+};
+
+static unsigned char forced_photometry_status_code( const char *status_str ) {
+ unsigned char i;
+ for ( i= 0; i < FORCED_PHOTOMETRY_N_STATUS; i++ ) {
+  if ( 0 == strcmp( status_str, forced_photometry_status_names[i] ) ) {
+   return i;
+  }
+ }
+ return FORCED_PHOTOMETRY_STATUS_IMAGE_FAIL;
+}
+
+// Read a target list in the list-mode format "center_x center_y [label]".
+// Returns the number of targets (the array is allocated here) or -1 on error.
+static int read_forced_photometry_target_list( const char *filename, struct Forced_photometry_target **targets_out ) {
+ FILE *listf;
+ char line_buf[4096];
+ char *p;
+ int line_idx, nfields, n_targets, n_alloc;
+ struct Forced_photometry_target *targets;
+
+ *targets_out= NULL;
+ listf= fopen( filename, "r" );
+ if ( listf == NULL ) {
+  fprintf( stderr, "ERROR: cannot open target list %s\n", filename );
+  return -1;
+ }
+ n_alloc= 1 + count_lines_in_ASCII_file( (char *)filename );
+ targets= (struct Forced_photometry_target *)malloc( n_alloc * sizeof( struct Forced_photometry_target ) );
+ if ( targets == NULL ) {
+  fprintf( stderr, "ERROR: cannot allocate memory for the target list\n" );
+  fclose( listf );
+  return -1;
+ }
+ n_targets= 0;
+ line_idx= 0;
+ while ( fgets( line_buf, sizeof( line_buf ), listf ) != NULL && n_targets < n_alloc ) {
+  line_idx++;
+  p= line_buf;
+  while ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ) {
+   p++;
+  }
+  if ( *p == '\0' || *p == '#' || *p == '%' ) {
+   continue;
+  }
+  nfields= sscanf( p, "%lf %lf %63s", &targets[n_targets].x, &targets[n_targets].y, targets[n_targets].label );
+  if ( nfields < 2 ) {
+   fprintf( stderr, "WARNING: %s line %d: could not parse center_x center_y: %s",
+            filename, line_idx, line_buf );
+   continue;
+  }
+  if ( nfields < 3 ) {
+   snprintf( targets[n_targets].label, sizeof( targets[n_targets].label ), "%d", line_idx );
+  }
+  n_targets++;
+ }
+ fclose( listf );
+ *targets_out= targets;
+ return n_targets;
+}
+
+// Read the image list "image.fits JD [targets_file [calib_file]]".
+// A per-image targets file lists the same targets in the same order as the
+// common target list, with the pixel positions on that particular image
+// (e.g. produced by sky2xy from the RA/Dec list); '-' means "not given".
+// Returns the number of images (the array is allocated here) or -1 on error.
+static int read_forced_photometry_image_list( const char *filename, struct Forced_photometry_image **images_out ) {
+ FILE *listf;
+ char line_buf[4096];
+ char *p;
+ int line_idx, nfields, n_images, n_alloc;
+ struct Forced_photometry_image *images;
+
+ *images_out= NULL;
+ listf= fopen( filename, "r" );
+ if ( listf == NULL ) {
+  fprintf( stderr, "ERROR: cannot open image list %s\n", filename );
+  return -1;
+ }
+ n_alloc= 1 + count_lines_in_ASCII_file( (char *)filename );
+ images= (struct Forced_photometry_image *)malloc( n_alloc * sizeof( struct Forced_photometry_image ) );
+ if ( images == NULL ) {
+  fprintf( stderr, "ERROR: cannot allocate memory for the image list\n" );
+  fclose( listf );
+  return -1;
+ }
+ n_images= 0;
+ line_idx= 0;
+ while ( fgets( line_buf, sizeof( line_buf ), listf ) != NULL && n_images < n_alloc ) {
+  line_idx++;
+  p= line_buf;
+  while ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ) {
+   p++;
+  }
+  if ( *p == '\0' || *p == '#' || *p == '%' ) {
+   continue;
+  }
+  images[n_images].targets_filename[0]= '\0';
+  images[n_images].calib_filename[0]= '\0';
+  nfields= sscanf( p, "%1023s %lf %1023s %1023s", images[n_images].filename, &images[n_images].jd,
+                   images[n_images].targets_filename, images[n_images].calib_filename );
+  if ( nfields < 2 ) {
+   fprintf( stderr, "WARNING: %s line %d: could not parse image.fits JD: %s",
+            filename, line_idx, line_buf );
+   continue;
+  }
+  if ( 0 == strcmp( images[n_images].targets_filename, "-" ) ) {
+   images[n_images].targets_filename[0]= '\0';
+  }
+  if ( 0 == strcmp( images[n_images].calib_filename, "-" ) ) {
+   images[n_images].calib_filename[0]= '\0';
+  }
+  n_images++;
+ }
+ fclose( listf );
+ *images_out= images;
+ return n_images;
+}
+
+// Read all pixels of a 2D FITS image as double. The pixel buffer is reused
+// (and grown if needed) between calls; *pix_alloc holds its current size.
+// Returns 0 on success, 1 on failure.
+static int read_fits_image_pixels( const char *fitsfilename, double **pix, long *pix_alloc, long *naxis1, long *naxis2 ) {
+ fitsfile *fptr;
+ int fits_status;
+ int naxis;
+ long naxes[2];
+ long totpix;
+ double nullval;
+ int anynul;
+ double *new_pix;
+
+ fits_status= 0;
+ fits_open_image( &fptr, fitsfilename, READONLY, &fits_status );
+ if ( fits_status != 0 ) {
+  fprintf( stderr, "ERROR: cannot open FITS image %s\n", fitsfilename );
+  fits_report_error( stderr, fits_status );
+  return 1;
+ }
+ fits_get_img_dim( fptr, &naxis, &fits_status );
+ if ( fits_status != 0 || naxis != 2 ) {
+  fprintf( stderr, "ERROR: expected a 2D FITS image %s, got naxis=%d\n", fitsfilename, naxis );
+  fits_status= 0;
+  fits_close_file( fptr, &fits_status );
+  return 1;
+ }
+ fits_get_img_size( fptr, 2, naxes, &fits_status );
+ if ( fits_status != 0 ) {
+  fprintf( stderr, "ERROR: cannot get image size of %s\n", fitsfilename );
+  fits_status= 0;
+  fits_close_file( fptr, &fits_status );
+  return 1;
+ }
+ totpix= naxes[0] * naxes[1];
+ if ( totpix > *pix_alloc ) {
+  new_pix= (double *)realloc( *pix, totpix * sizeof( double ) );
+  if ( new_pix == NULL ) {
+   fprintf( stderr, "ERROR: cannot allocate memory for %ld pixels\n", totpix );
+   fits_close_file( fptr, &fits_status );
+   return 1;
+  }
+  *pix= new_pix;
+  *pix_alloc= totpix;
+ }
+ nullval= 0.0;
+ anynul= 0;
+ fits_read_img( fptr, TDOUBLE, 1, totpix, &nullval, *pix, &anynul, &fits_status );
+ if ( fits_status != 0 ) {
+  fprintf( stderr, "ERROR: cannot read image pixels of %s\n", fitsfilename );
+  fits_report_error( stderr, fits_status );
+  fits_status= 0;
+  fits_close_file( fptr, &fits_status );
+  return 1;
+ }
+ fits_close_file( fptr, &fits_status );
+ *naxis1= naxes[0];
+ *naxis2= naxes[1];
+ return 0;
+}
+
+// Measure every target on every image and write one lightcurve per target
+// (output_dir/out<label>.dat, detections only) in the standard VaST format.
+// Each image is read once; the targets on it are measured in parallel.
+// The calibration is read once per distinct calibration file; the images
+// without their own calibration file use --calib (default calib.txt_param).
+// stdout: label n_detections n_images lightcurve_file
+static int batch_forced_photometry( const char *image_list_filename, const char *target_list_filename,
+                                    double aperture_diameter, const char *output_dir,
+                                    const char *common_calib_filename ) {
+ struct Forced_photometry_image *images;
+ struct Forced_photometry_target *targets;
+ struct Forced_photometry_target *image_targets;
+ struct Forced_photometry_result *results;
+ int n_images, n_targets, n_image_targets;
+ int image_counter, target_counter;
+ int n_detections;
+
+ double *pix;
+ long pix_alloc, naxis1, naxis2;
+
+ double *bad_X1, *bad_Y1, *bad_X2, *bad_Y2;
+ int n_bad_regions, max_bad_regions;
+ double satur_level;
+
+ int common_calib_ok;
+ double common_p3, common_p2, common_p1, common_p0;
+ double calib_p3, calib_p2, calib_p1, calib_p0;
+ int image_calib_ok;
+
+ double annulus_outer;
+ int n_annulus_alloc;
+ int alloc_error;
+
+ char lightcurve_filename[FILENAME_LENGTH + OUTFILENAME_LENGTH];
+ FILE *lightcurvefile;
+ struct Forced_photometry_result *r;
+
+ n_targets= read_forced_photometry_target_list( target_list_filename, &targets );
+ if ( n_targets <= 0 ) {
+  fprintf( stderr, "ERROR: no targets in %s\n", target_list_filename );
+  free( targets );
+  return 1;
+ }
+ n_images= read_forced_photometry_image_list( image_list_filename, &images );
+ if ( n_images <= 0 ) {
+  fprintf( stderr, "ERROR: no images in %s\n", image_list_filename );
+  free( targets );
+  free( images );
+  return 1;
+ }
+ fprintf( stderr, "Forced photometry (batch mode): %d images x %d targets, aperture=%.1f\n",
+          n_images, n_targets, aperture_diameter );
+
+ results= (struct Forced_photometry_result *)malloc( (size_t)n_targets * (size_t)n_images * sizeof( struct Forced_photometry_result ) );
+ image_targets= (struct Forced_photometry_target *)malloc( n_targets * sizeof( struct Forced_photometry_target ) );
+ if ( results == NULL || image_targets == NULL ) {
+  fprintf( stderr, "ERROR: cannot allocate memory for %d x %d results\n", n_targets, n_images );
+  free( results );
+  free( image_targets );
+  free( targets );
+  free( images );
+  return 1;
+ }
+
+ // Everything that does not depend on the image is read only once
+ max_bad_regions= 1 + count_lines_in_ASCII_file( "bad_region.lst" );
+ bad_X1= (double *)malloc( max_bad_regions * sizeof( double ) );
+ bad_Y1= (double *)malloc( max_bad_regions * sizeof( double ) );
+ bad_X2= (double *)malloc( max_bad_regions * sizeof( double ) );
+ bad_Y2= (double *)malloc( max_bad_regions * sizeof( double ) );
+ if ( bad_X1 == NULL || bad_Y1 == NULL || bad_X2 == NULL || bad_Y2 == NULL ) {
+  fprintf( stderr, "ERROR: cannot allocate memory for bad region arrays\n" );
+  exit( EXIT_FAILURE );
+ }
+ n_bad_regions= 0;
+ read_bad_CCD_regions_lst( bad_X1, bad_Y1, bad_X2, bad_Y2, &n_bad_regions );
+
+ satur_level= read_satur_level_from_default_sex();
+ fprintf( stderr, "Saturation level: %.1f\n", satur_level );
+
+ // The common calibration (--calib or calib.txt_param, as in the single and list modes)
+ // is needed only if some of the images have no calibration file of their own
+ common_p3= common_p2= common_p1= common_p0= 0.0;
+ common_calib_ok= 1;
+ for ( image_counter= 0; image_counter < n_images; image_counter++ ) {
+  if ( images[image_counter].calib_filename[0] == '\0' ) {
+   if ( 0 != read_calib_param( common_calib_filename, &common_p3, &common_p2, &common_p1, &common_p0 ) ) {
+    common_calib_ok= 0;
+   }
+   break;
+  }
+ }
+ (void)common_p3;
+
+ annulus_outer= 10.0 * aperture_diameter / 2.0;
+ n_annulus_alloc= (int)( 4.0 * annulus_outer * annulus_outer ) + 100;
+
+ pix= NULL;
+ pix_alloc= 0;
+ alloc_error= 0;
+ for ( image_counter= 0; image_counter < n_images; image_counter++ ) {
+  // Target positions on this image
+  if ( images[image_counter].targets_filename[0] != '\0' ) {
+   free( image_targets );
+   n_image_targets= read_forced_photometry_target_list( images[image_counter].targets_filename, &image_targets );
+   if ( n_image_targets != n_targets ) {
+    fprintf( stderr, "ERROR: %s lists %d targets while %s lists %d, skipping image %s\n",
+             images[image_counter].targets_filename, n_image_targets, target_list_filename, n_targets,
+             images[image_counter].filename );
+    free( image_targets );
+    image_targets= (struct Forced_photometry_target *)malloc( n_targets * sizeof( struct Forced_photometry_target ) );
+    if ( image_targets == NULL ) {
+     fprintf( stderr, "ERROR: cannot allocate memory for the target list\n" );
+     exit( EXIT_FAILURE );
+    }
+    for ( target_counter= 0; target_counter < n_targets; target_counter++ ) {
+     results[(size_t)target_counter * n_images + image_counter].status= FORCED_PHOTOMETRY_STATUS_IMAGE_FAIL;
+    }
+    continue;
+   }
+  } else {
+   memcpy( image_targets, targets, n_targets * sizeof( struct Forced_photometry_target ) );
+  }
+
+  // Calibration for this image
+  image_calib_ok= common_calib_ok;
+  calib_p2= common_p2;
+  calib_p1= common_p1;
+  calib_p0= common_p0;
+  if ( images[image_counter].calib_filename[0] != '\0' ) {
+   image_calib_ok= ( 0 == read_calib_param( images[image_counter].calib_filename, &calib_p3, &calib_p2, &calib_p1, &calib_p0 ) );
+  }
+  if ( image_calib_ok == 0 ) {
+   for ( target_counter= 0; target_counter < n_targets; target_counter++ ) {
+    results[(size_t)target_counter * n_images + image_counter].status= FORCED_PHOTOMETRY_STATUS_CALIB_FAIL;
+   }
+   continue;
+  }
+
+  if ( 0 != read_fits_image_pixels( images[image_counter].filename, &pix, &pix_alloc, &naxis1, &naxis2 ) ) {
+   for ( target_counter= 0; target_counter < n_targets; target_counter++ ) {
+    results[(size_t)target_counter * n_images + image_counter].status= FORCED_PHOTOMETRY_STATUS_IMAGE_FAIL;
+   }
+   continue;
+  }
+  fprintf( stderr, "Image %d/%d: %s (%ld x %ld)\n", image_counter + 1, n_images, images[image_counter].filename, naxis1, naxis2 );
+
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel private( target_counter, r )
+#endif
+#endif
+  {
+   double *annulus_vals, *annulus_copy, *abs_dev;
+   double cal_mag, mag_err;
+   char status_str[32];
+
+   annulus_vals= (double *)malloc( n_annulus_alloc * sizeof( double ) );
+   annulus_copy= (double *)malloc( n_annulus_alloc * sizeof( double ) );
+   abs_dev= (double *)malloc( n_annulus_alloc * sizeof( double ) );
+   if ( annulus_vals == NULL || annulus_copy == NULL || abs_dev == NULL ) {
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+#endif
+    alloc_error= 1;
+   } else {
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp for schedule( dynamic, 16 )
+#endif
+#endif
+    for ( target_counter= 0; target_counter < n_targets; target_counter++ ) {
+     photometry_at_position( pix, naxis1, naxis2,
+                             satur_level,
+                             bad_X1, bad_Y1, bad_X2, bad_Y2, n_bad_regions,
+                             calib_p2, calib_p1, calib_p0,
+                             image_targets[target_counter].x, image_targets[target_counter].y,
+                             aperture_diameter,
+                             annulus_vals, annulus_copy, abs_dev, n_annulus_alloc,
+                             &cal_mag, &mag_err, status_str, 0 );
+     r= &results[(size_t)target_counter * n_images + image_counter];
+     r->mag= (float)cal_mag;
+     r->mag_err= (float)mag_err;
+     r->x= (float)image_targets[target_counter].x;
+     r->y= (float)image_targets[target_counter].y;
+     r->status= forced_photometry_status_code( status_str );
+    }
+   }
+   free( annulus_vals );
+   free( annulus_copy );
+   free( abs_dev );
+  }
+  if ( alloc_error != 0 ) {
+   fprintf( stderr, "ERROR: cannot allocate annulus scratch buffers\n" );
+   exit( EXIT_FAILURE );
+  }
+ }
+
+ free( pix );
+ free( bad_X1 );
+ free( bad_Y1 );
+ free( bad_X2 );
+ free( bad_Y2 );
+ free( image_targets );
+
+ // Write one lightcurve per target
+ for ( target_counter= 0; target_counter < n_targets; target_counter++ ) {
+  snprintf( lightcurve_filename, sizeof( lightcurve_filename ), "%s/out%s.dat", output_dir, targets[target_counter].label );
+  lightcurvefile= fopen( lightcurve_filename, "w" );
+  if ( lightcurvefile == NULL ) {
+   fprintf( stderr, "ERROR: cannot open %s for writing\n", lightcurve_filename );
+   free( results );
+   free( targets );
+   free( images );
+   return 1;
+  }
+  n_detections= 0;
+  for ( image_counter= 0; image_counter < n_images; image_counter++ ) {
+   r= &results[(size_t)target_counter * n_images + image_counter];
+   if ( r->status != FORCED_PHOTOMETRY_STATUS_DETECTION ) {
+    continue;
+   }
+   write_lightcurve_point( lightcurvefile, images[image_counter].jd, (double)r->mag, (double)r->mag_err,
+                           (double)r->x, (double)r->y, aperture_diameter, images[image_counter].filename, NULL );
+   n_detections++;
+  }
+  fclose( lightcurvefile );
+  fprintf( stdout, "%s %d %d %s\n", targets[target_counter].label, n_detections, n_images, lightcurve_filename );
+ }
+
+ free( results );
+ free( targets );
+ free( images );
+
+ return 0;
+}
+
 // ------------------------------------------------------------------
 // main
 // ------------------------------------------------------------------
@@ -610,6 +1073,30 @@ int main( int argc, char **argv ) {
  // Optional calibration-file path (NULL = default "calib.txt_param")
  const char *calib_filename;
 
+ // ------------------------------------------------------------------
+ // Batch mode has its own argument list
+ // ------------------------------------------------------------------
+ if ( argc >= 2 && 0 == strcmp( argv[1], "--batch" ) ) {
+  if ( argc != 6 && argc != 8 ) {
+   fprintf( stderr, "Usage: %s --batch imagelist listfile aperture_diameter output_dir [--calib PATH]\n", argv[0] );
+   return 1;
+  }
+  calib_filename= NULL;
+  if ( argc == 8 ) {
+   if ( 0 != strcmp( argv[6], "--calib" ) ) {
+    fprintf( stderr, "ERROR: extra trailing argument must be '--calib PATH' (got '%s %s')\n", argv[6], argv[7] );
+    return 1;
+   }
+   calib_filename= argv[7];
+  }
+  aperture_diameter= atof( argv[4] );
+  if ( aperture_diameter <= 0.0 ) {
+   fprintf( stderr, "ERROR: aperture_diameter must be positive\n" );
+   return 1;
+  }
+  return batch_forced_photometry( argv[2], argv[3], aperture_diameter, argv[5], calib_filename );
+ }
+
  // ------------------------------------------------------------------
  // Parse arguments
  // ------------------------------------------------------------------
@@ -617,9 +1104,11 @@ int main( int argc, char **argv ) {
   fprintf( stderr, "Usage:\n" );
   fprintf( stderr, "  %s image.fits center_x center_y aperture_diameter [--calib PATH]\n", argv[0] );
   fprintf( stderr, "  %s image.fits --list listfile aperture_diameter [--calib PATH]\n", argv[0] );
+  fprintf( stderr, "  %s --batch imagelist listfile aperture_diameter output_dir [--calib PATH]\n", argv[0] );
   fprintf( stderr, "  center_x, center_y: 1-based pixel coordinates (from sky2xy)\n" );
   fprintf( stderr, "  aperture_diameter: in pixels\n" );
   fprintf( stderr, "  listfile: one line per position \"center_x center_y [label]\"\n" );
+  fprintf( stderr, "  imagelist: one line per image \"image.fits JD [listfile [calib]]\"\n" );
   fprintf( stderr, "  --calib PATH: read calibration parameters from PATH instead of calib.txt_param\n" );
   return 1;
  }
@@ -813,7 +1302,7 @@ int main( int argc, char **argv ) {
                           center_x, center_y,
                           aperture_diameter,
                           annulus_vals, annulus_copy, abs_dev, n_annulus_alloc,
-                          &cal_mag, &mag_err, status_str );
+                          &cal_mag, &mag_err, status_str, 1 );
   fprintf( stdout, "%.4f %.4f %s\n", cal_mag, mag_err, status_str );
  } else {
   listf= fopen( list_filename, "r" );
@@ -855,7 +1344,7 @@ int main( int argc, char **argv ) {
                            center_x, center_y,
                            aperture_diameter,
                            annulus_vals, annulus_copy, abs_dev, n_annulus_alloc,
-                           &cal_mag, &mag_err, status_str );
+                           &cal_mag, &mag_err, status_str, 1 );
    fprintf( stdout, "%s %.4f %.4f %.4f %.4f %s\n",
             label, center_x, center_y, cal_mag, mag_err, status_str );
   }
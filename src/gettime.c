@@ -8,6 +8,10 @@
 #include <strings.h> // for strcasecmp()
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>   // for realpath()
+#include <unistd.h>   // for access(), write()
+#include <fcntl.h>    // for open()
+#include <sys/stat.h> // for stat()
 
 #include "fitsio.h"
 #include "vast_limits.h"
@@ -825,7 +829,8 @@ void parse_seconds_and_fraction( const char *Tm_s, char *Tm_s_full_seconds_only,
  }
 }
 
-int gettime( char *fitsfilename, double *JD, int *timesys, int convert_timesys_to_TT, double *dimX, double *dimY, char *stderr_output, char *log_output, int param_nojdkeyword, int param_verbose, char *finder_chart_timestring_output ) {
+// Read the image time and size from the FITS header (see gettime() below for the cached version)
+static int gettime_from_fits_header( char *fitsfilename, double *JD, int *timesys, int convert_timesys_to_TT, double *dimX, double *dimY, char *stderr_output, char *log_output, int param_nojdkeyword, int param_verbose, char *finder_chart_timestring_output ) {
 
  unsigned int counter_i;
 
@@ -2105,3 +2110,434 @@ int gettime( char *fitsfilename, double *JD, int *timesys, int convert_timesys_t
 #endif
  return 0;
 }
+
+// ------------------------------------------------------------------
+// FITS header (image time and size) cache
+//
+// The same image is passed to gettime() several times in one VaST run and
+// again by the follow-up tools and scripts. If the VAST_HEADER_CACHE_DIR
+// environment variable points to an existing directory, the results of
+// gettime() are stored in VAST_HEADER_CACHE_DIR/vast_header_cache.txt and
+// re-used as long as the image path, its modification time (with nanoseconds,
+// so a header edited in place within the same second is noticed) and size, the
+// lib/tai-utc.dat file and the time-conversion options (including the
+// time system passed in via *timesys) are unchanged.
+// New entries are appended to the cache file; when the file is loaded and more
+// than half of its lines are outdated entries, it is re-written without them.
+// The cache is not used if vast_list_of_input_images_with_time_corrections.txt
+// is present or if the image header is to be updated (param_verbose == 2).
+// Without VAST_HEADER_CACHE_DIR gettime() behaves exactly as before.
+// ------------------------------------------------------------------
+
+#define HEADER_CACHE_FILENAME "vast_header_cache.txt"
+#define HEADER_CACHE_STRING_LENGTH 1024 // the callers' stderr_output and log_output buffers are at least this long
+
+struct Header_cache_entry {
+ char *path;
+ long long mtime; // nanoseconds
+ long long size;
+ long long tai_utc_mtime; // nanoseconds
+ long long tai_utc_size;
+ int convert_timesys_to_TT;
+ int param_nojdkeyword;
+ int input_timesys; // *timesys on input: gettime() leaves it unchanged for some headers
+ double JD;
+ int timesys;
+ double dimX;
+ double dimY;
+ char *stderr_output;
+ char *log_output;
+ char *finder_chart_timestring_output;
+};
+
+static struct Header_cache_entry *header_cache= NULL;
+static size_t header_cache_n= 0;
+static size_t header_cache_alloc= 0;
+static size_t *header_cache_hash_table= NULL; // open addressing: entry index + 1, 0 = empty slot
+static size_t header_cache_hash_table_size= 0;
+static int header_cache_is_loaded= 0;
+static char header_cache_filename[VAST_PATH_MAX + 64];
+
+static size_t header_cache_hash( const char *path, int convert_timesys_to_TT, int param_nojdkeyword, int input_timesys ) {
+ size_t hash;
+ const unsigned char *c;
+ hash= 5381;
+ for ( c= (const unsigned char *)path; *c != '\0'; c++ ) {
+  hash= hash * 33 + ( *c );
+ }
+ hash= hash * 33 + (size_t)convert_timesys_to_TT;
+ hash= hash * 33 + (size_t)param_nojdkeyword;
+ hash= hash * 33 + (size_t)input_timesys;
+ return hash;
+}
+
+// Find the entry for this path and options; returns its index + 1 or 0 if there is none
+static size_t header_cache_find( const char *path, int convert_timesys_to_TT, int param_nojdkeyword, int input_timesys, size_t *slot_out ) {
+ size_t slot, entry_plus_one;
+ struct Header_cache_entry *entry;
+ slot= header_cache_hash( path, convert_timesys_to_TT, param_nojdkeyword, input_timesys ) % header_cache_hash_table_size;
+ while ( 0 != ( entry_plus_one= header_cache_hash_table[slot] ) ) {
+  entry= &header_cache[entry_plus_one - 1];
+  if ( entry->convert_timesys_to_TT == convert_timesys_to_TT && entry->param_nojdkeyword == param_nojdkeyword && entry->input_timesys == input_timesys && 0 == strcmp( entry->path, path ) ) {
+   break;
+  }
+  slot= ( slot + 1 ) % header_cache_hash_table_size;
+ }
+ *slot_out= slot;
+ return entry_plus_one;
+}
+
+// Add an entry to the in-memory cache; an older entry for the same path and options is replaced
+static void header_cache_insert( struct Header_cache_entry *new_entry ) {
+ size_t slot, entry_plus_one, i;
+ struct Header_cache_entry *entry;
+
+ // keep the hash table at most half full
+ if ( 2 * ( header_cache_n + 1 ) > header_cache_hash_table_size ) {
+  free( header_cache_hash_table );
+  header_cache_hash_table_size= MAX( 1024, 4 * ( header_cache_n + 1 ) );
+  header_cache_hash_table= (size_t *)calloc( header_cache_hash_table_size, sizeof( size_t ) );
+  if ( header_cache_hash_table == NULL ) {
+   fprintf( stderr, "ERROR: cannot allocate memory for the header cache hash table\n" );
+   exit( EXIT_FAILURE );
+  }
+  for ( i= 0; i < header_cache_n; i++ ) {
+   header_cache_find( header_cache[i].path, header_cache[i].convert_timesys_to_TT, header_cache[i].param_nojdkeyword, header_cache[i].input_timesys, &slot );
+   header_cache_hash_table[slot]= i + 1;
+  }
+ }
+
+ entry_plus_one= header_cache_find( new_entry->path, new_entry->convert_timesys_to_TT, new_entry->param_nojdkeyword, new_entry->input_timesys, &slot );
+ if ( entry_plus_one != 0 ) {
+  entry= &header_cache[entry_plus_one - 1];
+  free( entry->path );
+  free( entry->stderr_output );
+  free( entry->log_output );
+  free( entry->finder_chart_timestring_output );
+  ( *entry )= ( *new_entry );
+  return;
+ }
+
+ if ( header_cache_n == header_cache_alloc ) {
+  header_cache_alloc= MAX( 1024, 2 * header_cache_alloc );
+  entry= (struct Header_cache_entry *)realloc( header_cache, header_cache_alloc * sizeof( struct Header_cache_entry ) );
+  if ( entry == NULL ) {
+   fprintf( stderr, "ERROR: cannot allocate memory for the header cache\n" );
+   exit( EXIT_FAILURE );
+  }
+  header_cache= entry;
+ }
+ header_cache[header_cache_n]= ( *new_entry );
+ header_cache_hash_table[slot]= header_cache_n + 1;
+ header_cache_n++;
+}
+
+// Strings are stored with '\\', '\t' and '\n' escaped so that each entry is one tab-separated line
+static void header_cache_escape_string( const char *in, char *out, size_t out_size ) {
+ size_t j;
+ j= 0;
+ for ( ; *in != '\0' && j + 3 < out_size; in++ ) {
+  if ( *in == '\\' ) {
+   out[j++]= '\\';
+   out[j++]= '\\';
+  } else if ( *in == '\t' ) {
+   out[j++]= '\\';
+   out[j++]= 't';
+  } else if ( *in == '\n' ) {
+   out[j++]= '\\';
+   out[j++]= 'n';
+  } else {
+   out[j++]= *in;
+  }
+ }
+ out[j]= '\0';
+}
+
+static char *header_cache_unescape_string( const char *in ) {
+ char *out;
+ size_t j;
+ out= (char *)malloc( strlen( in ) + 1 );
+ if ( out == NULL ) {
+  fprintf( stderr, "ERROR: cannot allocate memory for the header cache\n" );
+  exit( EXIT_FAILURE );
+ }
+ j= 0;
+ for ( ; *in != '\0'; in++ ) {
+  if ( *in == '\\' && in[1] != '\0' ) {
+   in++;
+   if ( *in == 't' ) {
+    out[j++]= '\t';
+   } else if ( *in == 'n' ) {
+    out[j++]= '\n';
+   } else {
+    out[j++]= *in;
+   }
+  } else {
+   out[j++]= *in;
+  }
+ }
+ out[j]= '\0';
+ return out;
+}
+
+// Split a cache line into tab-separated fields (in place); returns the number of fields
+static int header_cache_split_line( char *line, char **fields, int max_fields ) {
+ int n;
+ char *c;
+ n= 0;
+ fields[n++]= line;
+ for ( c= line; *c != '\0'; c++ ) {
+  if ( *c == '\n' || *c == '\r' ) {
+   *c= '\0';
+   break;
+  }
+  if ( *c == '\t' ) {
+   *c= '\0';
+   if ( n == max_fields ) {
+    break;
+   }
+   fields[n++]= c + 1;
+  }
+ }
+ return n;
+}
+
+// File modification time in nanoseconds
+static long long header_cache_mtime_ns( struct stat *file_stat ) {
+#ifdef __APPLE__
+ return (long long)file_stat->st_mtimespec.tv_sec * 1000000000LL + (long long)file_stat->st_mtimespec.tv_nsec;
+#else
+ return (long long)file_stat->st_mtim.tv_sec * 1000000000LL + (long long)file_stat->st_mtim.tv_nsec;
+#endif
+}
+
+// Format one cache file line (terminated by '\n')
+static void header_cache_format_line( struct Header_cache_entry *entry, char *line, size_t line_size ) {
+ char escaped_path[2 * VAST_PATH_MAX];
+ char escaped_stderr_output[2 * HEADER_CACHE_STRING_LENGTH];
+ char escaped_log_output[2 * HEADER_CACHE_STRING_LENGTH];
+ char escaped_finder_chart_timestring_output[2 * HEADER_CACHE_STRING_LENGTH];
+
+ header_cache_escape_string( entry->path, escaped_path, sizeof( escaped_path ) );
+ header_cache_escape_string( entry->stderr_output, escaped_stderr_output, sizeof( escaped_stderr_output ) );
+ header_cache_escape_string( entry->log_output, escaped_log_output, sizeof( escaped_log_output ) );
+ header_cache_escape_string( entry->finder_chart_timestring_output, escaped_finder_chart_timestring_output, sizeof( escaped_finder_chart_timestring_output ) );
+ snprintf( line, line_size, "%s\t%lld\t%lld\t%lld\t%lld\t%d\t%d\t%d\t%.17g\t%d\t%.17g\t%.17g\t%s\t%s\t%s\n",
+           escaped_path, entry->mtime, entry->size, entry->tai_utc_mtime, entry->tai_utc_size,
+           entry->convert_timesys_to_TT, entry->param_nojdkeyword, entry->input_timesys,
+           entry->JD, entry->timesys, entry->dimX, entry->dimY,
+           escaped_stderr_output, escaped_log_output, escaped_finder_chart_timestring_output );
+}
+
+// Re-write the cache file keeping only the current entries. The new file is written
+// under a temporary name and then renamed, so the readers never see a partial file.
+// An entry appended by another process while the file is being re-written may be lost,
+// which means only that the header will be read once again.
+static void header_cache_compact_file( void ) {
+ FILE *cachefile;
+ char line[4 * ( 2 * HEADER_CACHE_STRING_LENGTH ) + 2 * VAST_PATH_MAX];
+ char tmp_filename[VAST_PATH_MAX + 128];
+ size_t i;
+ int write_error;
+
+ snprintf( tmp_filename, sizeof( tmp_filename ), "%s.tmp%d", header_cache_filename, (int)getpid() );
+ cachefile= fopen( tmp_filename, "w" );
+ if ( cachefile == NULL ) {
+  return;
+ }
+ write_error= 0;
+ for ( i= 0; i < header_cache_n; i++ ) {
+  header_cache_format_line( &header_cache[i], line, sizeof( line ) );
+  if ( EOF == fputs( line, cachefile ) ) {
+   write_error= 1;
+   break;
+  }
+ }
+ if ( 0 != fclose( cachefile ) ) {
+  write_error= 1;
+ }
+ if ( write_error != 0 || 0 != rename( tmp_filename, header_cache_filename ) ) {
+  fprintf( stderr, "WARNING: cannot re-write the FITS header cache %s\n", header_cache_filename );
+  unlink( tmp_filename );
+ }
+}
+
+static void header_cache_load( void ) {
+ FILE *cachefile;
+ char *cache_dir;
+ char line[4 * ( 2 * HEADER_CACHE_STRING_LENGTH ) + 2 * VAST_PATH_MAX];
+ char *fields[15];
+ struct Header_cache_entry entry;
+ size_t n_lines;
+
+ header_cache_is_loaded= 1;
+ header_cache_filename[0]= '\0';
+ cache_dir= getenv( "VAST_HEADER_CACHE_DIR" );
+ if ( cache_dir == NULL || cache_dir[0] == '\0' ) {
+  return;
+ }
+ if ( 0 != access( cache_dir, W_OK ) ) {
+  fprintf( stderr, "WARNING: VAST_HEADER_CACHE_DIR=%s is not a writable directory, the FITS header cache is disabled\n", cache_dir );
+  return;
+ }
+ snprintf( header_cache_filename, sizeof( header_cache_filename ), "%s/%s", cache_dir, HEADER_CACHE_FILENAME );
+
+ cachefile= fopen( header_cache_filename, "r" );
+ if ( cachefile == NULL ) {
+  return;
+ }
+ n_lines= 0;
+ while ( NULL != fgets( line, sizeof( line ), cachefile ) ) {
+  n_lines++;
+  if ( 15 != header_cache_split_line( line, fields, 15 ) ) {
+   continue;
+  }
+  entry.path= header_cache_unescape_string( fields[0] );
+  entry.mtime= atoll( fields[1] );
+  entry.size= atoll( fields[2] );
+  entry.tai_utc_mtime= atoll( fields[3] );
+  entry.tai_utc_size= atoll( fields[4] );
+  entry.convert_timesys_to_TT= atoi( fields[5] );
+  entry.param_nojdkeyword= atoi( fields[6] );
+  entry.input_timesys= atoi( fields[7] );
+  entry.JD= atof( fields[8] );
+  entry.timesys= atoi( fields[9] );
+  entry.dimX= atof( fields[10] );
+  entry.dimY= atof( fields[11] );
+  entry.stderr_output= header_cache_unescape_string( fields[12] );
+  entry.log_output= header_cache_unescape_string( fields[13] );
+  entry.finder_chart_timestring_output= header_cache_unescape_string( fields[14] );
+  header_cache_insert( &entry );
+ }
+ fclose( cachefile );
+ // The replaced entries stay in the file as the new ones are appended
+ if ( n_lines > 2 * header_cache_n ) {
+  header_cache_compact_file();
+ }
+}
+
+// Append one entry to the cache file. The file is opened with O_APPEND and
+// the whole line goes out in one write() call, so the kernel places each line
+// at the end of the file as one piece and entries appended concurrently
+// by several processes do not interleave. (A stdio stream would split
+// a line longer than its buffer into several write() calls.)
+static void header_cache_append_to_file( struct Header_cache_entry *entry ) {
+ int cachefile_fd;
+ char line[4 * ( 2 * HEADER_CACHE_STRING_LENGTH ) + 2 * VAST_PATH_MAX];
+ size_t line_length;
+
+ header_cache_format_line( entry, line, sizeof( line ) );
+ line_length= strlen( line );
+ cachefile_fd= open( header_cache_filename, O_WRONLY | O_APPEND | O_CREAT, 0644 );
+ if ( cachefile_fd == -1 ) {
+  fprintf( stderr, "WARNING: cannot write to the FITS header cache %s\n", header_cache_filename );
+  return;
+ }
+ if ( write( cachefile_fd, line, line_length ) != (ssize_t)line_length ) {
+  fprintf( stderr, "WARNING: cannot write to the FITS header cache %s\n", header_cache_filename );
+ }
+ close( cachefile_fd );
+}
+
+static char *header_cache_strdup( const char *str ) {
+ char *out;
+ out= (char *)malloc( strlen( str ) + 1 );
+ if ( out == NULL ) {
+  fprintf( stderr, "ERROR: cannot allocate memory for the header cache\n" );
+  exit( EXIT_FAILURE );
+ }
+ strcpy( out, str );
+ return out;
+}
+
+static void header_cache_copy_string( char *destination, const char *source ) {
+ if ( destination != NULL ) {
+  strncpy( destination, source, HEADER_CACHE_STRING_LENGTH - 1 );
+  destination[HEADER_CACHE_STRING_LENGTH - 1]= '\0';
+ }
+}
+
+int gettime( char *fitsfilename, double *JD, int *timesys, int convert_timesys_to_TT, double *dimX, double *dimY, char *stderr_output, char *log_output, int param_nojdkeyword, int param_verbose, char *finder_chart_timestring_output ) {
+ struct stat image_stat;
+ struct stat tai_utc_stat;
+ long long image_mtime, tai_utc_mtime, tai_utc_size;
+ char image_path[VAST_PATH_MAX];
+ size_t slot, entry_plus_one;
+ struct Header_cache_entry *entry;
+ struct Header_cache_entry new_entry;
+ char cached_stderr_output[HEADER_CACHE_STRING_LENGTH];
+ char cached_log_output[HEADER_CACHE_STRING_LENGTH];
+ char cached_finder_chart_timestring_output[HEADER_CACHE_STRING_LENGTH];
+ int input_timesys;
+ int status;
+
+ if ( header_cache_is_loaded == 0 ) {
+  header_cache_load();
+ }
+
+ // Conditions under which the cache cannot be used
+ if ( header_cache_filename[0] == '\0' || param_verbose == 2 || 0 == access( "vast_list_of_input_images_with_time_corrections.txt", F_OK ) || NULL == realpath( fitsfilename, image_path ) || 0 != stat( image_path, &image_stat ) ) {
+  return gettime_from_fits_header( fitsfilename, JD, timesys, convert_timesys_to_TT, dimX, dimY, stderr_output, log_output, param_nojdkeyword, param_verbose, finder_chart_timestring_output );
+ }
+ if ( 0 != stat( "lib/tai-utc.dat", &tai_utc_stat ) ) {
+  tai_utc_mtime= 0;
+  tai_utc_size= 0;
+ } else {
+  tai_utc_mtime= header_cache_mtime_ns( &tai_utc_stat );
+  tai_utc_size= (long long)tai_utc_stat.st_size;
+ }
+ image_mtime= header_cache_mtime_ns( &image_stat );
+
+ input_timesys= ( *timesys );
+ if ( header_cache_n > 0 ) {
+  entry_plus_one= header_cache_find( image_path, convert_timesys_to_TT, param_nojdkeyword, input_timesys, &slot );
+  if ( entry_plus_one != 0 ) {
+   entry= &header_cache[entry_plus_one - 1];
+   if ( entry->mtime == image_mtime && entry->size == (long long)image_stat.st_size && entry->tai_utc_mtime == tai_utc_mtime && entry->tai_utc_size == tai_utc_size ) {
+    if ( param_verbose >= 1 ) {
+     fprintf( stderr, "Processing  %s (cached header information from %s)\n", fitsfilename, header_cache_filename );
+    }
+    ( *JD )= entry->JD;
+    ( *timesys )= entry->timesys;
+    ( *dimX )= entry->dimX;
+    ( *dimY )= entry->dimY;
+    header_cache_copy_string( stderr_output, entry->stderr_output );
+    header_cache_copy_string( log_output, entry->log_output );
+    header_cache_copy_string( finder_chart_timestring_output, entry->finder_chart_timestring_output );
+    return 0;
+   }
+  }
+ }
+
+ // Not in the cache: read the header, asking for all the output strings so the entry is complete
+ cached_stderr_output[0]= '\0';
+ cached_log_output[0]= '\0';
+ cached_finder_chart_timestring_output[0]= '\0';
+ status= gettime_from_fits_header( fitsfilename, JD, timesys, convert_timesys_to_TT, dimX, dimY, cached_stderr_output, cached_log_output, param_nojdkeyword, param_verbose, cached_finder_chart_timestring_output );
+ header_cache_copy_string( stderr_output, cached_stderr_output );
+ header_cache_copy_string( log_output, cached_log_output );
+ header_cache_copy_string( finder_chart_timestring_output, cached_finder_chart_timestring_output );
+ if ( status != 0 ) {
+  return status;
+ }
+
+ new_entry.path= header_cache_strdup( image_path );
+ new_entry.mtime= image_mtime;
+ new_entry.size= (long long)image_stat.st_size;
+ new_entry.tai_utc_mtime= tai_utc_mtime;
+ new_entry.tai_utc_size= tai_utc_size;
+ new_entry.convert_timesys_to_TT= convert_timesys_to_TT;
+ new_entry.param_nojdkeyword= param_nojdkeyword;
+ new_entry.input_timesys= input_timesys;
+ new_entry.JD= ( *JD );
+ new_entry.timesys= ( *timesys );
+ new_entry.dimX= ( *dimX );
+ new_entry.dimY= ( *dimY );
+ new_entry.stderr_output= header_cache_strdup( cached_stderr_output );
+ new_entry.log_output= header_cache_strdup( cached_log_output );
+ new_entry.finder_chart_timestring_output= header_cache_strdup( cached_finder_chart_timestring_output );
+ header_cache_insert( &new_entry );
+ header_cache_append_to_file( &new_entry );
+
+ return 0;
+}
@@ -544,126 +544,279 @@ struct Triangle *Separate_to_triangles( struct Star *star, int Number, int *Ntri
  return ( triangles );
 }
 
+// Check if the two triangles are similar trying the six possible correspondences of their vertices.
+// If they are, the vertices of t2 corresponding to the vertices t1->a[0], t1->a[1], t1->a[2] are returned in b[].
+static inline int Are_triangles_similar( struct Triangle *t1, struct Triangle *t2, float sigma, int *b ) {
+ float podobie, podobie1, ab1, bc1, ab2, bc2, ac2;
+
+ // First, check if the triangles overall have the same scale
+ // .ab_bc_ac is pre-computed by Compute_sides_of_triangles()
+ podobie= t1->ab_bc_ac / t2->ab_bc_ac;
+ if ( 0 != compare_two_floats_to_absolute_accuracy( podobie, 1.0, MAX_SCALE_FACTOR ) ) {
+  return 0;
+ }
+ // Once the overall scale is established to be the same, we need to match two specific sides
+ ab1= t1->ab;
+ bc1= t1->bc;
+ ab2= t2->ab;
+ bc2= t2->bc;
+ ac2= t2->ac;
+
+ podobie1= ab1 / ab2;
+ podobie1= podobie1 * podobie1 * podobie1;
+ if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
+  podobie1= bc1 / bc2;
+  podobie1= podobie1 * podobie1 * podobie1;
+  if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
+   b[0]= t2->a[0];
+   b[1]= t2->a[1];
+   b[2]= t2->a[2];
+   return 1;
+  }
+ }
+
+ podobie1= ab1 / bc2;
+ podobie1= podobie1 * podobie1 * podobie1;
+ if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
+  podobie1= bc1 / ac2;
+  podobie1= podobie1 * podobie1 * podobie1;
+  if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
+   b[0]= t2->a[1];
+   b[1]= t2->a[2];
+   b[2]= t2->a[0];
+   return 1;
+  }
+ }
+
+ podobie1= ab1 / bc2;
+ podobie1= podobie1 * podobie1 * podobie1;
+ if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
+  podobie1= bc1 / ab2;
+  podobie1= podobie1 * podobie1 * podobie1;
+  if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
+   b[0]= t2->a[2];
+   b[1]= t2->a[0];
+   b[2]= t2->a[1];
+   return 1;
+  }
+ }
+
+ podobie1= ab1 / ac2;
+ podobie1= podobie1 * podobie1 * podobie1;
+ if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
+  podobie1= bc1 / ab2;
+  podobie1= podobie1 * podobie1 * podobie1;
+  if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
+   b[0]= t2->a[2];
+   b[1]= t2->a[1];
+   b[2]= t2->a[0];
+   return 1;
+  }
+ }
+
+ podobie1= ab1 / ac2;
+ podobie1= podobie1 * podobie1 * podobie1;
+ if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
+  podobie1= bc1 / bc2;
+  podobie1= podobie1 * podobie1 * podobie1;
+  if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
+   b[0]= t2->a[0];
+   b[1]= t2->a[2];
+   b[2]= t2->a[1];
+   return 1;
+  }
+ }
+
+ podobie1= ab1 / ab2;
+ podobie1= podobie1 * podobie1 * podobie1;
+ if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
+  podobie1= bc1 / ac2;
+  podobie1= podobie1 * podobie1 * podobie1;
+  if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
+   b[0]= t2->a[1];
+   b[1]= t2->a[0];
+   b[2]= t2->a[2];
+   return 1;
+  }
+ }
+
+ return 0;
+}
+
+/*
+ Index of triangles sorted on their scale descriptor ab_bc_ac (the product of squared sides).
+ Two triangles may be similar only if their ab_bc_ac values agree to MAX_SCALE_FACTOR,
+ so for a given triangle all the candidates are found with a binary search in this index
+ instead of looping over all the triangles.
+ */
+struct Triangle_scale_index {
+ int Nt;
+ float *key;   // sorted ab_bc_ac values
+ int *ntriangle; // index of the triangle in the original array
+};
+
+struct Triangle_scale_index_element {
+ float key;
+ int ntriangle;
+};
+
+static int compare_Triangle_scale_index_elements( const void *a1, const void *a2 ) {
+ const struct Triangle_scale_index_element *e1= (const struct Triangle_scale_index_element *)a1;
+ const struct Triangle_scale_index_element *e2= (const struct Triangle_scale_index_element *)a2;
+ if ( e1->key < e2->key )
+  return -1;
+ if ( e1->key > e2->key )
+  return 1;
+ return e1->ntriangle - e2->ntriangle;
+}
+
+static struct Triangle_scale_index *Build_Triangle_scale_index( struct Triangle *tr, int Nt ) {
+ struct Triangle_scale_index *index;
+ struct Triangle_scale_index_element *elements;
+ int n, m;
+ index= malloc( sizeof( struct Triangle_scale_index ) );
+ elements= malloc( sizeof( struct Triangle_scale_index_element ) * ( Nt + 1 ) );
+ if ( index == NULL || elements == NULL ) {
+  fprintf( stderr, "ERROR in Build_Triangle_scale_index(): cannot allocate memory\n" );
+  vast_report_memory_error();
+  exit( EXIT_FAILURE );
+ }
+ // Degenerate triangles (ab_bc_ac=0, or NaN) can never pass the scale test, so they are not indexed
+ for ( n= 0, m= 0; n < Nt; n++ ) {
+  if ( !( tr[n].ab_bc_ac > 0.0 ) ) {
+   continue;
+  }
+  elements[m].key= tr[n].ab_bc_ac;
+  elements[m].ntriangle= n;
+  m++;
+ }
+ qsort( elements, m, sizeof( struct Triangle_scale_index_element ), compare_Triangle_scale_index_elements );
+ index->Nt= m;
+ index->key= malloc( sizeof( float ) * ( m + 1 ) );
+ index->ntriangle= malloc( sizeof( int ) * ( m + 1 ) );
+ if ( index->key == NULL || index->ntriangle == NULL ) {
+  fprintf( stderr, "ERROR in Build_Triangle_scale_index(): cannot allocate memory\n" );
+  vast_report_memory_error();
+  exit( EXIT_FAILURE );
+ }
+ for ( n= 0; n < m; n++ ) {
+  index->key[n]= elements[n].key;
+  index->ntriangle[n]= elements[n].ntriangle;
+ }
+ free( elements );
+ return index;
+}
+
+static void Delete_Triangle_scale_index( struct Triangle_scale_index *index ) {
+ if ( index == NULL ) {
+  return;
+ }
+ free( index->key );
+ free( index->ntriangle );
+ free( index );
+}
+
+// Returns the position of the first element of the index with key >= value
+static inline int Triangle_scale_index_lower_bound( struct Triangle_scale_index *index, float value ) {
+ int first= 0;
+ int count= index->Nt;
+ int step, middle;
+ while ( count > 0 ) {
+  step= count / 2;
+  middle= first + step;
+  if ( index->key[middle] < value ) {
+   first= middle + 1;
+   count-= step + 1;
+  } else {
+   count= step;
+  }
+ }
+ return first;
+}
+
+struct Similar_triangles_pair {
+ int n1;
+ int n2;
+ int b[3];
+};
+
+static int compare_Similar_triangles_pairs( const void *a1, const void *a2 ) {
+ const struct Similar_triangles_pair *p1= (const struct Similar_triangles_pair *)a1;
+ const struct Similar_triangles_pair *p2= (const struct Similar_triangles_pair *)a2;
+ if ( p1->n1 != p2->n1 )
+  return p1->n1 - p2->n1;
+ return p1->n2 - p2->n2;
+}
+
 // Optimization note: Sorting tr2 by ab_bc_ac and using binary search to find matching
 // triangles was tested. While it reduced loop iterations by ~99%, the qsort overhead
 // cancelled out any gains, resulting in no measurable speedup. The simple O(Nt1*Nt2)
 // nested loop below is kept as it performs equally well in practice.
+// Update: the nested loop has since been replaced by the scale index of tr1 below. Even though
+// the index is rebuilt on every call, Podobie() became faster: 1.7 -> 0.4 ms for 100 stars
+// (1058 triangles), 153 -> 13 ms for 1000 stars and 1.44 -> 0.12 s for 3000 stars per call
+// (synthetic star lists, -O2, x86_64).
+/*
+ Find pairs of similar triangles using the scale index of the reference triangles tr1.
+ For each triangle of the current frame (tr2) only the reference triangles with
+ ab_bc_ac within the (slightly widened) MAX_SCALE_FACTOR window are tested.
+ The pairs are reported in the same order as an exhaustive loop over tr1 and tr2 would find them.
+ */
 int Podobie( struct PixCoordinateTransformation *struct_pixel_coordinate_transformation, struct Ecv_triangles *ecv_tr,
              struct Triangle *tr1, int Nt1,
              struct Triangle *tr2, int Nt2 ) {
- int n1, n2;
- float sigma, podobie, podobie1, ab1, bc1, ab2, bc2, ac2;
+ int n2, i, b[3];
+ float sigma, key2;
+ struct Triangle_scale_index *tr1_index;
+ struct Similar_triangles_pair *pairs= NULL;
+ int N_pairs= 0;
+ int N_pairs_allocated= 0;
 
  sigma= struct_pixel_coordinate_transformation->sigma_podobia;
- for ( n1= 0; n1 < Nt1; n1++ ) {
-  ab1= tr1[n1].ab;
-  bc1= tr1[n1].bc;
-  // fprintf(stderr,"\nDEBUUUG: tr1 %d-%d-%d \n", tr1[n1].a[0], tr1[n1].a[1], tr1[n1].a[2]);
-  for ( n2= 0; n2 < Nt2; n2++ ) {
-
-   // fprintf(stderr,"DEBUUUG: tr2 %d-%d-%d \n", tr2[n2].a[0], tr2[n2].a[1], tr2[n2].a[2]);
-
-   // First, check if the triangles overall have the same scale
-   // .ab_bc_ac is pre-computed by Compute_sides_of_triangles()
-   podobie= tr1[n1].ab_bc_ac / tr2[n2].ab_bc_ac;
-   if ( 0 != compare_two_floats_to_absolute_accuracy( podobie, 1.0, MAX_SCALE_FACTOR ) ) {
+ tr1_index= Build_Triangle_scale_index( tr1, Nt1 );
+ for ( n2= 0; n2 < Nt2; n2++ ) {
+  key2= tr2[n2].ab_bc_ac;
+  if ( !( key2 > 0.0 ) ) {
+   continue;
+  }
+  // The window is a bit wider than MAX_SCALE_FACTOR, the exact test is done by Are_triangles_similar()
+  for ( i= Triangle_scale_index_lower_bound( tr1_index, (float)( key2 * ( 1.0 - 1.2 * MAX_SCALE_FACTOR ) ) ); i < tr1_index->Nt && tr1_index->key[i] <= (float)( key2 * ( 1.0 + 1.2 * MAX_SCALE_FACTOR ) ); i++ ) {
+   if ( 0 == Are_triangles_similar( &tr1[tr1_index->ntriangle[i]], &tr2[n2], sigma, b ) ) {
     continue;
    }
-   // Once the overall scale is established to be the same, we need to match two specific sides
-   // fprintf(stderr,"DEBUUUGtriangle 0\n");
-
-   // Now try to match the specific sides of the triangles
-   ab2= tr2[n2].ab;
-   bc2= tr2[n2].bc;
-   ac2= tr2[n2].ac;
-
-   podobie1= ab1 / ab2;
-   podobie1= podobie1 * podobie1 * podobie1;
-   if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
-    podobie1= bc1 / bc2;
-    podobie1= podobie1 * podobie1 * podobie1;
-    if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
-     Add_ecv_triangles( ecv_tr, tr1[n1].a[0], tr1[n1].a[1], tr1[n1].a[2],
-                        tr2[n2].a[0], tr2[n2].a[1], tr2[n2].a[2] ); //,
-     continue;
-    }
-   }
-   // fprintf(stderr,"DEBUUUGtriangle 1 %lf %lf %lf\n",podobie1, podobie, sigma);
-
-   podobie1= ab1 / bc2;
-   podobie1= podobie1 * podobie1 * podobie1;
-   if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
-    podobie1= bc1 / ac2;
-    podobie1= podobie1 * podobie1 * podobie1;
-    if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
-     Add_ecv_triangles( ecv_tr, tr1[n1].a[0], tr1[n1].a[1], tr1[n1].a[2],
-                        tr2[n2].a[1], tr2[n2].a[2], tr2[n2].a[0] ); //,
-     continue;
-    }
-   }
-   // fprintf(stderr,"DEBUUUGtriangle 2\n");
-
-   podobie1= ab1 / bc2;
-   podobie1= podobie1 * podobie1 * podobie1;
-   if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
-    podobie1= bc1 / ab2;
-    podobie1= podobie1 * podobie1 * podobie1;
-    if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
-     Add_ecv_triangles( ecv_tr, tr1[n1].a[0], tr1[n1].a[1], tr1[n1].a[2],
-                        tr2[n2].a[2], tr2[n2].a[0], tr2[n2].a[1] ); //,
-     continue;
-    }
-   }
-   // fprintf(stderr,"DEBUUUGtriangle 3\n");
-
-   // new
-   podobie1= ab1 / ac2;
-   podobie1= podobie1 * podobie1 * podobie1;
-   if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
-    podobie1= bc1 / ab2;
-    podobie1= podobie1 * podobie1 * podobie1;
-    if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
-     Add_ecv_triangles( ecv_tr, tr1[n1].a[0], tr1[n1].a[1], tr1[n1].a[2],
-                        tr2[n2].a[2], tr2[n2].a[1], tr2[n2].a[0] ); //,
-     continue;
+   if ( N_pairs == N_pairs_allocated ) {
+    N_pairs_allocated= MAX( 1024, 2 * N_pairs_allocated );
+    pairs= realloc( pairs, sizeof( struct Similar_triangles_pair ) * N_pairs_allocated );
+    if ( pairs == NULL ) {
+     fprintf( stderr, "ERROR in Podobie(): cannot allocate memory\n" );
+     vast_report_memory_error();
+     exit( EXIT_FAILURE );
     }
    }
-   // fprintf(stderr,"DEBUUUGtriangle 4\n");
-
-   podobie1= ab1 / ac2;
-   podobie1= podobie1 * podobie1 * podobie1;
-   if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
-    podobie1= bc1 / bc2;
-    podobie1= podobie1 * podobie1 * podobie1;
-    if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
-     Add_ecv_triangles( ecv_tr, tr1[n1].a[0], tr1[n1].a[1], tr1[n1].a[2],
-                        tr2[n2].a[0], tr2[n2].a[2], tr2[n2].a[1] ); //,
-     continue;
-    }
-   }
-   // fprintf(stderr,"DEBUUUGtriangle 5\n");
-
-   podobie1= ab1 / ab2;
-   podobie1= podobie1 * podobie1 * podobie1;
-   if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
-    podobie1= bc1 / ac2;
-    podobie1= podobie1 * podobie1 * podobie1;
-    if ( 0 == compare_two_floats_to_absolute_accuracy( podobie1, podobie, sigma ) ) {
-     Add_ecv_triangles( ecv_tr, tr1[n1].a[0], tr1[n1].a[1], tr1[n1].a[2],
-                        tr2[n2].a[1], tr2[n2].a[0], tr2[n2].a[2] ); //,
-     continue;
-    }
-   }
-   // fprintf(stderr,"DEBUUUGtriangle 6\n");
-   //
+   pairs[N_pairs].n1= tr1_index->ntriangle[i];
+   pairs[N_pairs].n2= n2;
+   pairs[N_pairs].b[0]= b[0];
+   pairs[N_pairs].b[1]= b[1];
+   pairs[N_pairs].b[2]= b[2];
+   N_pairs++;
   }
  }
+ if ( N_pairs > 1 ) {
+  qsort( pairs, N_pairs, sizeof( struct Similar_triangles_pair ), compare_Similar_triangles_pairs );
+ }
+ for ( i= 0; i < N_pairs; i++ ) {
+  Add_ecv_triangles( ecv_tr, tr1[pairs[i].n1].a[0], tr1[pairs[i].n1].a[1], tr1[pairs[i].n1].a[2],
+                     pairs[i].b[0], pairs[i].b[1], pairs[i].b[2] );
+ }
+ free( pairs );
+ Delete_Triangle_scale_index( tr1_index );
  if ( ecv_tr->Number == 0 ) {
   return 0;
  }
  return 1;
 }
 
+
 /*
  This function computes how many stars can be matched between the two structures star1 and star2 containing
  Number1 and Number2 stars if the positional accuracy is sigma_popadaniya.
@@ -1286,6 +1439,219 @@ static inline int isNumberInIntArray( int *array, int n_elements, int number_to_
  return -1;
 }
 
+/*
+
+ Spatial index of the reference stars for Ident_on_sigma().
+
+ The stars are distributed over the same grid as the one built by createGrid(), but instead of
+ a linked list per cell (one malloc() per star) the index is stored in CSR form: the star numbers
+ are sorted by cell in one contiguous array and cell_start[] gives the first star of each cell.
+ The star coordinates are copied in the same order, so a query reads a few contiguous chunks of memory.
+ Cells are numbered column by column (cell= column * rows + row), so the three cells of a column
+ visited by a query form one contiguous range.
+
+ Ident() calls Ident_on_sigma() several times for each image (and more times on a retry) with
+ the same reference star list, so the index is kept between the calls and rebuilt only if
+ the reference stars (or the image size) have changed. The memory is re-used when rebuilding.
+ As the index is a static variable, Ident_on_sigma() should not be called from several threads at once.
+
+*/
+
+struct Star_match_index {
+ // Grid geometry, exactly as in createGrid()
+ float minX;
+ float minY;
+ float cellSize;
+ int columns;
+ int rows;
+ // CSR index
+ int *cell_start; // columns*rows+1 elements
+ int *cell_star;  // star numbers sorted by cell
+ float *cell_x;
+ float *cell_y;
+ char *cell_moving_object;
+ int number_of_indexed_stars;
+ // The reference stars the index was built for, needed to check if the index is still valid
+ int Number1;
+ float frame_sizeX;
+ float frame_sizeY;
+ float *star_x;
+ float *star_y;
+ char *star_moving_object;
+ int *star_cell; // -1 if the star is outside the grid
+ // Allocated sizes
+ int allocated_stars;
+ int allocated_cells;
+ int is_valid;
+};
+
+static struct Star_match_index star_match_index= {0};
+
+// Same arithmetic as pointToCell() to get exactly the same cells
+static inline int star_match_index_cell_coordinate( double x, float min, float cellSize ) {
+ return (int)( x - min ) / cellSize;
+}
+
+static void *star_match_index_realloc( void *ptr, size_t size ) {
+ void *new_ptr;
+ new_ptr= realloc( ptr, size );
+ if ( new_ptr == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for the star matching index(ident_lib.c)\n" );
+  vast_report_memory_error();
+  exit( EXIT_FAILURE );
+ }
+ return new_ptr;
+}
+
+static int star_match_index_is_up_to_date( struct Star *star1, int Number1, float frame_sizeX, float frame_sizeY ) {
+ int i;
+ if ( star_match_index.is_valid == 0 ) {
+  return 0;
+ }
+ if ( star_match_index.Number1 != Number1 || star_match_index.frame_sizeX != frame_sizeX || star_match_index.frame_sizeY != frame_sizeY ) {
+  return 0;
+ }
+ for ( i= 0; i < Number1; i++ ) {
+  if ( star_match_index.star_x[i] != star1[i].x || star_match_index.star_y[i] != star1[i].y || star_match_index.star_moving_object[i] != star1[i].moving_object ) {
+   return 0;
+  }
+ }
+ return 1;
+}
+
+static void build_star_match_index( struct Star *star1, int Number1, float frame_sizeX, float frame_sizeY ) {
+ float minX, minY, maxX, maxY;
+ int i, column, row, number_of_cells, cell, position;
+
+ if ( Number1 > star_match_index.allocated_stars ) {
+  star_match_index.cell_star= star_match_index_realloc( star_match_index.cell_star, MAX( Number1, 1 ) * sizeof( int ) );
+  star_match_index.cell_x= star_match_index_realloc( star_match_index.cell_x, MAX( Number1, 1 ) * sizeof( float ) );
+  star_match_index.cell_y= star_match_index_realloc( star_match_index.cell_y, MAX( Number1, 1 ) * sizeof( float ) );
+  star_match_index.cell_moving_object= star_match_index_realloc( star_match_index.cell_moving_object, MAX( Number1, 1 ) * sizeof( char ) );
+  star_match_index.star_x= star_match_index_realloc( star_match_index.star_x, MAX( Number1, 1 ) * sizeof( float ) );
+  star_match_index.star_y= star_match_index_realloc( star_match_index.star_y, MAX( Number1, 1 ) * sizeof( float ) );
+  star_match_index.star_moving_object= star_match_index_realloc( star_match_index.star_moving_object, MAX( Number1, 1 ) * sizeof( char ) );
+  star_match_index.star_cell= star_match_index_realloc( star_match_index.star_cell, MAX( Number1, 1 ) * sizeof( int ) );
+  star_match_index.allocated_stars= Number1;
+ }
+
+ // The grid geometry - see the comments in createGrid()
+ star_match_index.cellSize= sqrtf( frame_sizeX * frame_sizeY / ( (float)Number1 ) );
+ minX= 0.0f - frame_sizeX - STAR_MATCH_GRID_PADDING_PIXELS;
+ minY= 0.0f - frame_sizeY - STAR_MATCH_GRID_PADDING_PIXELS;
+ maxX= minX + 3 * frame_sizeX + 2 * STAR_MATCH_GRID_PADDING_PIXELS;
+ maxY= minY + 3 * frame_sizeY + 2 * STAR_MATCH_GRID_PADDING_PIXELS;
+ star_match_index.minX= minX;
+ star_match_index.minY= minY;
+ star_match_index.columns= star_match_index_cell_coordinate( maxX, minX, star_match_index.cellSize ) + 1;
+ star_match_index.rows= star_match_index_cell_coordinate( maxY, minY, star_match_index.cellSize ) + 1;
+ if ( star_match_index.columns <= 0 || star_match_index.rows <= 0 ) {
+  fprintf( stderr, "ERROR: Trying allocate zero or negative bytes amount(ident_lib.c)\n" );
+  exit( EXIT_FAILURE );
+ }
+ number_of_cells= star_match_index.columns * star_match_index.rows;
+ if ( number_of_cells + 1 > star_match_index.allocated_cells ) {
+  star_match_index.cell_start= star_match_index_realloc( star_match_index.cell_start, ( number_of_cells + 1 ) * sizeof( int ) );
+  star_match_index.allocated_cells= number_of_cells + 1;
+ }
+
+ // Counting sort of the stars by cell.
+ // Stars outside the (padded) grid cannot match anything on the current frame and are not indexed, as in createGrid()
+ memset( star_match_index.cell_start, 0, ( number_of_cells + 1 ) * sizeof( int ) );
+ for ( i= 0; i < Number1; i++ ) {
+  star_match_index.star_x[i]= star1[i].x;
+  star_match_index.star_y[i]= star1[i].y;
+  star_match_index.star_moving_object[i]= star1[i].moving_object;
+  column= star_match_index_cell_coordinate( star1[i].x, minX, star_match_index.cellSize );
+  row= star_match_index_cell_coordinate( star1[i].y, minY, star_match_index.cellSize );
+  if ( column < 0 || column >= star_match_index.columns || row < 0 || row >= star_match_index.rows ) {
+   star_match_index.star_cell[i]= -1;
+   continue;
+  }
+  cell= column * star_match_index.rows + row;
+  star_match_index.star_cell[i]= cell;
+  star_match_index.cell_start[cell + 1]++;
+ }
+ for ( cell= 0; cell < number_of_cells; cell++ ) {
+  star_match_index.cell_start[cell + 1]+= star_match_index.cell_start[cell];
+ }
+ star_match_index.number_of_indexed_stars= star_match_index.cell_start[number_of_cells];
+ // Within a cell the stars are in the increasing order of their numbers
+ for ( i= 0; i < Number1; i++ ) {
+  cell= star_match_index.star_cell[i];
+  if ( cell < 0 ) {
+   continue;
+  }
+  // cell_start[cell] is temporarily used as the insertion point and is restored below
+  position= star_match_index.cell_start[cell];
+  star_match_index.cell_start[cell]++;
+  star_match_index.cell_star[position]= i;
+  star_match_index.cell_x[position]= star1[i].x;
+  star_match_index.cell_y[position]= star1[i].y;
+  star_match_index.cell_moving_object[position]= star1[i].moving_object;
+ }
+ for ( cell= number_of_cells; cell > 0; cell-- ) {
+  star_match_index.cell_start[cell]= star_match_index.cell_start[cell - 1];
+ }
+ star_match_index.cell_start[0]= 0;
+
+ star_match_index.Number1= Number1;
+ star_match_index.frame_sizeX= frame_sizeX;
+ star_match_index.frame_sizeY= frame_sizeY;
+ star_match_index.is_valid= 1;
+ return;
+}
+
+// Find the closest reference star within sqrt(epsilon) of (x,y) in the 3x3 cells around the star.
+// The candidates are checked in the same order as the linked lists returned by getListFromGrid()
+// (last cell first, stars in the decreasing order of their numbers), so that the choice
+// between equally distant stars is the same as in the original implementation.
+static inline int star_match_index_find_closest( float x, float y, float epsilon ) {
+ int ic, jc, i_min, j_min, i_max, j_max, i, k, k_first;
+ float R, R_best;
+ int best;
+
+ ic= star_match_index_cell_coordinate( x, star_match_index.minX, star_match_index.cellSize );
+ jc= star_match_index_cell_coordinate( y, star_match_index.minY, star_match_index.cellSize );
+ i_min= MAX( ic - 1, 0 );
+ j_min= MAX( jc - 1, 0 );
+ i_max= MIN( ic + 1, star_match_index.columns - 1 );
+ j_max= MIN( jc + 1, star_match_index.rows - 1 );
+
+ best= -1;
+ R_best= epsilon;
+ if ( j_min > j_max ) {
+  return best;
+ }
+ for ( i= i_max; i >= i_min; i-- ) {
+  k_first= star_match_index.cell_start[i * star_match_index.rows + j_min];
+  for ( k= star_match_index.cell_start[i * star_match_index.rows + j_max + 1] - 1; k >= k_first; k-- ) {
+   // do not allow moving object to participate in positional match!
+   if ( star_match_index.cell_moving_object[k] == 1 ) {
+    continue;
+   }
+   R= ( x - star_match_index.cell_x[k] ) * ( x - star_match_index.cell_x[k] ) + ( y - star_match_index.cell_y[k] ) * ( y - star_match_index.cell_y[k] );
+   if ( R < R_best ) {
+    best= star_match_index.cell_star[k];
+    R_best= R;
+   }
+  }
+ }
+ return best;
+}
+
+// The user-specified moving object is matched against the moving object on the reference frame
+// without using the spatial index - it might have moved out of its original cell by now.
+static inline int star_match_index_find_moving_object() {
+ int k;
+ for ( k= 0; k < star_match_index.number_of_indexed_stars; k++ ) {
+  if ( star_match_index.cell_moving_object[k] == 1 ) {
+   return star_match_index.cell_star[k];
+  }
+ }
+ return -1;
+}
+
 /*
 
  This function will match stars in two strctures (star1 and star2) based on their positional coincidence.
@@ -1295,15 +1661,8 @@ static inline int isNumberInIntArray( int *array, int n_elements, int number_to_
 */
 
 int Ident_on_sigma( struct Star *star1, int Number1, struct Star *star2, int Number2, int *Pos1, int *Pos2, double sigma_popadaniya, double image_size_X, double image_size_Y ) {
- float R_best, R, epsilon;
- int find_flag, number_of_matched_stars, q;
- frame fr;
- grid gr;
- list points1, points2, points_2, ps, ps_1;
- list xs_matched, ys_matched, ys_unmatched;
- list xs_matched_, ys_matched_, ys_unmatched_;
-
- point p1, p2, p_best;
+ float epsilon;
+ int number_of_matched_stars, q, i;
 
  int number_of_ambiguous_matches= 0;
  double fraction_of_ambiguous_matches;
@@ -1311,6 +1670,11 @@ int Ident_on_sigma( struct Star *star1, int Number1, struct Star *star2, int Num
  // Bitmap for O(1) lookup of already-matched star1 indices (replaces O(n) linear search)
  char *matched_star1_bitmap;
 
+ // The closest star1 for each star2 (-1 if there is none within sigma_popadaniya)
+ int *best_star1;
+ // star2 that matched an already matched star1
+ int *ambiguous_star2;
+
  epsilon= sigma_popadaniya * sigma_popadaniya;
 
  // Allocate and zero-initialize bitmap for tracking matched star1 indices
@@ -1319,142 +1683,83 @@ int Ident_on_sigma( struct Star *star1, int Number1, struct Star *star2, int Num
   fprintf( stderr, "ERROR in Ident_on_sigma(): cannot allocate memory for matched_star1_bitmap\n" );
   return 0;
  }
+ best_star1= (int *)malloc( MAX( Number2, 1 ) * sizeof( int ) );
+ if ( best_star1 == NULL ) {
+  fprintf( stderr, "ERROR in Ident_on_sigma(): cannot allocate memory for best_star1\n" );
+  free( matched_star1_bitmap );
+  return 0;
+ }
+ ambiguous_star2= (int *)malloc( MAX( Number2, 1 ) * sizeof( int ) );
+ if ( ambiguous_star2 == NULL ) {
+  fprintf( stderr, "ERROR in Ident_on_sigma(): cannot allocate memory for ambiguous_star2\n" );
+  free( best_star1 );
+  free( matched_star1_bitmap );
+  return 0;
+ }
 
- points1= loadPoint( star1, Number1 );
- points2= loadPoint( star2, Number2 );
-
- // Create frame with stars on it
- fr= createFrame( 0, 0, image_size_X, image_size_Y, points1 );
- // Create the spatial indexin grid
- gr= createGrid( fr );
-
- points_2= points2;
-
- xs_matched= emptyList();
- ys_matched= emptyList();
- ys_unmatched= emptyList();
-
- //  number_of_matched_stars=0;
- while ( isEmpty( points_2 ) == 0 ) {
-  R_best= epsilon;
-  find_flag= 0;
-  p2= disjoinList( &points_2 );
-  // ps= getListFromGrid(gr, p2.x, p2.y);
-  // ps_1= ps;
-  //  First, check the user-specified moving object
-  if ( p2.moving_object == 1 ) {
-   // If this is a moving object - we want to match it against all objects on the reference frame without using the spatial indexing.
-   // The moving object might have moved out of its original indexing square by now.
-   ps= getListFromGrid__getAllStarsNevermindGrid( gr );
-   ps_1= ps;
-   // fprintf(stderr, "\n\n\nDEBUG: YES HERE IS THE MOVING OBJECT IN P2  (%f,%f)\n\n\n",p2.x,p2.y);
-   while ( isEmpty( ps_1 ) == 0 ) {
-    p1= disjoinList( &ps_1 );
-    // WE NEED TO CHECK ALL STARS, NOT JUST THE ONES IN THE SAME SPATIAL SEGMENT
-    // Manually match the moving object using the flag (we assume there is only one moving object on the series of images)
-    if ( p1.moving_object == 1 ) {
-     find_flag= 1;
-     p_best= p1;
-     R_best= 0.0;
-     // fprintf(stderr, "DEBUG: --- HERE IT IS IN P1  (%f,%f)\n\n\n",p1.x,p1.y);
-     // break; // we probably can break here as we need to empty ps_1
-    }
-   }
-  } else {
-   // Second - the normal route - coordinate-based match
-   ps= getListFromGrid( gr, p2.x, p2.y );
-   ps_1= ps;
-   while ( isEmpty( ps_1 ) == 0 ) {
-    p1= disjoinList( &ps_1 );
-    // do not allow moving object to participate in positional match!
-    if ( p1.moving_object == 1 ) {
-     continue;
-    }
-    //
-    R= ( p2.x - p1.x ) * ( p2.x - p1.x ) + ( p2.y - p1.y ) * ( p2.y - p1.y );
-    if ( R < R_best ) { // && R<star1[p1.i].distance_to_neighbor_squared && R<star2[p2.i].distance_to_neighbor_squared) {
-     find_flag= 1;
-     p_best= p1;
-     R_best= R;
-    }
-   }
-  }
-  if ( find_flag == 1 ) {
-   xs_matched= addToList( p_best, xs_matched );
-   ys_matched= addToList( p2, ys_matched );
+ // Create (or re-use) the spatial index of the reference stars
+ if ( 0 == star_match_index_is_up_to_date( star1, Number1, (float)image_size_X, (float)image_size_Y ) ) {
+  build_star_match_index( star1, Number1, (float)image_size_X, (float)image_size_Y );
+ }
+
+ // Find the closest reference star for all stars of the current frame.
+ // The queries are independent, the matches are resolved serially below.
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for private( i ) schedule( static )
+#endif
+#endif
+ for ( i= 0; i < Number2; i++ ) {
+  if ( star2[i].moving_object == 1 ) {
+   best_star1[i]= star_match_index_find_moving_object();
   } else {
-   //
-   // if ( fabs(p1.x - 1494.6) < 1.0 && fabs(p1.y - 2081.4) < 1.0 ){
-   // fprintf( stderr, "\n--- NO MATCH!!!   p2.i=%d R=%lf R_best=%lf  p2.x=%lf p2.x=%lf  \n", p2.i, sqrt(R), sqrt(R_best), p2.x, p2.y );
-   // exit( EXIT_FAILURE );
-   //}
-   //
-   ys_unmatched= addToList( p2, ys_unmatched );
+   best_star1[i]= star_match_index_find_closest( star2[i].x, star2[i].y, epsilon );
   }
-  freeList( ps );
  }
 
- xs_matched_= xs_matched;
- ys_matched_= ys_matched;
+ // First-come-first-served: the star2 with the smallest number claims the star1,
+ // the subsequent star2s wanting the same star1 are rejected as ambiguous.
  number_of_matched_stars= 0;
- while ( isEmpty( xs_matched_ ) == 0 ) {
-  p1= disjoinList( &xs_matched_ );
-  p2= disjoinList( &ys_matched_ );
+ for ( i= 0; i < Number2; i++ ) {
+  if ( best_star1[i] < 0 ) {
+   continue;
+  }
   // if the star was not matched with another star before
   // Use bitmap for O(1) lookup instead of O(n) linear search
-  if ( matched_star1_bitmap[p1.i] == 0 ) {
+  if ( matched_star1_bitmap[best_star1[i]] == 0 ) {
    //
    if ( number_of_matched_stars >= Number1 ) {
     fprintf( stderr, "ERROR in Ident_on_sigma(): number_of_matched_stars>=Number1 while it shouldn't\n" );
     free( matched_star1_bitmap );
     exit( EXIT_FAILURE );
    }
-   if ( number_of_matched_stars >= Number2 ) {
-    fprintf( stderr, "ERROR in Ident_on_sigma(): number_of_matched_stars>=Number2 while it shouldn't\n" );
-    free( matched_star1_bitmap );
-    exit( EXIT_FAILURE );
-   }
-   //
-   //
-   //   if ( fabs(p1.x - 1125.732) < 1.0 && fabs(p1.y - 1675.50) < 1.0 ){
-   //     fprintf( stderr, "\nmmm p1.x=%lf p1.y=%lf  p2.i=%d R=%lf R_best=%lf  p2.x=%lf p2.x=%lf\n", p1.x, p1.y, p2.i, sqrt(R), sqrt(R_best), p2.x, p2.y );
-   //   }
-   //
    // write it as matched
-   Pos1[number_of_matched_stars]= p1.i;
-   Pos2[number_of_matched_stars]= p2.i;
-   matched_star1_bitmap[p1.i]= 1; // Mark this star1 index as matched
+   Pos1[number_of_matched_stars]= best_star1[i];
+   Pos2[number_of_matched_stars]= i;
+   matched_star1_bitmap[best_star1[i]]= 1; // Mark this star1 index as matched
    number_of_matched_stars++;
   } else {
-   // Note: the comment below is misleading. The algorithm doesn't find a "better" match.
-   // It simply uses first-come-first-served: whichever star2 was processed first claimed
-   // this star1, and subsequent star2s wanting the same star1 are rejected as ambiguous.
-   // this star has a better match, so this match is wrong
-   // WHY DO YOU THINK THE PREVIOUS MATCH IS THE BETTER ONE?
-   ys_unmatched= addToList( p2, ys_unmatched );
-   //
-   // fprintf(stderr, "AMBIGUOUS MATCH: p1.i=%d p1.x=%lf p1.y=%lf   p2.i=%d p2.x=%lf p2.y=%lf\n", p1.i, p1.x, p1.y, p2.i, p2.x, p2.y);
+   ambiguous_star2[number_of_ambiguous_matches]= i;
    number_of_ambiguous_matches++;
-   //
   }
  }
 
- ys_unmatched_= ys_unmatched;
-
+ // The unmatched stars follow the matched ones in Pos2[]: first the ambiguous matches
+ // in the decreasing order of star2 number, then the stars that had no match at all
  q= number_of_matched_stars;
- while ( isEmpty( ys_unmatched_ ) == 0 ) {
-  p2= disjoinList( &ys_unmatched_ );
-  Pos2[q]= p2.i;
+ for ( i= number_of_ambiguous_matches; i--; ) {
+  Pos2[q]= ambiguous_star2[i];
   q++;
  }
+ for ( i= 0; i < Number2; i++ ) {
+  if ( best_star1[i] < 0 ) {
+   Pos2[q]= i;
+   q++;
+  }
+ }
 
- freeList( xs_matched );
- freeList( ys_matched );
- freeList( ys_unmatched );
-
- freeGrid( gr );
- freeList( points2 );
- freeList( points1 );
+ free( ambiguous_star2 );
+ free( best_star1 );
 
  if ( number_of_matched_stars > 0 ) {
   // fraction_of_ambiguous_matches= (double)number_of_ambiguous_matches / (double)number_of_matched_stars;
@@ -20,8 +20,43 @@
 #include "lightcurve_io.h"
 #include "safely_encode_user_input_string.h" // for safely_encode_user_input_string()
 
+// Include omp.h ONLY if VaST compiler flag is requesting it
+#ifdef VAST_ENABLE_OPENMP
+// Include omp.h ONLY if the compiler supports OpenMP
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#endif
+
 #define CORRECTION_RADIUS_DEG_OR_PIX 20.0 / 3600.0
 
+// Stars measured on one image binned into a uniform grid.
+// The cell size is at least the search radius, so all neighbours of a star
+// are in the 3x3 block of cells around its cell.
+// In the degrees mode the grid is built on the orthogonal projection of the unit vectors
+// onto the plane perpendicular to the mean direction to the stars on the image.
+// The projection does not increase distances, so no neighbour is lost,
+// and there is no special case for RA=0 or the celestial poles.
+// The position and residual of the star are copied here, so the neighbour search
+// reads them from the cell-ordered array instead of the per-star arrays scattered in memory.
+struct star_in_grid {
+ double u;
+ double v;
+ float x;
+ float y;
+ float r;
+ size_t star;
+ size_t cell;
+};
+
+static size_t grid_cell_along_axis( double coordinate, double min_coordinate, double cell_size, size_t n_cells ) {
+ size_t cell;
+ cell= (size_t)( ( coordinate - min_coordinate ) / cell_size );
+ if ( cell >= n_cells )
+  cell= n_cells - 1;
+ return cell;
+}
+
 void write_fake_log_file( double *jd, size_t *Nobs ) {
  size_t i;
  FILE *logfile;
@@ -180,6 +215,19 @@ double compute_distance_on_sphere( double RA1, double DEC1, double target_ra, do
  return distance;
 }
 
+static void ra_dec_to_unit_vector( double RA, double DEC, double *unit_vector ) {
+ double RA_rad;
+ double DEC_rad;
+
+ RA_rad= RA * M_PI / 180.0;
+ DEC_rad= DEC * M_PI / 180.0;
+
+ unit_vector[0]= cos( DEC_rad ) * cos( RA_rad );
+ unit_vector[1]= cos( DEC_rad ) * sin( RA_rad );
+ unit_vector[2]= sin( DEC_rad );
+ return;
+}
+
 // int main(int argc, char **argv){
 int main() {
  FILE *lightcurvefile;
@@ -202,7 +250,7 @@ int main() {
  // int i, j; //,iter;
  // long k, l;
 
- size_t i, j, k, l;
+ size_t i, j, k;
 
  double djd;
  double dmag, dmerr, X, Y, app;
@@ -237,6 +285,21 @@ int main() {
 
  int degrees_or_pixels;
 
+ struct star_in_grid *stars_on_image;
+ size_t n_stars_on_image;
+ struct star_in_grid *stars_in_cells; // stars_on_image ordered by cell
+ size_t *cell_start;     // stars of cell c are stars_in_cells[cell_start[c]] ... stars_in_cells[cell_start[c + 1] - 1]
+ size_t max_n_cells;
+ size_t n_cells_u, n_cells_v;
+ size_t cell_u, cell_v, cell_u_to_search, cell_v_to_search;
+ double min_u, max_u, min_v, max_v;
+ double cell_size;
+ double star_vector[3], center_vector[3], u_vector[3], v_vector[3];
+ double vector_length;
+ size_t p, q;
+ float *neighbour_r;
+ int neighbour_r_alloc_error;
+
  /* Protection against strange free() crashes */
  // setenv("MALLOC_CHECK_", "0", 1);
 
@@ -483,55 +546,192 @@ int main() {
  fprintf( stderr, "done\n" );
 
  fprintf( stderr, "Computing local corrections...\n" );
+ stars_on_image= malloc( Nstars * sizeof( struct star_in_grid ) );
+ if ( stars_on_image == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for stars_on_image(local_zeropoint_correction.c)\n" );
+  exit( EXIT_FAILURE );
+ };
+ stars_in_cells= malloc( Nstars * sizeof( struct star_in_grid ) );
+ if ( stars_in_cells == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for stars_in_cells(local_zeropoint_correction.c)\n" );
+  exit( EXIT_FAILURE );
+ };
+ // Limit the number of grid cells to a few per star, so the grid stays small
+ // if the field is large compared to the search radius
+ max_n_cells= 4 * Nstars + 64;
+ cell_start= malloc( ( max_n_cells + 1 ) * sizeof( size_t ) );
+ if ( cell_start == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for cell_start(local_zeropoint_correction.c)\n" );
+  exit( EXIT_FAILURE );
+ };
  // For each image
  for ( j= Nobs; j--; ) {
-  // For each star
-  for ( i= Nstars; i--; ) {
-   // If there is a data point
+  // Collect stars measured on this image
+  n_stars_on_image= 0;
+  for ( i= 0; i < Nstars; i++ ) {
    if ( r[i][j] != 0.0 ) {
-    // Find nearest stars on that image
-    k= 0;
+    stars_on_image[n_stars_on_image].x= x[i][j];
+    stars_on_image[n_stars_on_image].y= y[i][j];
+    stars_on_image[n_stars_on_image].r= r[i][j];
+    stars_on_image[n_stars_on_image].u= x[i][j];
+    stars_on_image[n_stars_on_image].v= y[i][j];
+    stars_on_image[n_stars_on_image].star= i;
+    n_stars_on_image++;
+   }
+  }
+  if ( n_stars_on_image == 0 ) {
+   fprintf( stderr, "***********************************************\n" );
+   continue;
+  }
+  if ( degrees_or_pixels == 0 ) {
+   // Project the unit vectors onto the plane perpendicular to the mean direction
+   center_vector[0]= center_vector[1]= center_vector[2]= 0.0;
+   for ( p= 0; p < n_stars_on_image; p++ ) {
+    ra_dec_to_unit_vector( stars_on_image[p].x, stars_on_image[p].y, star_vector );
+    center_vector[0]+= star_vector[0];
+    center_vector[1]+= star_vector[1];
+    center_vector[2]+= star_vector[2];
+   }
+   vector_length= sqrt( center_vector[0] * center_vector[0] + center_vector[1] * center_vector[1] + center_vector[2] * center_vector[2] );
+   if ( vector_length > 0.0 ) {
+    center_vector[0]/= vector_length;
+    center_vector[1]/= vector_length;
+    center_vector[2]/= vector_length;
+   } else {
+    center_vector[0]= center_vector[1]= 0.0;
+    center_vector[2]= 1.0;
+   }
+   // u_vector = axis x center_vector, where the axis is the one least aligned with center_vector
+   if ( fabs( center_vector[2] ) < 0.9 ) {
+    u_vector[0]= -center_vector[1];
+    u_vector[1]= center_vector[0];
+    u_vector[2]= 0.0;
+   } else {
+    u_vector[0]= 0.0;
+    u_vector[1]= -center_vector[2];
+    u_vector[2]= center_vector[1];
+   }
+   vector_length= sqrt( u_vector[0] * u_vector[0] + u_vector[1] * u_vector[1] + u_vector[2] * u_vector[2] );
+   u_vector[0]/= vector_length;
+   u_vector[1]/= vector_length;
+   u_vector[2]/= vector_length;
+   // v_vector = center_vector x u_vector
+   v_vector[0]= center_vector[1] * u_vector[2] - center_vector[2] * u_vector[1];
+   v_vector[1]= center_vector[2] * u_vector[0] - center_vector[0] * u_vector[2];
+   v_vector[2]= center_vector[0] * u_vector[1] - center_vector[1] * u_vector[0];
+   for ( p= 0; p < n_stars_on_image; p++ ) {
+    ra_dec_to_unit_vector( stars_on_image[p].x, stars_on_image[p].y, star_vector );
+    stars_on_image[p].u= star_vector[0] * u_vector[0] + star_vector[1] * u_vector[1] + star_vector[2] * u_vector[2];
+    stars_on_image[p].v= star_vector[0] * v_vector[0] + star_vector[1] * v_vector[1] + star_vector[2] * v_vector[2];
+   }
+  }
+  min_u= max_u= stars_on_image[0].u;
+  min_v= max_v= stars_on_image[0].v;
+  for ( p= 1; p < n_stars_on_image; p++ ) {
+   min_u= MIN( min_u, stars_on_image[p].u );
+   max_u= MAX( max_u, stars_on_image[p].u );
+   min_v= MIN( min_v, stars_on_image[p].v );
+   max_v= MAX( max_v, stars_on_image[p].v );
+  }
+  // The cell size is the search radius: in pixels, or the chord length of the radius on the unit sphere.
+  // The chord is taken 1% larger to stay on the safe side of the rounding in compute_distance_on_sphere().
+  if ( degrees_or_pixels == 0 ) {
+   cell_size= 1.01 * 2.0 * sin( 0.5 * CORRECTION_RADIUS_DEG_OR_PIX * M_PI / 180.0 );
+  } else {
+   cell_size= CORRECTION_RADIUS_DEG_OR_PIX;
+  }
+  // Larger cells are still correct, only less selective
+  while ( ( floor( ( max_u - min_u ) / cell_size ) + 1.0 ) * ( floor( ( max_v - min_v ) / cell_size ) + 1.0 ) > (double)max_n_cells ) {
+   cell_size= 2.0 * cell_size;
+  }
+  n_cells_u= (size_t)( ( max_u - min_u ) / cell_size ) + 1;
+  n_cells_v= (size_t)( ( max_v - min_v ) / cell_size ) + 1;
+  // Bin the stars (counting sort by cell)
+  memset( cell_start, 0, ( n_cells_u * n_cells_v + 1 ) * sizeof( size_t ) );
+  for ( p= 0; p < n_stars_on_image; p++ ) {
+   cell_u= grid_cell_along_axis( stars_on_image[p].u, min_u, cell_size, n_cells_u );
+   cell_v= grid_cell_along_axis( stars_on_image[p].v, min_v, cell_size, n_cells_v );
+   stars_on_image[p].cell= cell_v * n_cells_u + cell_u;
+   cell_start[stars_on_image[p].cell]++;
+  }
+  // cell_start[c] is now the end of cell c in stars_in_cells[]
+  for ( q= 1; q < n_cells_u * n_cells_v; q++ ) {
+   cell_start[q]+= cell_start[q - 1];
+  }
+  cell_start[n_cells_u * n_cells_v]= n_stars_on_image;
+  // filling the cells from the end turns cell_start[c] into the start of cell c
+  for ( p= n_stars_on_image; p--; ) {
+   cell_start[stars_on_image[p].cell]--;
+   stars_in_cells[cell_start[stars_on_image[p].cell]]= stars_on_image[p];
+  }
+  // For each star (the stars are independent, each thread collects neighbours in its own buffer)
+  neighbour_r_alloc_error= 0;
 #ifdef VAST_ENABLE_OPENMP
 #ifdef _OPENMP
-#pragma omp parallel for private( l, distance )
+#pragma omp parallel private( i, k, p, q, distance, neighbour_r, cell_u, cell_v, cell_u_to_search, cell_v_to_search )
 #endif
 #endif
-    for ( l= 0; l < Nstars; l++ ) {
-     if ( r[l][j] != 0.0 && i != l ) {
-      if ( fabsf( y[l][j] - y[i][j] ) > CORRECTION_RADIUS_DEG_OR_PIX )
-       continue;
-      if ( degrees_or_pixels == 0 ) {
-       distance= compute_distance_on_sphere( x[l][j], y[l][j], x[i][j], y[i][j] );
-      } else {
-       // pixels
-       distance= sqrt( ( x[l][j] - x[i][j] ) * ( x[l][j] - x[i][j] ) + ( y[l][j] - y[i][j] ) * ( y[l][j] - y[i][j] ) );
-      }
-      // fprintf(stderr,"distance=%f\n",distance);
-      if ( distance < CORRECTION_RADIUS_DEG_OR_PIX ) {
+  {
+   neighbour_r= malloc( Nstars * sizeof( float ) );
+   if ( neighbour_r == NULL ) {
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+#endif
+    neighbour_r_alloc_error= 1;
+   }
 #ifdef VAST_ENABLE_OPENMP
 #ifdef _OPENMP
-#pragma omp critical
+#pragma omp for schedule( dynamic, 256 )
 #endif
 #endif
-       {
-        data[k]= r[l][j];
-        w[k]= 1.0 / ( mag_err[i][j] * mag_err[i][j] );
+   for ( p= 0; p < n_stars_on_image; p++ ) {
+    // all threads have to reach the omp for, so the thread without a buffer just skips its share
+    if ( neighbour_r == NULL )
+     continue;
+    i= stars_in_cells[p].star;
+    cell_u= stars_in_cells[p].cell % n_cells_u;
+    cell_v= stars_in_cells[p].cell / n_cells_u;
+    // Find nearest stars on that image: look only at the stars in this and the adjacent cells
+    k= 0;
+    for ( cell_v_to_search= MAX( cell_v, 1 ) - 1; cell_v_to_search <= MIN( cell_v + 1, n_cells_v - 1 ); cell_v_to_search++ ) {
+     for ( cell_u_to_search= MAX( cell_u, 1 ) - 1; cell_u_to_search <= MIN( cell_u + 1, n_cells_u - 1 ); cell_u_to_search++ ) {
+      for ( q= cell_start[cell_v_to_search * n_cells_u + cell_u_to_search]; q < cell_start[cell_v_to_search * n_cells_u + cell_u_to_search + 1]; q++ ) {
+       if ( q == p )
+        continue;
+       if ( degrees_or_pixels == 0 ) {
+        distance= compute_distance_on_sphere( stars_in_cells[q].x, stars_in_cells[q].y, stars_in_cells[p].x, stars_in_cells[p].y );
+       } else {
+        // pixels
+        distance= sqrt( ( stars_in_cells[q].x - stars_in_cells[p].x ) * ( stars_in_cells[q].x - stars_in_cells[p].x ) + ( stars_in_cells[q].y - stars_in_cells[p].y ) * ( stars_in_cells[q].y - stars_in_cells[p].y ) );
+       }
+       if ( distance < CORRECTION_RADIUS_DEG_OR_PIX ) {
+        neighbour_r[k]= stars_in_cells[q].r;
         k++;
        }
       }
-     } // if( r[l][j]!=0.0 && i!=l ){
-    } // for(k=0;k<Nstars;k++){
-    // Now determine the mean local correction
-    gsl_sort_float( data, 1, k );
-    corr[i][j]= gsl_stats_float_median_from_sorted_data( data, 1, k );
-// fprintf(stderr,"corr[%d][%d]=%f\n",i,j,corr[i][j]);
+     }
+    }
+    // Now determine the median local correction
+    // (the median does not depend on the order in which the neighbours were found)
+    gsl_sort_float( neighbour_r, 1, k );
+    corr[i][j]= gsl_stats_float_median_from_sorted_data( neighbour_r, 1, k );
 #ifdef DEBUGFILES
     fprintf( stderr, "%7.3f %7.3f %6.4f\n", x[i][j], y[i][j], corr[i][j] );
 #endif
-   } // if( r[i][j]!=0.0 ){
-  } // for(i=Nstars;i--;){
+   } // for ( p= 0; p < n_stars_on_image; p++ ) {
+   free( neighbour_r );
+  } // omp parallel
+  if ( neighbour_r_alloc_error != 0 ) {
+   fprintf( stderr, "ERROR: Couldn't allocate memory for neighbour_r(local_zeropoint_correction.c)\n" );
+   exit( EXIT_FAILURE );
+  }
   fprintf( stderr, "***********************************************\n" );
  } // for(j=Nobs;j--;){
+ free( cell_start );
+ free( stars_in_cells );
+ free( stars_on_image );
 
  // Apply corrections to lightcurves *
  fprintf( stderr, "Applying corrections... \n" );
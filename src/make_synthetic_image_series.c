@@ -0,0 +1,381 @@
+// This program simulates a series of FITS images of a star field for benchmarking
+// and testing the whole VaST pipeline (source extraction, matching, magnitude calibration
+// and lightcurve post-processing) on data with a known content.
+//
+// The field is generated once from the random seed, so the same command line always
+// produces identical images. Each frame is shifted by a random offset and rotated by
+// a fixed angle with respect to the previous one. A fraction of stars are sine-wave
+// variables (the same model as in lightcurve_simulator), the rest are constant;
+// the pixel noise is Poisson noise of the stars plus the sky background and the read noise.
+// The list of simulated stars is written to synthetic_stars.txt in the output directory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/stat.h> // for mkdir()
+#include <sys/types.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+
+#include "fitsio.h"
+
+#define DEFAULT_IMAGE_SIZE_PIX 1024
+#define DEFAULT_NUMBER_OF_STARS 1000
+#define DEFAULT_NUMBER_OF_FRAMES 20
+#define DEFAULT_ROTATION_DEG_PER_FRAME 0.0
+#define DEFAULT_SHIFT_PIX 3.0
+#define DEFAULT_FWHM_PIX 3.0
+#define DEFAULT_VARIABLE_FRACTION 0.01
+#define DEFAULT_RANDOM_SEED 1
+
+#define SYNTHETIC_SKY_BACKGROUND_ADU 1000.0
+#define SYNTHETIC_READ_NOISE_ADU 5.0
+#define SYNTHETIC_POISSON_TO_GAUSSIAN_ADU 100.0
+#define SYNTHETIC_BRIGHTEST_MAG 10.0
+#define SYNTHETIC_FAINTEST_MAG 16.0
+#define SYNTHETIC_ZEROPOINT_MAG 25.0 // flux of 1 ADU
+#define SYNTHETIC_SATURATION_ADU 65535.0
+#define SYNTHETIC_EXPOSURE_SEC 60.0
+#define SYNTHETIC_CADENCE_DAYS 0.01
+#define SYNTHETIC_JD_START 2459000.5
+#define SYNTHETIC_MIN_PERIOD_DAYS 0.05
+#define SYNTHETIC_MAX_PERIOD_DAYS 1.0
+#define SYNTHETIC_MIN_AMPLITUDE_MAG 0.1
+#define SYNTHETIC_MAX_AMPLITUDE_MAG 0.5
+#define SYNTHETIC_PSF_RADIUS_IN_SIGMA 5.0
+
+struct Synthetic_star {
+ double x;
+ double y;
+ double mag;
+ int is_variable;
+ double period;
+ double amplitude; // half-amplitude in mag
+ double phase;
+};
+
+void print_usage( char *program_name ) {
+ fprintf( stderr, "Simulate a series of FITS images of a star field.\n" );
+ fprintf( stderr, "Usage: %s [options]\n", program_name );
+ fprintf( stderr, "  -x, --nx N               image width in pixels (default %d)\n", DEFAULT_IMAGE_SIZE_PIX );
+ fprintf( stderr, "  -y, --ny N               image height in pixels (default %d)\n", DEFAULT_IMAGE_SIZE_PIX );
+ fprintf( stderr, "  -n, --stars N            number of stars in the field (default %d)\n", DEFAULT_NUMBER_OF_STARS );
+ fprintf( stderr, "  -f, --frames N           number of images (default %d)\n", DEFAULT_NUMBER_OF_FRAMES );
+ fprintf( stderr, "  -r, --rotation DEG       field rotation between consecutive images (default %.1lf)\n", DEFAULT_ROTATION_DEG_PER_FRAME );
+ fprintf( stderr, "  -s, --shift PIX          RMS of the random shift of each image (default %.1lf)\n", DEFAULT_SHIFT_PIX );
+ fprintf( stderr, "  -w, --fwhm PIX           stellar FWHM (default %.1lf)\n", DEFAULT_FWHM_PIX );
+ fprintf( stderr, "  -v, --variables FRACTION fraction of variable stars (default %.2lf)\n", DEFAULT_VARIABLE_FRACTION );
+ fprintf( stderr, "  -S, --seed N             random seed (default %d)\n", DEFAULT_RANDOM_SEED );
+ fprintf( stderr, "  -o, --output DIR         output directory (default: current directory)\n" );
+ fprintf( stderr, "Example: %s -x 2048 -y 2048 -n 5000 -f 50 -r 0.1 -o synthetic_images\n", program_name );
+ return;
+}
+
+// Add a Gaussian PSF normalized to the total flux to the image
+static void add_star_to_image( float *image, long nx, long ny, double x0, double y0, double flux, double sigma ) {
+ long x, y, xmin, xmax, ymin, ymax;
+ double radius, dx, dy, norm, inv_two_sigma2;
+
+ radius= SYNTHETIC_PSF_RADIUS_IN_SIGMA * sigma;
+ // Pixel (1,1) is centered at 1.0,1.0 in the FITS convention used by SExtractor
+ xmin= (long)floor( x0 - radius ) - 1;
+ xmax= (long)ceil( x0 + radius ) - 1;
+ ymin= (long)floor( y0 - radius ) - 1;
+ ymax= (long)ceil( y0 + radius ) - 1;
+ if ( xmax < 0 || ymax < 0 || xmin >= nx || ymin >= ny ) {
+  return;
+ }
+ if ( xmin < 0 )
+  xmin= 0;
+ if ( ymin < 0 )
+  ymin= 0;
+ if ( xmax >= nx )
+  xmax= nx - 1;
+ if ( ymax >= ny )
+  ymax= ny - 1;
+ norm= flux / ( 2.0 * M_PI * sigma * sigma );
+ inv_two_sigma2= 1.0 / ( 2.0 * sigma * sigma );
+ for ( y= ymin; y <= ymax; y++ ) {
+  dy= (double)( y + 1 ) - y0;
+  for ( x= xmin; x <= xmax; x++ ) {
+   dx= (double)( x + 1 ) - x0;
+   image[y * nx + x]+= (float)( norm * exp( -1.0 * ( dx * dx + dy * dy ) * inv_two_sigma2 ) );
+  }
+ }
+ return;
+}
+
+// Convert JD to the DATE-OBS string (the exposure start) assuming the Gregorian calendar
+static void jd_to_date_obs_string( double jd, char *date_obs ) {
+ long z, a, alpha, b, c, d, e;
+ double f, day, hours, minutes, seconds;
+ int year, month;
+
+ z= (long)( jd + 0.5 );
+ f= jd + 0.5 - (double)z;
+ alpha= (long)( ( (double)z - 1867216.25 ) / 36524.25 );
+ a= z + 1 + alpha - alpha / 4;
+ b= a + 1524;
+ c= (long)( ( (double)b - 122.1 ) / 365.25 );
+ d= (long)( 365.25 * (double)c );
+ e= (long)( (double)( b - d ) / 30.6001 );
+ day= (double)( b - d - (long)( 30.6001 * (double)e ) );
+ month= ( e < 14 ) ? (int)( e - 1 ) : (int)( e - 13 );
+ year= ( month > 2 ) ? (int)( c - 4716 ) : (int)( c - 4715 );
+ hours= f * 24.0;
+ minutes= ( hours - floor( hours ) ) * 60.0;
+ seconds= ( minutes - floor( minutes ) ) * 60.0;
+ sprintf( date_obs, "%04d-%02d-%02dT%02d:%02d:%06.3lf", year, month, (int)day, (int)floor( hours ), (int)floor( minutes ), seconds );
+ return;
+}
+
+static int write_synthetic_image( const char *filename, float *image, long nx, long ny, double jd_start ) {
+ fitsfile *fptr;
+ int status= 0;
+ long naxes[2];
+ char date_obs[FLEN_VALUE];
+ double exposure= SYNTHETIC_EXPOSURE_SEC;
+ double saturation= SYNTHETIC_SATURATION_ADU;
+ char fits_filename[FILENAME_MAX + 64];
+
+ naxes[0]= nx;
+ naxes[1]= ny;
+ // The leading '!' tells CFITSIO to overwrite the existing file
+ snprintf( fits_filename, FILENAME_MAX + 64, "!%s", filename );
+ jd_to_date_obs_string( jd_start, date_obs );
+ fits_create_file( &fptr, fits_filename, &status );
+ fits_create_img( fptr, FLOAT_IMG, 2, naxes, &status );
+ fits_update_key( fptr, TSTRING, "DATE-OBS", date_obs, "exposure start (UTC)", &status );
+ fits_update_key( fptr, TDOUBLE, "EXPTIME", &exposure, "exposure time (sec)", &status );
+ fits_update_key( fptr, TDOUBLE, "SATURATE", &saturation, "saturation level (ADU)", &status );
+ fits_write_history( fptr, "Synthetic image created by VaST make_synthetic_image_series", &status );
+ fits_write_img( fptr, TFLOAT, 1, nx * ny, image, &status );
+ fits_close_file( fptr, &status );
+ if ( status != 0 ) {
+  fits_report_error( stderr, status );
+  fprintf( stderr, "ERROR writing %s\n", filename );
+  return 1;
+ }
+ return 0;
+}
+
+int main( int argc, char **argv ) {
+ long nx= DEFAULT_IMAGE_SIZE_PIX;
+ long ny= DEFAULT_IMAGE_SIZE_PIX;
+ int number_of_stars= DEFAULT_NUMBER_OF_STARS;
+ int number_of_frames= DEFAULT_NUMBER_OF_FRAMES;
+ double rotation_deg_per_frame= DEFAULT_ROTATION_DEG_PER_FRAME;
+ double shift_pix= DEFAULT_SHIFT_PIX;
+ double fwhm_pix= DEFAULT_FWHM_PIX;
+ double variable_fraction= DEFAULT_VARIABLE_FRACTION;
+ unsigned long int seed= DEFAULT_RANDOM_SEED;
+ char output_dir[FILENAME_MAX];
+
+ const gsl_rng_type *T;
+ gsl_rng *r;
+
+ struct Synthetic_star *star;
+ float *image;
+ long i;
+ int star_counter, frame_counter;
+ double jd, sigma, angle, cos_angle, sin_angle, dx, dy, xc, yc, x, y, mag, pixel_value;
+ double random_mag_uniform;
+ char filename[FILENAME_MAX + 32];
+ FILE *truthfile;
+ struct stat sb;
+
+ int opt;
+ int option_index= 0;
+ static struct option long_options[]= {
+     {"nx", required_argument, 0, 'x'},
+     {"ny", required_argument, 0, 'y'},
+     {"stars", required_argument, 0, 'n'},
+     {"frames", required_argument, 0, 'f'},
+     {"rotation", required_argument, 0, 'r'},
+     {"shift", required_argument, 0, 's'},
+     {"fwhm", required_argument, 0, 'w'},
+     {"variables", required_argument, 0, 'v'},
+     {"seed", required_argument, 0, 'S'},
+     {"output", required_argument, 0, 'o'},
+     {"help", no_argument, 0, 'h'},
+     {0, 0, 0, 0}};
+
+ strncpy( output_dir, ".", FILENAME_MAX );
+
+ while ( ( opt= getopt_long( argc, argv, "x:y:n:f:r:s:w:v:S:o:h", long_options, &option_index ) ) != -1 ) {
+  switch ( opt ) {
+  case 'x':
+   nx= atol( optarg );
+   break;
+  case 'y':
+   ny= atol( optarg );
+   break;
+  case 'n':
+   number_of_stars= atoi( optarg );
+   break;
+  case 'f':
+   number_of_frames= atoi( optarg );
+   break;
+  case 'r':
+   rotation_deg_per_frame= atof( optarg );
+   break;
+  case 's':
+   shift_pix= atof( optarg );
+   break;
+  case 'w':
+   fwhm_pix= atof( optarg );
+   break;
+  case 'v':
+   variable_fraction= atof( optarg );
+   break;
+  case 'S':
+   seed= strtoul( optarg, NULL, 10 );
+   break;
+  case 'o':
+   strncpy( output_dir, optarg, FILENAME_MAX - 1 );
+   output_dir[FILENAME_MAX - 1]= '\0';
+   break;
+  case 'h':
+   print_usage( argv[0] );
+   return 0;
+  default:
+   print_usage( argv[0] );
+   return 1;
+  }
+ }
+
+ if ( nx < 64 || ny < 64 ) {
+  fprintf( stderr, "ERROR: the image size %ldx%ld is too small\n", nx, ny );
+  return 1;
+ }
+ if ( number_of_stars < 10 ) {
+  fprintf( stderr, "ERROR: at least 10 stars are needed to match images, not %d\n", number_of_stars );
+  return 1;
+ }
+ if ( number_of_frames < 2 ) {
+  fprintf( stderr, "ERROR: at least two images are needed, not %d\n", number_of_frames );
+  return 1;
+ }
+ if ( fwhm_pix <= 0.5 ) {
+  fprintf( stderr, "ERROR: the FWHM of %lf pix is too small\n", fwhm_pix );
+  return 1;
+ }
+ if ( variable_fraction < 0.0 || variable_fraction > 1.0 ) {
+  fprintf( stderr, "ERROR: the fraction of variable stars should be between 0 and 1, not %lf\n", variable_fraction );
+  return 1;
+ }
+ if ( 0 != stat( output_dir, &sb ) ) {
+  if ( 0 != mkdir( output_dir, 0755 ) ) {
+   fprintf( stderr, "ERROR: cannot create the output directory %s\n", output_dir );
+   return 1;
+  }
+ } else if ( !S_ISDIR( sb.st_mode ) ) {
+  fprintf( stderr, "ERROR: %s is not a directory\n", output_dir );
+  return 1;
+ }
+
+ star= malloc( number_of_stars * sizeof( struct Synthetic_star ) );
+ if ( star == NULL ) {
+  fprintf( stderr, "ERROR: cannot allocate memory for the star list\n" );
+  return 1;
+ }
+ image= malloc( nx * ny * sizeof( float ) );
+ if ( image == NULL ) {
+  fprintf( stderr, "ERROR: cannot allocate memory for the %ldx%ld image\n", nx, ny );
+  free( star );
+  return 1;
+ }
+
+ gsl_rng_env_setup();
+ T= gsl_rng_default;
+ r= gsl_rng_alloc( T );
+ gsl_rng_set( r, seed );
+
+ // Generate the field: stars are uniformly distributed on the sky (the number of stars
+ // grows as 10^(0.6 m) for a uniform spatial distribution, hence the power-law magnitude sampling)
+ for ( star_counter= 0; star_counter < number_of_stars; star_counter++ ) {
+  star[star_counter].x= 1.0 + gsl_rng_uniform( r ) * (double)( nx - 1 );
+  star[star_counter].y= 1.0 + gsl_rng_uniform( r ) * (double)( ny - 1 );
+  random_mag_uniform= gsl_rng_uniform( r );
+  star[star_counter].mag= SYNTHETIC_FAINTEST_MAG + log10( random_mag_uniform * ( 1.0 - pow( 10.0, -0.6 * ( SYNTHETIC_FAINTEST_MAG - SYNTHETIC_BRIGHTEST_MAG ) ) ) + pow( 10.0, -0.6 * ( SYNTHETIC_FAINTEST_MAG - SYNTHETIC_BRIGHTEST_MAG ) ) ) / 0.6;
+  star[star_counter].is_variable= ( gsl_rng_uniform( r ) < variable_fraction ) ? 1 : 0;
+  star[star_counter].period= SYNTHETIC_MIN_PERIOD_DAYS + gsl_rng_uniform( r ) * ( SYNTHETIC_MAX_PERIOD_DAYS - SYNTHETIC_MIN_PERIOD_DAYS );
+  star[star_counter].amplitude= SYNTHETIC_MIN_AMPLITUDE_MAG + gsl_rng_uniform( r ) * ( SYNTHETIC_MAX_AMPLITUDE_MAG - SYNTHETIC_MIN_AMPLITUDE_MAG );
+  star[star_counter].phase= gsl_rng_uniform( r );
+ }
+
+ snprintf( filename, FILENAME_MAX + 32, "%s/synthetic_stars.txt", output_dir );
+ truthfile= fopen( filename, "w" );
+ if ( truthfile == NULL ) {
+  fprintf( stderr, "ERROR: cannot open %s for writing\n", filename );
+  gsl_rng_free( r );
+  free( image );
+  free( star );
+  return 1;
+ }
+ fprintf( truthfile, "# X Y (on the first image)  mean_mag  is_variable  period(days)  half-amplitude(mag)  JD0\n" );
+ for ( star_counter= 0; star_counter < number_of_stars; star_counter++ ) {
+  fprintf( truthfile, "%10.4lf %10.4lf %8.4lf %d %10.6lf %6.4lf %.6lf\n", star[star_counter].x, star[star_counter].y, star[star_counter].mag, star[star_counter].is_variable, star[star_counter].period, star[star_counter].amplitude, SYNTHETIC_JD_START - star[star_counter].phase * star[star_counter].period );
+ }
+ fclose( truthfile );
+
+ sigma= fwhm_pix / ( 2.0 * sqrt( 2.0 * log( 2.0 ) ) );
+ xc= 0.5 * (double)( nx + 1 );
+ yc= 0.5 * (double)( ny + 1 );
+ for ( frame_counter= 0; frame_counter < number_of_frames; frame_counter++ ) {
+  jd= SYNTHETIC_JD_START + SYNTHETIC_CADENCE_DAYS * (double)frame_counter;
+  angle= rotation_deg_per_frame * (double)frame_counter * M_PI / 180.0;
+  cos_angle= cos( angle );
+  sin_angle= sin( angle );
+  // The first image defines the reference pointing
+  if ( frame_counter == 0 ) {
+   dx= dy= 0.0;
+  } else {
+   dx= gsl_ran_gaussian( r, shift_pix );
+   dy= gsl_ran_gaussian( r, shift_pix );
+  }
+  for ( i= 0; i < nx * ny; i++ ) {
+   image[i]= (float)SYNTHETIC_SKY_BACKGROUND_ADU;
+  }
+  for ( star_counter= 0; star_counter < number_of_stars; star_counter++ ) {
+   x= xc + ( star[star_counter].x - xc ) * cos_angle - ( star[star_counter].y - yc ) * sin_angle + dx;
+   y= yc + ( star[star_counter].x - xc ) * sin_angle + ( star[star_counter].y - yc ) * cos_angle + dy;
+   mag= star[star_counter].mag;
+   if ( star[star_counter].is_variable == 1 ) {
+    // the mid-exposure time
+    mag+= star[star_counter].amplitude * sin( 2.0 * M_PI * ( ( jd + 0.5 * SYNTHETIC_EXPOSURE_SEC / 86400.0 - SYNTHETIC_JD_START ) / star[star_counter].period + star[star_counter].phase ) );
+   }
+   add_star_to_image( image, nx, ny, x, y, pow( 10.0, 0.4 * ( SYNTHETIC_ZEROPOINT_MAG - mag ) ), sigma );
+  }
+  for ( i= 0; i < nx * ny; i++ ) {
+   // The Poisson distribution is indistinguishable from the Gaussian one at high counts,
+   // and the ziggurat Gaussian generator is much faster than gsl_ran_poisson()
+   if ( image[i] > SYNTHETIC_POISSON_TO_GAUSSIAN_ADU ) {
+    pixel_value= (double)image[i] + gsl_ran_gaussian_ziggurat( r, sqrt( (double)image[i] + SYNTHETIC_READ_NOISE_ADU * SYNTHETIC_READ_NOISE_ADU ) );
+   } else {
+    pixel_value= (double)gsl_ran_poisson( r, (double)image[i] ) + gsl_ran_gaussian_ziggurat( r, SYNTHETIC_READ_NOISE_ADU );
+   }
+   if ( pixel_value > SYNTHETIC_SATURATION_ADU ) {
+    pixel_value= SYNTHETIC_SATURATION_ADU;
+   }
+   image[i]= (float)pixel_value;
+  }
+  snprintf( filename, FILENAME_MAX + 32, "%s/synthetic%05d.fit", output_dir, frame_counter + 1 );
+  if ( 0 != write_synthetic_image( filename, image, nx, ny, jd ) ) {
+   gsl_rng_free( r );
+   free( image );
+   free( star );
+   return 1;
+  }
+  fprintf( stderr, "Writing %s\n", filename );
+ }
+
+ gsl_rng_free( r );
+ free( image );
+ free( star );
+
+ return 0;
+}
@@ -1,166 +1,570 @@
+// Box Least Squares (BLS) transit search
+// Kovacs, Zucker & Mazeh 2002, A&A, 391, 369
+//
+// For each trial frequency the lightcurve is folded into phase bins, the binned weights,
+// weighted magnitudes and point counts are turned into cumulative sums, and every box
+// (starting bin, width in bins) is evaluated with two subtractions.
+// The trial frequencies are independent, so they are distributed between OpenMP threads.
+//
+// Usage:
+//  lib/BLS/bls lightcurve.dat [Pmin Pmax]
+//   - search one lightcurve, print the best solution to stdout
+//  lib/BLS/bls --batch lightcurves.lst [Pmin Pmax]
+//  lib/BLS/bls --all [Pmin Pmax]
+//   - search all the listed lightcurves (or all out*.dat files in the current directory)
+//     and write the solutions ranked by SDE to vast_bls_candidates.log
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
 
+#include <sys/types.h>
+#include <dirent.h>
+
 #include <gsl/gsl_statistics.h>
 
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#endif
+
 #include "../../vast_limits.h"
+#include "../../lightcurve_io.h"
+
+#define BLS_CANDIDATES_LOG_FILENAME "vast_bls_candidates.log"
 
-double time_interval(char *lcfilename) {
- FILE *lcfile;
- double jdmin= 0, jdmax= 0, jd;
- char string[MAX_STRING_LENGTH_IN_LIGHTCURVE_FILE];
- int n= 0;
- lcfile= fopen(lcfilename, "r");
- while( NULL != fgets(string, MAX_STRING_LENGTH_IN_LIGHTCURVE_FILE, lcfile) ) {
-  sscanf(string, "%lf ", &jd);
-  if( jdmin == 0 )
-   jdmin= jd;
-  if( jdmax == 0 )
-   jdmax= jd;
-  if( jd > jdmax )
-   jdmax= jd;
-  if( jd < jdmin )
-   jdmin= jd;
-  n++;
- }
- fclose(lcfile);
- if( n < BLS_DI_MAX ) {
-  fprintf(stderr, "ERROR! Not enough points for BLS test!\n");
-  exit(1);
- }
- return jdmax - jdmin;
+// The best box found for one lightcurve
+struct BLS_result {
+ char lightcurvefilename[FILENAME_LENGTH];
+ int is_good; // 1 - the search was performed, 0 - the lightcurve was skipped
+ int n_points;
+ double SDE;          // signal detection efficiency of the highest peak
+ double period;       // days
+ double epoch;        // JD of the mid-transit
+ double duration;     // days
+ double depth;        // mag, positive for a dimming
+ int n_points_in_transit;
+};
+
+// Lightcurve arrays re-used for all the lightcurves processed in one run
+struct BLS_lightcurve {
+ double *t;
+ double *m;
+ double *w;
+ int n;
+ int allocated;
+};
+
+static int is_lightcurve_filename( const char *filename ) {
+ size_t filename_length= strlen( filename );
+ if ( filename_length < 8 )
+  return 0; // make sure the filename is not too short for the following tests
+ if ( filename[0] == 'o' && filename[1] == 'u' && filename[2] == 't' && filename[filename_length - 1] == 't' && filename[filename_length - 2] == 'a' && filename[filename_length - 3] == 'd' )
+  return 1;
+ return 0;
 }
 
-void fold(double T0, double Period, int n, double *jd, double *m, double *x) {
- double phase[MAX_NUMBER_OF_OBSERVATIONS];
- int i, j, min_n;
- double buf_x, buf_phase;
- double for_phase;
- // double sum;
- for( i= 0; i < n; i++ ) {
-  for_phase= (jd[i] - T0) / Period;
-  phase[i]= for_phase - (int)(for_phase);
-  x[i]= m[i];
- }
- for( i= 0; i < n; i++ ) {
-  min_n= i;
-  for( j= i; j < n; j++ ) {
-   if( phase[min_n] > phase[j] ) {
-    min_n= j;
+static int compare_bls_results_by_SDE( const void *a, const void *b ) {
+ const struct BLS_result *ra= (const struct BLS_result *)a;
+ const struct BLS_result *rb= (const struct BLS_result *)b;
+ // skipped lightcurves go to the end of the list
+ if ( ra->is_good != rb->is_good )
+  return rb->is_good - ra->is_good;
+ if ( ra->SDE > rb->SDE )
+  return -1;
+ if ( ra->SDE < rb->SDE )
+  return 1;
+ return strcmp( ra->lightcurvefilename, rb->lightcurvefilename );
+}
+
+// Read the lightcurve, compute normalized weights and subtract the weighted mean magnitude.
+// Returns 0 on success, 1 if the lightcurve cannot be read or has too few points.
+static int read_lightcurve_for_bls( const char *lightcurvefilename, struct BLS_lightcurve *lc ) {
+ FILE *lightcurvefile;
+ double jd, mag, magerr, x, y, app;
+ char string[FILENAME_LENGTH];
+ double *realloc_t, *realloc_m, *realloc_w;
+ double sum_w, mean_m;
+ int i;
+
+ lightcurvefile= fopen( lightcurvefilename, "r" );
+ if ( NULL == lightcurvefile ) {
+  fprintf( stderr, "ERROR: Can't open file %s\n", lightcurvefilename );
+  return 1;
+ }
+ lc->n= 0;
+ while ( -1 < read_lightcurve_point( lightcurvefile, &jd, &mag, &magerr, &x, &y, &app, string, NULL ) ) {
+  if ( jd == 0.0 ) {
+   continue; // if this line could not be parsed, try the next one
+  }
+  if ( magerr <= 0.0 ) {
+   continue;
+  }
+  if ( lc->n == lc->allocated ) {
+   lc->allocated= ( lc->allocated == 0 ) ? 1024 : 2 * lc->allocated;
+   realloc_t= realloc( lc->t, lc->allocated * sizeof( double ) );
+   realloc_m= realloc( lc->m, lc->allocated * sizeof( double ) );
+   realloc_w= realloc( lc->w, lc->allocated * sizeof( double ) );
+   if ( realloc_t == NULL || realloc_m == NULL || realloc_w == NULL ) {
+    fprintf( stderr, "ERROR in bls.c - cannot allocate memory\n" );
+    exit( EXIT_FAILURE );
    }
+   lc->t= realloc_t;
+   lc->m= realloc_m;
+   lc->w= realloc_w;
   }
-  buf_phase= phase[i];
-  buf_x= x[i];
-  phase[i]= phase[min_n];
-  x[i]= x[min_n];
-  phase[min_n]= buf_phase;
-  x[min_n]= buf_x;
- }
- return;
+  lc->t[lc->n]= jd;
+  lc->m[lc->n]= mag;
+  lc->w[lc->n]= 1.0 / ( magerr * magerr );
+  lc->n++;
+ }
+ fclose( lightcurvefile );
+
+ if ( lc->n < BLS_MIN_NUMBER_OF_POINTS ) {
+  return 1;
+ }
+
+ sum_w= 0.0;
+ for ( i= 0; i < lc->n; i++ ) {
+  sum_w+= lc->w[i];
+ }
+ mean_m= 0.0;
+ for ( i= 0; i < lc->n; i++ ) {
+  lc->w[i]= lc->w[i] / sum_w;
+  mean_m+= lc->w[i] * lc->m[i];
+ }
+ for ( i= 0; i < lc->n; i++ ) {
+  lc->m[i]= lc->m[i] - mean_m;
+ }
+
+ return 0;
 }
 
-int main(int argc, char **argv) {
- FILE *lightcurvefile;
- char str_buf[MAX_NUMBER_OF_OBSERVATIONS];
- double jd[MAX_NUMBER_OF_OBSERVATIONS];
- double m[MAX_NUMBER_OF_OBSERVATIONS];
- double x[MAX_NUMBER_OF_OBSERVATIONS];
- double w;
- double summa_sigm= 0;
- double r[MAX_NUMBER_OF_OBSERVATIONS];
- double s[MAX_NUMBER_OF_OBSERVATIONS];
- double Period= 0.5;
- double T0= 0.0;
- double SRmax= 0.0;
- double SRcurrent;
- double frequency;
- int i, n, di, dimax, i1, i2, i1i2_counter, k;
-
- double *sr_f= NULL;
- double sr_best= 0.0;
- int sr_f_counter= 0;
- double sr_mean, sr_sd, snr;
- /* Start test */
- if( argc < 2 ) {
-  fprintf(stderr, "Usage: ./bls lightcurve.dat\n");
+// Best box for one trial frequency.
+// The bin arrays have nbins + max_box_bins elements so boxes may wrap around phase 1.0.
+// Returns the signal residue SR = s^2 / ( r * (1 - r) ) of the best dimming box.
+static double bls_single_frequency( const struct BLS_lightcurve *lc, double t0, double frequency, int nbins, int min_box_bins, int max_box_bins,
+                                    double *cumulative_w, double *cumulative_m, int *cumulative_n,
+                                    int *best_start_bin, int *best_box_bins ) {
+ int i, j, bin;
+ double phase;
+ double r, s, SR, SRmax;
+
+ for ( i= 0; i <= nbins + max_box_bins; i++ ) {
+  cumulative_w[i]= 0.0;
+  cumulative_m[i]= 0.0;
+  cumulative_n[i]= 0;
+ }
+
+ // Fold and bin, bin i is accumulated in element i + 1
+ for ( i= 0; i < lc->n; i++ ) {
+  phase= ( lc->t[i] - t0 ) * frequency;
+  phase= phase - floor( phase );
+  bin= (int)( phase * nbins );
+  if ( bin >= nbins )
+   bin= nbins - 1;
+  cumulative_w[bin + 1]+= lc->w[i];
+  cumulative_m[bin + 1]+= lc->w[i] * lc->m[i];
+  cumulative_n[bin + 1]++;
+ }
+ // Wrap the first max_box_bins bins after the last one
+ for ( i= 1; i <= max_box_bins; i++ ) {
+  cumulative_w[nbins + i]= cumulative_w[i];
+  cumulative_m[nbins + i]= cumulative_m[i];
+  cumulative_n[nbins + i]= cumulative_n[i];
+ }
+ // Turn the bins into cumulative sums
+ for ( i= 1; i <= nbins + max_box_bins; i++ ) {
+  cumulative_w[i]+= cumulative_w[i - 1];
+  cumulative_m[i]+= cumulative_m[i - 1];
+  cumulative_n[i]+= cumulative_n[i - 1];
+ }
+
+ SRmax= 0.0;
+ ( *best_start_bin )= 0;
+ ( *best_box_bins )= min_box_bins;
+ for ( i= 0; i < nbins; i++ ) {
+  for ( j= min_box_bins; j <= max_box_bins; j++ ) {
+   // In magnitudes a transit is positive s
+   s= cumulative_m[i + j] - cumulative_m[i];
+   if ( s <= 0.0 )
+    continue;
+   if ( cumulative_n[i + j] - cumulative_n[i] < BLS_MIN_POINTS_IN_TRANSIT )
+    continue;
+   r= cumulative_w[i + j] - cumulative_w[i];
+   if ( r >= 1.0 )
+    continue;
+   SR= s * s / ( r * ( 1.0 - r ) );
+   if ( SR > SRmax ) {
+    SRmax= SR;
+    ( *best_start_bin )= i;
+    ( *best_box_bins )= j;
+   }
+  }
+ }
+
+ return SRmax;
+}
+
+// Run the BLS search on one lightcurve.
+// Returns 0 on success, 1 if the lightcurve was skipped.
+static int bls_search_lightcurve( const char *lightcurvefilename, double pmin, double pmax, struct BLS_lightcurve *lc, struct BLS_result *result ) {
+ double tmin, tmax, time_span;
+ double fmin, fmax, df;
+ long nfreq, k, k_best;
+ int nbins, min_box_bins, max_box_bins;
+ double *power;
+ int *start_bin;
+ int *box_bins;
+ double power_mean, power_sd;
+ double r, s, phase;
+ double best_frequency;
+ int i, bin, in_transit;
+ int fatal_error;
+
+ double *cumulative_w;
+ double *cumulative_m;
+ int *cumulative_n;
+
+ memset( result, 0, sizeof( struct BLS_result ) );
+ strncpy( result->lightcurvefilename, lightcurvefilename, FILENAME_LENGTH - 1 );
+ result->lightcurvefilename[FILENAME_LENGTH - 1]= '\0';
+
+ if ( 0 != read_lightcurve_for_bls( lightcurvefilename, lc ) ) {
+  return 1;
+ }
+ result->n_points= lc->n;
+
+ tmin= tmax= lc->t[0];
+ for ( i= 1; i < lc->n; i++ ) {
+  if ( lc->t[i] < tmin )
+   tmin= lc->t[i];
+  if ( lc->t[i] > tmax )
+   tmax= lc->t[i];
+ }
+ time_span= tmax - tmin;
+ if ( time_span <= 0.0 ) {
+  return 1;
+ }
+
+ // The transit of the longest period should be seen at least twice
+ if ( pmax > time_span / 2.0 )
+  pmax= time_span / 2.0;
+ if ( pmax <= pmin ) {
   return 1;
  }
- /* Read data */
- n= 0;
- lightcurvefile= fopen(argv[1], "r");
- while( NULL != fgets(str_buf, MAX_NUMBER_OF_OBSERVATIONS, lightcurvefile) ) {
-  sscanf(str_buf, "%lf %lf", &jd[n], &m[n]);
-  n++;
- }
- fclose(lightcurvefile);
- /* Compute weights */
- summa_sigm= 0;
- for( i= 0; i < n; i++ )
-  summa_sigm+= 1 / (BLS_SIGMA * BLS_SIGMA);
- w= BLS_SIGMA * BLS_SIGMA;
- w= 1 / w;
- w= w / summa_sigm;
- /* Normalize data */
- summa_sigm= 0;
- for( i= 0; i < n; i++ )
-  summa_sigm+= w * m[i];
- for( i= 0; i < n; i++ )
-  m[i]= m[i] - summa_sigm;
- /* Try different periods */
- frequency= 2 / time_interval(argv[1]);
- if( frequency < BLS_MIN_FREQ )
-  frequency= BLS_MIN_FREQ;
- dimax= BLS_DI_MAX; //max eclipse duration
- while( frequency < BLS_MAX_FREQ ) {
-  i1i2_counter= 0;
-  /* Fold with a given period */
-  Period= 1.0 / frequency;
-  fold(T0, Period, n, jd, m, x);
-  /* Try different eclipse width */
-  for( di= BLS_DI_MIN; di < dimax; di++ ) {
-   /* Try different eclipse starting points */
-   for( i= 0; i < n - di; i++ ) {
-    i1= i;
-    i2= i1 + di;
-    r[i1i2_counter]= w * di;
-    summa_sigm= 0;
-    for( k= i1; k <= i2; k++ ) {
-     summa_sigm+= x[k];
-    }
-    s[i1i2_counter]= w * summa_sigm;
-    i1i2_counter++;
+ fmin= 1.0 / pmax;
+ fmax= 1.0 / pmin;
+ // Frequency step that shifts the phase of the last point by a fraction of the shortest box
+ df= BLS_MIN_FRACTIONAL_DURATION / ( BLS_FREQUENCY_OVERSAMPLING * time_span );
+ nfreq= (long)( ( fmax - fmin ) / df ) + 1;
+ if ( nfreq > BLS_MAX_NUMBER_OF_FREQUENCIES ) {
+  nfreq= BLS_MAX_NUMBER_OF_FREQUENCIES;
+  df= ( fmax - fmin ) / (double)( nfreq - 1 );
+ }
+ if ( nfreq < 2 ) {
+  return 1;
+ }
+
+ nbins= BLS_NUMBER_OF_PHASE_BINS;
+ min_box_bins= (int)( BLS_MIN_FRACTIONAL_DURATION * nbins + 0.5 );
+ if ( min_box_bins < 1 )
+  min_box_bins= 1;
+ max_box_bins= (int)( BLS_MAX_FRACTIONAL_DURATION * nbins + 0.5 );
+ if ( max_box_bins < min_box_bins )
+  max_box_bins= min_box_bins;
+
+ power= malloc( nfreq * sizeof( double ) );
+ start_bin= malloc( nfreq * sizeof( int ) );
+ box_bins= malloc( nfreq * sizeof( int ) );
+ if ( power == NULL || start_bin == NULL || box_bins == NULL ) {
+  fprintf( stderr, "ERROR in bls.c - cannot allocate memory\n" );
+  exit( EXIT_FAILURE );
+ }
+
+ // The power is stored for every frequency and the peak is found afterwards,
+ // so the result does not depend on the number of threads
+ fatal_error= 0;
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel private( k, cumulative_w, cumulative_m, cumulative_n )
+#endif
+#endif
+ {
+  cumulative_w= malloc( ( nbins + max_box_bins + 1 ) * sizeof( double ) );
+  cumulative_m= malloc( ( nbins + max_box_bins + 1 ) * sizeof( double ) );
+  cumulative_n= malloc( ( nbins + max_box_bins + 1 ) * sizeof( int ) );
+  if ( cumulative_w == NULL || cumulative_m == NULL || cumulative_n == NULL ) {
+   fprintf( stderr, "ERROR in bls.c - cannot allocate memory\n" );
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+#endif
+   fatal_error= 1;
+  } else {
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp for schedule( static )
+#endif
+#endif
+   for ( k= 0; k < nfreq; k++ ) {
+    power[k]= sqrt( bls_single_frequency( lc, tmin, fmin + k * df, nbins, min_box_bins, max_box_bins, cumulative_w, cumulative_m, cumulative_n, &start_bin[k], &box_bins[k] ) );
    }
   }
-  SRmax= 0.0;
-  for( i= 0; i < i1i2_counter; i++ ) {
-   SRcurrent= r[i] * (1 - r[i]);
-   //   SRcurrent=sqrt(s[i]*s[i]/SRcurrent);
-   SRcurrent= s[i] * s[i] / SRcurrent; //no sqrt
-   if( SRmax < SRcurrent )
-    SRmax= SRcurrent;
+  free( cumulative_w );
+  free( cumulative_m );
+  free( cumulative_n );
+ }
+ if ( fatal_error != 0 ) {
+  exit( EXIT_FAILURE );
+ }
+
+ k_best= 0;
+ for ( k= 1; k < nfreq; k++ ) {
+  if ( power[k] > power[k_best] )
+   k_best= k;
+ }
+ power_mean= gsl_stats_mean( power, 1, nfreq );
+ power_sd= gsl_stats_sd_m( power, 1, nfreq, power_mean );
+
+ best_frequency= fmin + k_best * df;
+ result->period= 1.0 / best_frequency;
+ result->duration= (double)box_bins[k_best] / (double)nbins * result->period;
+ result->epoch= tmin + ( (double)start_bin[k_best] + 0.5 * (double)box_bins[k_best] ) / (double)nbins * result->period;
+ if ( power_sd > 0.0 ) {
+  result->SDE= ( power[k_best] - power_mean ) / power_sd;
+ }
+
+ // Recompute the box parameters for the best frequency
+ r= s= 0.0;
+ in_transit= 0;
+ for ( i= 0; i < lc->n; i++ ) {
+  phase= ( lc->t[i] - tmin ) * best_frequency;
+  phase= phase - floor( phase );
+  bin= (int)( phase * nbins );
+  if ( bin >= nbins )
+   bin= nbins - 1;
+  if ( bin < start_bin[k_best] )
+   bin+= nbins;
+  if ( bin < start_bin[k_best] + box_bins[k_best] ) {
+   r+= lc->w[i];
+   s+= lc->w[i] * lc->m[i];
+   in_transit++;
+  }
+ }
+ if ( r > 0.0 && r < 1.0 ) {
+  result->depth= s / ( r * ( 1.0 - r ) );
+ }
+ result->n_points_in_transit= in_transit;
+ result->is_good= 1;
+
+ free( power );
+ free( start_bin );
+ free( box_bins );
+
+ return 0;
+}
+
+static void print_bls_result( FILE *outfile, const struct BLS_result *result ) {
+ fprintf( outfile, "%8.2lf %14.8lf %15.6lf %10.6lf %8.4lf %5d %5d %s\n", result->SDE, result->period, result->epoch, result->duration, result->depth, result->n_points_in_transit, result->n_points, result->lightcurvefilename );
+}
+
+// Returns the list of lightcurve files, either all out*.dat files in the current directory
+// (if listfilename is NULL) or the files listed in listfilename
+static char **list_lightcurve_files_for_bls( const char *listfilename, int *number_of_lightcurve_files ) {
+ DIR *dp= NULL;
+ struct dirent *ep;
+ FILE *listfile= NULL;
+ char lightcurvefilename[FILENAME_LENGTH];
+ char **lightcurve_filenames;
+ char **realloc_lightcurve_filenames;
+ int allocated_filenames;
+
+ ( *number_of_lightcurve_files )= 0;
+
+ if ( listfilename == NULL ) {
+  dp= opendir( "./" );
+  if ( dp == NULL ) {
+   perror( "Couldn't open the directory" );
+   return NULL;
+  }
+ } else {
+  listfile= fopen( listfilename, "r" );
+  if ( listfile == NULL ) {
+   fprintf( stderr, "ERROR opening the list of lightcurve files %s\n", listfilename );
+   return NULL;
   }
+ }
+
+ allocated_filenames= 1024;
+ lightcurve_filenames= malloc( allocated_filenames * sizeof( char * ) );
+ if ( lightcurve_filenames == NULL ) {
+  fprintf( stderr, "ERROR in bls.c - cannot allocate memory\n" );
+  exit( EXIT_FAILURE );
+ }
+
+ while ( 1 ) {
+  if ( dp != NULL ) {
+   if ( ( ep= readdir( dp ) ) == NULL )
+    break;
+   if ( 0 == is_lightcurve_filename( ep->d_name ) )
+    continue;
+   strncpy( lightcurvefilename, ep->d_name, FILENAME_LENGTH - 1 );
+  } else {
+   if ( 1 != fscanf( listfile, "%s", lightcurvefilename ) )
+    break;
+  }
+  lightcurvefilename[FILENAME_LENGTH - 1]= '\0'; // just in case
+  if ( ( *number_of_lightcurve_files ) == allocated_filenames ) {
+   allocated_filenames= 2 * allocated_filenames;
+   realloc_lightcurve_filenames= realloc( lightcurve_filenames, allocated_filenames * sizeof( char * ) );
+   if ( realloc_lightcurve_filenames == NULL ) {
+    fprintf( stderr, "ERROR in bls.c - cannot allocate memory\n" );
+    exit( EXIT_FAILURE );
+   }
+   lightcurve_filenames= realloc_lightcurve_filenames;
+  }
+  lightcurve_filenames[( *number_of_lightcurve_files )]= strdup( lightcurvefilename );
+  if ( lightcurve_filenames[( *number_of_lightcurve_files )] == NULL ) {
+   fprintf( stderr, "ERROR in bls.c - cannot allocate memory\n" );
+   exit( EXIT_FAILURE );
+  }
+  ( *number_of_lightcurve_files )++;
+ }
+
+ if ( dp != NULL )
+  (void)closedir( dp );
+ if ( listfile != NULL )
+  fclose( listfile );
+
+ return lightcurve_filenames;
+}
+
+int main( int argc, char **argv ) {
+ double pmin= 1.0 / BLS_MAX_FREQ;
+ double pmax= 1.0 / BLS_MIN_FREQ;
+ double tmp_period_shuffle;
+
+ struct BLS_lightcurve lc;
+ struct BLS_result single_result;
+ struct BLS_result *results;
+
+ // Batch mode: process many lightcurves in one run
+ int batch_mode= 0;
+ const char *listfilename= NULL;
+ char **lightcurve_filenames;
+ int number_of_lightcurve_files;
+ int lightcurve_counter;
+ int number_of_candidates;
 
-  sr_f_counter++;
-  sr_f= realloc(sr_f, sr_f_counter * sizeof(double));
-  sr_f[sr_f_counter - 1]= sqrt(SRmax);
-  if( sr_best < sr_f[sr_f_counter - 1] )
-   sr_best= sr_f[sr_f_counter - 1];
-  //  fprintf(stdout,"%lf %lf\n",frequency,sqrt(SRmax)); //sqrt!
-  frequency+= BLS_FREQ_STEP;
- }
- //sr_mean=mean_double(sr_f,0,sr_f_counter);
- sr_mean= gsl_stats_mean(sr_f, 1, sr_f_counter);
- //sr_sd=sd_double(sr_f,sr_mean,sr_f_counter);
- sr_sd= gsl_stats_sd_m(sr_f, 1, sr_f_counter, sr_mean);
- snr= (sr_best - sr_mean) / sr_sd;
- fprintf(stdout, "%lf\n", snr);
- /*
- fprintf(stdout,"SDE=%.2lf (%.2lf required) ",snr,BLS_CUT);
- if( snr>BLS_CUT )
+ FILE *candidates_log;
+
+ if ( argc > 1 && 0 == strcmp( argv[1], "--all" ) ) {
+  batch_mode= 1;
+ } else if ( argc > 2 && 0 == strcmp( argv[1], "--batch" ) ) {
+  batch_mode= 1;
+  listfilename= argv[2];
+  // drop "--batch" from the argument list keeping the program name in argv[0]
+  argv[1]= argv[0];
+  argc--;
+  argv++;
+ }
+
+ if ( argc != 2 && argc != 4 ) {
+  fprintf( stderr, "Box Least Squares transit search (Kovacs, Zucker & Mazeh 2002)\n" );
+  fprintf( stderr, "Usage:\n Search for transits in one lightcurve\n  %s lightcurve.dat [Pmin Pmax]\n", argv[0] );
+  fprintf( stderr, " or search all the lightcurves listed in lightcurves.lst\n  %s --batch lightcurves.lst [Pmin Pmax]\n", argv[0] );
+  fprintf( stderr, " or search all the out*.dat lightcurves in the current directory\n  %s --all [Pmin Pmax]\n", argv[0] );
+  fprintf( stderr, "The default period range is %.3lf to %.3lf days. In the batch mode the results\nranked by SDE are written to %s\n", 1.0 / BLS_MAX_FREQ, 1.0 / BLS_MIN_FREQ, BLS_CANDIDATES_LOG_FILENAME );
+  fprintf( stderr, "Output columns: SDE Period(d) Epoch(JD) Duration(d) Depth(mag) N_in_transit N_points lightcurve\n" );
+  return 1;
+ }
+
+ if ( argc == 4 ) {
+  pmin= atof( argv[2] );
+  pmax= atof( argv[3] );
+  // Range check
+  if ( pmin <= 0.0 || pmax <= 0.0 ) {
+   fprintf( stderr, "ERROR: Pmin and Pmax should be > 0\n" );
+   return 1;
+  }
+  if ( pmin == pmax ) {
+   fprintf( stderr, "ERROR: Pmax should be > Pmin\n" );
+   return 1;
+  }
+  if ( pmin > pmax ) {
+   tmp_period_shuffle= pmax;
+   pmax= pmin;
+   pmin= tmp_period_shuffle;
+  }
+ }
+
+ memset( &lc, 0, sizeof( struct BLS_lightcurve ) );
+
+ if ( batch_mode == 0 ) {
+  if ( 0 != bls_search_lightcurve( argv[1], pmin, pmax, &lc, &single_result ) ) {
+   fprintf( stderr, "ERROR: cannot run the BLS search on %s (not enough points or too short time span?)\n", argv[1] );
+   free( lc.t );
+   free( lc.m );
+   free( lc.w );
+   return 1;
+  }
+  print_bls_result( stdout, &single_result );
+  free( lc.t );
+  free( lc.m );
+  free( lc.w );
   return 0;
- else
+ }
+
+ lightcurve_filenames= list_lightcurve_files_for_bls( listfilename, &number_of_lightcurve_files );
+ if ( lightcurve_filenames == NULL ) {
   return 1;
- */
+ }
+ results= malloc( ( number_of_lightcurve_files + 1 ) * sizeof( struct BLS_result ) );
+ if ( results == NULL ) {
+  fprintf( stderr, "ERROR in bls.c - cannot allocate memory\n" );
+  return 1;
+ }
+
+ fprintf( stderr, "Running BLS on %d lightcurves, period range %.5lf to %.5lf days\n", number_of_lightcurve_files, pmin, pmax );
+ for ( lightcurve_counter= 0; lightcurve_counter < number_of_lightcurve_files; lightcurve_counter++ ) {
+  bls_search_lightcurve( lightcurve_filenames[lightcurve_counter], pmin, pmax, &lc, &results[lightcurve_counter] );
+  if ( ( lightcurve_counter + 1 ) % 100 == 0 )
+   fprintf( stderr, "." );
+ }
+ fprintf( stderr, "\n" );
+
+ qsort( results, number_of_lightcurve_files, sizeof( struct BLS_result ), compare_bls_results_by_SDE );
+
+ candidates_log= fopen( BLS_CANDIDATES_LOG_FILENAME, "w" );
+ if ( NULL == candidates_log ) {
+  fprintf( stderr, "ERROR in bls.c - cannot open file %s for writing!\n", BLS_CANDIDATES_LOG_FILENAME );
+  return 1;
+ }
+ fprintf( candidates_log, "#  SDE     Period(d)       Epoch(JD)  Dur.(d) Depth(mag) Nin  Npts lightcurve\n" );
+ number_of_candidates= 0;
+ for ( lightcurve_counter= 0; lightcurve_counter < number_of_lightcurve_files; lightcurve_counter++ ) {
+  if ( results[lightcurve_counter].is_good == 0 )
+   continue;
+  print_bls_result( candidates_log, &results[lightcurve_counter] );
+  if ( results[lightcurve_counter].SDE > BLS_CUT )
+   number_of_candidates++;
+ }
+ fclose( candidates_log );
+
+ fprintf( stderr, "%d lightcurves have SDE>%.1lf, the ranked list is written to %s\n", number_of_candidates, BLS_CUT, BLS_CANDIDATES_LOG_FILENAME );
+
+ for ( lightcurve_counter= 0; lightcurve_counter < number_of_lightcurve_files; lightcurve_counter++ ) {
+  free( lightcurve_filenames[lightcurve_counter] );
+ }
+ free( lightcurve_filenames );
+ free( results );
+ free( lc.t );
+ free( lc.m );
+ free( lc.w );
+
+ return 0;
 }
@@ -35,6 +35,8 @@
 
 #define MIN_OBS_PERIOD_SEARCH 2 // that's very optimistic
 
+#define PERIODOGRAM_FREQUENCY_BLOCK 64 // number of frequencies computed with the trigonometric recurrence before re-evaluating sin() and cos()
+
 // INFINITY and NAN are undeclared in the older versions of GCC
 // if this is the case - define them using GCC builtin functions
 #ifndef INFINITY
@@ -183,64 +185,9 @@ unsigned long int random_seed() {
  return ( seed );
 }
 
-void compute_LS( double *jd, double *m, unsigned long N_obs, double f, double *LS_Power ) {
+double compute_variance( double *m, unsigned long N_obs ) {
  unsigned long i;
- double ReF, ImF, C, S, angle;
-
- double t, tau;
-
- double ReF2, ImF2;
-
  double mean, sigma_squared;
-
- // Compute tau:  Eq. (34) of 2018ApJS..236...16V
- ReF= ImF= 0.0;
- for ( i= N_obs; i--; ) {
-  // not sure if we should bother subtracting jd[0], but I'm afraid of large numbers
-  t= jd[i] - jd[0];
-  angle= FOURPI * f * t;
-#ifdef VAST_USE_SINCOS
-  sincos( angle, &S, &C );
-#else
-  C= cos( angle );
-  S= sin( angle );
-#endif
-  ImF+= S;
-  ReF+= C;
- }
- tau= 1.0 / ( FOURPI * f ) * atan2( ImF, ReF );
- //
-
- // Compute LS Power:  Eq. (33) of 2018ApJS..236...16V
- ReF2= ImF2= ReF= ImF= 0.0;
- // for(i=0;i<N_obs;i++){
- for ( i= N_obs; i--; ) {
-
-  // not sure if we should bother subtracting jd[0], but I'm afraid of large numbers
-  t= jd[i] - jd[0];
-  angle= TWOPI * f * ( t - tau );
-#ifdef VAST_USE_SINCOS
-  sincos( angle, &S, &C );
-#else
-  C= cos( angle );
-  S= sin( angle );
-#endif
-  ReF+= m[i] * C;
-  ImF+= m[i] * S;
-  ReF2+= C * C;
-  ImF2+= S * S;
- }
-
- // This how the LS periodogram is normalized in Eq. (10) of 1982ApJ...263..835S and Eq. (33) of 2018ApJS..236...16V
- // This is also astropy's 'psd' normalization when no errors are supplied.
- //(*LS_Power)= 0.5 * ( ReF*ReF/ReF2 + ImF*ImF/ImF2 );
- //
- // "Numerical recipes in C" 1992nrca.book.....P Eq. (13.8.4) shows that the above thing should be divided by
- // the variance of the data to get the normalization that can be used as the input of FAP calculations.
- // The same is reported by 1986ApJ...302..757H
- //
- // Actually, mean should be 0,0 as it only make sence to run the LS computation on the mean-subtracted lightcurve!
- // We compute it here just for the sake of completeness.
  mean= 0.0;
  for ( i= N_obs; i--; ) {
   mean+= m[i];
@@ -251,37 +198,109 @@ void compute_LS( double *jd, double *m, unsigned long N_obs, double f, double *L
   sigma_squared+= ( m[i] - mean ) * ( m[i] - mean );
  }
  sigma_squared= sigma_squared / (double)( N_obs - 1 );
- ( *LS_Power )= 1.0 / ( 2.0 * sigma_squared ) * ( ReF * ReF / ReF2 + ImF * ImF / ImF2 );
- //
+ return sigma_squared;
+}
 
- return;
+// Lomb-Scargle power from the trigonometric sums computed at the angular frequency w:
+// mC = sum m*cos(wt), mS = sum m*sin(wt), CC = sum cos^2(wt), SS = sum sin^2(wt), CS = sum cos(wt)*sin(wt)
+// The time offset tau is determined by Eq. (34) of 2018ApJS..236...16V as
+// 2*w*tau = atan2( sum sin(2wt), sum cos(2wt) ) = atan2( 2*CS, CC - SS ),
+// the sums in Eq. (33) are then obtained by rotating the above ones by w*tau.
+double LS_power_from_trigonometric_sums( double mC, double mS, double CC, double SS, double CS, double sigma_squared ) {
+ double wtau, cos_wtau, sin_wtau;
+ double ReF, ImF, ReF2, ImF2;
+
+ wtau= 0.5 * atan2( 2.0 * CS, CC - SS );
+ cos_wtau= cos( wtau );
+ sin_wtau= sin( wtau );
+
+ ReF= cos_wtau * mC + sin_wtau * mS;
+ ImF= cos_wtau * mS - sin_wtau * mC;
+ ReF2= cos_wtau * cos_wtau * CC + 2.0 * cos_wtau * sin_wtau * CS + sin_wtau * sin_wtau * SS;
+ ImF2= sin_wtau * sin_wtau * CC - 2.0 * cos_wtau * sin_wtau * CS + cos_wtau * cos_wtau * SS;
+
+ // This how the LS periodogram is normalized in Eq. (10) of 1982ApJ...263..835S and Eq. (33) of 2018ApJS..236...16V
+ // This is also astropy's 'psd' normalization when no errors are supplied.
+ //
+ // "Numerical recipes in C" 1992nrca.book.....P Eq. (13.8.4) shows that the above thing should be divided by
+ // the variance of the data to get the normalization that can be used as the input of FAP calculations.
+ // The same is reported by 1986ApJ...302..757H
+ return 1.0 / ( 2.0 * sigma_squared ) * ( ReF * ReF / ReF2 + ImF * ImF / ImF2 );
 }
 
-void compute_DFT( double *jd, double *m, unsigned long N_obs, double f, double *DFT, double T_DFT ) {
- unsigned long i;
- double ReF, ImF, C, S, angle, dN_obs;
+// Compute the Deeming DFT and Lomb-Scargle periodograms (and, optionally, their spectral windows)
+// for the frequencies fmin + k * df with k in [k_start, k_end).
+// Instead of evaluating sin() and cos() for every frequency-observation pair, cos(wt) and sin(wt)
+// are evaluated once per observation at the start of the block and then advanced to the next frequency
+// with the rotation by the angle 2*pi*df*t. The block length is limited by PERIODOGRAM_FREQUENCY_BLOCK
+// so the round-off errors accumulated by the recurrence stay negligible.
+// The inner loop runs over observations and is vectorizable.
+// t[] is the time since the first observation, cos_wt, sin_wt, cos_dwt, sin_dwt are work arrays of N_obs elements.
+void compute_DFT_and_LS_for_frequency_block( double *t, double *m, unsigned long N_obs, double fmin, double df, unsigned long k_start, unsigned long k_end,
+                                             double T_DFT, double sigma_squared, double sigma_squared_window,
+                                             double *DFT, double *DFT_window, double *LS_Power, double *LS_window,
+                                             double *cos_wt, double *sin_wt, double *cos_dwt, double *sin_dwt ) {
+ unsigned long i, k;
+ double angle, C, S;
+ double mC, mS, sum_C, sum_S, CC, SS, CS;
+ double dN_obs;
 
- ReF= ImF= 0.0;
- // for(i=0;i<N_obs;i++){
- for ( i= N_obs; i--; ) {
-  angle= TWOPI * f * ( jd[i] - jd[0] );
-// not sure if we should bother subtracting jd[0], but I'm afraid of large numbers
+ dN_obs= (double)N_obs;
+
+ for ( i= 0; i < N_obs; i++ ) {
+  // not sure if we should bother subtracting jd[0], but I'm afraid of large numbers (t[i] is already jd[i]-jd[0])
+  angle= TWOPI * ( fmin + (double)k_start * df ) * t[i];
 #ifdef VAST_USE_SINCOS
-  sincos( angle, &S, &C );
+  sincos( angle, &sin_wt[i], &cos_wt[i] );
 #else
-  C= cos( angle );
-  S= sin( angle );
+  cos_wt[i]= cos( angle );
+  sin_wt[i]= sin( angle );
+#endif
+  angle= TWOPI * df * t[i];
+#ifdef VAST_USE_SINCOS
+  sincos( angle, &sin_dwt[i], &cos_dwt[i] );
+#else
+  cos_dwt[i]= cos( angle );
+  sin_dwt[i]= sin( angle );
 #endif
-  ReF+= m[i] * C;
-  ImF+= m[i] * S;
  }
 
- dN_obs= (double)N_obs;
- // New normalization consistent with 2014MNRAS.445..437M
- // The multiplicative factor is a normalization, such that the integral
- // from f_i to f_f is equal to the variance contributed to the light curve
- // in this frequency range.
- ( *DFT )= 2.0 * T_DFT / ( dN_obs * dN_obs ) * ( ReF * ReF + ImF * ImF );
+ for ( k= k_start; k < k_end; k++ ) {
+  mC= mS= sum_C= sum_S= CC= SS= CS= 0.0;
+#if defined( _OPENMP ) && _OPENMP >= 201307
+#pragma omp simd private( C, S ) reduction( + : mC, mS, sum_C, sum_S, CC, SS, CS )
+#endif
+  for ( i= 0; i < N_obs; i++ ) {
+   C= cos_wt[i];
+   S= sin_wt[i];
+   mC+= m[i] * C;
+   mS+= m[i] * S;
+   sum_C+= C;
+   sum_S+= S;
+   CC+= C * C;
+   SS+= S * S;
+   CS+= C * S;
+   // advance to the next frequency
+   cos_wt[i]= C * cos_dwt[i] - S * sin_dwt[i];
+   sin_wt[i]= S * cos_dwt[i] + C * sin_dwt[i];
+  }
+  if ( NULL != DFT ) {
+   // New normalization consistent with 2014MNRAS.445..437M
+   // The multiplicative factor is a normalization, such that the integral
+   // from f_i to f_f is equal to the variance contributed to the light curve
+   // in this frequency range.
+   DFT[k]= 2.0 * T_DFT / ( dN_obs * dN_obs ) * ( mC * mC + mS * mS );
+   if ( NULL != DFT_window ) {
+    DFT_window[k]= 2.0 * T_DFT / ( dN_obs * dN_obs ) * ( sum_C * sum_C + sum_S * sum_S );
+   }
+  }
+  if ( NULL != LS_Power ) {
+   LS_Power[k]= LS_power_from_trigonometric_sums( mC, mS, CC, SS, CS, sigma_squared );
+   if ( NULL != LS_window ) {
+    LS_window[k]= LS_power_from_trigonometric_sums( sum_C, sum_S, CC, SS, CS, sigma_squared_window );
+   }
+  }
+ }
 
  return;
 }
@@ -414,20 +433,19 @@ double compute_LK_reciprocal_theta( double *jd, double *m, unsigned long N_obs,
  return sum2 / sum1; // 1.0/theta;
 }
 
-int main( int argc, char **argv ) {
+// Compute the periodograms for one lightcurve file and print the highest peaks to stdout.
+// If batch_mode is set, the output lines are prefixed with the lightcurve file name, the header line
+// is not printed and the periodogram files are not written (so the spectral window is not computed).
+// Returns 0 on success.
+int compute_periodogram_for_lightcurve( char *lightcurvefilename, double pmax, double pmin, double step, int shuffle_iterations, gsl_rng *r,
+                                        int compute_LombScargle, int compute_Deeming, int compute_LK, int batch_mode ) {
 
  FILE *lcfile= NULL;
  FILE *LK_periodogramfile= NULL;
  FILE *DFT_periodogramfile= NULL;
  FILE *LS_periodogramfile= NULL;
 
- double pmax;
- double pmin;
- double step;
- double tmp_period_shuffle;
-
  int shuffle_iteration;
- int shuffle_iterations= 0;
 
  double fmin; //=1.0/pmax;
  double fmax; //=1.0/pmin;
@@ -435,6 +453,7 @@ int main( int argc, char **argv ) {
 
  // the number of frequencies will be determined later based on the JD range of observations
  unsigned long N_freq;
+ unsigned long N_freq_blocks;
  double *freq= NULL;
  double *power= NULL;
  double *power_LS= NULL;
@@ -446,6 +465,7 @@ int main( int argc, char **argv ) {
  double *jd= NULL;
  double *m= NULL;
  double *m_fake= NULL;
+ double *t= NULL; // jd - jd[0]
 
  double merr, x, y, app;       // not actually used, needed for compatibility with read_lightcurve_point()
  char string[FILENAME_LENGTH]; // used for comaptibility with read_lightcurve_point() and re-used later
@@ -478,17 +498,12 @@ int main( int argc, char **argv ) {
 
  double T_DFT; // f_Nyq = N/2T_DFT is the Nyquist frequency as defined in 2014MNRAS.445..437M
 
- char temporary_string_for_line_counter[MAX_STRING_LENGTH_IN_LIGHTCURVE_FILE];
+ double sigma_squared;
+ double sigma_squared_window= 0.0;
 
- // RNG initialization
- const gsl_rng_type *RNG_TYPE;
- gsl_rng *r= NULL;
+ int compute_spectral_window;
 
- // Select operation mode
- // Use all methods by default
- int compute_LombScargle= 1; // 1 - yes, 0 - no
- int compute_Deeming= 1;     // 1 - yes, 0 - no
- int compute_LK= 1;          // 1 - yes, 0 - no
+ char temporary_string_for_line_counter[MAX_STRING_LENGTH_IN_LIGHTCURVE_FILE];
 
  // FAP-related variables
  unsigned long N_freq_presumably_independent;
@@ -498,94 +513,16 @@ int main( int argc, char **argv ) {
  double FAP;
  double FAP__HorneBaliunas_style;
 
- if ( argc < 5 ) {
-  fprintf( stderr, "Usage:\n Search for the best period\n  %s lightcurve.dat Pmax Pmin Step\n or search for the best period AND estimeate it's significance through lightcurve shuffling\n  %s lightcurve.dat Pmax Pmin Step Niterations\n", argv[0], argv[0] );
-  return 1;
+ // The spectral window is needed only for the periodogram files
+ compute_spectral_window= 0;
+ if ( shuffle_iterations == 0 && batch_mode == 0 ) {
+  compute_spectral_window= 1;
  }
 
- pmax= atof( argv[2] );
- pmin= atof( argv[3] );
- step= atof( argv[4] );
-
- // Range check
- if ( pmax <= 0.0 ) {
-  fprintf( stderr, "ERROR: pmax should be > 0\n" );
-  return 1;
- }
- if ( pmin <= 0.0 ) {
-  fprintf( stderr, "ERROR: pmin should be > 0\n" );
-  return 1;
- }
- if ( pmin == pmax ) {
-  fprintf( stderr, "ERROR: pmax should be > pmin\n" );
-  return 1;
- }
- if ( pmin > pmax ) {
-  // fprintf(stderr,"WARNING: pmax should be > pmin, assuming the input order is mixed-up\n");
-  tmp_period_shuffle= pmax;
-  pmax= pmin;
-  pmin= tmp_period_shuffle;
- }
- if ( step <= 0.0 ) {
-  fprintf( stderr, "ERROR: the phase step should be > 0\n" );
-  return 1;
- }
- if ( step > 0.5 ) {
-  fprintf( stderr, "ERROR: the phase step should be < 0.5\n" );
-  return 1;
- }
-
- shuffle_iterations= 0;
- if ( argc == 6 ) {
-  shuffle_iterations= atoi( argv[5] );
-  // Check range!
-  if ( shuffle_iterations < 0 ) {
-   fprintf( stderr, "ERROR: the number of shuffle iteration cannot be <0\n" );
-   return 1;
-  }
-  if ( shuffle_iterations > 1000000 ) {
-   fprintf( stderr, "ERROR: the number of shuffle iteration cannot be >1000000\n" );
-   return 1;
-  }
- }
- if ( shuffle_iterations > 0 )
-  fprintf( stderr, "Lightcurve shuffle iterations: %d\n", shuffle_iterations );
-
- // if we'll be shuffling the lightcurve
- if ( shuffle_iterations > 0 ) {
-  // create a generator chosen by the
-  //  environment variable GSL_RNG_TYPE
-  gsl_rng_env_setup();
-  RNG_TYPE= gsl_rng_default;
-  r= gsl_rng_alloc( RNG_TYPE );
-  gsl_rng_set( r, random_seed() ); // set random seed
- }
- // done RNG initialization
-
- if ( 0 == strcmp( "deeming_compute_periodogram", basename( argv[0] ) ) ) {
-  // Only Deeming
-  compute_LombScargle= 0; // 1 - yes, 0 - no
-  compute_Deeming= 1;     // 1 - yes, 0 - no
-  compute_LK= 0;          // 1 - yes, 0 - no
- }
- if ( 0 == strcmp( "lk_compute_periodogram", basename( argv[0] ) ) ) {
-  // Only LK
-  compute_LombScargle= 0; // 1 - yes, 0 - no
-  compute_Deeming= 0;     // 1 - yes, 0 - no
-  compute_LK= 1;          // 1 - yes, 0 - no
- }
- if ( 0 == strcmp( "ls_compute_periodogram", basename( argv[0] ) ) ) {
-  // Only LombScargle
-  compute_LombScargle= 1; // 1 - yes, 0 - no
-  compute_Deeming= 0;     // 1 - yes, 0 - no
-  compute_LK= 0;          // 1 - yes, 0 - no
- }
- //
-
  // Read the input lightcurve file
- lcfile= fopen( argv[1], "r" );
+ lcfile= fopen( lightcurvefilename, "r" );
  if ( lcfile == NULL ) {
-  fprintf( stderr, "ERROR opening the lightcurve file %s\n", argv[1] );
+  fprintf( stderr, "ERROR opening the lightcurve file %s\n", lightcurvefilename );
   return 1;
  }
 
@@ -618,9 +555,15 @@ int main( int argc, char **argv ) {
   fclose( lcfile );
   return 1;
  }
+ t= malloc( N_obs * sizeof( double ) );
+ if ( t == NULL ) {
+  fprintf( stderr, "ERROR: allocating memory for the t array!\n" );
+  fclose( lcfile );
+  return 1;
+ }
  if ( compute_Deeming == 1 || compute_LombScargle == 1 ) {
   // if this is one iteration and the Deeming or LombScargle method is to be used - we'll also need the spectral window
-  if ( shuffle_iterations == 0 ) {
+  if ( compute_spectral_window == 1 ) {
    m_fake= malloc( N_obs * sizeof( double ) );
    if ( m_fake == NULL ) {
     fprintf( stderr, "ERROR: allocating memory for the m_fake array!\n" );
@@ -648,9 +591,10 @@ int main( int argc, char **argv ) {
   fprintf( stderr, "ERROR: too few observations in the input lightcurve: %ld<5 \n", N_obs );
   free( m );
   free( jd );
+  free( t );
   //
   if ( compute_Deeming == 1 || compute_LombScargle == 1 ) {
-   if ( shuffle_iterations == 0 ) {
+   if ( compute_spectral_window == 1 ) {
     free( m_fake );
    }
   }
@@ -666,9 +610,14 @@ int main( int argc, char **argv ) {
  // also for the stuff below we need the sorted lightcurve
  // f_Nyq = N/2T_DFT is the Nyquist frequency as defined in 2014MNRAS.445..437M
  T_DFT= (double)N_obs * ( jd[N_obs - 1] - jd[0] ) / (double)( N_obs - 1 );
- // we compute T_DFT once here and then pass to compute_DFT()
+ // we compute T_DFT once here and then pass to compute_DFT_and_LS_for_frequency_block()
  // so we don't need to recompute it every time
 
+ // not sure if we should bother subtracting jd[0], but I'm afraid of large numbers
+ for ( i= 0; i < N_obs; i++ ) {
+  t[i]= jd[i] - jd[0];
+ }
+
  get_min_max( jd, N_obs, &jdmin, &jdmax );
  T= jdmax - jdmin;
 
@@ -679,6 +628,7 @@ int main( int argc, char **argv ) {
  // Get number of frequencies in the spectrum
  df= step / T;
  N_freq= (unsigned long)( ( fmax - fmin ) / df + 0.5 );
+ N_freq_blocks= ( N_freq + PERIODOGRAM_FREQUENCY_BLOCK - 1 ) / PERIODOGRAM_FREQUENCY_BLOCK;
 
  // compute mean magnitude (M) here
  for ( M= 0.0, i= 0; i < N_obs; i++ ) {
@@ -690,6 +640,14 @@ int main( int argc, char **argv ) {
   m[i]-= M;
  }
 
+ // The variance is not changed by shuffling, so we compute it only once
+ // Actually, mean should be 0,0 as it only make sence to run the LS computation on the mean-subtracted lightcurve!
+ // We compute it here just for the sake of completeness.
+ sigma_squared= compute_variance( m, N_obs );
+ if ( compute_spectral_window == 1 ) {
+  sigma_squared_window= compute_variance( m_fake, N_obs );
+ }
+
  freq= malloc( N_freq * sizeof( double ) );
  if ( compute_LombScargle == 1 ) {
   power_LS= malloc( N_freq * sizeof( double ) );
@@ -698,12 +656,12 @@ int main( int argc, char **argv ) {
   power= malloc( N_freq * sizeof( double ) );
  }
  if ( compute_Deeming == 1 ) {
-  if ( shuffle_iterations == 0 ) {
+  if ( compute_spectral_window == 1 ) {
    spectral_window= malloc( N_freq * sizeof( double ) );
   }
  }
  if ( compute_LombScargle == 1 ) {
-  if ( shuffle_iterations == 0 ) {
+  if ( compute_spectral_window == 1 ) {
    spectral_window_LS= malloc( N_freq * sizeof( double ) );
   }
  }
@@ -711,6 +669,10 @@ int main( int argc, char **argv ) {
   theta= malloc( N_freq * sizeof( double ) );
  }
 
+ for ( i= 0; i < N_freq; i++ ) {
+  freq[i]= fmin + i * df;
+ }
+
  // +1 as we always want at least one iteration - the run at the original non-shuffled lightcurve
  for ( shuffle_iteration= 0; shuffle_iteration < shuffle_iterations + 1; shuffle_iteration++ ) {
 
@@ -719,27 +681,44 @@ int main( int argc, char **argv ) {
    gsl_ran_shuffle( r, m, N_obs, sizeof( double ) );
   }
 
-// Main loop in frequency
+  // Main loop in frequency: Deeming and LombScargle are computed block-by-block
+  if ( compute_Deeming == 1 || compute_LombScargle == 1 ) {
 #ifdef VAST_ENABLE_OPENMP
 #ifdef _OPENMP
-#pragma omp parallel for private( i )
+#pragma omp parallel private( i )
 #endif
 #endif
-  for ( i= 0; i < N_freq; i++ ) {
-   freq[i]= fmin + i * df;
-   if ( compute_LombScargle == 1 ) {
-    compute_LS( jd, m, N_obs, freq[i], &power_LS[i] );
-    if ( shuffle_iterations == 0 ) {
-     compute_LS( jd, m_fake, N_obs, freq[i], &spectral_window_LS[i] );
+   {
+    unsigned long i_block;
+    // work arrays for the trigonometric recurrence, one set per thread
+    double *cos_wt= malloc( 4 * N_obs * sizeof( double ) );
+    if ( cos_wt == NULL ) {
+     fprintf( stderr, "ERROR: allocating memory for the trigonometric recurrence work arrays!\n" );
+     exit( EXIT_FAILURE );
     }
-   }
-   if ( compute_Deeming == 1 ) {
-    compute_DFT( jd, m, N_obs, freq[i], &power[i], T_DFT );
-    if ( shuffle_iterations == 0 ) {
-     compute_DFT( jd, m_fake, N_obs, freq[i], &spectral_window[i], T_DFT );
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp for schedule( dynamic )
+#endif
+#endif
+    for ( i_block= 0; i_block < N_freq_blocks; i_block++ ) {
+     i= i_block * PERIODOGRAM_FREQUENCY_BLOCK;
+     compute_DFT_and_LS_for_frequency_block( t, m, N_obs, fmin, df, i, MIN( i + PERIODOGRAM_FREQUENCY_BLOCK, N_freq ),
+                                             T_DFT, sigma_squared, sigma_squared_window,
+                                             power, spectral_window, power_LS, spectral_window_LS,
+                                             cos_wt, cos_wt + N_obs, cos_wt + 2 * N_obs, cos_wt + 3 * N_obs );
     }
+    free( cos_wt );
    }
-   if ( compute_LK == 1 ) {
+  }
+
+  if ( compute_LK == 1 ) {
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for private( i )
+#endif
+#endif
+   for ( i= 0; i < N_freq; i++ ) {
     theta[i]= compute_LK_reciprocal_theta( jd, m, N_obs, freq[i], 0.0 ); // mean mag is always 0.0 as we subtracted it from the LC
    }
   }
@@ -820,18 +799,19 @@ int main( int argc, char **argv ) {
 
  } // for(shuffle_iteration=0;shuffle_iteration<shuffle_iterations;shuffle_iteration++){
 
- // if we've ben shuffling the lightcurve
- if ( shuffle_iterations > 0 ) {
-  gsl_rng_free( r ); // RNG de-allocation
- }
-
  free( jd );
  free( m );
+ free( t );
 
  // Print out the results
  /////////////////5.1750108489 23.627805 LS  FAP=
- fprintf( stdout, "Peak_Freq(c/d) Power Type  Notes\n" );
+ if ( batch_mode == 0 ) {
+  fprintf( stdout, "Peak_Freq(c/d) Power Type  Notes\n" );
+ }
  if ( compute_LombScargle == 1 ) {
+  if ( batch_mode == 1 ) {
+   fprintf( stdout, "%s ", lightcurvefilename );
+  }
   fprintf( stdout, "%.10lf %lf", noshuffle_LS_periodogram_max_freq, noshuffle_LS_periodogram_max );
   if ( shuffle_iterations > 0 )
    fprintf( stdout, "  %lf +/- %lf", LS_p, sqrt( (double)LS_shuffled_peak_counter ) / (double)shuffle_iterations );
@@ -871,19 +851,25 @@ FAP_HB= %lg for %lg presumably independent frequencies computed Horne & Baliunas
   //
  }
  if ( compute_Deeming == 1 ) {
+  if ( batch_mode == 1 ) {
+   fprintf( stdout, "%s ", lightcurvefilename );
+  }
   fprintf( stdout, "%.10lf %lf", noshuffle_DFT_periodogram_max_freq, noshuffle_DFT_periodogram_max );
   if ( shuffle_iterations > 0 )
    fprintf( stdout, "  %lf +/- %lf", DFT_p, sqrt( (double)DFT_shuffled_peak_counter ) / (double)shuffle_iterations );
   fprintf( stdout, " DFT\n" );
  }
  if ( compute_LK == 1 ) {
+  if ( batch_mode == 1 ) {
+   fprintf( stdout, "%s ", lightcurvefilename );
+  }
   fprintf( stdout, "%.10lf %lf", noshuffle_LK_periodogram_max_freq, noshuffle_LK_periodogram_max );
   if ( shuffle_iterations > 0 )
    fprintf( stdout, "  %lf +/- %lf", LK_p, sqrt( (double)LK_shuffled_peak_counter ) / (double)shuffle_iterations );
   fprintf( stdout, " LK\n" );
  }
 
- if ( shuffle_iterations == 0 ) {
+ if ( compute_spectral_window == 1 ) {
   // Write the output files
   if ( compute_LK == 1 ) {
    LK_periodogramfile= fopen( "lk.periodogram", "w" );
@@ -946,20 +932,166 @@ FAP_HB= %lg for %lg presumably independent frequencies computed Horne & Baliunas
   free( power_LS );
  }
  if ( compute_Deeming == 1 || compute_LombScargle == 1 ) {
-  if ( shuffle_iterations == 0 ) {
+  if ( compute_spectral_window == 1 ) {
    free( m_fake );
   }
  }
  if ( compute_Deeming == 1 ) {
-  if ( shuffle_iterations == 0 ) {
+  if ( compute_spectral_window == 1 ) {
    free( spectral_window );
   }
  }
  if ( compute_LombScargle == 1 ) {
-  if ( shuffle_iterations == 0 ) {
+  if ( compute_spectral_window == 1 ) {
    free( spectral_window_LS );
   }
  }
 
  return 0;
 }
+
+int main( int argc, char **argv ) {
+
+ double pmax;
+ double pmin;
+ double step;
+ double tmp_period_shuffle;
+
+ int shuffle_iterations= 0;
+
+ // RNG initialization
+ const gsl_rng_type *RNG_TYPE;
+ gsl_rng *r= NULL;
+
+ // Select operation mode
+ // Use all methods by default
+ int compute_LombScargle= 1; // 1 - yes, 0 - no
+ int compute_Deeming= 1;     // 1 - yes, 0 - no
+ int compute_LK= 1;          // 1 - yes, 0 - no
+
+ // Batch mode: process all the lightcurves listed in a file in one run
+ int batch_mode= 0;
+ FILE *lightcurvelistfile;
+ char lightcurvefilename[FILENAME_LENGTH];
+
+ int return_code;
+
+ if ( argc > 1 && 0 == strcmp( argv[1], "--batch" ) ) {
+  batch_mode= 1;
+  // drop "--batch" from the argument list keeping the program name in argv[0]
+  argv[1]= argv[0];
+  argc--;
+  argv++;
+ }
+
+ if ( argc < 5 ) {
+  fprintf( stderr, "Usage:\n Search for the best period\n  %s lightcurve.dat Pmax Pmin Step\n or search for the best period AND estimeate it's significance through lightcurve shuffling\n  %s lightcurve.dat Pmax Pmin Step Niterations\n", argv[0], argv[0] );
+  fprintf( stderr, " or search for the best period in each lightcurve listed in lightcurves.lst (one output line per lightcurve and method)\n  %s --batch lightcurves.lst Pmax Pmin Step [Niterations]\n", argv[0] );
+  return 1;
+ }
+
+ pmax= atof( argv[2] );
+ pmin= atof( argv[3] );
+ step= atof( argv[4] );
+
+ // Range check
+ if ( pmax <= 0.0 ) {
+  fprintf( stderr, "ERROR: pmax should be > 0\n" );
+  return 1;
+ }
+ if ( pmin <= 0.0 ) {
+  fprintf( stderr, "ERROR: pmin should be > 0\n" );
+  return 1;
+ }
+ if ( pmin == pmax ) {
+  fprintf( stderr, "ERROR: pmax should be > pmin\n" );
+  return 1;
+ }
+ if ( pmin > pmax ) {
+  // fprintf(stderr,"WARNING: pmax should be > pmin, assuming the input order is mixed-up\n");
+  tmp_period_shuffle= pmax;
+  pmax= pmin;
+  pmin= tmp_period_shuffle;
+ }
+ if ( step <= 0.0 ) {
+  fprintf( stderr, "ERROR: the phase step should be > 0\n" );
+  return 1;
+ }
+ if ( step > 0.5 ) {
+  fprintf( stderr, "ERROR: the phase step should be < 0.5\n" );
+  return 1;
+ }
+
+ shuffle_iterations= 0;
+ if ( argc == 6 ) {
+  shuffle_iterations= atoi( argv[5] );
+  // Check range!
+  if ( shuffle_iterations < 0 ) {
+   fprintf( stderr, "ERROR: the number of shuffle iteration cannot be <0\n" );
+   return 1;
+  }
+  if ( shuffle_iterations > 1000000 ) {
+   fprintf( stderr, "ERROR: the number of shuffle iteration cannot be >1000000\n" );
+   return 1;
+  }
+ }
+ if ( shuffle_iterations > 0 )
+  fprintf( stderr, "Lightcurve shuffle iterations: %d\n", shuffle_iterations );
+
+ // if we'll be shuffling the lightcurve
+ if ( shuffle_iterations > 0 ) {
+  // create a generator chosen by the
+  //  environment variable GSL_RNG_TYPE
+  gsl_rng_env_setup();
+  RNG_TYPE= gsl_rng_default;
+  r= gsl_rng_alloc( RNG_TYPE );
+  gsl_rng_set( r, random_seed() ); // set random seed
+ }
+ // done RNG initialization
+
+ if ( 0 == strcmp( "deeming_compute_periodogram", basename( argv[0] ) ) ) {
+  // Only Deeming
+  compute_LombScargle= 0; // 1 - yes, 0 - no
+  compute_Deeming= 1;     // 1 - yes, 0 - no
+  compute_LK= 0;          // 1 - yes, 0 - no
+ }
+ if ( 0 == strcmp( "lk_compute_periodogram", basename( argv[0] ) ) ) {
+  // Only LK
+  compute_LombScargle= 0; // 1 - yes, 0 - no
+  compute_Deeming= 0;     // 1 - yes, 0 - no
+  compute_LK= 1;          // 1 - yes, 0 - no
+ }
+ if ( 0 == strcmp( "ls_compute_periodogram", basename( argv[0] ) ) ) {
+  // Only LombScargle
+  compute_LombScargle= 1; // 1 - yes, 0 - no
+  compute_Deeming= 0;     // 1 - yes, 0 - no
+  compute_LK= 0;          // 1 - yes, 0 - no
+ }
+ //
+
+ if ( batch_mode == 0 ) {
+  return_code= compute_periodogram_for_lightcurve( argv[1], pmax, pmin, step, shuffle_iterations, r, compute_LombScargle, compute_Deeming, compute_LK, 0 );
+ } else {
+  lightcurvelistfile= fopen( argv[1], "r" );
+  if ( NULL == lightcurvelistfile ) {
+   fprintf( stderr, "ERROR opening the list of lightcurve files %s\n", argv[1] );
+   return_code= 1;
+  } else {
+   return_code= 0;
+   while ( 1 == fscanf( lightcurvelistfile, "%s", lightcurvefilename ) ) {
+    lightcurvefilename[FILENAME_LENGTH - 1]= '\0'; // just in case
+    if ( 0 != compute_periodogram_for_lightcurve( lightcurvefilename, pmax, pmin, step, shuffle_iterations, r, compute_LombScargle, compute_Deeming, compute_LK, 1 ) ) {
+     fprintf( stderr, "WARNING: cannot compute the periodogram for %s\n", lightcurvefilename );
+    }
+   }
+   fclose( lightcurvelistfile );
+  }
+ }
+
+ // if we've ben shuffling the lightcurve
+ if ( shuffle_iterations > 0 ) {
+  gsl_rng_free( r ); // RNG de-allocation
+ }
+
+ return return_code;
+}
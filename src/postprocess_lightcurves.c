@@ -0,0 +1,804 @@
+// Post-process the lightcurves (out*.dat files) produced by VaST in one run:
+// sort the measurements in JD, remove measurements obtained from bad images,
+// sigma-clip outliers and delete lightcurves with too few points.
+//
+// The stages have the same semantics and are applied in the same order as
+// lib/sort_all_lightcurve_files_in_jd, lib/remove_bad_images, lib/new_lightcurve_sigma_filter
+// and lib/remove_lightcurves_with_small_number_of_points started one after another,
+// but a lightcurve is kept in memory while it passes through the stages and is written to disk at most once.
+// The only thing that needs a look at all the lightcurves before any of them may be modified
+// is the bad image search, so if bad images are found (or sigma-clipping is requested)
+// the lightcurves are read for the second time.
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <getopt.h>
+
+#include <gsl/gsl_sort.h>
+#include <gsl/gsl_statistics_double.h>
+
+#include "vast_limits.h"
+#include "lightcurve_io.h"
+#include "variability_indexes.h" // for esimate_sigma_from_MAD_of_sorted_data() and compare_double()
+#include "quickselect.h"         // for quickselect_median_double()
+
+#define POSTPROCESS_LIGHTCURVES_MAX_SIGMA_CLIP_ITERATIONS 10
+
+// The whole content of a lightcurve file
+struct Lightcurve_text {
+ char *text;
+ size_t length;
+};
+
+// One line of a lightcurve file as it would be returned by fgets()
+struct Lightcurve_line {
+ double julian_date;
+ size_t start;
+ size_t length;
+};
+
+// Growable arrays for the measurements parsed from a lightcurve
+struct Lightcurve_points {
+ double *jd;
+ double *mag;
+ long n;
+ long allocated;
+};
+
+// Per-image outlier statistics collected by the bad image search.
+// JD is used as the image ID, the images are stored in the order they are first encountered
+// and image_index_sorted_in_jd[] allows for a fast binary search of an image by its JD.
+struct Image_outlier_statistics {
+ double *image_jd;
+ int *image_Nall;
+ int *image_Noutliers;
+ long *image_index_sorted_in_jd;
+ long image_Number;
+ long allocated;
+};
+
+static int is_lightcurve_filename( const char *filename ) {
+ size_t filenamelen;
+ filenamelen= strlen( filename );
+ if ( filenamelen < 8 ) {
+  return 0; // make sure the filename is not too short for the following tests
+ }
+ if ( filename[0] == 'o' && filename[1] == 'u' && filename[2] == 't' && filename[filenamelen - 1] == 't' && filename[filenamelen - 2] == 'a' && filename[filenamelen - 3] == 'd' ) {
+  return 1;
+ }
+ return 0;
+}
+
+static int read_lightcurve_text( const char *filename, struct Lightcurve_text *lc ) {
+ FILE *lightcurvefile;
+ long filesize;
+
+ lc->text= NULL;
+ lc->length= 0;
+ lightcurvefile= fopen( filename, "r" );
+ if ( NULL == lightcurvefile ) {
+  fprintf( stderr, "ERROR: Can't open file %s\n", filename );
+  return 1;
+ }
+ fseek( lightcurvefile, 0, SEEK_END );
+ filesize= ftell( lightcurvefile );
+ fseek( lightcurvefile, 0, SEEK_SET );
+ if ( filesize < 0 ) {
+  fprintf( stderr, "ERROR: Can't get the size of %s\n", filename );
+  fclose( lightcurvefile );
+  return 1;
+ }
+ lc->text= malloc( (size_t)filesize + 1 );
+ if ( NULL == lc->text ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for the lightcurve %s\n", filename );
+  fclose( lightcurvefile );
+  return 1;
+ }
+ lc->length= fread( lc->text, sizeof( char ), (size_t)filesize, lightcurvefile );
+ lc->text[lc->length]= '\0';
+ fclose( lightcurvefile );
+ return 0;
+}
+
+static int write_lightcurve_text( const char *filename, struct Lightcurve_text *lc ) {
+ FILE *outlightcurvefile;
+ char lightcurve_tmp_filename[FILENAME_LENGTH + 8];
+
+ snprintf( lightcurve_tmp_filename, sizeof( lightcurve_tmp_filename ), "%s.tmp", filename );
+ outlightcurvefile= fopen( lightcurve_tmp_filename, "w" );
+ if ( NULL == outlightcurvefile ) {
+  fprintf( stderr, "ERROR: Can't open file %s\n", lightcurve_tmp_filename );
+  return 1;
+ }
+ if ( lc->length != fwrite( lc->text, sizeof( char ), lc->length, outlightcurvefile ) ) {
+  fprintf( stderr, "ERROR writing %s\n", lightcurve_tmp_filename );
+  fclose( outlightcurvefile );
+  unlink( lightcurve_tmp_filename );
+  return 1;
+ }
+ fclose( outlightcurvefile );
+ unlink( filename );                          // delete old lightcurve file
+ rename( lightcurve_tmp_filename, filename ); // move the temporary file to lightcurve file
+ return 0;
+}
+
+// Open the in-memory lightcurve for reading with read_lightcurve_point().
+// Returns NULL for an empty lightcurve.
+static FILE *open_lightcurve_text( struct Lightcurve_text *lc ) {
+ FILE *lightcurvefile;
+ if ( lc->length == 0 ) {
+  return NULL;
+ }
+ lightcurvefile= fmemopen( lc->text, lc->length, "r" );
+ if ( NULL == lightcurvefile ) {
+  fprintf( stderr, "ERROR in open_lightcurve_text(): fmemopen() failed\n" );
+ }
+ return lightcurvefile;
+}
+
+// The length of the line starting at the given position that fgets() would read
+static size_t lightcurve_line_length( const char *text, size_t length, size_t start ) {
+ size_t n;
+ for ( n= 0; start + n < length && n < MAX_STRING_LENGTH_IN_LIGHTCURVE_FILE - 1; ) {
+  n++;
+  if ( text[start + n - 1] == '\n' ) {
+   break;
+  }
+ }
+ return n;
+}
+
+static int compare_julian_date( const void *a, const void *b ) {
+ double date_a= ( (const struct Lightcurve_line *)a )->julian_date;
+ double date_b= ( (const struct Lightcurve_line *)b )->julian_date;
+ return ( date_a > date_b ) - ( date_a < date_b );
+}
+
+// Sort the lines of the lightcurve in JD (the same way lib/sort_all_lightcurve_files_in_jd does)
+// Returns 0 if the lightcurve was already sorted, 1 if it was sorted and -1 in case of error.
+static int sort_lightcurve_text_in_jd( struct Lightcurve_text *lc ) {
+ struct Lightcurve_line *line_arr;
+ long line_count;
+ long line_allocated;
+ char line[MAX_STRING_LENGTH_IN_LIGHTCURVE_FILE];
+ double julian_date;
+ size_t position, line_length;
+ char *sorted_text;
+ long i;
+ int is_sorted= 1; // Assume sorted initially
+
+ line_allocated= 1024;
+ line_arr= malloc( line_allocated * sizeof( struct Lightcurve_line ) );
+ if ( NULL == line_arr ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for line_arr\n" );
+  return -1;
+ }
+
+ julian_date= 0.0;
+ line_count= 0;
+ for ( position= 0; position < lc->length; position+= line_length ) {
+  line_length= lightcurve_line_length( lc->text, lc->length, position );
+  memcpy( line, lc->text + position, line_length );
+  line[line_length]= '\0';
+  // If the line cannot be parsed it inherits JD of the previous line
+  sscanf( line, "%lf", &julian_date );
+  if ( line_count == line_allocated ) {
+   line_allocated*= 2;
+   line_arr= realloc( line_arr, line_allocated * sizeof( struct Lightcurve_line ) );
+   if ( NULL == line_arr ) {
+    fprintf( stderr, "ERROR: Couldn't allocate memory for line_arr\n" );
+    return -1;
+   }
+  }
+  line_arr[line_count].julian_date= julian_date;
+  line_arr[line_count].start= position;
+  line_arr[line_count].length= line_length;
+  // Check if the current entry is out of order
+  if ( line_count > 0 && julian_date < line_arr[line_count - 1].julian_date ) {
+   is_sorted= 0;
+  }
+  line_count++;
+ }
+
+ if ( is_sorted ) {
+  free( line_arr );
+  return 0;
+ }
+
+ qsort( line_arr, line_count, sizeof( struct Lightcurve_line ), compare_julian_date );
+
+ sorted_text= malloc( lc->length + 1 );
+ if ( NULL == sorted_text ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for sorted_text\n" );
+  free( line_arr );
+  return -1;
+ }
+ for ( position= 0, i= 0; i < line_count; i++ ) {
+  memcpy( sorted_text + position, lc->text + line_arr[i].start, line_arr[i].length );
+  position+= line_arr[i].length;
+ }
+ sorted_text[position]= '\0';
+ free( line_arr );
+ free( lc->text );
+ lc->text= sorted_text;
+ return 1;
+}
+
+// Read JD and magnitude of all the measurements (without the x, y columns,
+// just like lib/remove_bad_images and lib/remove_lightcurves_with_small_number_of_points do)
+static int get_lightcurve_points( struct Lightcurve_text *lc, struct Lightcurve_points *points ) {
+ FILE *lightcurvefile;
+ double jd, mag, merr, y, app;
+ char string[FILENAME_LENGTH];
+ char comments_string[MAX_STRING_LENGTH_IN_LIGHTCURVE_FILE];
+
+ points->n= 0;
+ lightcurvefile= open_lightcurve_text( lc );
+ if ( NULL == lightcurvefile ) {
+  return ( lc->length == 0 ? 0 : 1 );
+ }
+ jd= mag= merr= y= app= 0.0; // initialize just in case
+ while ( -1 < read_lightcurve_point( lightcurvefile, &jd, &mag, &merr, NULL, &y, &app, string, comments_string ) ) {
+  if ( jd == 0.0 ) {
+   continue; // if this line could not be parsed, try the next one
+  }
+  if ( points->n == points->allocated ) {
+   points->allocated= MAX( 2 * points->allocated, 1024 );
+   points->jd= realloc( points->jd, points->allocated * sizeof( double ) );
+   points->mag= realloc( points->mag, points->allocated * sizeof( double ) );
+   if ( NULL == points->jd || NULL == points->mag ) {
+    fprintf( stderr, "ERROR: Couldn't allocate memory for the lightcurve points\n" );
+    fclose( lightcurvefile );
+    return 1;
+   }
+  }
+  points->jd[points->n]= jd;
+  points->mag[points->n]= mag;
+  points->n++;
+ }
+ fclose( lightcurvefile );
+ return 0;
+}
+
+static int is_bad_image( double jd, double *images_bad, int images_Nbad ) {
+ if ( images_Nbad == 0 ) {
+  return 0;
+ }
+ if ( NULL == bsearch( &jd, images_bad, images_Nbad, sizeof( double ), compare_double ) ) {
+  return 0;
+ }
+ return 1;
+}
+
+// Re-write the lightcurve keeping only the measurements from good images (images_bad[] should be sorted)
+// or only the measurements within sigma_filter*mag_sigma from median_mag if images_bad is NULL.
+// Returns the number of removed measurements or -1 in case of error.
+static long filter_lightcurve_text( struct Lightcurve_text *lc, double *images_bad, int images_Nbad, double median_mag, double mag_sigma, double sigma_filter ) {
+ FILE *lightcurvefile;
+ FILE *outlightcurvefile;
+ double jd, mag, merr, x, y, app;
+ char string[FILENAME_LENGTH];
+ char comments_string[MAX_STRING_LENGTH_IN_LIGHTCURVE_FILE];
+ char *filtered_text;
+ size_t filtered_length;
+ long removed_points;
+ int is_this_point_good;
+
+ lightcurvefile= open_lightcurve_text( lc );
+ if ( NULL == lightcurvefile ) {
+  return ( lc->length == 0 ? 0 : -1 );
+ }
+ filtered_text= NULL;
+ filtered_length= 0;
+ outlightcurvefile= open_memstream( &filtered_text, &filtered_length );
+ if ( NULL == outlightcurvefile ) {
+  fprintf( stderr, "ERROR in filter_lightcurve_text(): open_memstream() failed\n" );
+  fclose( lightcurvefile );
+  return -1;
+ }
+ removed_points= 0;
+ while ( -1 < read_lightcurve_point( lightcurvefile, &jd, &mag, &merr, &x, &y, &app, string, comments_string ) ) {
+  if ( jd == 0.0 ) {
+   continue; // if this line could not be parsed, try the next one
+  }
+  if ( NULL != images_bad ) {
+   is_this_point_good= 1 - is_bad_image( jd, images_bad, images_Nbad );
+  } else {
+   is_this_point_good= ( fabs( mag - median_mag ) < sigma_filter * mag_sigma );
+  }
+  if ( is_this_point_good == 1 ) {
+   write_lightcurve_point( outlightcurvefile, jd, mag, merr, x, y, app, string, comments_string );
+  } else {
+   removed_points++;
+  }
+ }
+ fclose( outlightcurvefile );
+ fclose( lightcurvefile );
+ free( lc->text );
+ lc->text= filtered_text;
+ lc->length= filtered_length;
+ return removed_points;
+}
+
+// Iterative sigma-clipping as in lib/new_lightcurve_sigma_filter
+static int sigma_clip_lightcurve_text( struct Lightcurve_text *lc, double sigma_filter, struct Lightcurve_points *points ) {
+ FILE *lightcurvefile;
+ double jd, mag, merr, x, y, app;
+ char string[FILENAME_LENGTH];
+ char comments_string[MAX_STRING_LENGTH_IN_LIGHTCURVE_FILE];
+ double median_mag;
+ double mag_sigma;
+ long clipped_points;
+ int sigma_clip_iteration;
+
+ for ( sigma_clip_iteration= 0; sigma_clip_iteration < POSTPROCESS_LIGHTCURVES_MAX_SIGMA_CLIP_ITERATIONS; sigma_clip_iteration++ ) {
+  // Compute median mag & sigma
+  points->n= 0;
+  lightcurvefile= open_lightcurve_text( lc );
+  if ( NULL != lightcurvefile ) {
+   while ( -1 < read_lightcurve_point( lightcurvefile, &jd, &mag, &merr, &x, &y, &app, string, comments_string ) ) {
+    if ( jd == 0.0 ) {
+     continue; // if this line could not be parsed, try the next one
+    }
+    if ( points->n == points->allocated ) {
+     points->allocated= MAX( 2 * points->allocated, 1024 );
+     points->jd= realloc( points->jd, points->allocated * sizeof( double ) );
+     points->mag= realloc( points->mag, points->allocated * sizeof( double ) );
+     if ( NULL == points->jd || NULL == points->mag ) {
+      fprintf( stderr, "ERROR: Couldn't allocate memory for the lightcurve points\n" );
+      fclose( lightcurvefile );
+      return 1;
+     }
+    }
+    points->mag[points->n]= mag;
+    points->n++;
+   }
+   fclose( lightcurvefile );
+  }
+  if ( points->n < 2 ) {
+   break; // not enough data points to compute sigma, skip filtering
+  }
+  median_mag= quickselect_median_double( points->mag, (int)points->n );
+  mag_sigma= gsl_stats_sd_m( points->mag, 1, points->n, median_mag );
+  clipped_points= filter_lightcurve_text( lc, NULL, 0, median_mag, mag_sigma, sigma_filter );
+  if ( clipped_points < 0 ) {
+   return 1;
+  }
+  if ( clipped_points == 0 ) {
+   break; // stop if we have no more points to clip
+  }
+ }
+ return 0;
+}
+
+// Add measurements of one lightcurve to the bad image statistics (the same way lib/remove_bad_images does)
+static int add_lightcurve_to_image_outlier_statistics( struct Lightcurve_points *points, struct Image_outlier_statistics *stat ) {
+ double median_mag;
+ double mag_sigma;
+ long j;
+ long image_counter;
+ long low, high, middle;
+
+ if ( points->n < SOFT_MIN_NUMBER_OF_POINTS ) {
+  return 0;
+ }
+ gsl_sort2( points->mag, 1, points->jd, 1, points->n );
+ median_mag= gsl_stats_median_from_sorted_data( points->mag, 1, points->n );
+ mag_sigma= esimate_sigma_from_MAD_of_sorted_data( points->mag, points->n );
+
+ // Count outliers
+ for ( j= 0; j < points->n; j++ ) {
+  // Binary search for the image with this JD
+  low= 0;
+  high= stat->image_Number;
+  image_counter= -1;
+  while ( low < high ) {
+   middle= ( low + high ) / 2;
+   if ( stat->image_jd[stat->image_index_sorted_in_jd[middle]] < points->jd[j] ) {
+    low= middle + 1;
+   } else {
+    high= middle;
+   }
+  }
+  if ( low < stat->image_Number && stat->image_jd[stat->image_index_sorted_in_jd[low]] == points->jd[j] ) {
+   image_counter= stat->image_index_sorted_in_jd[low];
+  }
+  // Add a new image
+  if ( image_counter == -1 ) {
+   if ( stat->image_Number == stat->allocated ) {
+    stat->allocated= MAX( 2 * stat->allocated, 1024 );
+    stat->image_jd= realloc( stat->image_jd, stat->allocated * sizeof( double ) );
+    stat->image_Nall= realloc( stat->image_Nall, stat->allocated * sizeof( int ) );
+    stat->image_Noutliers= realloc( stat->image_Noutliers, stat->allocated * sizeof( int ) );
+    stat->image_index_sorted_in_jd= realloc( stat->image_index_sorted_in_jd, stat->allocated * sizeof( long ) );
+    if ( NULL == stat->image_jd || NULL == stat->image_Nall || NULL == stat->image_Noutliers || NULL == stat->image_index_sorted_in_jd ) {
+     fprintf( stderr, "ERROR: Couldn't allocate memory for the image outlier statistics\n" );
+     return 1;
+    }
+   }
+   image_counter= stat->image_Number;
+   stat->image_jd[image_counter]= points->jd[j]; // initialize
+   stat->image_Nall[image_counter]= 0;           // initialize
+   stat->image_Noutliers[image_counter]= 0;      // initialize
+   memmove( &stat->image_index_sorted_in_jd[low + 1], &stat->image_index_sorted_in_jd[low], ( stat->image_Number - low ) * sizeof( long ) );
+   stat->image_index_sorted_in_jd[low]= image_counter;
+   stat->image_Number++;
+  }
+  stat->image_Nall[image_counter]++;
+  if ( fabs( points->mag[j] - median_mag ) > REMOVE_BAD_IMAGES__OUTLIER_THRESHOLD * mag_sigma ) {
+   stat->image_Noutliers[image_counter]++;
+  }
+ }
+ return 0;
+}
+
+static void update_number_of_bad_images_in_log_file( int images_Nbad ) {
+ FILE *logfilein;
+ FILE *logfileout;
+ int old_number_of_bad_images= 0;
+ char str[2048];
+ logfilein= fopen( "vast_summary.log", "r" );
+ if ( logfilein != NULL ) {
+  logfileout= fopen( "vast_summary.log.tmp", "w" );
+  if ( logfileout == NULL ) {
+   fclose( logfilein );
+   return;
+  }
+  while ( NULL != fgets( str, 2048, logfilein ) ) {
+   if ( 1 == sscanf( str, "Number of identified bad images: %d", &old_number_of_bad_images ) ) {
+    sprintf( str, "Number of identified bad images: %d\n", old_number_of_bad_images + images_Nbad );
+   }
+   fputs( str, logfileout );
+  }
+  fclose( logfileout );
+  fclose( logfilein );
+  unlink( "vast_summary.log" );
+  rename( "vast_summary.log.tmp", "vast_summary.log" );
+ }
+ return;
+}
+
+// Write JD and image filename (or only JD) of the bad image to vast_list_of_bad_images.log
+static void log_bad_image( double JD ) {
+ FILE *vast_image_details_file;
+ FILE *vast_list_of_bad_images_file;
+ char str[MAX_LOG_STR_LENGTH];
+ char filename[FILENAME_LENGTH];
+ double logJD;
+ int image_found_in_logfile= 0;
+
+#ifdef STRICT_CHECK_OF_JD_AND_MAG_RANGE
+ // Allow for both MJD and JD
+ if ( JD < EXPECTED_MIN_MJD || JD > EXPECTED_MAX_JD )
+  return;
+#endif
+
+ vast_image_details_file= fopen( "vast_image_details.log", "r" );
+ if ( vast_image_details_file == NULL ) {
+  return;
+ }
+ while ( NULL != fgets( str, MAX_LOG_STR_LENGTH, vast_image_details_file ) ) {
+  str[MAX_LOG_STR_LENGTH - 1]= '\0'; // just in case
+  if ( strlen( str ) < 100 )
+   continue; // this line is probably corrupted
+  if ( 2 != sscanf( str, "exp_start= %*s %*s  exp=   %*s  JD= %lf  ap= %*s  rotation=   %*s  *detected=  %*s  *matched=  %*s  %*s  %s", &logJD, filename ) )
+   continue;
+  if ( fabs( JD - logJD ) < 0.00001 ) {
+   fprintf( stderr, "%.8lf %s\n", JD, filename );
+   image_found_in_logfile= 1;
+   break;
+  }
+ }
+ fclose( vast_image_details_file );
+
+ vast_list_of_bad_images_file= fopen( "vast_list_of_bad_images.log", "a" );
+ if ( vast_list_of_bad_images_file != NULL ) {
+  if ( image_found_in_logfile == 1 ) {
+   fprintf( vast_list_of_bad_images_file, "%.8lf %s\n", JD, filename );
+  } else {
+   fprintf( vast_list_of_bad_images_file, "%.8lf \n", JD );
+  }
+  fclose( vast_list_of_bad_images_file );
+ }
+ return;
+}
+
+// Pass the lightcurve through the filtering stages and write the result
+static int process_lightcurve_file( const char *filename, double *images_bad, int images_Nbad, double sigma_filter, int min_number_of_points ) {
+ struct Lightcurve_text lc;
+ char *original_text;
+ size_t original_length;
+ struct Lightcurve_points points;
+ int is_deleted= 0;
+ int status= 0;
+
+ if ( 0 != read_lightcurve_text( filename, &lc ) ) {
+  return 1;
+ }
+ // Keep the original content to check if the file needs to be re-written
+ original_text= malloc( lc.length + 1 );
+ if ( NULL == original_text ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for original_text\n" );
+  free( lc.text );
+  return 1;
+ }
+ memcpy( original_text, lc.text, lc.length + 1 );
+ original_length= lc.length;
+
+ memset( &points, 0, sizeof( struct Lightcurve_points ) );
+
+ if ( -1 == sort_lightcurve_text_in_jd( &lc ) ) {
+  status= 1;
+ }
+ if ( status == 0 && images_Nbad > 0 ) {
+  if ( 0 > filter_lightcurve_text( &lc, images_bad, images_Nbad, 0.0, 0.0, 0.0 ) ) {
+   status= 1;
+  }
+ }
+ if ( status == 0 && sigma_filter > 0.0 ) {
+  status= sigma_clip_lightcurve_text( &lc, sigma_filter, &points );
+ }
+ if ( status == 0 && min_number_of_points > 0 ) {
+  status= get_lightcurve_points( &lc, &points );
+  if ( status == 0 && points.n < min_number_of_points ) {
+   unlink( filename ); // delete lightcurve file
+   is_deleted= 1;
+  }
+ }
+ if ( status == 0 && is_deleted == 0 && ( lc.length != original_length || 0 != memcmp( lc.text, original_text, lc.length ) ) ) {
+  status= write_lightcurve_text( filename, &lc );
+ }
+
+ free( points.jd );
+ free( points.mag );
+ free( original_text );
+ free( lc.text );
+ return status;
+}
+
+static void print_usage( const char *program_name ) {
+ fprintf( stderr, "Post-process lightcurves (out*dat files): sort them in JD and optionally\n" );
+ fprintf( stderr, "remove measurements from bad images, sigma-clip outliers and remove lightcurves with too few points.\n" );
+ fprintf( stderr, "The stages are applied in the order listed below, each lightcurve file is written at most once.\n" );
+ fprintf( stderr, "Usage:\n %s [-b] [-f FRACTION_OF_BAD_DETECTIONS] [-s SIGMA] [-m MIN_NUMBER_OF_POINTS] [-r REMOVED_LIST_FILE]\n", program_name );
+ fprintf( stderr, "  -b, --remove-bad-images             remove measurements from images having a large fraction of outliers\n" );
+ fprintf( stderr, "  -f, --max-fraction-of-outliers=F    the fraction of outliers identifying a bad image (default %.2lf)\n", REMOVE_BAD_IMAGES__DEFAULT_MAX_FRACTION_OF_OUTLIERS );
+ fprintf( stderr, "  -s, --sigma-filter=SIGMA            iteratively remove measurements deviating by more than SIGMA from the median\n" );
+ fprintf( stderr, "  -m, --min-points=N                  delete lightcurves with less than N points\n" );
+ fprintf( stderr, "  -r, --removed-list=FILE             append the names of the deleted lightcurve files to FILE\n" );
+ fprintf( stderr, "Example:\n %s -b -m %d\n", program_name, HARD_MIN_NUMBER_OF_POINTS );
+ return;
+}
+
+int main( int argc, char **argv ) {
+ // File name handling
+ DIR *dp;
+ struct dirent *ep;
+ char **filenamelist;
+ long filename_counter;
+ long filename_n;
+ long filenamelen;
+ long filenamelist_allocated;
+
+ int param_remove_bad_images= 0;
+ double max_fraction_of_outliers= REMOVE_BAD_IMAGES__DEFAULT_MAX_FRACTION_OF_OUTLIERS;
+ double sigma_filter= 0.0;
+ int min_number_of_points= 0;
+ char *removed_list_filename= NULL;
+ FILE *removed_list_file;
+
+ struct Lightcurve_text lc;
+ struct Lightcurve_points points;
+ struct Image_outlier_statistics stat;
+ long *number_of_points_in_lightcurve;
+ int *is_lightcurve_unsorted;
+
+ double *images_bad= NULL;
+ int images_Nbad;
+ long image_counter;
+ int is_filtering_needed;
+ int status;
+
+ int opt;
+ int option_index= 0;
+ static struct option long_options[]= {
+     {"remove-bad-images", no_argument, 0, 'b'},
+     {"max-fraction-of-outliers", required_argument, 0, 'f'},
+     {"sigma-filter", required_argument, 0, 's'},
+     {"min-points", required_argument, 0, 'm'},
+     {"removed-list", required_argument, 0, 'r'},
+     {"help", no_argument, 0, 'h'},
+     {0, 0, 0, 0}};
+
+ while ( ( opt= getopt_long( argc, argv, "bf:s:m:r:h", long_options, &option_index ) ) != -1 ) {
+  switch ( opt ) {
+  case 'b':
+   param_remove_bad_images= 1;
+   break;
+  case 'f':
+   max_fraction_of_outliers= atof( optarg );
+   break;
+  case 's':
+   sigma_filter= atof( optarg );
+   break;
+  case 'm':
+   min_number_of_points= atoi( optarg );
+   break;
+  case 'r':
+   removed_list_filename= optarg;
+   break;
+  case 'h':
+   print_usage( argv[0] );
+   return 0;
+  default:
+   print_usage( argv[0] );
+   return 1;
+  }
+ }
+
+ // Create a list of files
+ filenamelist_allocated= 1024;
+ filenamelist= malloc( filenamelist_allocated * sizeof( char * ) );
+ if ( NULL == filenamelist ) {
+  fprintf( stderr, "ERROR: allocating memory for filenamelist\n" );
+  return 1;
+ }
+ filename_n= 0;
+ dp= opendir( "./" );
+ if ( dp == NULL ) {
+  perror( "Couldn't open the directory" );
+  free( filenamelist );
+  return 2;
+ }
+ while ( ( ep= readdir( dp ) ) != NULL ) {
+  if ( 0 == is_lightcurve_filename( ep->d_name ) ) {
+   continue;
+  }
+  if ( filename_n == filenamelist_allocated ) {
+   filenamelist_allocated*= 2;
+   filenamelist= realloc( filenamelist, filenamelist_allocated * sizeof( char * ) );
+   if ( NULL == filenamelist ) {
+    fprintf( stderr, "ERROR: allocating memory for filenamelist\n" );
+    return 1;
+   }
+  }
+  filenamelen= strlen( ep->d_name );
+  filenamelist[filename_n]= malloc( ( filenamelen + 1 ) * sizeof( char ) );
+  if ( NULL == filenamelist[filename_n] ) {
+   fprintf( stderr, "ERROR: allocating memory for filenamelist[%ld]\n", filename_n );
+   return 1;
+  }
+  strncpy( filenamelist[filename_n], ep->d_name, ( filenamelen + 1 ) );
+  filename_n++;
+ }
+ (void)closedir( dp );
+
+ number_of_points_in_lightcurve= malloc( ( filename_n + 1 ) * sizeof( long ) );
+ is_lightcurve_unsorted= malloc( ( filename_n + 1 ) * sizeof( int ) );
+ if ( NULL == number_of_points_in_lightcurve || NULL == is_lightcurve_unsorted ) {
+  fprintf( stderr, "ERROR: allocating memory for the list of lightcurves\n" );
+  return 1;
+ }
+
+ memset( &points, 0, sizeof( struct Lightcurve_points ) );
+ memset( &stat, 0, sizeof( struct Image_outlier_statistics ) );
+
+ // First pass: sort the lightcurves in memory, count the points and collect the bad image statistics.
+ // Nothing is written to disk at this stage.
+ if ( param_remove_bad_images == 1 ) {
+  fprintf( stderr, "Searching for bad images that have a large fraction (>%.2lf) of outliers...\n", max_fraction_of_outliers );
+ }
+ for ( filename_counter= 0; filename_counter < filename_n; filename_counter++ ) {
+  if ( 0 != read_lightcurve_text( filenamelist[filename_counter], &lc ) ) {
+   return 1;
+  }
+  is_lightcurve_unsorted[filename_counter]= sort_lightcurve_text_in_jd( &lc );
+  if ( -1 == is_lightcurve_unsorted[filename_counter] ) {
+   return 1;
+  }
+  if ( 0 != get_lightcurve_points( &lc, &points ) ) {
+   return 1;
+  }
+  free( lc.text );
+  number_of_points_in_lightcurve[filename_counter]= points.n;
+  if ( param_remove_bad_images == 1 ) {
+   if ( 0 != add_lightcurve_to_image_outlier_statistics( &points, &stat ) ) {
+    return 1;
+   }
+  }
+ }
+ free( points.jd );
+ free( points.mag );
+
+ // Identify bad images considering fraction and the total number of outlier measurements
+ images_Nbad= 0;
+ if ( param_remove_bad_images == 1 ) {
+  for ( image_counter= 0; image_counter < stat.image_Number; image_counter++ ) {
+   if ( (double)stat.image_Noutliers[image_counter] / (double)stat.image_Nall[image_counter] > max_fraction_of_outliers && stat.image_Noutliers[image_counter] > REMOVE_BAD_IMAGES__MAX_ALLOWED_NUMBER_OF_OUTLIERS ) {
+    images_Nbad++;
+    images_bad= realloc( images_bad, images_Nbad * sizeof( double ) );
+    if ( images_bad == NULL ) {
+     fprintf( stderr, "ERROR: Couldn't allocate memory for images_bad\n" );
+     return 1;
+    }
+    images_bad[images_Nbad - 1]= stat.image_jd[image_counter];
+    fprintf( stderr, "Identified bad image %03ld  JD%lf   Nall = %05d  Noutliers = %05d  fraction=%lf\n", image_counter, stat.image_jd[image_counter], stat.image_Nall[image_counter], stat.image_Noutliers[image_counter], (double)stat.image_Noutliers[image_counter] / (double)stat.image_Nall[image_counter] );
+   }
+  }
+  fprintf( stderr, "Identified %d bad images!\n", images_Nbad );
+  // Sort images_bad in JD to get a nice log output and for the binary search
+  gsl_sort( images_bad, 1, images_Nbad );
+  for ( image_counter= 0; image_counter < images_Nbad; image_counter++ ) {
+   log_bad_image( images_bad[image_counter] );
+  }
+ }
+ free( stat.image_jd );
+ free( stat.image_Nall );
+ free( stat.image_Noutliers );
+ free( stat.image_index_sorted_in_jd );
+
+ // Second pass: apply the filtering stages and write the results
+ is_filtering_needed= ( images_Nbad > 0 || sigma_filter > 0.0 );
+ if ( images_Nbad > 0 ) {
+  fprintf( stderr, "Removing bad-image measurements from all lightcurves... " );
+ }
+ if ( sigma_filter > 0.0 ) {
+  fprintf( stderr, "Removing (%.1lf sigma) outliers from lightcurves... ", sigma_filter );
+ }
+ if ( min_number_of_points > 0 ) {
+  fprintf( stderr, "Removing lightcurves with less than %d points... ", min_number_of_points );
+ }
+ status= 0;
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for schedule( dynamic, 16 ) reduction( | : status )
+#endif
+#endif
+ for ( filename_counter= 0; filename_counter < filename_n; filename_counter++ ) {
+  if ( is_filtering_needed == 1 ) {
+   status|= process_lightcurve_file( filenamelist[filename_counter], images_bad, images_Nbad, sigma_filter, min_number_of_points );
+  } else if ( min_number_of_points > 0 && number_of_points_in_lightcurve[filename_counter] < min_number_of_points ) {
+   // No need to sort the lightcurve that will be deleted
+   unlink( filenamelist[filename_counter] );
+  } else if ( is_lightcurve_unsorted[filename_counter] == 1 ) {
+   status|= process_lightcurve_file( filenamelist[filename_counter], NULL, 0, 0.0, 0 );
+  }
+ }
+
+ if ( images_Nbad > 0 ) {
+  update_number_of_bad_images_in_log_file( images_Nbad ); // Update vast_summary.log
+ }
+
+ // Keep track of the deleted lightcurves, so 'vast --append' will not re-create them from the new images only
+ if ( removed_list_filename != NULL && min_number_of_points > 0 ) {
+  removed_list_file= fopen( removed_list_filename, "a" );
+  if ( NULL == removed_list_file ) {
+   fprintf( stderr, "ERROR: cannot open %s for writing\n", removed_list_filename );
+   status= 1;
+  } else {
+   for ( filename_counter= 0; filename_counter < filename_n; filename_counter++ ) {
+    if ( 0 != access( filenamelist[filename_counter], F_OK ) ) {
+     fprintf( removed_list_file, "%s\n", filenamelist[filename_counter] );
+    }
+   }
+   fclose( removed_list_file );
+  }
+ }
+
+ for ( filename_counter= 0; filename_counter < filename_n; filename_counter++ ) {
+  free( filenamelist[filename_counter] );
+ }
+ free( filenamelist );
+ free( number_of_points_in_lightcurve );
+ free( is_lightcurve_unsorted );
+ free( images_bad );
+
+ fprintf( stderr, "done!  =)\n" );
+
+ return status;
+}
@@ -254,21 +254,19 @@ void	makeback(picstruct *field, picstruct *wfield, int wscale_flag)
       }
 
     /*-- Compute background statistics from the histograms */
-    bm = backmesh;
-    for (m=0; m<nx; m++, bm++)
-      {
-      k = m+nx*j;
-      backguess(bm, field->back+k, field->sigma+k);
-      free(bm->histo);
-      }
-    if (wfield)
+    k = nx*j;
+#if defined(VAST_ENABLE_OPENMP) && defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic) \
+	if (nx>1 && (size_t)w*bh>=2*(size_t)BACK_MINPIXPERTHREAD)
+#endif
+    for (m=0; m<nx; m++)
       {
-      wbm = wbackmesh;
-      for (m=0; m<nx; m++, wbm++)
+      backguess(backmesh+m, field->back+k+m, field->sigma+k+m);
+      free(backmesh[m].histo);
+      if (wfield)
         {
-        k = m+nx*j;
-        backguess(wbm, wfield->back+k, wfield->sigma+k);
-        free(wbm->histo);
+        backguess(wbackmesh+m, wfield->back+k+m, wfield->sigma+k+m);
+        free(wbackmesh[m].histo);
         }
       }
     }
@@ -388,228 +386,242 @@ void	makeback(picstruct *field, picstruct *wfield, int wscale_flag)
   }
 
 
-/******************************** backstat **********************************/
+/****************************** backstat_mesh *******************************/
 /*
-Compute robust statistical estimators in a row of meshes.
+Compute robust statistical estimators in a single mesh of width bw.
 */
-void	backstat(backstruct *backmesh, backstruct *wbackmesh,
-		PIXTYPE *buf, PIXTYPE *wbuf, size_t bufsize,
-			int n, int w, int bw, PIXTYPE wthresh)
+static void	backstat_mesh(backstruct *bm, backstruct *wbm,
+		PIXTYPE *buf, PIXTYPE *wbuf, int h, int w, int bw,
+		PIXTYPE wthresh)
 
   {
-   backstruct	*bm, *wbm;
    double	pix,wpix, sig, mean,wmean, sigma,wsigma, step;
    PIXTYPE	*buft,*wbuft,
 		lcut,wlcut, hcut,whcut;
-   int		m,h,x,y, npix,wnpix, offset, lastbite;
+   int		x,y, npix,wnpix, offset;
 
-  h = bufsize/w;
-  bm = backmesh;
-  wbm = wbackmesh;
   offset = w - bw;
   step = sqrt(2/PI)*QUANTIF_NSIGMA/QUANTIF_AMIN;
   wmean = wsigma = wlcut = whcut = 0.0;	/* to avoid gcc -Wall warnings */
-  for (m = n; m--; bm++,buf+=bw)
+  mean = sigma = 0.0;
+  buft=buf;
+/* We separate the weighted case at this level to avoid penalty in CPU */
+  npix = 0;
+  if (wbm)
     {
-    if (!m && (lastbite=w%bw))
-      {
-      bw = lastbite;
-      offset = w-bw;
-      }
-    mean = sigma = 0.0;
-    buft=buf;
-/*-- We separate the weighted case at this level to avoid penalty in CPU */
-    npix = 0;
-    if (wbackmesh)
-      {
-      wmean = wsigma = 0.0;
-      wbuft = wbuf;
-      for (y=h; y--; buft+=offset,wbuft+=offset)
-        for (x=bw; x--;)
-          {
-          pix = *(buft++);
-          if ((wpix = *(wbuft++)) < wthresh && pix > -BIG)
-            {
-            wmean += wpix;
-            wsigma += wpix*wpix;
-            mean += pix;
-            sigma += pix*pix;
-            npix++;
-            }
-	  }
-      }
-    else
-      for (y=h; y--; buft+=offset)
-        for (x=bw; x--;)
-          if ((pix = *(buft++)) > -BIG)
-            {
-            mean += pix;
-            sigma += pix*pix;
-            npix++;
-            }
-/*-- If not enough valid pixels, discard this mesh */
-    if ((float)npix < (float)(bw*h*BACK_MINGOODFRAC))
-      {
-      bm->mean = bm->sigma = -BIG;
-      if (wbackmesh)
+    wmean = wsigma = 0.0;
+    wbuft = wbuf;
+    for (y=h; y--; buft+=offset,wbuft+=offset)
+      for (x=bw; x--;)
         {
-        wbm->mean = wbm->sigma = -BIG;
-        wbm++;
-        wbuf += bw;
+        pix = *(buft++);
+        if ((wpix = *(wbuft++)) < wthresh && pix > -BIG)
+          {
+          wmean += wpix;
+          wsigma += wpix*wpix;
+          mean += pix;
+          sigma += pix*pix;
+          npix++;
+          }
         }
-      continue;
-      }
-    if (wbackmesh)
-      {
-      wmean /= (double)npix;
-      wsigma = (sig = wsigma/npix - wmean*wmean)>0.0? sqrt(sig):0.0;
-      wlcut = wbm->lcut = (PIXTYPE)(wmean - 2.0*wsigma);
-      whcut = wbm->hcut = (PIXTYPE)(wmean + 2.0*wsigma);
-      }
-    mean /= (double)npix;
-    sigma = (sig = sigma/npix - mean*mean)>0.0? sqrt(sig):0.0;
-    lcut = bm->lcut = (PIXTYPE)(mean - 2.0*sigma);
-    hcut = bm->hcut = (PIXTYPE)(mean + 2.0*sigma);
-    mean = sigma = 0.0;
-    npix = wnpix = 0;
-    buft = buf;
-    if (wbackmesh)
-      {
-      wmean = wsigma = 0.0;
-      wbuft=wbuf;
-      for (y=h; y--; buft+=offset, wbuft+=offset)
-        for (x=bw; x--;)
+    }
+  else
+    for (y=h; y--; buft+=offset)
+      for (x=bw; x--;)
+        if ((pix = *(buft++)) > -BIG)
           {
-          pix = *(buft++);
-          if ((wpix = *(wbuft++))<wthresh && pix<=hcut && pix>=lcut)
-            {
-            mean += pix;
-            sigma += pix*pix;
-            npix++;
-            if (wpix<=whcut && wpix>=wlcut)
-              {
-              wmean += wpix;
-              wsigma += wpix*wpix;
-              wnpix++;
-              }
-            }
+          mean += pix;
+          sigma += pix*pix;
+          npix++;
           }
-      }
-    else
-      for (y=h; y--; buft+=offset)
-        for (x=bw; x--;)
+/* If not enough valid pixels, discard this mesh */
+  if ((float)npix < (float)(bw*h*BACK_MINGOODFRAC))
+    {
+    bm->mean = bm->sigma = -BIG;
+    if (wbm)
+      wbm->mean = wbm->sigma = -BIG;
+    return;
+    }
+  if (wbm)
+    {
+    wmean /= (double)npix;
+    wsigma = (sig = wsigma/npix - wmean*wmean)>0.0? sqrt(sig):0.0;
+    wlcut = wbm->lcut = (PIXTYPE)(wmean - 2.0*wsigma);
+    whcut = wbm->hcut = (PIXTYPE)(wmean + 2.0*wsigma);
+    }
+  mean /= (double)npix;
+  sigma = (sig = sigma/npix - mean*mean)>0.0? sqrt(sig):0.0;
+  lcut = bm->lcut = (PIXTYPE)(mean - 2.0*sigma);
+  hcut = bm->hcut = (PIXTYPE)(mean + 2.0*sigma);
+  mean = sigma = 0.0;
+  npix = wnpix = 0;
+  buft = buf;
+  if (wbm)
+    {
+    wmean = wsigma = 0.0;
+    wbuft=wbuf;
+    for (y=h; y--; buft+=offset, wbuft+=offset)
+      for (x=bw; x--;)
+        {
+        pix = *(buft++);
+        if ((wpix = *(wbuft++))<wthresh && pix<=hcut && pix>=lcut)
           {
-          pix = *(buft++);
-          if (pix<=hcut && pix>=lcut)
+          mean += pix;
+          sigma += pix*pix;
+          npix++;
+          if (wpix<=whcut && wpix>=wlcut)
             {
-            mean += pix;
-            sigma += pix*pix;
-            npix++;
+            wmean += wpix;
+            wsigma += wpix*wpix;
+            wnpix++;
             }
           }
+        }
+    }
+  else
+    for (y=h; y--; buft+=offset)
+      for (x=bw; x--;)
+        {
+        pix = *(buft++);
+        if (pix<=hcut && pix>=lcut)
+          {
+          mean += pix;
+          sigma += pix*pix;
+          npix++;
+          }
+        }
 
-    bm->npix = npix;
-    mean /= (double)npix;
-    sig = sigma/npix - mean*mean;
-    sigma = sig>0.0 ? sqrt(sig):0.0;
-    bm->mean = mean;
-    bm->sigma = sigma;
-    if ((bm->nlevels = (int)(step*npix+1)) > QUANTIF_NMAXLEVELS)
-      bm->nlevels = QUANTIF_NMAXLEVELS;
-    bm->qscale = sigma>0.0? 2*QUANTIF_NSIGMA*sigma/bm->nlevels : 1.0;
-    bm->qzero = mean - QUANTIF_NSIGMA*sigma;
-    if (wbackmesh)
-      {
-      wbm->npix = wnpix;
-      wmean /= (double)wnpix;
-      sig = wsigma/wnpix - wmean*wmean;
-      wsigma = sig>0.0 ? sqrt(sig):0.0;
-      wbm->mean = wmean;
-      wbm->sigma = wsigma;
-      if ((wbm->nlevels = (int)(step*wnpix+1)) > QUANTIF_NMAXLEVELS)
-        wbm->nlevels = QUANTIF_NMAXLEVELS;
-      wbm->qscale = wsigma>0.0? 2*QUANTIF_NSIGMA*wsigma/wbm->nlevels : 1.0;
-      wbm->qzero = wmean - QUANTIF_NSIGMA*wsigma;
-      wbm++;
-      wbuf += bw;
-      }
+  bm->npix = npix;
+  mean /= (double)npix;
+  sig = sigma/npix - mean*mean;
+  sigma = sig>0.0 ? sqrt(sig):0.0;
+  bm->mean = mean;
+  bm->sigma = sigma;
+  if ((bm->nlevels = (int)(step*npix+1)) > QUANTIF_NMAXLEVELS)
+    bm->nlevels = QUANTIF_NMAXLEVELS;
+  bm->qscale = sigma>0.0? 2*QUANTIF_NSIGMA*sigma/bm->nlevels : 1.0;
+  bm->qzero = mean - QUANTIF_NSIGMA*sigma;
+  if (wbm)
+    {
+    wbm->npix = wnpix;
+    wmean /= (double)wnpix;
+    sig = wsigma/wnpix - wmean*wmean;
+    wsigma = sig>0.0 ? sqrt(sig):0.0;
+    wbm->mean = wmean;
+    wbm->sigma = wsigma;
+    if ((wbm->nlevels = (int)(step*wnpix+1)) > QUANTIF_NMAXLEVELS)
+      wbm->nlevels = QUANTIF_NMAXLEVELS;
+    wbm->qscale = wsigma>0.0? 2*QUANTIF_NSIGMA*wsigma/wbm->nlevels : 1.0;
+    wbm->qzero = wmean - QUANTIF_NSIGMA*wsigma;
     }
 
   return;
   }
 
 
-/******************************** backhisto *********************************/
+/******************************** backstat **********************************/
 /*
 Compute robust statistical estimators in a row of meshes.
+The meshes are independent, so large rows are shared among threads.
 */
-void	backhisto(backstruct *backmesh, backstruct *wbackmesh,
+void	backstat(backstruct *backmesh, backstruct *wbackmesh,
 		PIXTYPE *buf, PIXTYPE *wbuf, size_t bufsize,
 			int n, int w, int bw, PIXTYPE wthresh)
+
+  {
+   int		m, h, lastbite;
+
+  h = bufsize/w;
+  lastbite = w%bw;
+#if defined(VAST_ENABLE_OPENMP) && defined(_OPENMP)
+#pragma omp parallel for schedule(static) \
+	if (n>1 && bufsize>=2*(size_t)BACK_MINPIXPERTHREAD)
+#endif
+  for (m=0; m<n; m++)
+    backstat_mesh(backmesh+m, wbackmesh? wbackmesh+m : NULL,
+	buf+(size_t)m*bw, wbackmesh? wbuf+(size_t)m*bw : NULL,
+	h, w, (m==n-1 && lastbite)? lastbite : bw, wthresh);
+
+  return;
+  }
+
+
+/****************************** backhisto_mesh ******************************/
+/*
+Fill the histograms of a single mesh of width bw.
+*/
+static void	backhisto_mesh(backstruct *bm, backstruct *wbm,
+		PIXTYPE *buf, PIXTYPE *wbuf, int h, int w, int bw,
+		PIXTYPE wthresh)
   {
-   backstruct	*bm,*wbm;
    PIXTYPE	*buft,*wbuft;
    float	qscale,wqscale, cste,wcste, wpix;
    LONG		*histo,*whisto;
-   int		h,m,x,y, nlevels,wnlevels, lastbite, offset, bin;
+   int		x,y, nlevels,wnlevels, offset, bin;
 
-  h = bufsize/w;
-  bm = backmesh;
-  wbm = wbackmesh;
+/* Skip bad meshes */
+  if (bm->mean <= -BIG)
+    return;
   offset = w - bw;
-  for (m=0; m++<n; bm++ , buf+=bw)
+  nlevels = bm->nlevels;
+  histo = bm->histo;
+  qscale = bm->qscale;
+  cste = 0.499999 - bm->qzero/qscale;
+  buft = buf;
+  if (wbm)
     {
-    if (m==n && (lastbite=w%bw))
-      {
-      bw = lastbite;
-      offset = w-bw;
-      }
-/*-- Skip bad meshes */
-    if (bm->mean <= -BIG)
-      {
-      if (wbackmesh)
+    wnlevels = wbm->nlevels;
+    whisto = wbm->histo;
+    wqscale = wbm->qscale;
+    wcste = 0.499999 - wbm->qzero/wqscale;
+    wbuft = wbuf;
+    for (y=h; y--; buft+=offset, wbuft+=offset)
+      for (x=bw; x--;)
         {
-        wbm++;
-        wbuf += bw;
-        }
-      continue;
-      }
-    nlevels = bm->nlevels;
-    histo = bm->histo;
-    qscale = bm->qscale;
-    cste = 0.499999 - bm->qzero/qscale;
-    buft = buf;
-    if (wbackmesh)
-      {
-      wnlevels = wbm->nlevels;
-      whisto = wbm->histo;
-      wqscale = wbm->qscale;
-      wcste = 0.499999 - wbm->qzero/wqscale;
-      wbuft = wbuf;
-      for (y=h; y--; buft+=offset, wbuft+=offset)
-        for (x=bw; x--;)
-          {
-          bin = (int)(*(buft++)/qscale + cste);
-          if ((wpix = *(wbuft++))<wthresh && bin<nlevels && bin>=0)
-            {
-            (*(histo+bin))++;
-            bin = (int)(wpix/wqscale + wcste);
-            if (bin>=0 && bin<wnlevels)
-              (*(whisto+bin))++;
-            }
-          }
-      wbm++;
-      wbuf += bw;
-      }
-    else
-      for (y=h; y--; buft += offset)
-        for (x=bw; x--;)
+        bin = (int)(*(buft++)/qscale + cste);
+        if ((wpix = *(wbuft++))<wthresh && bin<nlevels && bin>=0)
           {
-          bin = (int)(*(buft++)/qscale + cste);
-          if (bin>=0 && bin<nlevels)
-            (*(histo+bin))++;
+          (*(histo+bin))++;
+          bin = (int)(wpix/wqscale + wcste);
+          if (bin>=0 && bin<wnlevels)
+            (*(whisto+bin))++;
           }
+        }
     }
+  else
+    for (y=h; y--; buft += offset)
+      for (x=bw; x--;)
+        {
+        bin = (int)(*(buft++)/qscale + cste);
+        if (bin>=0 && bin<nlevels)
+          (*(histo+bin))++;
+        }
+
+  return;
+  }
+
+
+/******************************** backhisto *********************************/
+/*
+Compute robust statistical estimators in a row of meshes.
+The meshes are independent, so large rows are shared among threads.
+*/
+void	backhisto(backstruct *backmesh, backstruct *wbackmesh,
+		PIXTYPE *buf, PIXTYPE *wbuf, size_t bufsize,
+			int n, int w, int bw, PIXTYPE wthresh)
+  {
+   int		m, h, lastbite;
+
+  h = bufsize/w;
+  lastbite = w%bw;
+#if defined(VAST_ENABLE_OPENMP) && defined(_OPENMP)
+#pragma omp parallel for schedule(static) \
+	if (n>1 && bufsize>=2*(size_t)BACK_MINPIXPERTHREAD)
+#endif
+  for (m=0; m<n; m++)
+    backhisto_mesh(backmesh+m, wbackmesh? wbackmesh+m : NULL,
+	buf+(size_t)m*bw, wbackmesh? wbuf+(size_t)m*bw : NULL,
+	h, w, (m==n-1 && lastbite)? lastbite : bw, wthresh);
 
   return;
   }
@@ -716,36 +728,44 @@ void	filterback(picstruct *field)
   sigma = field->sigma;
   val = sval = 0.0;			/* to avoid gcc -Wall warnings */
 
-/* Look for `bad' meshes and interpolate them if necessary */
-  for (i=0,py=0; py<ny; py++)
-    for (px=0; px<nx; px++,i++)
-      if ((back2[i]=back[i])<=-BIG)
-        {
-/*------ Seek the closest valid mesh */
-        d2min = BIG;
-        nmin = 0.0;
-        for (j=0,y=0; y<ny; y++)
-          for (x=0; x<nx; x++,j++)
-            if (back[j]>-BIG)
+/* Look for `bad' meshes and interpolate them if necessary (each of them */
+/* needs a pass through the map, but only bad meshes are modified, so they */
+/* can be processed by different threads) */
+#if defined(VAST_ENABLE_OPENMP) && defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 16) \
+	private(j,px,py,x,y, d2,d2min, nmin) firstprivate(val,sval) \
+	if ((double)np*np>=2.0*BACK_MINPIXPERTHREAD)
+#endif
+  for (i=0; i<np; i++)
+    if ((back2[i]=back[i])<=-BIG)
+      {
+      px = i%nx;
+      py = i/nx;
+/*---- Seek the closest valid mesh */
+      d2min = BIG;
+      nmin = 0.0;
+      for (j=0,y=0; y<ny; y++)
+        for (x=0; x<nx; x++,j++)
+          if (back[j]>-BIG)
+            {
+            d2 = (float)(x-px)*(x-px)+(y-py)*(y-py);
+            if (d2<d2min)
               {
-              d2 = (float)(x-px)*(x-px)+(y-py)*(y-py);
-              if (d2<d2min)
-                {
-                val = back[j];
-                sval = sigma[j];
-                nmin = 1;
-                d2min = d2;
-                }
-              else if (d2==d2min)
-                {
-                val += back[j];
-                sval += sigma[j];
-                nmin++;
-                }
+              val = back[j];
+              sval = sigma[j];
+              nmin = 1;
+              d2min = d2;
               }
-        back2[i] = nmin? val/nmin: 0.0;
-        sigma[i] = nmin? sval/nmin: 1.0;
-        }
+            else if (d2==d2min)
+              {
+              val += back[j];
+              sval += sigma[j];
+              nmin++;
+              }
+            }
+      back2[i] = nmin? val/nmin: 0.0;
+      sigma[i] = nmin? sval/nmin: 1.0;
+      }
   memcpy(back, back2, (size_t)np*sizeof(float));
 
 /* Do the actual filtering */
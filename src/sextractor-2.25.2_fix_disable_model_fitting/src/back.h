@@ -32,6 +32,7 @@
 #define	QUANTIF_NSIGMA		5		/* histogram limits */
 #define	QUANTIF_NMAXLEVELS	4096		/* max nb of quantif. levels */
 #define	QUANTIF_AMIN		4		/* min nb of "mode pixels" */
+#define	BACK_MINPIXPERTHREAD	65536		/* min nb of pixels per thread */
 
 #define	BACK_WSCALE		1		/* Activate weight scaling */
 #define	BACK_NOWSCALE		0		/* No weight scaling */
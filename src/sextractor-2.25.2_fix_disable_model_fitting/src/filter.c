@@ -36,6 +36,15 @@
 #include	<stdlib.h>
 #include	<string.h>
 
+#if defined(VAST_ENABLE_OPENMP) && defined(_OPENMP)
+#include	<omp.h>
+#endif
+#if defined(__AVX__)
+#include	<immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include	<arm_neon.h>
+#endif
+
 #include	"define.h"
 #include	"globals.h"
 #include	"prefs.h"
@@ -46,22 +55,109 @@
 
 filterstruct	*thefilter;
 
-/******************************** convolve ***********************************/
+/* Do not start threads for the filtering of lines with fewer operations */
+#define	CONVOLVE_MIN_OPERATIONS_PER_THREAD	65536.0
+
+/******************************* convolve_add ********************************/
 /*
-Convolve a scan line with an array.
+Add a scan line segment multiplied by a mask element to the destination:
+d[i] += mval*s[i]. The vector loops perform exactly the same operation on
+each pixel as the scalar one (a fused multiply-add is used only if the
+target has it, as the compiler then contracts the scalar expression too),
+so the result does not depend on which code path is taken.
 */
-void	convolve(picstruct *field, PIXTYPE *mscan, int y)
+static void	convolve_add(PIXTYPE *d, const PIXTYPE *s, int n, PIXTYPE mval)
+
+  {
+   int		i;
+
+  i = 0;
+#if defined(__AVX__)
+   {
+    __m256	vmval = _mm256_set1_ps(mval);
+  for (; i+8<=n; i+=8)
+#if defined(__FMA__)
+    _mm256_storeu_ps(d+i, _mm256_fmadd_ps(vmval, _mm256_loadu_ps(s+i),
+		_mm256_loadu_ps(d+i)));
+#else
+    _mm256_storeu_ps(d+i, _mm256_add_ps(_mm256_loadu_ps(d+i),
+		_mm256_mul_ps(vmval, _mm256_loadu_ps(s+i))));
+#endif
+   }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+   {
+    float32x4_t	vmval = vdupq_n_f32(mval);
+  for (; i+4<=n; i+=4)
+    vst1q_f32(d+i, vfmaq_f32(vld1q_f32(d+i), vmval, vld1q_f32(s+i)));
+   }
+#endif
+  for (; i<n; i++)
+#if defined(__FP_FAST_FMAF)
+    d[i] = fmaf(mval, s[i], d[i]);
+#else
+    d[i] += mval*s[i];
+#endif
+
+  return;
+  }
+
+
+/***************************** convolve_segment ******************************/
+/*
+Convolve the [x0,x1[ segment of a scan line with the filter mask,
+starting from image line y0 and mask element m0, and ending before mask
+element me (see convolve()).
+*/
+static void	convolve_segment(picstruct *field, PIXTYPE *mscan, int y0,
+			int m0, int me, int x0, int x1)
 
   {
-   int		mw,mw2,m0,me,m,mx,dmx, y0, dy, sw,sh;
+   int		mw,mw2,m,mx,dmx, sw,sh, xmin,xmax;
    float	*mask;
-   PIXTYPE	*mscane, *s,*s0, *d,*de, mval;
+   PIXTYPE	*s0;
 
   sw = field->width;
   sh = field->stripheight;
   mw = thefilter->convw;
   mw2 = mw/2;
-  mscane = mscan+sw;
+  memset(mscan+x0, 0, (x1-x0)*sizeof(PIXTYPE));
+  s0 = NULL;				/* To avoid gcc -Wall warnings */
+  mask = thefilter->conv+m0;
+  for (m = m0, mx = 0; m<me; m++, mx++)
+    {
+    if (mx==mw)
+      mx = 0;
+    if (!mx)
+      s0 = field->strip+sw*((y0++)%sh);
+/*-- Pixels of the destination line that the current mask element reaches */
+    dmx = mx-mw2;
+    xmin = dmx>=0? 0 : -dmx;
+    xmax = dmx>=0? sw-dmx : sw;
+    if (xmin<x0)
+      xmin = x0;
+    if (xmax>x1)
+      xmax = x1;
+    if (xmax>xmin)
+      convolve_add(mscan+xmin, s0+xmin+dmx, xmax-xmin, *mask);
+    mask++;
+    }
+
+  return;
+  }
+
+
+/******************************** convolve ***********************************/
+/*
+Convolve a scan line with an array.
+Wide lines are split in segments convolved in parallel threads.
+*/
+void	convolve(picstruct *field, PIXTYPE *mscan, int y)
+
+  {
+   int		mw,m0,me, y0, dy, sw;
+
+  sw = field->width;
+  mw = thefilter->convw;
   y0 = y - (thefilter->convh/2);
   if ((dy = field->ymin-y0) > 0)
     {
@@ -76,33 +172,26 @@ void	convolve(picstruct *field, PIXTYPE *mscan, int y)
   else
     me = mw*thefilter->convh;
 
-  memset(mscan, 0, sw*sizeof(PIXTYPE));
-  s0 = NULL;				/* To avoid gcc -Wall warnings */
-  mask = thefilter->conv+m0;
-  for (m = m0, mx = 0; m<me; m++, mx++)
+#if defined(VAST_ENABLE_OPENMP) && defined(_OPENMP)
+  if ((double)sw*(me-m0) >= CONVOLVE_MIN_OPERATIONS_PER_THREAD*2.0)
     {
-    if (mx==mw)
-      mx = 0;
-    if (!mx)
-      s0 = field->strip+sw*((y0++)%sh);
-
-    if ((dmx = mx-mw2)>=0)
-      {
-      s = s0 + dmx;
-      d = mscan;
-      de = mscane - dmx;
-      }
-    else
-      {
-      s = s0;
-      d = mscan - dmx;
-      de = mscane;
-      }
-
-    mval = *(mask++);
-    while (d<de)
-      *(d++) += mval**(s++);
+#pragma omp parallel
+     {
+      int	nthreads, ithread, x0, x1;
+
+    nthreads = omp_get_num_threads();
+    ithread = omp_get_thread_num();
+/*-- Segments are multiples of 16 pixels to keep the vector loops busy */
+    x0 = (int)(((long)sw*ithread/nthreads) & ~15L);
+    x1 = (ithread==nthreads-1)? sw : (int)(((long)sw*(ithread+1)/nthreads) & ~15L);
+    if (x1>x0)
+      convolve_segment(field, mscan, y0, m0, me, x0, x1);
+     }
+    return;
     }
+#endif
+
+  convolve_segment(field, mscan, y0, m0, me, 0, sw);
 
   return;
   }
@@ -34,6 +34,7 @@
 
 #include <libgen.h>    // for basename()
 #include <sys/types.h> // for getpid()
+#include <sys/stat.h>  // for fstat() in get_UCAC5_zone_RA_index()
 #include <unistd.h>    // also for getpid(), unlink(), sleep() ...
 #include <math.h>
 
@@ -1522,6 +1523,166 @@ int read_APASS_from_vizquery( struct detected_star *stars, int N, char *vizquery
  return 0; // return code 0 means everything is fine - match success
 }
 
+// The local copy of UCAC5 is the set of 900 zone files lib/catalogs/ucac5/z001 ... z900
+// each covering 0.2 deg in Dec. A zone file is a sequence of 52-byte binary records
+// (see http://cdsarc.u-strasbg.fr/ftp/I/340/readmeU5.txt), we need only these fields:
+#define UCAC5_RECORD_SIZE 52
+#define UCAC5_RECORD_OFFSET_EPI 22  // int16 mean epoch - 1997.0 in 1/1000 yr
+#define UCAC5_RECORD_OFFSET_IRA 24  // int32 RA in mas
+#define UCAC5_RECORD_OFFSET_IDC 28  // int32 Dec in mas
+#define UCAC5_RECORD_OFFSET_PMIR 32 // int16 pmRA*cosDec in 0.1 mas/yr
+#define UCAC5_RECORD_OFFSET_PMID 34 // int16 pmDec in 0.1 mas/yr
+#define UCAC5_RECORD_OFFSET_IM1 42  // int16 UCAC fit model mag in mmag
+// Records are read from the zone file in blocks of this many records
+#define UCAC5_READ_BLOCK_RECORDS 4096
+
+// The records within a UCAC5 zone are sorted by RA. The per-zone RA index keeps the number
+// of the first record in each 1 deg RA bin, so only the RA strip overlapping the field
+// needs to be read from the zone file. The index is computed when the zone is accessed
+// for the first time and saved as lib/catalogs/ucac5/zNNN.raindex next to the zone file.
+#define UCAC5_RA_INDEX_MAGIC "UCAC5 RA index1"
+#define UCAC5_RA_INDEX_NBINS 361 // bins 0 to 359 deg + the bin for RA=360.0
+
+struct UCAC5_zone_RA_index {
+ char magic[16];
+ long long zone_file_size;
+ long long zone_file_mtime;
+ int n_records;
+ int is_sorted_by_RA; // if 0, the RA index cannot be used and the whole zone has to be read
+ int first_record_in_bin[UCAC5_RA_INDEX_NBINS + 1];
+};
+
+// Detected star positions sorted in Dec for matching them with the catalog stars
+struct detected_star_sorted_by_dec {
+ double dec_deg;
+ int star_number; // index in the stars[] array
+};
+
+static int compare_detected_stars_by_dec( const void *a, const void *b ) {
+ const struct detected_star_sorted_by_dec *sa= (const struct detected_star_sorted_by_dec *)a;
+ const struct detected_star_sorted_by_dec *sb= (const struct detected_star_sorted_by_dec *)b;
+ if ( sa->dec_deg < sb->dec_deg ) {
+  return -1;
+ }
+ if ( sa->dec_deg > sb->dec_deg ) {
+  return 1;
+ }
+ return sa->star_number - sb->star_number;
+}
+
+static inline int32_t get_int32_from_UCAC5_record( const unsigned char *record, int offset ) {
+ int32_t value;
+ memcpy( &value, record + offset, sizeof( value ) );
+ return value;
+}
+
+static inline int16_t get_int16_from_UCAC5_record( const unsigned char *record, int offset ) {
+ int16_t value;
+ memcpy( &value, record + offset, sizeof( value ) );
+ return value;
+}
+
+static inline int get_UCAC5_RA_index_bin( int32_t ira ) {
+ int bin;
+ bin= (int)( ira / 3600000 );
+ if ( bin < 0 ) {
+  bin= 0;
+ }
+ if ( bin > UCAC5_RA_INDEX_NBINS - 1 ) {
+  bin= UCAC5_RA_INDEX_NBINS - 1;
+ }
+ return bin;
+}
+
+// Read the whole zone file once to compute its RA index.
+// Returns 0 on success, 1 on a read error.
+static int compute_UCAC5_zone_RA_index( FILE *zonefile, unsigned char *buffer, struct UCAC5_zone_RA_index *index ) {
+ size_t n_records_in_block, record_in_block;
+ int record_counter, bin, previous_bin;
+ int32_t ira, previous_ira;
+
+ index->is_sorted_by_RA= 1;
+ record_counter= 0;
+ previous_bin= -1;
+ previous_ira= 0;
+ rewind( zonefile );
+ while ( 0 < ( n_records_in_block= fread( buffer, UCAC5_RECORD_SIZE, UCAC5_READ_BLOCK_RECORDS, zonefile ) ) ) {
+  for ( record_in_block= 0; record_in_block < n_records_in_block; record_in_block++, record_counter++ ) {
+   ira= get_int32_from_UCAC5_record( buffer + record_in_block * UCAC5_RECORD_SIZE, UCAC5_RECORD_OFFSET_IRA );
+   if ( record_counter > 0 && ira < previous_ira ) {
+    index->is_sorted_by_RA= 0;
+   }
+   previous_ira= ira;
+   bin= get_UCAC5_RA_index_bin( ira );
+   for ( ; previous_bin < bin; previous_bin++ ) {
+    index->first_record_in_bin[previous_bin + 1]= record_counter;
+   }
+  }
+ }
+ if ( 0 != ferror( zonefile ) ) {
+  return 1;
+ }
+ for ( ; previous_bin < UCAC5_RA_INDEX_NBINS; previous_bin++ ) {
+  index->first_record_in_bin[previous_bin + 1]= record_counter;
+ }
+ index->n_records= record_counter;
+ return 0;
+}
+
+// Load the RA index of the zone file from zNNN.raindex or compute it (and try to save it).
+// Returns 0 on success, 1 on a zone file read error.
+static int get_UCAC5_zone_RA_index( const char *zonefilename, FILE *zonefile, unsigned char *buffer, struct UCAC5_zone_RA_index *index ) {
+ struct UCAC5_zone_RA_index index_from_file;
+ struct stat zonefile_stat;
+ char indexfilename[FILENAME_LENGTH];
+ char tmp_indexfilename[FILENAME_LENGTH + 32];
+ FILE *indexfile;
+ int is_index_file_ok;
+
+ memset( index, 0, sizeof( struct UCAC5_zone_RA_index ) );
+ strncpy( index->magic, UCAC5_RA_INDEX_MAGIC, sizeof( index->magic ) - 1 );
+ if ( 0 == fstat( fileno( zonefile ), &zonefile_stat ) ) {
+  index->zone_file_size= (long long)zonefile_stat.st_size;
+  index->zone_file_mtime= (long long)zonefile_stat.st_mtime;
+ }
+
+ snprintf( indexfilename, FILENAME_LENGTH, "%s.raindex", zonefilename );
+ indexfile= fopen( indexfilename, "rb" );
+ if ( NULL != indexfile ) {
+  is_index_file_ok= 0;
+  if ( 1 == fread( &index_from_file, sizeof( struct UCAC5_zone_RA_index ), 1, indexfile ) ) {
+   if ( 0 == memcmp( index_from_file.magic, index->magic, sizeof( index->magic ) ) && index_from_file.zone_file_size == index->zone_file_size && index_from_file.zone_file_mtime == index->zone_file_mtime && (long long)index_from_file.n_records * UCAC5_RECORD_SIZE == index->zone_file_size ) {
+    is_index_file_ok= 1;
+   }
+  }
+  fclose( indexfile );
+  if ( 1 == is_index_file_ok ) {
+   memcpy( index, &index_from_file, sizeof( struct UCAC5_zone_RA_index ) );
+   return 0;
+  }
+ }
+
+ if ( 0 != compute_UCAC5_zone_RA_index( zonefile, buffer, index ) ) {
+  return 1;
+ }
+
+ // Save the index for the next runs (via a temporary file in case another process is doing the same).
+ // The catalog directory may be read-only, that is fine - we'll just compute the index again next time.
+ snprintf( tmp_indexfilename, FILENAME_LENGTH + 32, "%s.tmp%d", indexfilename, (int)getpid() );
+ indexfile= fopen( tmp_indexfilename, "wb" );
+ if ( NULL != indexfile ) {
+  is_index_file_ok= ( 1 == fwrite( index, sizeof( struct UCAC5_zone_RA_index ), 1, indexfile ) );
+  if ( 0 != fclose( indexfile ) ) {
+   is_index_file_ok= 0;
+  }
+  if ( 0 == is_index_file_ok || 0 != rename( tmp_indexfilename, indexfilename ) ) {
+   unlink( tmp_indexfilename );
+  }
+ }
+
+ return 0;
+}
+
 int search_UCAC5_localcopy( struct detected_star *stars, int N, struct str_catalog_search_parameters *catalog_search_parameters ) {
 
  double faintest_mag, brightest_mag;
@@ -1534,8 +1695,6 @@ int search_UCAC5_localcopy( struct detected_star *stars, int N, struct str_catal
  double cos_delta;
  int N_stars_matched_with_astrometric_catalog= 0;
 
- int search_stars_counter;
-
  double epoch, pmRA, pmDE;
  // double e_pmRA, e_pmDE;
 
@@ -1560,14 +1719,28 @@ int search_UCAC5_localcopy( struct detected_star *stars, int N, struct str_catal
  double ucac_pm_ra_masy;  //, ucac_pm_ra_err_masy;
  double ucac_pm_dec_masy; //, ucac_pm_dec_err_masy;
 
- int64_t srcid;                                                                    // long
- int32_t ira, idc, rag, dcg;                                                       // int
- int16_t epi, pmir, pmid, pmer, pmed, phgm, im1, rmag, jmag, hmag, kmag, erg, edg; // short
- int8_t flg, nu1;                                                                  // char
+ int32_t ira, idc;
+ int16_t epi, pmir, pmid, im1;
 
- // unsigned char buffer[52];
  FILE *ptr;
 
+ // RA index of the current zone and the ranges of records to be read from it
+ struct UCAC5_zone_RA_index zone_RA_index;
+ int n_record_ranges, record_range_counter;
+ int record_range_first[2];
+ int record_range_end[2];
+ unsigned char *record_buffer;
+ unsigned char *record;
+ size_t n_records_in_block, record_in_block, n_records_to_read;
+ int record_counter;
+
+ // Detected stars considered for matching, sorted in Dec
+ struct detected_star_sorted_by_dec *search_stars;
+ int n_search_stars;
+ int first_search_star, last_search_star, middle_search_star, search_star_counter;
+ double search_star_dec_min, search_star_dec_max;
+ int matched_star_number;
+
  // Check if a local copy of UCAC5 is found
  sprintf( zonefilename, "lib/catalogs/ucac5/z%03d", 1 );
  ptr= fopen( zonefilename, "rb" ); // r for read, b for binary
@@ -1626,6 +1799,31 @@ int search_UCAC5_localcopy( struct detected_star *stars, int N, struct str_catal
  faintest_mag= catalog_search_parameters->faintest_mag;
  brightest_mag= catalog_search_parameters->brightest_mag;
 
+ // Only the first MAX_STARS_IN_LOCAL_CAT_QUERY good stars are matched with the catalog.
+ // Sort them in Dec, so for each catalog star we check only the detected stars
+ // within the search radius in Dec instead of all of them.
+ search_stars= malloc( MAX( N, 1 ) * sizeof( struct detected_star_sorted_by_dec ) );
+ record_buffer= malloc( UCAC5_READ_BLOCK_RECORDS * UCAC5_RECORD_SIZE );
+ if ( NULL == search_stars || NULL == record_buffer ) {
+  fprintf( stderr, "ERROR allocating memory in search_UCAC5_localcopy()\n" );
+  free( search_stars );
+  free( record_buffer );
+  return 1;
+ }
+ n_search_stars= 0;
+ for ( detected_star_counter= 0; detected_star_counter < N; detected_star_counter++ ) {
+  if ( stars[detected_star_counter].good_star != 1 ) {
+   continue;
+  }
+  if ( n_search_stars == MAX_STARS_IN_LOCAL_CAT_QUERY ) {
+   break;
+  }
+  search_stars[n_search_stars].dec_deg= stars[detected_star_counter].dec_deg_measured;
+  search_stars[n_search_stars].star_number= detected_star_counter;
+  n_search_stars++;
+ }
+ qsort( search_stars, n_search_stars, sizeof( struct detected_star_sorted_by_dec ), compare_detected_stars_by_dec );
+
  fprintf( stderr, "Reading UCAC5 zone files...\n" );
 
  // Select only the relevant zone files based on declination
@@ -1661,204 +1859,198 @@ int search_UCAC5_localcopy( struct detected_star *stars, int N, struct str_catal
 
   // fprintf(stderr,"DEBUG: reading %s\n",zonefilename);
 
-  // Read all stars in the zone file
-  while ( 1 == 1 ) {
-   if ( 0 == fread( &srcid, sizeof( srcid ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &rag, sizeof( rag ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &dcg, sizeof( dcg ), 1, ptr ) ) {
-    break;
-   }
-   //
-   // gaia_ra_deg=(double)rag/3600000.0;
-   // garia_dec_deg=(double)dcg/3600000.0;
-   //
-   if ( 0 == fread( &erg, sizeof( erg ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &edg, sizeof( edg ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &flg, sizeof( flg ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &nu1, sizeof( nu1 ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &epi, sizeof( epi ), 1, ptr ) ) {
-    break;
-   }
-   //
-   ucac_epoch= (double)epi / 1000.0 + 1997.0;
-   epoch= ucac_epoch;
-   //
-   if ( 0 == fread( &ira, sizeof( ira ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &idc, sizeof( idc ), 1, ptr ) ) {
-    break;
-   }
-   //
-   ucac_ra_deg= (double)ira / 3600000.0;
-   ucac_dec_deg= (double)idc / 3600000.0;
-   //
-   if ( fabs( search_dec_mean_deg - ucac_dec_deg ) > search_dec_maxmin_deg / 2.0 + 0.2 ) {
-    break;
-   }
-   //
-   if ( 0 == fread( &pmir, sizeof( pmir ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &pmid, sizeof( pmid ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &pmer, sizeof( pmer ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &pmed, sizeof( pmed ), 1, ptr ) ) {
-    break;
-   }
-   //
-   ucac_pm_ra_masy= 0.1 * (double)pmir;
-   // ucac_pm_ra_err_masy=0.1*(double)pmer;
-   ucac_pm_dec_masy= 0.1 * (double)pmid;
-   // ucac_pm_dec_err_masy=0.1*(double)pmed;
+  // A failing storage device makes fread() return 0 (looking like a normal
+  // end-of-file to the reading loop below) while fopen() still succeeds, so
+  // a zone silently reads as empty. Report it: this is how an unreadable
+  // local UCAC5 copy manifests as the mysterious 'Matched 0 stars'.
+  if ( 0 != get_UCAC5_zone_RA_index( zonefilename, ptr, record_buffer, &zone_RA_index ) ) {
+   n_zone_files_with_read_errors++;
+   fclose( ptr );
+   continue;
+  }
 
-   //
-   if ( 0 == fread( &phgm, sizeof( phgm ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &im1, sizeof( im1 ), 1, ptr ) ) {
-    break;
-   }
-   //
-   ucac_mag= (double)im1 / 1000.0;
-   //
-   if ( 0 == fread( &rmag, sizeof( rmag ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &jmag, sizeof( jmag ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &hmag, sizeof( hmag ), 1, ptr ) ) {
-    break;
-   }
-   if ( 0 == fread( &kmag, sizeof( kmag ), 1, ptr ) ) {
-    break;
-   }
+  // Select the ranges of records (in the file order) that may be within the field
+  if ( 0 == zone_RA_index.is_sorted_by_RA ) {
+   n_record_ranges= 1;
+   record_range_first[0]= 0;
+   record_range_end[0]= zone_RA_index.n_records;
+  } else if ( ra_wraps ) {
+   n_record_ranges= 2;
+   record_range_first[0]= 0;
+   record_range_end[0]= zone_RA_index.first_record_in_bin[get_UCAC5_RA_index_bin( (int32_t)( ra_gap_start * 3600000.0 ) ) + 1];
+   record_range_first[1]= zone_RA_index.first_record_in_bin[get_UCAC5_RA_index_bin( (int32_t)( ra_gap_end * 3600000.0 ) )];
+   record_range_end[1]= zone_RA_index.n_records;
+  } else {
+   n_record_ranges= 1;
+   record_range_first[0]= zone_RA_index.first_record_in_bin[get_UCAC5_RA_index_bin( (int32_t)( search_ra_min_deg * 3600000.0 ) )];
+   record_range_end[0]= zone_RA_index.first_record_in_bin[get_UCAC5_RA_index_bin( (int32_t)( search_ra_max_deg * 3600000.0 ) ) + 1];
+  }
 
-   // Check the search parameters
-   if ( ucac_mag > faintest_mag ) {
-    continue;
-   } // continue to the next star
-   if ( ucac_mag < brightest_mag ) {
-    continue;
-   } // continue to the next star
-   //
-   if ( ra_wraps ) {
-    // Field straddles RA=0/360: reject stars in the gap (between ra_gap_start and ra_gap_end)
-    if ( ucac_ra_deg > ra_gap_start && ucac_ra_deg < ra_gap_end ) {
-     continue;
-    }
-   } else {
-    if ( ucac_ra_deg < search_ra_min_deg ) {
-     continue;
-    }
-    if ( ucac_ra_deg > search_ra_max_deg ) {
-     continue;
-    }
-   }
-   if ( ucac_dec_deg < search_dec_min_deg ) {
+  for ( record_range_counter= 0; record_range_counter < n_record_ranges; record_range_counter++ ) {
+   record_counter= record_range_first[record_range_counter];
+   if ( record_counter >= record_range_end[record_range_counter] ) {
     continue;
    }
-   if ( ucac_dec_deg > search_dec_max_deg ) {
-    continue;
+   if ( 0 != fseek( ptr, (long)record_counter * UCAC5_RECORD_SIZE, SEEK_SET ) ) {
+    break;
    }
-   //
-   // Go through all the detected stars and search for a match
-   search_stars_counter= 0;
-   for ( detected_star_counter= 0; detected_star_counter < N; detected_star_counter++ ) {
-    //
-    if ( stars[detected_star_counter].good_star != 1 ) {
-     continue;
-    }
-    if ( search_stars_counter == MAX_STARS_IN_LOCAL_CAT_QUERY ) {
+   // Read the stars in the selected range of the zone file
+   while ( record_counter < record_range_end[record_range_counter] ) {
+    n_records_to_read= (size_t)MIN( UCAC5_READ_BLOCK_RECORDS, record_range_end[record_range_counter] - record_counter );
+    n_records_in_block= fread( record_buffer, UCAC5_RECORD_SIZE, n_records_to_read, ptr );
+    if ( 0 == n_records_in_block ) {
      break;
     }
-    search_stars_counter++;
-    //
-    measured_ra= stars[detected_star_counter].ra_deg_measured;
-    measured_dec= stars[detected_star_counter].dec_deg_measured;
-    distance= compute_distance_on_sphere( ucac_ra_deg, ucac_dec_deg, measured_ra, measured_dec );
-    if ( distance < catalog_search_parameters->search_radius_deg ) {
-     if ( ( ucac_mag < stars[detected_star_counter].catalog_mag && stars[detected_star_counter].matched_with_astrometric_catalog == 1 ) || stars[detected_star_counter].matched_with_astrometric_catalog == 0 ) {
-      //
-      // fprintf(stderr,"DEBUG: we've got a match!\n");
-      //
-      if ( stars[detected_star_counter].matched_with_astrometric_catalog == 0 ) {
-       N_stars_matched_with_astrometric_catalog++;
+    record_counter+= (int)n_records_in_block;
+    for ( record_in_block= 0; record_in_block < n_records_in_block; record_in_block++ ) {
+     record= record_buffer + record_in_block * UCAC5_RECORD_SIZE;
+     //
+     epi= get_int16_from_UCAC5_record( record, UCAC5_RECORD_OFFSET_EPI );
+     ucac_epoch= (double)epi / 1000.0 + 1997.0;
+     epoch= ucac_epoch;
+     //
+     ira= get_int32_from_UCAC5_record( record, UCAC5_RECORD_OFFSET_IRA );
+     idc= get_int32_from_UCAC5_record( record, UCAC5_RECORD_OFFSET_IDC );
+     //
+     ucac_ra_deg= (double)ira / 3600000.0;
+     ucac_dec_deg= (double)idc / 3600000.0;
+     //
+     if ( fabs( search_dec_mean_deg - ucac_dec_deg ) > search_dec_maxmin_deg / 2.0 + 0.2 ) {
+      continue;
+     }
+     //
+     pmir= get_int16_from_UCAC5_record( record, UCAC5_RECORD_OFFSET_PMIR );
+     pmid= get_int16_from_UCAC5_record( record, UCAC5_RECORD_OFFSET_PMID );
+     //
+     ucac_pm_ra_masy= 0.1 * (double)pmir;
+     ucac_pm_dec_masy= 0.1 * (double)pmid;
+     //
+     im1= get_int16_from_UCAC5_record( record, UCAC5_RECORD_OFFSET_IM1 );
+     //
+     ucac_mag= (double)im1 / 1000.0;
+     //
+
+     // Check the search parameters
+     if ( ucac_mag > faintest_mag ) {
+      continue;
+     } // continue to the next star
+     if ( ucac_mag < brightest_mag ) {
+      continue;
+     } // continue to the next star
+     //
+     if ( ra_wraps ) {
+      // Field straddles RA=0/360: reject stars in the gap (between ra_gap_start and ra_gap_end)
+      if ( ucac_ra_deg > ra_gap_start && ucac_ra_deg < ra_gap_end ) {
+       continue;
       }
-      //
-      catalog_ra= ucac_ra_deg;
-      catalog_dec= ucac_dec_deg;
-      pmRA= ucac_pm_ra_masy;
-      pmDE= ucac_pm_dec_masy;
-      catalog_mag= ucac_mag;
-      ///////////////// Account for proper motion /////////////////
-      cos_delta= cos( catalog_dec * M_PI / 180.0 );
-      catalog_ra_original= catalog_ra;
-      catalog_dec_original= catalog_dec;
-      observing_epoch_jy= 2000.0 + ( stars[0].observing_epoch_jd - 2451545.0 ) / 365.25;
-      dt= observing_epoch_jy - epoch;
-      if ( fabs( cos_delta ) > 1e-6 ) {
-       catalog_ra= catalog_ra + pmRA / ( 3600000 * cos_delta ) * dt;
+     } else {
+      if ( ucac_ra_deg < search_ra_min_deg ) {
+       continue;
+      }
+      if ( ucac_ra_deg > search_ra_max_deg ) {
+       continue;
       }
-      // catalog_ra= catalog_ra + pmRA / 3600000 * cos_delta * dt;
-      catalog_dec= catalog_dec + pmDE / 3600000 * dt;
-      //
-      stars[detected_star_counter].matched_with_astrometric_catalog= 1;
-      stars[detected_star_counter].d_ra= ra_diff_normalized_for_wraparound( catalog_ra, measured_ra );
-      stars[detected_star_counter].d_dec= catalog_dec - measured_dec;
-      stars[detected_star_counter].catalog_ra= catalog_ra;
-      stars[detected_star_counter].catalog_dec= catalog_dec;
-      stars[detected_star_counter].catalog_mag= catalog_mag;
-      stars[detected_star_counter].catalog_mag_err= 0.0;
-      stars[detected_star_counter].catalog_ra_original= catalog_ra_original;
-      stars[detected_star_counter].catalog_dec_original= catalog_dec_original;
-      //
-      stars[detected_star_counter].match_distance_astrometric_catalog_arcsec= distance;
-      // reset photometric info
-      stars[detected_star_counter].APASS_B= 0.0;
-      stars[detected_star_counter].APASS_B_err= 0.0;
-      stars[detected_star_counter].APASS_V= 0.0;
-      stars[detected_star_counter].APASS_V_err= 0.0;
-      stars[detected_star_counter].APASS_r= 0.0;
-      stars[detected_star_counter].APASS_r_err= 0.0;
-      stars[detected_star_counter].APASS_i= 0.0;
-      stars[detected_star_counter].APASS_i_err= 0.0;
-      stars[detected_star_counter].Rc_computed_from_APASS_ri= 0.0;
-      stars[detected_star_counter].Rc_computed_from_APASS_ri_err= 0.0;
-      stars[detected_star_counter].Rc_computed_from_APASS_ri_err= 0.0;
-      stars[detected_star_counter].Ic_computed_from_APASS_ri= 0.0;
-      stars[detected_star_counter].Ic_computed_from_APASS_ri_err= 0.0;
-      //
-      break; // assume we have only one match
-      //
      }
-    }
-   }
-   //
-
-   // fprintf(stderr, "%li  %.7lf %.7lf  %.3lf %.3lf  %.1lf %.1lf %.1lf %.1lf\n", srcid, ucac_ra_deg, ucac_dec_deg, ucac_epoch, ucac_mag,  ucac_pm_ra_masy, ucac_pm_ra_err_masy, ucac_pm_dec_masy, ucac_pm_dec_err_masy );
-  } // while( 1 == 1 ) { // Read all stars in the zone file
+     if ( ucac_dec_deg < search_dec_min_deg ) {
+      continue;
+     }
+     if ( ucac_dec_deg > search_dec_max_deg ) {
+      continue;
+     }
+     //
+     // Search for the first (in the stars[] order) detected star that matches this catalog star.
+     // The angular distance cannot be smaller than the Dec difference, the Dec window is slightly
+     // widened to account for the rounding errors of compute_distance_on_sphere().
+     search_star_dec_min= ucac_dec_deg - catalog_search_parameters->search_radius_deg - 1.0 / 3600.0;
+     search_star_dec_max= ucac_dec_deg + catalog_search_parameters->search_radius_deg + 1.0 / 3600.0;
+     first_search_star= 0;
+     last_search_star= n_search_stars;
+     while ( first_search_star < last_search_star ) {
+      middle_search_star= first_search_star + ( last_search_star - first_search_star ) / 2;
+      if ( search_stars[middle_search_star].dec_deg < search_star_dec_min ) {
+       first_search_star= middle_search_star + 1;
+      } else {
+       last_search_star= middle_search_star;
+      }
+     }
+     matched_star_number= -1;
+     for ( search_star_counter= first_search_star; search_star_counter < n_search_stars && search_stars[search_star_counter].dec_deg <= search_star_dec_max; search_star_counter++ ) {
+      detected_star_counter= search_stars[search_star_counter].star_number;
+      if ( matched_star_number != -1 && detected_star_counter > matched_star_number ) {
+       continue;
+      }
+      measured_ra= stars[detected_star_counter].ra_deg_measured;
+      measured_dec= stars[detected_star_counter].dec_deg_measured;
+      distance= compute_distance_on_sphere( ucac_ra_deg, ucac_dec_deg, measured_ra, measured_dec );
+      if ( distance < catalog_search_parameters->search_radius_deg ) {
+       if ( ( ucac_mag < stars[detected_star_counter].catalog_mag && stars[detected_star_counter].matched_with_astrometric_catalog == 1 ) || stars[detected_star_counter].matched_with_astrometric_catalog == 0 ) {
+        matched_star_number= detected_star_counter;
+       }
+      }
+     }
+     if ( matched_star_number == -1 ) {
+      continue;
+     }
+     //
+     detected_star_counter= matched_star_number;
+     measured_ra= stars[detected_star_counter].ra_deg_measured;
+     measured_dec= stars[detected_star_counter].dec_deg_measured;
+     distance= compute_distance_on_sphere( ucac_ra_deg, ucac_dec_deg, measured_ra, measured_dec );
+     //
+     // fprintf(stderr,"DEBUG: we've got a match!\n");
+     //
+     if ( stars[detected_star_counter].matched_with_astrometric_catalog == 0 ) {
+      N_stars_matched_with_astrometric_catalog++;
+     }
+     //
+     catalog_ra= ucac_ra_deg;
+     catalog_dec= ucac_dec_deg;
+     pmRA= ucac_pm_ra_masy;
+     pmDE= ucac_pm_dec_masy;
+     catalog_mag= ucac_mag;
+     ///////////////// Account for proper motion /////////////////
+     cos_delta= cos( catalog_dec * M_PI / 180.0 );
+     catalog_ra_original= catalog_ra;
+     catalog_dec_original= catalog_dec;
+     observing_epoch_jy= 2000.0 + ( stars[0].observing_epoch_jd - 2451545.0 ) / 365.25;
+     dt= observing_epoch_jy - epoch;
+     if ( fabs( cos_delta ) > 1e-6 ) {
+      catalog_ra= catalog_ra + pmRA / ( 3600000 * cos_delta ) * dt;
+     }
+     // catalog_ra= catalog_ra + pmRA / 3600000 * cos_delta * dt;
+     catalog_dec= catalog_dec + pmDE / 3600000 * dt;
+     //
+     stars[detected_star_counter].matched_with_astrometric_catalog= 1;
+     stars[detected_star_counter].d_ra= ra_diff_normalized_for_wraparound( catalog_ra, measured_ra );
+     stars[detected_star_counter].d_dec= catalog_dec - measured_dec;
+     stars[detected_star_counter].catalog_ra= catalog_ra;
+     stars[detected_star_counter].catalog_dec= catalog_dec;
+     stars[detected_star_counter].catalog_mag= catalog_mag;
+     stars[detected_star_counter].catalog_mag_err= 0.0;
+     stars[detected_star_counter].catalog_ra_original= catalog_ra_original;
+     stars[detected_star_counter].catalog_dec_original= catalog_dec_original;
+     //
+     stars[detected_star_counter].match_distance_astrometric_catalog_arcsec= distance;
+     // reset photometric info
+     stars[detected_star_counter].APASS_B= 0.0;
+     stars[detected_star_counter].APASS_B_err= 0.0;
+     stars[detected_star_counter].APASS_V= 0.0;
+     stars[detected_star_counter].APASS_V_err= 0.0;
+     stars[detected_star_counter].APASS_r= 0.0;
+     stars[detected_star_counter].APASS_r_err= 0.0;
+     stars[detected_star_counter].APASS_i= 0.0;
+     stars[detected_star_counter].APASS_i_err= 0.0;
+     stars[detected_star_counter].Rc_computed_from_APASS_ri= 0.0;
+     stars[detected_star_counter].Rc_computed_from_APASS_ri_err= 0.0;
+     stars[detected_star_counter].Rc_computed_from_APASS_ri_err= 0.0;
+     stars[detected_star_counter].Ic_computed_from_APASS_ri= 0.0;
+     stars[detected_star_counter].Ic_computed_from_APASS_ri_err= 0.0;
+     //
+    } // for ( record_in_block= 0; ...
+   } // while ( record_counter < record_range_end[record_range_counter] ) { // Read the stars in the selected range
+  } // for ( record_range_counter= 0; ...
 
-  // A failing storage device makes fread() return 0 (looking like a normal
-  // end-of-file to the reading loop above) while fopen() still succeeds, so
-  // a zone silently reads as empty. Report it: this is how an unreadable
-  // local UCAC5 copy manifests as the mysterious 'Matched 0 stars'.
+  // See the comment above about the failing storage device
   if ( 0 != ferror( ptr ) ) {
    n_zone_files_with_read_errors++;
   }
@@ -1866,6 +2058,9 @@ int search_UCAC5_localcopy( struct detected_star *stars, int N, struct str_catal
   fclose( ptr );
  } // for( zone_counter==0; zone_counter<900; zone_counter++ ) { // Read each zone file
 
+ free( record_buffer );
+ free( search_stars );
+
  fprintf( stderr, "Done reading UCAC5 zone files...\n" );
  if ( n_zone_files_with_read_errors > 0 ) {
   fprintf( stderr, "ERROR: input/output errors while reading %d of %u UCAC5 zone files - the storage device hosting lib/catalogs/ucac5 may be failing or disconnected!\n", n_zone_files_with_read_errors, zone_end - zone_start + 1 );
@@ -175,12 +175,397 @@ void change_number_of_sysrem_iterations_in_log_file() {
  return;
 }
 
+// One measurement in the sparse SysRem matrix.
+// index is the image number for the by-star (CSR) copy of the matrix
+// and the star number for the by-image (CSC) copy of the matrix.
+struct SysRem_measurement {
+ int index;
+ float r; // magnitude residual
+ float w; // weight 1/err^2
+};
+
+// Measurements of one processing block stored twice:
+// by star (each star's measurements sorted by image number) for the c[i] update and
+// by image (each image's measurements sorted by star number) for the a[j] update.
+// Only the existing measurements are stored, so fields with partial coverage
+// (many stars not measured on many images) need much less memory than a dense Nstars x Nobs matrix.
+struct SysRem_sparse_matrix {
+ int Nstars;
+ int Nobs;
+ long *star_start; // measurements of star i are star_entries[star_start[i]] .. star_entries[star_start[i+1]-1]
+ struct SysRem_measurement *star_entries;
+ long *image_start; // measurements on image j are image_entries[image_start[j]] .. image_entries[image_start[j+1]-1]
+ struct SysRem_measurement *image_entries;
+};
+
+// Image JDs sorted in time, for the binary search of the image number corresponding to a lightcurve point
+struct SysRem_image_jd {
+ double jd;
+ int image;
+};
+
+static int compare_SysRem_image_jd( const void *a, const void *b ) {
+ const struct SysRem_image_jd *jd_a= (const struct SysRem_image_jd *)a;
+ const struct SysRem_image_jd *jd_b= (const struct SysRem_image_jd *)b;
+ if ( jd_a->jd < jd_b->jd )
+  return -1;
+ if ( jd_a->jd > jd_b->jd )
+  return 1;
+ if ( jd_a->image < jd_b->image )
+  return -1;
+ if ( jd_a->image > jd_b->image )
+  return 1;
+ return 0;
+}
+
+// Returns the image number k such that fabs( jd[k] - djd ) <= 0.00001 (0.8 sec) or -1 if there is no such image.
+// If several images match, the one with the smallest number is returned, just like a linear search over jd[] would do.
+static int find_image_number_for_jd( struct SysRem_image_jd *sorted_jd, int Nobs, double djd ) {
+ int first, last, middle;
+ int image= -1;
+ // lower bound of the search window, a bit wider than the actual tolerance to be safe with rounding
+ first= 0;
+ last= Nobs;
+ while ( first < last ) {
+  middle= first + ( last - first ) / 2;
+  if ( sorted_jd[middle].jd < djd - 0.00001 - 0.000000001 ) {
+   first= middle + 1;
+  } else {
+   last= middle;
+  }
+ }
+ for ( ; first < Nobs && sorted_jd[first].jd <= djd + 0.00001 + 0.000000001; first++ ) {
+  if ( fabs( sorted_jd[first].jd - djd ) <= 0.00001 ) {
+   if ( image == -1 || sorted_jd[first].image < image ) {
+    image= sorted_jd[first].image;
+   }
+  }
+ }
+ return image;
+}
+
+static int compare_int_sysrem( const void *a, const void *b ) {
+ if ( *(const int *)a < *(const int *)b )
+  return -1;
+ if ( *(const int *)a > *(const int *)b )
+  return 1;
+ return 0;
+}
+
+// Read the lightcurves listed in the (split) SysRem input star list into the sparse matrix.
+// The star magnitudes are converted to residuals from the star's median magnitude.
+static void read_SysRem_sparse_matrix( char **lightcurvefilenames, int Nstars, struct SysRem_image_jd *sorted_jd, int Nobs, struct SysRem_sparse_matrix *matrix ) {
+ struct SysRem_measurement **measurements_of_star;
+ int *number_of_measurements_of_star;
+ int i, j;
+ long k, l;
+ long *image_fill;
+
+ measurements_of_star= malloc( Nstars * sizeof( struct SysRem_measurement * ) );
+ number_of_measurements_of_star= malloc( Nstars * sizeof( int ) );
+ if ( measurements_of_star == NULL || number_of_measurements_of_star == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for measurements_of_star\n" );
+  exit( EXIT_FAILURE );
+ }
+
+// Each thread reads its lightcurves into a dense row re-used for all the stars it processes,
+// then the row is compressed to the list of the actual measurements
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel private( i, j, k, l )
+#endif
+#endif
+ {
+  FILE *lightcurvefile;
+  double djd, ddmag, ddmerr, y, app;
+  char string[FILENAME_LENGTH];
+  char comments_string[MAX_STRING_LENGTH_IN_LIGHTCURVE_FILE];
+  float *row_r;
+  float *row_err;
+  unsigned char *row_measured;
+  int *measured_images;
+  int number_of_measured_images;
+  double *double_data;
+  float median;
+
+  row_r= malloc( Nobs * sizeof( float ) );
+  row_err= malloc( Nobs * sizeof( float ) );
+  row_measured= malloc( Nobs * sizeof( unsigned char ) );
+  measured_images= malloc( Nobs * sizeof( int ) );
+  double_data= malloc( Nobs * sizeof( double ) );
+  if ( row_r == NULL || row_err == NULL || row_measured == NULL || measured_images == NULL || double_data == NULL ) {
+   fprintf( stderr, "ERROR: Couldn't allocate memory for row_r\n" );
+   exit( EXIT_FAILURE );
+  }
+  for ( j= Nobs; j--; ) {
+   row_r[j]= 0.0;
+   row_measured[j]= 0;
+  }
+
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp for schedule( dynamic, 16 )
+#endif
+#endif
+  for ( i= 0; i < Nstars; i++ ) {
+   lightcurvefile= fopen( lightcurvefilenames[i], "r" );
+   if ( NULL == lightcurvefile ) {
+    fprintf( stderr, "ERROR: Can't read file %s\n", lightcurvefilenames[i] );
+    exit( EXIT_FAILURE );
+   }
+   number_of_measured_images= 0;
+   while ( -1 < read_lightcurve_point( lightcurvefile, &djd, &ddmag, &ddmerr, NULL, &y, &app, string, comments_string ) ) {
+    if ( djd == 0.0 )
+     continue; // if this line could not be parsed, try the next one
+    //  Find which j is corresponding to the current JD
+    j= find_image_number_for_jd( sorted_jd, Nobs, djd );
+    if ( j < 0 )
+     continue;
+    if ( row_measured[j] == 0 ) {
+     row_measured[j]= 1;
+     measured_images[number_of_measured_images]= j;
+     number_of_measured_images++;
+    }
+    row_r[j]= (float)ddmag;
+    row_err[j]= (float)ddmerr;
+   }
+   fclose( lightcurvefile );
+
+   // Compute median magnitude and subtract it from all measurements
+   // Use quickselect for O(n) median computation instead of O(n log n) sort
+   for ( k= 0, l= 0; l < number_of_measured_images; l++ ) {
+    if ( row_r[measured_images[l]] != 0.0 ) {
+     double_data[k]= (double)row_r[measured_images[l]];
+     k++;
+    }
+   }
+   if ( k > 0 ) {
+    median= quickselect_median_double( double_data, k );
+   } else {
+    median= 0.0;
+   }
+
+   // Keep only the non-zero residuals (zero means "no measurement") sorted in image number
+   qsort( measured_images, number_of_measured_images, sizeof( int ), compare_int_sysrem );
+   measurements_of_star[i]= malloc( MAX( number_of_measured_images, 1 ) * sizeof( struct SysRem_measurement ) );
+   if ( measurements_of_star[i] == NULL ) {
+    fprintf( stderr, "ERROR: Couldn't allocate memory for measurements_of_star[i]\n" );
+    exit( EXIT_FAILURE );
+   }
+   for ( k= 0, l= 0; l < number_of_measured_images; l++ ) {
+    j= measured_images[l];
+    if ( row_r[j] != 0.0 ) {
+     row_r[j]= row_r[j] - median;
+     if ( row_r[j] != 0.0 ) {
+      measurements_of_star[i][k].index= j;
+      measurements_of_star[i][k].r= row_r[j];
+      measurements_of_star[i][k].w= 1.0f / ( row_err[j] * row_err[j] );
+      k++;
+     }
+    }
+    row_r[j]= 0.0; // reset the row for the next star
+    row_measured[j]= 0;
+   }
+   number_of_measurements_of_star[i]= (int)k;
+  }
+
+  free( double_data );
+  free( measured_images );
+  free( row_measured );
+  free( row_err );
+  free( row_r );
+ }
+
+ // Pack the per-star measurements into the by-star matrix
+ matrix->Nstars= Nstars;
+ matrix->Nobs= Nobs;
+ matrix->star_start= malloc( ( Nstars + 1 ) * sizeof( long ) );
+ matrix->image_start= malloc( ( Nobs + 1 ) * sizeof( long ) );
+ image_fill= malloc( ( Nobs + 1 ) * sizeof( long ) );
+ if ( matrix->star_start == NULL || matrix->image_start == NULL || image_fill == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for the SysRem matrix index\n" );
+  exit( EXIT_FAILURE );
+ }
+ matrix->star_start[0]= 0;
+ for ( i= 0; i < Nstars; i++ ) {
+  matrix->star_start[i + 1]= matrix->star_start[i] + number_of_measurements_of_star[i];
+ }
+ matrix->star_entries= malloc( MAX( matrix->star_start[Nstars], 1 ) * sizeof( struct SysRem_measurement ) );
+ matrix->image_entries= malloc( MAX( matrix->star_start[Nstars], 1 ) * sizeof( struct SysRem_measurement ) );
+ if ( matrix->star_entries == NULL || matrix->image_entries == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for %ld SysRem measurements\n", matrix->star_start[Nstars] );
+  exit( EXIT_FAILURE );
+ }
+ for ( i= 0; i < Nstars; i++ ) {
+  memcpy( &matrix->star_entries[matrix->star_start[i]], measurements_of_star[i], number_of_measurements_of_star[i] * sizeof( struct SysRem_measurement ) );
+  free( measurements_of_star[i] );
+ }
+ free( measurements_of_star );
+ free( number_of_measurements_of_star );
+
+ // Transpose it into the by-image matrix (stars come in increasing order within each image)
+ for ( j= 0; j <= Nobs; j++ ) {
+  matrix->image_start[j]= 0;
+ }
+ for ( k= 0; k < matrix->star_start[Nstars]; k++ ) {
+  matrix->image_start[matrix->star_entries[k].index + 1]++;
+ }
+ for ( j= 0; j < Nobs; j++ ) {
+  matrix->image_start[j + 1]+= matrix->image_start[j];
+ }
+ for ( j= 0; j <= Nobs; j++ ) {
+  image_fill[j]= matrix->image_start[j];
+ }
+ for ( i= 0; i < Nstars; i++ ) {
+  for ( k= matrix->star_start[i]; k < matrix->star_start[i + 1]; k++ ) {
+   l= image_fill[matrix->star_entries[k].index]++;
+   matrix->image_entries[l].index= i;
+   matrix->image_entries[l].r= matrix->star_entries[k].r;
+   matrix->image_entries[l].w= matrix->star_entries[k].w;
+  }
+ }
+ free( image_fill );
+
+ fprintf( stderr, "%ld measurements in the SysRem matrix (%.1lf%% of %d stars x %d images)\n", matrix->star_start[Nstars], 100.0 * (double)matrix->star_start[Nstars] / ( (double)Nstars * (double)Nobs ), Nstars, Nobs );
+
+ return;
+}
+
+static void free_SysRem_sparse_matrix( struct SysRem_sparse_matrix *matrix ) {
+ free( matrix->star_start );
+ free( matrix->star_entries );
+ free( matrix->image_start );
+ free( matrix->image_entries );
+ return;
+}
+
+// Iterative search for best c[i] and a[j].
+// In the second pass ( second_pass == 1 ) the bad stars are ignored and only
+// the first (brightest, as the input list is sorted in magnitude) 1000 stars are used to compute a[j].
+// The summation order is the same as in the dense-matrix version of this code.
+static void SysRem_iterations( struct SysRem_sparse_matrix *matrix, int *bad_stars, int second_pass, float *c, float *old_c, float *a, float *old_a ) {
+ int i, j, iter;
+ long k;
+ float sum1, sum2;
+ float max_c_change, max_a_change;
+ int Nstars= matrix->Nstars;
+ int Nobs= matrix->Nobs;
+
+ for ( iter= 0; iter < NUMBER_OF_Ai_Ci_ITERATIONS; iter++ ) {
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for private( i, k, sum1, sum2 )
+#endif
+#endif
+  for ( i= 0; i < Nstars; i++ ) {
+   sum1= sum2= 0.0;
+   if ( second_pass == 0 ) {
+    for ( k= matrix->star_start[i]; k < matrix->star_start[i + 1]; k++ ) {
+     sum1+= matrix->star_entries[k].r * a[matrix->star_entries[k].index] * matrix->star_entries[k].w;
+     sum2+= a[matrix->star_entries[k].index] * a[matrix->star_entries[k].index] * matrix->star_entries[k].w;
+    }
+   } else if ( bad_stars[i] == 0 ) {
+    for ( k= matrix->star_start[i + 1]; k-- > matrix->star_start[i]; ) {
+     sum1+= matrix->star_entries[k].r * a[matrix->star_entries[k].index] * matrix->star_entries[k].w;
+     sum2+= a[matrix->star_entries[k].index] * a[matrix->star_entries[k].index] * matrix->star_entries[k].w;
+    }
+   }
+   if ( sum1 != 0.0 && sum2 != 0.0 ) {
+    old_c[i]= c[i];
+    c[i]= sum1 / sum2;
+   }
+  }
+
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for private( j, k, sum1, sum2 )
+#endif
+#endif
+  for ( j= 0; j < Nobs; j++ ) {
+   sum1= sum2= 0.0;
+   if ( second_pass == 0 ) {
+    for ( k= matrix->image_start[j + 1]; k-- > matrix->image_start[j]; ) {
+     sum1+= matrix->image_entries[k].r * c[matrix->image_entries[k].index] * matrix->image_entries[k].w;
+     sum2+= c[matrix->image_entries[k].index] * c[matrix->image_entries[k].index] * matrix->image_entries[k].w;
+    }
+   } else {
+    // !!!!! experimental !!!!! - try to use only a few brightest stars to compute a[j]
+    // We assume the array is sorted in magnitude
+    for ( k= matrix->image_start[j]; k < matrix->image_start[j + 1] && matrix->image_entries[k].index < 1000; k++ ) {
+     if ( bad_stars[matrix->image_entries[k].index] == 0 ) {
+      sum1+= matrix->image_entries[k].r * c[matrix->image_entries[k].index] * matrix->image_entries[k].w;
+      sum2+= c[matrix->image_entries[k].index] * c[matrix->image_entries[k].index] * matrix->image_entries[k].w;
+     }
+    }
+   }
+   if ( sum1 != 0.0 && sum2 != 0.0 ) {
+    old_a[j]= a[j];
+    a[j]= sum1 / sum2;
+   }
+  }
+
+  // Should we stop now?
+  // Yes, if both a and c change by less than Ai_Ci_DIFFERENCE_TO_STOP_ITERATIONS compared to the previous step
+  // (for all indexes = stars/images)
+  max_c_change= max_a_change= 0.0;
+  for ( i= Nstars; i--; ) {
+   if ( fabsf( c[i] - old_c[i] ) > max_c_change ) {
+    max_c_change= fabsf( c[i] - old_c[i] );
+   }
+  }
+  for ( j= Nobs; j--; ) {
+   if ( fabsf( a[j] - old_a[j] ) > max_a_change ) {
+    max_a_change= fabsf( a[j] - old_a[j] );
+   }
+  }
+  fprintf( stderr, "\riteration %4d  max|dc|=%.2e max|da|=%.2e", iter + 1, max_c_change, max_a_change );
+  if ( max_c_change <= Ai_Ci_DIFFERENCE_TO_STOP_ITERATIONS && max_a_change <= Ai_Ci_DIFFERENCE_TO_STOP_ITERATIONS ) {
+   break; // Stop iteretions if they make no difference
+  }
+ } // Iterative search for best c[i] and a[j]
+
+ return;
+}
+
+// A filtering attempt: if a single star dominates the solution, it should have c~1 while
+// all other stars should have c~0
+static void SysRem_mark_outlier_stars( float *c, int Nstars, int *bad_stars ) {
+ double *double_data;
+ long k;
+ int i;
+ float median, sigma;
+
+ double_data= malloc( Nstars * sizeof( double ) );
+ if ( double_data == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for double_data\n" );
+  exit( EXIT_FAILURE );
+ }
+ k= 0;
+ for ( i= Nstars; i--; ) {
+  if ( c[i] != 0.0f ) {
+   double_data[k]= (double)c[i];
+   k++;
+  }
+ }
+ gsl_sort( double_data, 1, k );
+ median= (float)gsl_stats_median_from_sorted_data( double_data, 1, k );
+ sigma= (float)esimate_sigma_from_MAD_of_sorted_data_and_ruin_input_array( double_data, k );
+ free( double_data );
+ for ( i= 0; i < Nstars; i++ ) {
+  if ( c[i] != 0.0f ) {
+   if ( fabsf( c[i] - median ) > 10.0 * sigma ) {
+    bad_stars[i]= 1;
+   }
+  }
+ }
+ return;
+}
+
 int main() {
  FILE *lightcurvefile;
  FILE *outlightcurvefile;
 
- float **mag_err;
- float **r;
+ struct SysRem_sparse_matrix matrix;
 
  float *c;
  float *a;
@@ -189,8 +574,9 @@ int main() {
  float *old_a;
 
  double *jd;
+ struct SysRem_image_jd *sorted_jd;
 
- int i, j, iter;
+ int i, j;
 
  long k;
 
@@ -209,21 +595,23 @@ int main() {
  int Nobs;
  int Nstars;
 
- // float *data;
- double *double_data;
- float mean, median, sigma, sum1, sum2;
+ float mean;
 
  FILE *datafile;
  char lightcurvefilename[OUTFILENAME_LENGTH];
  char outlightcurvefilename[OUTFILENAME_LENGTH];
 
- int stop_iterations= 0;
+ char **block_lightcurvefilenames;
 
- // int bad_stars_counter;
- int *bad_stars;
- char **star_numbers;
-
- float tmpfloat; // for faster computation
+ // Results of all processing blocks, the corrections are applied in one pass after all blocks are done
+ int Nstars_total;
+ int Nstars_total_allocated;
+ char **star_numbers;     // star number of each star in all blocks
+ int *bad_stars;          // bad star flag of each star in all blocks
+ float *c_all;            // c[i] of each star in all blocks
+ int *block_of_star;      // processing block each star belongs to
+ float *a_all;            // a[j] of each processing block: a_all[block*Nobs+j]
+ int first_star_in_block; // index of the first star of the current block in the above arrays
 
  int number_of_cpu_cores_to_report;
 
@@ -243,6 +631,56 @@ int main() {
  }
  split_sysrem_input_star_list_lst( split_sysrem_input_star_list_lst_filenames, &N_sysrem_input_star_list_lst );
 
+ // Read the log file
+ jd= malloc( MAX_NUMBER_OF_OBSERVATIONS * sizeof( double ) );
+ if ( jd == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for jd\n" );
+  exit( EXIT_FAILURE );
+ }
+ Nobs= 0; // initialize it here, just in case
+ get_dates( jd, &Nobs );
+ if ( Nobs <= 0 ) {
+  fprintf( stderr, "ERROR: Attempting to allocate a zero or negative amount of memory (Nobs <= 0)\n" );
+  exit( EXIT_FAILURE );
+ };
+ sorted_jd= malloc( Nobs * sizeof( struct SysRem_image_jd ) );
+ if ( sorted_jd == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for sorted_jd\n" );
+  exit( EXIT_FAILURE );
+ }
+ for ( j= 0; j < Nobs; j++ ) {
+  sorted_jd[j].jd= jd[j];
+  sorted_jd[j].image= j;
+ }
+ qsort( sorted_jd, Nobs, sizeof( struct SysRem_image_jd ), compare_SysRem_image_jd );
+
+ ////////////////////////
+ // get_number_of_cpu_cores() will set OMP_NUM_THREADS variable
+ // in a hope to avoid out-of-memory situation when using OpenMP down below
+ number_of_cpu_cores_to_report= get_number_of_cpu_cores();
+ // and report the number of CPU cores to the user (just for information)
+ fprintf( stderr, "Number of CPU cores: %d\n", number_of_cpu_cores_to_report );
+
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+ // tests show that limiting the number of OpenMP threads dramatically improves performance.
+ omp_set_num_threads( MIN( number_of_cpu_cores_to_report, 48 ) );
+#endif
+#endif
+ fprintf( stderr, "Number of threads: %d\n", MIN( number_of_cpu_cores_to_report, 48 ) );
+
+ Nstars_total= 0;
+ Nstars_total_allocated= 0;
+ star_numbers= NULL;
+ bad_stars= NULL;
+ c_all= NULL;
+ block_of_star= NULL;
+ a_all= malloc( (size_t)N_sysrem_input_star_list_lst * (size_t)Nobs * sizeof( float ) );
+ if ( a_all == NULL ) {
+  fprintf( stderr, "ERROR: Couldn't allocate memory for a_all\n" );
+  exit( EXIT_FAILURE );
+ }
+
  ///////////////////////
  for ( sysrem_input_star_list_lst_counter= 0; sysrem_input_star_list_lst_counter < N_sysrem_input_star_list_lst; sysrem_input_star_list_lst_counter++ ) {
 
@@ -265,79 +703,75 @@ int main() {
    exit( EXIT_FAILURE );
   }
 
-  bad_stars= malloc( Nstars * sizeof( int ) );
-  if ( bad_stars == NULL ) {
-   fprintf( stderr, "ERROR: Couldn't allocate memory for bad_stars\n" );
-   exit( EXIT_FAILURE );
-  };
-  star_numbers= malloc( Nstars * sizeof( char * ) );
-  if ( star_numbers == NULL ) {
-   fprintf( stderr, "ERROR: Couldn't allocate memory for star_numbers\n" );
+  // Make room for the stars of this block in the arrays describing all the stars
+  first_star_in_block= Nstars_total;
+  if ( Nstars_total + Nstars > Nstars_total_allocated ) {
+   Nstars_total_allocated= Nstars_total + Nstars;
+   star_numbers= realloc( star_numbers, Nstars_total_allocated * sizeof( char * ) );
+   bad_stars= realloc( bad_stars, Nstars_total_allocated * sizeof( int ) );
+   c_all= realloc( c_all, Nstars_total_allocated * sizeof( float ) );
+   block_of_star= realloc( block_of_star, Nstars_total_allocated * sizeof( int ) );
+   if ( star_numbers == NULL || bad_stars == NULL || c_all == NULL || block_of_star == NULL ) {
+    fprintf( stderr, "ERROR: Couldn't allocate memory for star_numbers\n" );
+    exit( EXIT_FAILURE );
+   };
+  }
+  block_lightcurvefilenames= malloc( Nstars * sizeof( char * ) );
+  if ( block_lightcurvefilenames == NULL ) {
+   fprintf( stderr, "ERROR: Couldn't allocate memory for block_lightcurvefilenames\n" );
    exit( EXIT_FAILURE );
   };
-  // for(i=0;i<Nstars;i++){
   for ( i= Nstars; i--; ) {
-   star_numbers[i]= malloc( OUTFILENAME_LENGTH * sizeof( char ) );
-   if ( star_numbers[i] == NULL ) {
+   star_numbers[first_star_in_block + i]= malloc( OUTFILENAME_LENGTH * sizeof( char ) );
+   block_lightcurvefilenames[i]= malloc( OUTFILENAME_LENGTH * sizeof( char ) );
+   if ( star_numbers[first_star_in_block + i] == NULL || block_lightcurvefilenames[i] == NULL ) {
     fprintf( stderr, "ERROR: Couldn't allocate memory for star_numbers[i]\n" );
     exit( EXIT_FAILURE );
    };
-   bad_stars[i]= 0;
-  }
-
-  // Read the log file
-  jd= malloc( MAX_NUMBER_OF_OBSERVATIONS * sizeof( double ) );
-  if ( jd == NULL ) {
-   fprintf( stderr, "ERROR: Couldn't allocate memory for jd\n" );
-   exit( EXIT_FAILURE );
+   bad_stars[first_star_in_block + i]= 0;
+   block_of_star[first_star_in_block + i]= sysrem_input_star_list_lst_counter;
   }
-  Nobs= 0; // initialize it here, just in case
-  get_dates( jd, &Nobs );
-  if ( Nobs <= 0 ) {
-   fprintf( stderr, "ERROR: Attempting to allocate a zero or negative amount of memory (Nobs <= 0)\n" );
-   exit( EXIT_FAILURE );
-  };
 
-  // Allocate memory
-  mag_err= malloc( Nstars * sizeof( float * ) );
-  if ( mag_err == NULL ) {
-   fprintf( stderr, "ERROR: Couldn't allocate memory for mag_err\n" );
-   exit( EXIT_FAILURE );
-  }
-  r= malloc( Nstars * sizeof( float * ) );
-  if ( r == NULL ) {
-   fprintf( stderr, "ERROR: Couldn't allocate memory for r\n" );
+  // Read the star list
+  i= 0;
+  // datafile= fopen( "sysrem_input_star_list.lst", "r" );
+  datafile= fopen( split_sysrem_input_star_list_lst_filenames[sysrem_input_star_list_lst_counter], "r" );
+  if ( NULL == datafile ) {
+   fprintf( stderr, "ERROR! Can't open file %s\n", split_sysrem_input_star_list_lst_filenames[sysrem_input_star_list_lst_counter] );
    exit( EXIT_FAILURE );
   }
-
-  // for(i=0;i<Nstars;i++){
-  for ( i= Nstars; i--; ) {
-   mag_err[i]= malloc( Nobs * sizeof( float ) ); // !!
-   r[i]= malloc( Nobs * sizeof( float ) );       // is it correct ????? // !!
-   if ( r[i] == NULL || mag_err[i] == NULL ) {
-    fprintf( stderr, "ERROR: Couldn't allocate memory(i=%d)\n", i );
-    exit( EXIT_FAILURE );
+  while ( i < Nstars && 5 == fscanf( datafile, "%f %f %f %f %s", &mean, &mean, &mean, &mean, lightcurvefilename ) ) {
+   memset( star_number_string, 0, FILENAME_LENGTH ); // just in case
+   // Get star number from the lightcurve file name
+   for ( k= 3; k < (long)strlen( lightcurvefilename ); k++ ) {
+    star_number_string[k - 3]= lightcurvefilename[k];
+    if ( lightcurvefilename[k] == '.' ) {
+     star_number_string[k - 3]= '\0';
+     break;
+    }
    }
+   strncpy( star_numbers[first_star_in_block + i], star_number_string, OUTFILENAME_LENGTH );
+   star_numbers[first_star_in_block + i][OUTFILENAME_LENGTH - 1]= '\0';
+   strncpy( block_lightcurvefilenames[i], lightcurvefilename, OUTFILENAME_LENGTH );
+   block_lightcurvefilenames[i][OUTFILENAME_LENGTH - 1]= '\0';
+   i++;
   }
+  fclose( datafile );
 
-  // for(i=0;i<Nstars;i++)
+  // Do the actual work
+  fprintf( stderr, "Reading lightcurves and computing average magnitudes... " );
+  read_SysRem_sparse_matrix( block_lightcurvefilenames, Nstars, sorted_jd, Nobs, &matrix );
   for ( i= Nstars; i--; ) {
-   // for(j=0;j<Nobs;j++)
-   for ( j= Nobs; j--; ) {
-    r[i][j]= 0.0;
-   }
+   free( block_lightcurvefilenames[i] );
   }
+  free( block_lightcurvefilenames );
 
   c= malloc( Nstars * sizeof( float ) );
   if ( c == NULL ) {
    fprintf( stderr, "ERROR: Couldn't allocate memory for c array\n" );
    exit( EXIT_FAILURE );
   }
-  a= malloc( Nobs * sizeof( float ) );
-  if ( a == NULL ) {
-   fprintf( stderr, "ERROR: Couldn't allocate memory for a array\n" );
-   exit( EXIT_FAILURE );
-  }
+  a= &a_all[(size_t)sysrem_input_star_list_lst_counter * (size_t)Nobs];
 
   old_c= malloc( Nstars * sizeof( float ) );
   if ( old_c == NULL ) {
@@ -362,227 +796,12 @@ int main() {
    old_a[i]= 1.0;
   }
 
-  // Read the data
-  i= j= 0;
-  // datafile= fopen( "sysrem_input_star_list.lst", "r" );
-  datafile= fopen( split_sysrem_input_star_list_lst_filenames[sysrem_input_star_list_lst_counter], "r" );
-  if ( NULL == datafile ) {
-   fprintf( stderr, "ERROR! Can't open file %s\n", split_sysrem_input_star_list_lst_filenames[sysrem_input_star_list_lst_counter] );
-   exit( EXIT_FAILURE );
-  }
-  while ( 5 == fscanf( datafile, "%f %f %f %f %s", &mean, &mean, &mean, &mean, lightcurvefilename ) ) {
-   memset( star_number_string, 0, FILENAME_LENGTH ); // just in case
-   // Get star number from the lightcurve file name
-   for ( k= 3; k < (long)strlen( lightcurvefilename ); k++ ) {
-    star_number_string[k - 3]= lightcurvefilename[k];
-    if ( lightcurvefilename[k] == '.' ) {
-     star_number_string[k - 3]= '\0';
-     break;
-    }
-   }
-   strncpy( star_numbers[i], star_number_string, OUTFILENAME_LENGTH );
-   star_numbers[i][OUTFILENAME_LENGTH - 1]= '\0';
-   lightcurvefile= fopen( lightcurvefilename, "r" );
-   if ( NULL == lightcurvefile ) {
-    fprintf( stderr, "ERROR: Can't read file %s\n", lightcurvefilename );
-    exit( EXIT_FAILURE );
-   }
-   memset( string, 0, FILENAME_LENGTH );
-   memset( comments_string, 0, MAX_STRING_LENGTH_IN_LIGHTCURVE_FILE );
-   // while ( -1 < read_lightcurve_point( lightcurvefile, &djd, &ddmag, &ddmerr, &x, &y, &app, string, comments_string ) ) {
-   while ( -1 < read_lightcurve_point( lightcurvefile, &djd, &ddmag, &ddmerr, NULL, &y, &app, string, comments_string ) ) {
-    if ( djd == 0.0 )
-     continue; // if this line could not be parsed, try the next one
-    //  Find which j is corresponding to the current JD
-    for ( k= 0; k < Nobs; k++ ) {
-     if ( fabs( jd[k] - djd ) <= 0.00001 ) { // 0.8 sec
-                                             // if( fabs(jd[k]-djd)<=0.0001 ){ // 8 sec
-      j= k;
-      r[i][j]= (float)ddmag;
-      mag_err[i][j]= (float)ddmerr;
-      break;
-     }
-    }
-   }
-   fclose( lightcurvefile );
-   i++;
-  }
-  fclose( datafile );
-
-  ////////////////////////
-  // get_number_of_cpu_cores() will set OMP_NUM_THREADS variable
-  // in a hope to avoid out-of-memory situation when using OpenMP down below
-  number_of_cpu_cores_to_report= get_number_of_cpu_cores();
-  // and report the number of CPU cores to the user (just for information)
-  fprintf( stderr, "Number of CPU cores: %d\n", number_of_cpu_cores_to_report );
-
-#ifdef VAST_ENABLE_OPENMP
-#ifdef _OPENMP
-  // tests show that limiting the number of OpenMP threads dramatically improves performance.
-  omp_set_num_threads( MIN( number_of_cpu_cores_to_report, 48 ) );
-#endif
-#endif
-  fprintf( stderr, "Number of threads: %d\n", MIN( number_of_cpu_cores_to_report, 48 ) );
-
-  // Do the actual work
-  fprintf( stderr, "Computing average magnitudes... " );
-
-  // For each star compute median magnitude and subtract it from all measurements
-  // for(i=0;i<Nstars;i++){
-  double_data= malloc( Nobs * sizeof( double ) );
-  if ( double_data == NULL ) {
-   fprintf( stderr, "ERROR: Couldn't allocate memory for double_data_Nstars\n" );
-   exit( EXIT_FAILURE );
-  }
-  for ( i= Nstars; i--; ) {
-   k= 0;
-   // for ( j= 0; j < Nobs; j++ ) {
-   for ( j= Nobs; j--; ) {
-    if ( r[i][j] != 0.0 ) {
-     // data[k]= r[i][j];
-     double_data[k]= (double)r[i][j];
-     k++;
-    }
-   }
-   // Use quickselect for O(n) median computation instead of O(n log n) sort
-   if ( k > 0 ) {
-    median= quickselect_median_double( double_data, k );
-   } else {
-    median= 0.0;
-   }
-#ifdef VAST_ENABLE_OPENMP
-#ifdef _OPENMP
-#pragma omp parallel for private( j )
-#endif
-#endif
-   for ( j= 0; j < Nobs; j++ ) {
-    // for(j=Nobs;j--;){
-    if ( r[i][j] != 0.0 ) {
-     r[i][j]= r[i][j] - median;
-    }
-   }
-   // fprintf(stderr,"DEBUG06\n");
-  }
-  // fprintf(stderr,"DEBUG07\n");
-  free( double_data );
-
   fprintf( stderr, "done\nStarting iterations...\n" );
 
-  // Iterative search for best c[i] and a[j]
-  for ( iter= 0; iter < NUMBER_OF_Ai_Ci_ITERATIONS; iter++ ) {
-   fprintf( stderr, "\riteration %4d", iter + 1 );
-#ifdef VAST_ENABLE_OPENMP
-#ifdef _OPENMP
-#pragma omp parallel for private( i, j, sum1, sum2, tmpfloat )
-#endif
-#endif
-   for ( i= 0; i < Nstars; i++ ) {
-    // for(i=Nstars;i--;){
-    sum1= sum2= 0.0;
-    for ( j= 0; j < Nobs; j++ ) {
-     // for(j=Nobs;j--;){
-     if ( r[i][j] != 0.0 ) {
-      tmpfloat= 1.0f / ( mag_err[i][j] * mag_err[i][j] );
-      sum1+= r[i][j] * a[j] * tmpfloat;
-      sum2+= a[j] * a[j] * tmpfloat;
-     }
-    }
-    if ( sum1 != 0.0 && sum2 != 0.0 ) {
-     old_c[i]= c[i];
-     c[i]= sum1 / sum2;
-    }
-   }
-
-#ifdef VAST_ENABLE_OPENMP
-#ifdef _OPENMP
-#pragma omp parallel for private( i, j, sum1, sum2, tmpfloat )
-#endif
-#endif
-   for ( j= 0; j < Nobs; j++ ) {
-    // for(j=Nobs;j--;){
-    sum1= sum2= 0.0;
-    // for(i=0;i<Nstars;i++){
-    for ( i= Nstars; i--; ) {
-     if ( r[i][j] != 0.0 ) {
-      tmpfloat= 1.0f / ( mag_err[i][j] * mag_err[i][j] );
-      sum1+= r[i][j] * c[i] * tmpfloat;
-      sum2+= c[i] * c[i] * tmpfloat;
-     }
-    }
-    if ( sum1 != 0.0 && sum2 != 0.0 ) {
-     old_a[j]= a[j];
-     a[j]= sum1 / sum2;
-    }
-   }
-
-   //   // More debug
-   //   fprintf(stderr, "\nSysRem \"airmass\" coefficients for each image (not the actual airmass, of course):\n");
-   //   for( i= Nobs; i--; ) {
-   //    fprintf(stderr, "a[%d]=%lf\n", i, a[i]);
-   //   }
-
-   // Should we stop now?
-   // Yes, if both a and c change by less than Ai_Ci_DIFFERENCE_TO_STOP_ITERATIONS compared to the previous step
-   // (for all indexes = stars/images)
-   stop_iterations= 1;
-   // for(i=0;i<Nstars;i++){
-   for ( i= Nstars; i--; ) {
-    if ( fabsf( c[i] - old_c[i] ) > Ai_Ci_DIFFERENCE_TO_STOP_ITERATIONS ) {
-     stop_iterations= 0;
-     break;
-    }
-   }
-   if ( stop_iterations == 1 ) {
-    // for(j=0;j<Nobs;j++){
-    for ( j= Nobs; j--; ) {
-     if ( fabsf( a[j] - old_a[j] ) > Ai_Ci_DIFFERENCE_TO_STOP_ITERATIONS ) {
-      stop_iterations= 0;
-      break;
-     }
-    }
-   }
-   if ( stop_iterations == 1 ) {
-    break; // Stop iteretions if they make no difference
-   }
-
-  } // Iterative search for best c[i] and a[j]
+  SysRem_iterations( &matrix, &bad_stars[first_star_in_block], 0, c, old_c, a, old_a );
 
   fprintf( stderr, "\nRemoving outliers... " );
-
-  double_data= malloc( Nstars * sizeof( double ) );
-  if ( double_data == NULL ) {
-   fprintf( stderr, "ERROR: Couldn't allocate memory for double_data\n" );
-   exit( EXIT_FAILURE );
-  }
-
-  // A filtering attempt: if a single star dominates the solution, it should have c~1 while
-  // all other stars should have c~0
-  k= 0;
-  for ( i= Nstars; i--; ) {
-   if ( c[i] != 0.0f ) {
-    double_data[k]= (double)c[i];
-    k++;
-   }
-  }
-  gsl_sort( double_data, 1, k );
-  median= (float)gsl_stats_median_from_sorted_data( double_data, 1, k );
-  sigma= (float)esimate_sigma_from_MAD_of_sorted_data_and_ruin_input_array( double_data, k );
-  free( double_data );
-#ifdef VAST_ENABLE_OPENMP
-#ifdef _OPENMP
-#pragma omp parallel for private( i )
-#endif
-#endif
-  for ( i= 0; i < Nstars; i++ ) {
-   // for ( i= Nstars; i--; ) {
-   if ( c[i] != 0.0f ) {
-    if ( fabsf( c[i] - median ) > 10.0 * sigma ) {
-     //    fprintf( stderr, "EXCLUDING out%s.dat %d  fabsf(c[i]-median)=%f  >10.0*sigma=%f c[i]=%f median=%f\n", star_numbers[i], i, fabsf( c[i] - median ), 10.0 * sigma, c[i], median );
-     bad_stars[i]= 1;
-    }
-   }
-  }
-
+  SysRem_mark_outlier_stars( c, Nstars, &bad_stars[first_star_in_block] );
   fprintf( stderr, "done\n" );
 
   /* 2nd pass */
@@ -602,197 +821,83 @@ int main() {
   }
   /////////////////////////////////////////////////////////
 
-  for ( iter= 0; iter < NUMBER_OF_Ai_Ci_ITERATIONS; iter++ ) {
-   fprintf( stderr, "\riteration %4d", iter + 1 );
-#ifdef VAST_ENABLE_OPENMP
-#ifdef _OPENMP
-#pragma omp parallel for private( i, j, sum1, sum2, tmpfloat )
-#endif
-#endif
-   for ( i= 0; i < Nstars; i++ ) {
-    // for(i=Nstars;i--;){
-    sum1= sum2= 0.0;
-    if ( bad_stars[i] == 0 ) {
-     // for(j=0;j<Nobs;j++){
-     for ( j= Nobs; j--; ) {
-      if ( r[i][j] != 0.0 ) {
-       tmpfloat= 1.0f / ( mag_err[i][j] * mag_err[i][j] );
-       sum1+= r[i][j] * a[j] * tmpfloat;
-       sum2+= a[j] * a[j] * tmpfloat;
-      }
-     }
-    }
-    if ( sum1 != 0.0 && sum2 != 0.0 ) {
-     old_c[i]= c[i];
-     c[i]= sum1 / sum2;
-    }
-   }
-
-#ifdef VAST_ENABLE_OPENMP
-#ifdef _OPENMP
-#pragma omp parallel for private( i, j, sum1, sum2, tmpfloat )
-#endif
-#endif
-   for ( j= 0; j < Nobs; j++ ) {
-    // for(j=Nobs;j--;){
-    sum1= sum2= 0.0;
-    // !!!!! experimental !!!!! - try to use only a few brightest stars to compute a[j]
-    // We assume the array is sorted in magnitude
-    for ( i= 0; i < MIN( Nstars, 1000 ); i++ ) {
-     // for ( i= Nstars; i--; ) {
-     if ( bad_stars[i] == 0 ) {
-      if ( r[i][j] != 0.0 ) {
-       tmpfloat= 1.0f / ( mag_err[i][j] * mag_err[i][j] );
-       sum1+= r[i][j] * c[i] * tmpfloat;
-       sum2+= c[i] * c[i] * tmpfloat;
-      }
-     }
-    }
-    if ( sum1 != 0.0 && sum2 != 0.0 ) {
-     old_a[j]= a[j];
-     a[j]= sum1 / sum2;
-    }
-   }
-
-   //   // More debug
-   //   fprintf(stderr, "\nSysRem \"airmass\" coefficients for each image (not the actual airmass, of course):\n");
-   //   for( i= Nobs; i--; ) {
-   //    fprintf(stderr, "a[%d]=%lf\n", i, a[i]);
-   //   }
-
-   // Should we stop now?
-   stop_iterations= 1;
-   // for(i=0;i<Nstars;i++){
-   for ( i= Nstars; i--; ) {
-    if ( fabsf( c[i] - old_c[i] ) > Ai_Ci_DIFFERENCE_TO_STOP_ITERATIONS ) {
-     stop_iterations= 0;
-     break;
-    }
-   }
-   if ( stop_iterations == 1 ) {
-    // for(j=0;j<Nobs;j++){
-    for ( j= Nobs; j--; ) {
-     if ( fabsf( a[j] - old_a[j] ) > Ai_Ci_DIFFERENCE_TO_STOP_ITERATIONS ) {
-      stop_iterations= 0;
-      break;
-     }
-    }
-   }
-
-   if ( stop_iterations == 1 ) {
-    break; // Stop iteretions if they make no difference
-   }
-
-  } // Iterative search for best c[i] and a[j]
-
-  fprintf( stderr, "\nRemoving outliers... " );
-
-  double_data= malloc( Nstars * sizeof( double ) );
-  if ( double_data == NULL ) {
-   fprintf( stderr, "ERROR: Couldn't allocate memory for double_data_Nstars\n" );
-   exit( EXIT_FAILURE );
-  }
+  SysRem_iterations( &matrix, &bad_stars[first_star_in_block], 1, c, old_c, a, old_a );
 
   // Not sure how effective that is, considering that c[i] filtering with the same parameters is also done above...
-  // A filtering attempt: if a single star dominates the solution, it should have c~1 while
-  // all other stars should have c~0
-  k= 0;
-  for ( i= Nstars; i--; ) {
-   if ( c[i] != 0.0f ) {
-    double_data[k]= (double)c[i];
-    k++;
-   }
-  }
-  gsl_sort( double_data, 1, k );
-  median= (float)gsl_stats_median_from_sorted_data( double_data, 1, k );
-  sigma= (float)esimate_sigma_from_MAD_of_sorted_data_and_ruin_input_array( double_data, k );
-  free( double_data );
-#ifdef VAST_ENABLE_OPENMP
-#ifdef _OPENMP
-#pragma omp parallel for private( i )
-#endif
-#endif
-  for ( i= 0; i < Nstars; i++ ) {
-   // for ( i= Nstars; i--; ) {
-   if ( c[i] != 0.0f ) {
-    if ( fabsf( c[i] - median ) > 10.0 * sigma ) {
-     //    fprintf( stderr, "EXCLUDING out%s.dat %d  fabsf(c[i]-median)=%f  >10.0*sigma=%f c[i]=%f median=%f\n", star_numbers[i], i, fabsf( c[i] - median ), 10.0 * sigma, c[i], median );
-     bad_stars[i]= 1;
-    }
-   }
-  }
-
+  fprintf( stderr, "\nRemoving outliers... " );
+  SysRem_mark_outlier_stars( c, Nstars, &bad_stars[first_star_in_block] );
   fprintf( stderr, "done\n" );
 
-  // Apply corrections to lightcurves
-  fprintf( stderr, "Applying corrections... " );
-#ifdef VAST_ENABLE_OPENMP
-#ifdef _OPENMP
-// #pragma omp parallel for private( i, lightcurvefilename, lightcurvefile, djd, ddmag, ddmerr, x, y, app, string, comments_string, dmag, dmerr, j, k, outlightcurvefilename, outlightcurvefile, corrected_magnitude, correction_mag )
-#pragma omp parallel for private( i, lightcurvefilename, lightcurvefile, djd, ddmag, ddmerr, x, y, app, string, comments_string, j, k, outlightcurvefilename, outlightcurvefile, corrected_magnitude, correction_mag )
-#endif
-#endif
-  for ( i= 0; i < Nstars; i++ ) {
-   if ( bad_stars[i] == 0 ) {
-    sprintf( lightcurvefilename, "out%s.dat", star_numbers[i] );
-    sprintf( outlightcurvefilename, "out%s.tmp", star_numbers[i] );
-    lightcurvefile= fopen( lightcurvefilename, "r" );
-    if ( NULL == lightcurvefile ) {
-     fprintf( stderr, "ERROR: Can't read file %s\n", lightcurvefilename );
-     exit( EXIT_FAILURE );
-    }
-    outlightcurvefile= fopen( outlightcurvefilename, "w" );
-    while ( -1 < read_lightcurve_point( lightcurvefile, &djd, &ddmag, &ddmerr, &x, &y, &app, string, comments_string ) ) {
-     if ( djd == 0.0 )
-      continue; // if this line could not be parsed, try the next one
-     //  Find which j is corresponding to the current JD
-     for ( k= 0; k < Nobs; k++ ) {
-      if ( fabs( jd[k] - djd ) <= 0.00001 ) { // 0.8 sec
-       j= k;
-       // reject large corrections
-       corrected_magnitude= ddmag;
-       correction_mag= (double)( c[i] * a[j] );
-       if ( fabs( correction_mag ) < SYSREM_MAX_CORRECTION_MAG ) {
-        corrected_magnitude= ddmag - correction_mag;
-       } else {
-        fprintf( stderr, "SysRem WARNING: skipping a large correction of %lf mag for star %s on JD%lf  c[i]=%f a[j]=%f\n", correction_mag, outlightcurvefilename, djd, c[i], a[j] );
-       }
-       write_lightcurve_point( outlightcurvefile, djd, corrected_magnitude, (double)ddmerr, (double)x, (double)y, (double)app, string, comments_string );
-       break;
-      }
-     }
-    }
-    fclose( outlightcurvefile );
-    fclose( lightcurvefile );
-    unlink( lightcurvefilename );
-    rename( outlightcurvefilename, lightcurvefilename );
-   }
+  for ( i= Nstars; i--; ) {
+   c_all[first_star_in_block + i]= c[i];
   }
-  fprintf( stderr, "done\n" );
+  Nstars_total+= Nstars;
 
   // Free-up memory
-  free( bad_stars );
-  // for ( i= 0; i < Nstars; i++ ) {
-  for ( i= Nstars; i--; ) {
-   free( star_numbers[i] );
-   free( mag_err[i] );
-   free( r[i] );
-  }
-  free( star_numbers );
+  free_SysRem_sparse_matrix( &matrix );
   free( old_c );
   free( old_a );
-
-  free( mag_err );
-  free( r );
-  free( a );
   free( c );
-  free( jd );
 
   fprintf( stderr, "Removing %s\n", split_sysrem_input_star_list_lst_filenames[sysrem_input_star_list_lst_counter] );
   unlink( split_sysrem_input_star_list_lst_filenames[sysrem_input_star_list_lst_counter] );
 
  } // for( sysrem_input_star_list_lst_counter=0; sysrem_input_star_list_lst_counter<N_sysrem_input_star_list_lst;
 
+ // Apply corrections of all processing blocks to lightcurves in one pass
+ fprintf( stderr, "Applying corrections... " );
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for private( i, lightcurvefilename, lightcurvefile, djd, ddmag, ddmerr, x, y, app, string, comments_string, j, outlightcurvefilename, outlightcurvefile, corrected_magnitude, correction_mag, a ) schedule( dynamic, 16 )
+#endif
+#endif
+ for ( i= 0; i < Nstars_total; i++ ) {
+  if ( bad_stars[i] == 0 ) {
+   a= &a_all[(size_t)block_of_star[i] * (size_t)Nobs];
+   sprintf( lightcurvefilename, "out%s.dat", star_numbers[i] );
+   sprintf( outlightcurvefilename, "out%s.tmp", star_numbers[i] );
+   lightcurvefile= fopen( lightcurvefilename, "r" );
+   if ( NULL == lightcurvefile ) {
+    fprintf( stderr, "ERROR: Can't read file %s\n", lightcurvefilename );
+    exit( EXIT_FAILURE );
+   }
+   outlightcurvefile= fopen( outlightcurvefilename, "w" );
+   while ( -1 < read_lightcurve_point( lightcurvefile, &djd, &ddmag, &ddmerr, &x, &y, &app, string, comments_string ) ) {
+    if ( djd == 0.0 )
+     continue; // if this line could not be parsed, try the next one
+    //  Find which j is corresponding to the current JD
+    j= find_image_number_for_jd( sorted_jd, Nobs, djd );
+    if ( j < 0 )
+     continue;
+    // reject large corrections
+    corrected_magnitude= ddmag;
+    correction_mag= (double)( c_all[i] * a[j] );
+    if ( fabs( correction_mag ) < SYSREM_MAX_CORRECTION_MAG ) {
+     corrected_magnitude= ddmag - correction_mag;
+    } else {
+     fprintf( stderr, "SysRem WARNING: skipping a large correction of %lf mag for star %s on JD%lf  c[i]=%f a[j]=%f\n", correction_mag, outlightcurvefilename, djd, c_all[i], a[j] );
+    }
+    write_lightcurve_point( outlightcurvefile, djd, corrected_magnitude, (double)ddmerr, (double)x, (double)y, (double)app, string, comments_string );
+   }
+   fclose( outlightcurvefile );
+   fclose( lightcurvefile );
+   unlink( lightcurvefilename );
+   rename( outlightcurvefilename, lightcurvefilename );
+  }
+ }
+ fprintf( stderr, "done\n" );
+
+ for ( i= Nstars_total; i--; ) {
+  free( star_numbers[i] );
+ }
+ free( star_numbers );
+ free( bad_stars );
+ free( c_all );
+ free( block_of_star );
+ free( a_all );
+ free( sorted_jd );
+ free( jd );
+
  for ( sysrem_input_star_list_lst_counter= 0; sysrem_input_star_list_lst_counter < SYSREM_MAX_NUMBER_OF_PROCESSING_BLOCKS; sysrem_input_star_list_lst_counter++ ) {
   free( split_sysrem_input_star_list_lst_filenames[sysrem_input_star_list_lst_counter] );
  }
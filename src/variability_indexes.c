@@ -839,9 +839,8 @@ double compute_MAD_of_sorted_data__fullsort( double *sorted_data, long n ) {
 
 // Optimized version using quickselect - O(n) instead of O(n log n) for finding MAD median
 double compute_MAD_of_sorted_data( double *sorted_data, long n ) {
- double median_data, MAD;
+ double MAD;
  double *AD;
- int i;
 
  AD= malloc( n * sizeof( double ) );
  if ( AD == NULL ) {
@@ -849,6 +848,20 @@ double compute_MAD_of_sorted_data( double *sorted_data, long n ) {
   exit( EXIT_FAILURE );
  }
 
+ MAD= compute_MAD_of_sorted_data_using_buffer( sorted_data, n, AD );
+
+ free( AD );
+
+ return MAD;
+}
+
+// Same as compute_MAD_of_sorted_data() but the absolute deviations are stored
+// in the caller-provided buffer AD (at least n elements) instead of a freshly allocated array.
+// This allows the caller to re-use one scratch array for many lightcurves.
+double compute_MAD_of_sorted_data_using_buffer( double *sorted_data, long n, double *AD ) {
+ double median_data, MAD;
+ int i;
+
  // The input dataset has to be sorted so we can compute its median
  median_data= gsl_stats_median_from_sorted_data( sorted_data, 1, n );
 
@@ -859,8 +872,6 @@ double compute_MAD_of_sorted_data( double *sorted_data, long n ) {
  // Use quickselect to find median of absolute deviations - O(n) instead of O(n log n)
  MAD= quickselect_median_double( AD, (int)n );
 
- free( AD );
-
  return MAD;
 }
 
@@ -872,6 +883,14 @@ double esimate_sigma_from_MAD_of_sorted_data( double *sorted_data, long n ) {
  return sigma;
 }
 
+double esimate_sigma_from_MAD_of_sorted_data_using_buffer( double *sorted_data, long n, double *AD ) {
+ double sigma, MAD;
+ MAD= compute_MAD_of_sorted_data_using_buffer( sorted_data, n, AD );
+ // 1.48260221850560 = 1/norminv(3/4)
+ sigma= 1.48260221850560 * MAD;
+ return sigma;
+}
+
 // float version of the above functions
 // Original version using full sort - kept for reference/comparison
 float compute_MAD_of_sorted_data_float__fullsort( float *sorted_data, long n ) {
@@ -1544,7 +1563,6 @@ double compute_RoMS__fullsort( double *unsorted_m, double *unsorted_merr, int N
 
 // Optimized version using quickselect - O(n) instead of O(n log n) for finding median
 double compute_RoMS( double *unsorted_m, double *unsorted_merr, int N ) {
- double out_RoMS; // result will be stored here
  int i;           // counter
  double median_m; // median mag.
  double *x;       // a copy of the input array
@@ -1568,6 +1586,19 @@ double compute_RoMS( double *unsorted_m, double *unsorted_merr, int N ) {
  median_m= quickselect_median_double( x, N );
  free( x );
 
+ return compute_RoMS_with_known_median( unsorted_m, unsorted_merr, N, median_m );
+}
+
+// Same as compute_RoMS() for the case the caller already knows the median magnitude
+// (for example, from a magnitude-sorted copy of the lightcurve shared with other indexes)
+double compute_RoMS_with_known_median( double *unsorted_m, double *unsorted_merr, int N, double median_m ) {
+ double out_RoMS; // result will be stored here
+ int i;           // counter
+
+#ifdef DISABLE_INDEX_ROMS
+ return 0.0;
+#endif
+
  // compute RoMS
  for ( out_RoMS= 0.0, i= 0; i < N; i++ ) {
   out_RoMS+= fabs( ( unsorted_m[i] - median_m ) / unsorted_merr[i] );
@@ -1624,6 +1655,19 @@ void compute_variability_indexes_that_need_time_sorting( double *input_JD, doubl
   exit( EXIT_FAILURE );
  }
 
+ compute_variability_indexes_that_need_time_sorting_using_index_buffer( input_JD, input_m, input_merr, input_Nobs, input_Nmax, output_index_I, output_index_J, output_index_K, output_index_L, output_index_J_clip, output_index_L_clip, output_index_J_time, output_index_L_time, output_index_I_sign_only, N3, excursions, eta, E_A, SB, p );
+
+ free( p ); // free memory for the index array
+
+ return;
+}
+
+// Same as compute_variability_indexes_that_need_time_sorting() but the time-sort index
+// is stored in the caller-provided array p (at least input_Nobs elements).
+// This lets a caller processing many lightcurves (possibly in parallel, one p array per thread)
+// avoid allocating the index array for every lightcurve.
+void compute_variability_indexes_that_need_time_sorting_using_index_buffer( double *input_JD, double *input_m, double *input_merr, int input_Nobs, int input_Nmax, double *output_index_I, double *output_index_J, double *output_index_K, double *output_index_L, double *output_index_J_clip, double *output_index_L_clip, double *output_index_J_time, double *output_index_L_time, double *output_index_I_sign_only, double *N3, double *excursions, double *eta, double *E_A, double *SB, size_t *p ) {
+
  // Sort the lightcurve in time
  gsl_sort_index( p, input_JD, 1, input_Nobs ); // The elements of p give the index of the array element which would have been stored in that position if the array had been sorted in place. The array data is not changed.
 
@@ -1639,8 +1683,6 @@ void compute_variability_indexes_that_need_time_sorting( double *input_JD, doubl
  ( *E_A )= excess_Abbe_value_from_sorted_lightcurve( p, input_JD, input_m, input_Nobs );
  ( *SB )= SB_variability_detection_statistic_of_sorted_lightcurve( p, input_m, input_merr, input_Nobs );
 
- free( p ); // free memory for the index array
-
  return;
 }
 
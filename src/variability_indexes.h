@@ -42,6 +42,8 @@ void vast_qsort_double(double *x, int n);
 
 void compute_variability_indexes_that_need_time_sorting(double *input_JD, double *input_m, double *input_merr, int input_Nobs, int input_Nmax, double *output_index_I, double *output_index_J, double *output_index_K, double *output_index_L, double *output_index_J_clip, double *output_index_L_clip, double *output_index_J_time, double *output_index_L_time, double *output_index_I_sign_only, double *N3, double *excursions, double *eta, double *E_A, double *SB);
 
+void compute_variability_indexes_that_need_time_sorting_using_index_buffer(double *input_JD, double *input_m, double *input_merr, int input_Nobs, int input_Nmax, double *output_index_I, double *output_index_J, double *output_index_K, double *output_index_L, double *output_index_J_clip, double *output_index_L_clip, double *output_index_J_time, double *output_index_L_time, double *output_index_I_sign_only, double *N3, double *excursions, double *eta, double *E_A, double *SB, size_t *p);
+
 void stetson_JKL_from_sorted_lightcurve(size_t *input_array_index_p, double *input_JD, double *input_m, double *input_merr, int input_Nobs, int input_Nmax, double input_max_pair_diff_sigma, int input_use_time_based_weighting, double *output_J, double *output_K, double *output_L);
 
 double classic_welch_stetson_I_from_sorted_lightcurve(size_t *input_array_index_p, double *input_JD, double *input_m, double *input_merr, int input_Nobs);
@@ -62,8 +64,12 @@ double esimate_sigma_from_MAD_of_unsorted_data_and_target_median(double *unsorte
 
 double compute_MAD_of_sorted_data(double *sorted_data, long n);
 
+double compute_MAD_of_sorted_data_using_buffer(double *sorted_data, long n, double *AD);
+
 double esimate_sigma_from_MAD_of_sorted_data(double *sorted_data, long n);
 
+double esimate_sigma_from_MAD_of_sorted_data_using_buffer(double *sorted_data, long n, double *AD);
+
 float esimate_sigma_from_MAD_of_sorted_data_float(float *sorted_data, long n);
 
 float esimate_sigma_from_MAD_of_sorted_data_float(float *sorted_data, long n);
@@ -88,6 +94,8 @@ double Normalized_excess_variance(double *m, double *merr, int N);
 
 double compute_RoMS(double *m, double *merr, int N);
 
+double compute_RoMS_with_known_median(double *unsorted_m, double *unsorted_merr, int N, double median_m);
+
 double compute_reduced_chi2(double *m, double *merr, int N);
 
 double compute_chi2(double *m, double *merr, int N);
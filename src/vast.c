@@ -28,6 +28,7 @@
 // Standard header files
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h> // for offsetof()
 
 // #define _GNU_SOURCE
 #include <string.h> // for memmem
@@ -43,6 +44,7 @@
 #include <sys/resource.h>
 #include <sys/stat.h> /* for stat(), also requires #include <sys/types.h> and #include <unistd.h> */
 #include <dirent.h>   /* to work with directories */
+#include <errno.h>    /* for EINTR */
 
 #include <strings.h> // for strcasecmp()
 
@@ -94,6 +96,8 @@
 //
 #include "quickselect.h" // for quickselect_median_float()
 
+#include "vast_profiling.h" // for per-stage timing and memory statistics written to vast_profiling.json
+
 // Toggle median implementation:
 // - Set to 1 for GSL sort-based median.
 // - Set to 0 for quickselect-based median (faster O(n) average vs O(n log n) for sort).
@@ -191,6 +195,8 @@ void help_msg( const char *progname, int exit_code ) {
  printf( "  -7 or --autoselectrefimage  automatically select the deepest image as the reference image\n" );
  printf( "  -8 or --excluderefimage  do not use the reference image for photometry\n" );
  printf( "        --movingobject  manually specify moving object position at each image (comet/asteroid/space junk photometry)\n" );
+ printf( "        --parallelcatalogs  read and filter the catalogs of several images at once using all CPU cores\n" );
+ printf( "        --append  add the images that were not processed before to the lightcurves of the previous run in this directory\n" );
  printf( "\nExamples:\n" );
  printf( "  ./vast ../data/ccd_image-001.fit ../data/ccd_image-*.fit       # Typical CCD image reduction.\n" );
  printf( "  ./vast --UTC ../data/ccd_image-001.fit ../data/ccd_image-*.fit # CCD image reduction, UTC time will be used instead of TT.\n" );
@@ -841,6 +847,815 @@ void record_specified_fits_keywords( char *input_image, char *output_str_with_fi
 
 /****************** The main function ******************/
 
+// Pipelined source extraction: the dispatcher process fork()s SExtractor runs and reports through a pipe
+// the index of each image for which the catalog is complete. The main process waits only for the catalog
+// of the image it is about to match, so matching and photometry proceed while the remaining images are still processed.
+static void report_source_extraction_done( int pipe_write_fd, int image_index ) {
+ if ( pipe_write_fd < 0 ) {
+  return;
+ }
+ // writes of up to PIPE_BUF bytes to a pipe are atomic
+ if ( sizeof( int ) != write( pipe_write_fd, &image_index, sizeof( int ) ) && errno != EPIPE ) {
+  fprintf( stderr, "WARNING: cannot report the completion of source extraction for image %d\n", image_index );
+ }
+ return;
+}
+
+// Instead of an image index, the dispatcher sends this value followed by struct Vast_profiling_stage_report
+// with its "sextractor" stage statistics, so the stage appears in vast_profiling.json of the main process
+#define SOURCE_EXTRACTION_PROFILING_REPORT -1
+
+static void report_source_extraction_profiling( int pipe_write_fd ) {
+ char message[sizeof( int ) + sizeof( struct Vast_profiling_stage_report )];
+ int marker= SOURCE_EXTRACTION_PROFILING_REPORT;
+ struct Vast_profiling_stage_report report;
+ if ( pipe_write_fd < 0 || 0 != vast_profiling_get_stage_report( "sextractor", &report ) ) {
+  return;
+ }
+ memcpy( message, &marker, sizeof( int ) );
+ memcpy( message + sizeof( int ), &report, sizeof( struct Vast_profiling_stage_report ) );
+ // the message is shorter than PIPE_BUF, so it is written at once
+ if ( sizeof( message ) != write( pipe_write_fd, message, sizeof( message ) ) && errno != EPIPE ) {
+  fprintf( stderr, "WARNING: cannot report the SExtractor timing to the main process\n" );
+ }
+ return;
+}
+
+static int read_from_source_extraction_pipe( int pipe_read_fd, void *buffer, size_t n ) {
+ ssize_t bytes_read;
+ size_t total_bytes_read= 0;
+ while ( total_bytes_read < n ) {
+  bytes_read= read( pipe_read_fd, (char *)buffer + total_bytes_read, n - total_bytes_read );
+  if ( bytes_read > 0 ) {
+   total_bytes_read+= (size_t)bytes_read;
+   continue;
+  }
+  if ( bytes_read < 0 && errno == EINTR ) {
+   continue;
+  }
+  return 1;
+ }
+ return 0;
+}
+
+// Read one message from the dispatcher; returns 1 if the dispatcher is gone (EOF or error)
+static int read_source_extraction_report( int pipe_read_fd, char *is_source_extraction_done, int Num ) {
+ int finished_image_index;
+ struct Vast_profiling_stage_report report;
+ if ( 0 != read_from_source_extraction_pipe( pipe_read_fd, &finished_image_index, sizeof( int ) ) ) {
+  return 1;
+ }
+ if ( finished_image_index == SOURCE_EXTRACTION_PROFILING_REPORT ) {
+  if ( 0 != read_from_source_extraction_pipe( pipe_read_fd, &report, sizeof( struct Vast_profiling_stage_report ) ) ) {
+   return 1;
+  }
+  vast_profiling_add_stage_report( &report, "source_extraction_dispatcher" );
+  return 0;
+ }
+ if ( finished_image_index >= 0 && finished_image_index < Num ) {
+  is_source_extraction_done[finished_image_index]= 1;
+ }
+ return 0;
+}
+
+// The main process may leave through any of the many 'return EXIT_FAILURE;' paths after the dispatcher is started,
+// so the dispatcher is stopped by an atexit() handler. The child processes fork()ed by the main process later
+// inherit the handler, that's why it checks the pid of the process it is running in.
+// The SExtractor runs already started by the dispatcher are not killed: each of them just finishes its image.
+static pid_t source_extraction_dispatcher_pid_to_stop= 0;
+static pid_t source_extraction_main_process_pid= 0;
+
+static void stop_source_extraction_dispatcher( void ) {
+ if ( source_extraction_dispatcher_pid_to_stop <= 0 || getpid() != source_extraction_main_process_pid ) {
+  return;
+ }
+ kill( source_extraction_dispatcher_pid_to_stop, SIGTERM );
+ waitpid( source_extraction_dispatcher_pid_to_stop, NULL, 0 );
+ source_extraction_dispatcher_pid_to_stop= 0;
+ return;
+}
+
+// Collect all the SExtractor runs that have already finished (without waiting for the others)
+// and report each of them to the main process right away. Returns the number of collected processes.
+static int collect_finished_source_extraction_runs( int *child_pids, int *child_image_index, int n_fork, int pipe_write_fd ) {
+ pid_t pid_of_child_that_finished;
+ int pid_status;
+ int j_fork;
+ int n_collected= 0;
+ while ( ( pid_of_child_that_finished= waitpid( -1, &pid_status, WNOHANG ) ) > 0 ) {
+  for ( j_fork= 0; j_fork < n_fork; j_fork++ ) {
+   if ( pid_of_child_that_finished == child_pids[j_fork] ) {
+    report_source_extraction_done( pipe_write_fd, child_image_index[j_fork] );
+    child_pids[j_fork]= 0;
+    n_collected++;
+    break;
+   }
+  }
+ }
+ return n_collected;
+}
+
+static void wait_for_source_extraction_to_finish( int pipe_read_fd, char *is_source_extraction_done, int Num, int image_index ) {
+ if ( pipe_read_fd < 0 || NULL == is_source_extraction_done ) {
+  return;
+ }
+ while ( is_source_extraction_done[image_index] == 0 ) {
+  if ( 0 != read_source_extraction_report( pipe_read_fd, is_source_extraction_done, Num ) ) {
+   // The dispatcher is gone (EOF or error): whatever is not finished by now,
+   // autodetect_aperture() will (re)compute in this process
+   memset( is_source_extraction_done, 1, Num );
+  }
+ }
+ return;
+}
+
+// Catalog of an image prepared for star matching.
+// Reading and filtering the SExtractor catalog depends only on the image itself, not on STAR1/STAR3
+// that are updated after each matched image. With --parallelcatalogs this stage is performed for a batch of
+// upcoming images at once, while star matching, magnitude calibration and saving the measurements stay serial
+// and are performed in the order of images, so the results do not depend on the number of threads.
+struct Image_catalog_for_matching {
+ int fitsfile_read_error;
+ double JD;
+ int timesys;
+ double X_im_size;
+ double Y_im_size;
+ double aperture;
+ char sextractor_catalog[FILENAME_LENGTH];
+ char log_output[1024];
+ int catalog_read_error;
+ struct Star *STAR2;
+ int NUMBER2;
+ int counter_rejected_bad_flux;
+ int counter_rejected_low_snr;
+ int counter_rejected_bad_region;
+ int counter_rejected_frame_edge;
+ int counter_rejected_too_small;
+ int counter_rejected_too_large;
+ int counter_rejected_external_flag;
+ int counter_rejected_bad_psf_fit;
+ int counter_rejected_seflags_gt7;
+ int counter_rejected_MagSize;
+ int counter_rejected_seflags_gt_user_spec_threshold;
+};
+
+// Read the SExtractor catalog of a (non-reference) image into image_catalog->STAR2 and flag outliers in it.
+// Returns 0 on success. This function is called from within an OpenMP parallel loop, so it must not touch
+// anything but image_catalog and the per-image files.
+static int read_and_filter_sextractor_catalog( struct Image_catalog_for_matching *image_catalog, char *input_image, int image_index, double *X1, double *Y1, double *X2, double *Y2, int N_bad_regions, int maxsextractorflag, int param_nodiscardlargesrc, int param_P, int param_filterout_magsize_outliers, char moving_object, float *moving_object__user_array_x, float *moving_object__user_array_y, int debug ) {
+ FILE *file;
+ char *sextractor_catalog= image_catalog->sextractor_catalog;
+ double aperture= image_catalog->aperture;
+ double JD= image_catalog->JD;
+ double X_im_size= image_catalog->X_im_size;
+ double Y_im_size= image_catalog->Y_im_size;
+
+ struct Star *STAR2;
+ int NUMBER2;
+ int number_of_lines_current_image_cat;
+ long long int malloc_size;
+
+ char sextractor_catalog_string[MAX_STRING_LENGTH_IN_SEXTARCTOR_CAT];
+ int previous_star_number_in_sextractor_catalog;
+ int star_number_in_sextractor_catalog, sextractor_flag;
+ double flux_adu, flux_adu_err, position_x_pix, position_y_pix, mag, sigma_mag;
+ double a_a, a_a_err, a_b, a_b_err;
+ int external_flag;
+ double psf_chi2;
+ float float_parameters[NUMBER_OF_FLOAT_PARAMETERS];
+ int float_parameters_counter;
+ float debug_x, debug_y, debug_d;
+
+ int counter_rejected_bad_flux, counter_rejected_low_snr, counter_rejected_bad_region;
+ int counter_rejected_frame_edge, counter_rejected_too_small, counter_rejected_too_large;
+ int counter_rejected_external_flag, counter_rejected_seflags_gt7, counter_rejected_seflags_gt_user_spec_threshold;
+ int counter_rejected_bad_psf_fit= 0;
+ int counter_rejected_MagSize;
+
+ if ( debug != 0 )
+  fprintf( stderr, "DEBUG MSG: Read_sex_cat() - " );
+ /* Read_sex_cat2 */
+ number_of_lines_current_image_cat= count_lines_in_ASCII_file( sextractor_catalog );
+ if ( number_of_lines_current_image_cat <= 0 ) {
+  fprintf( stderr, "ERROR: %d lines in the file %s\n", number_of_lines_current_image_cat, sextractor_catalog );
+  return 1;
+ }
+ // malloc_size= MAX_NUMBER_OF_STARS * sizeof( struct Star );
+ malloc_size= number_of_lines_current_image_cat * sizeof( struct Star );
+ if ( malloc_size <= 0 ) {
+  fprintf( stderr, "ERROR017 - trying to allocate zero or negative number of bytes!\n" );
+  return 1;
+ }
+ STAR2= malloc( (size_t)malloc_size );
+ if ( STAR2 == NULL ) {
+  fprintf( stderr, "ERROR: No memory (STAR2)\n" );
+  vast_report_memory_error();
+  return 1;
+ }
+ file= fopen( sextractor_catalog, "r" );
+ if ( file == NULL ) {
+  fprintf( stderr, "Can't open file %s\n", sextractor_catalog );
+  free( STAR2 );
+  return 1;
+ }
+ NUMBER2= 0;
+ counter_rejected_bad_flux= counter_rejected_low_snr= counter_rejected_bad_region= counter_rejected_frame_edge= counter_rejected_too_small= counter_rejected_too_large= counter_rejected_external_flag= counter_rejected_seflags_gt7= counter_rejected_seflags_gt_user_spec_threshold= 0; // reset bad star counters
+ previous_star_number_in_sextractor_catalog= 0;
+ while ( NULL != fgets( sextractor_catalog_string, MAX_STRING_LENGTH_IN_SEXTARCTOR_CAT, file ) ) {
+  sextractor_catalog_string[MAX_STRING_LENGTH_IN_SEXTARCTOR_CAT - 1]= '\0'; // just in case
+  external_flag= 0;
+  // external_flag_string[0]='\0';
+  if ( 0 != parse_sextractor_catalog_string( sextractor_catalog_string, &star_number_in_sextractor_catalog, &flux_adu, &flux_adu_err, &mag, &sigma_mag, &position_x_pix, &position_y_pix, &a_a, &a_a_err, &a_b, &a_b_err, &sextractor_flag, &external_flag, &psf_chi2, float_parameters ) ) {
+   fprintf( stderr, "WARNING: problem occurred while parsing SExtractor catalog %s\nThe offending line is:\n%s\n", sextractor_catalog, sextractor_catalog_string );
+   continue;
+  }
+  // if( 12>sscanf(sextractor_catalog_string, "%d %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %d %[^\t\n]", &star_number_in_sextractor_catalog, &flux_adu, &flux_adu_err, &mag, &sigma_mag, &position_x_pix, &position_y_pix, &a_a, &a_a_err, &a_b, &a_b_err, &sextractor_flag, external_flag_string) ){
+  //  fprintf(stderr,"WARNING: problem occurred while parsing SExtractor catalog %s\nThe offending line is:\n%s\n",sextractor_catalog,sextractor_catalog_string);
+  //  continue;
+  // }
+  //  Read only stars detected at the first FITS image extension.
+  //  The start of the second image extension will be signified by a jump in star numbering
+  if ( star_number_in_sextractor_catalog < previous_star_number_in_sextractor_catalog ) {
+   fprintf( stderr, "WARNING: the input SExtractor catalog is not sorted. Was this catalog created from a multi-extension FITS? In this case, only sources detected on the first image extension will be processed!\n" );
+   break;
+  } else {
+   previous_star_number_in_sextractor_catalog= star_number_in_sextractor_catalog;
+  }
+  // Check if the catalog line is a really band one
+  if ( flux_adu <= 0 ) {
+   counter_rejected_bad_flux++;
+   continue;
+  }
+  if ( flux_adu_err == 999999 ) {
+   counter_rejected_bad_flux++;
+   continue;
+  }
+  if ( mag == 99.0000 ) {
+   counter_rejected_bad_flux++;
+   continue;
+  }
+  if ( sigma_mag == 99.0000 ) {
+   counter_rejected_bad_flux++;
+   continue;
+  }
+  // If we have no error estimates in at least one aperture - assume things are bad with this object
+  if ( float_parameters[3] == 99.0000 ) {
+   counter_rejected_bad_flux++;
+   continue;
+  }
+  if ( float_parameters[5] == 99.0000 ) {
+   counter_rejected_bad_flux++;
+   continue;
+  }
+  if ( float_parameters[7] == 99.0000 ) {
+   counter_rejected_bad_flux++;
+   continue;
+  }
+  if ( float_parameters[9] == 99.0000 ) {
+   counter_rejected_bad_flux++;
+   continue;
+  }
+  if ( float_parameters[11] == 99.0000 ) {
+   counter_rejected_bad_flux++;
+   continue;
+  }
+//
+#ifdef STRICT_CHECK_OF_JD_AND_MAG_RANGE
+  if ( mag < BRIGHTEST_STARS ) {
+   counter_rejected_bad_flux++;
+   continue;
+  }
+  if ( mag > FAINTEST_STARS_ANYMAG ) {
+   counter_rejected_bad_flux++;
+   continue;
+  }
+  if ( sigma_mag > MAX_MAG_ERROR ) {
+   counter_rejected_low_snr++;
+   continue;
+  }
+#endif
+  //
+  if ( flux_adu < MIN_SNR * flux_adu_err ) {
+   counter_rejected_low_snr++;
+   continue;
+  }
+  if ( 0 != exclude_region( X1, Y1, X2, Y2, N_bad_regions, position_x_pix, position_y_pix, aperture ) ) {
+   if ( counter_rejected_bad_region < 10 ) {
+    fprintf( stderr, "The star %9.3lf %9.3lf is rejected, see bad_region.lst\n", position_x_pix, position_y_pix );
+   }
+   if ( counter_rejected_bad_region == 10 ) {
+    fprintf( stderr, "Excluding more stars falling at bad regions!.. (will not print them all)\n" );
+   }
+   counter_rejected_bad_region++;
+   continue;
+  }
+  if ( 1 == is_point_close_or_off_the_frame_edge( position_x_pix, position_y_pix, X_im_size, Y_im_size, FRAME_EDGE_INDENT_PIXELS ) ) {
+   counter_rejected_frame_edge++;
+   continue;
+  }
+  //
+  if ( CONST * ( a_a + a_a_err ) < MIN_SOURCE_SIZE_APERTURE_FRACTION * aperture ) {
+   counter_rejected_too_small++;
+   continue;
+  }
+  //
+  if ( SIGMA_TO_FWHM_CONVERSION_FACTOR * ( a_a + a_a_err ) < FWHM_MIN ) {
+   counter_rejected_too_small++;
+   continue;
+  }
+  if ( SIGMA_TO_FWHM_CONVERSION_FACTOR * ( a_b + a_b_err ) < FWHM_MIN ) {
+   counter_rejected_too_small++;
+   continue;
+  }
+  // if ( float_parameters[0] < FWHM_MIN ) {
+  if ( MAX( float_parameters[0], SIGMA_TO_FWHM_CONVERSION_FACTOR * a_a ) < FWHM_MIN ) {
+   counter_rejected_too_small++;
+   continue;
+  }
+  //
+  if ( external_flag != 0 ) {
+   counter_rejected_external_flag++;
+   continue;
+  }
+  //
+  if ( maxsextractorflag < sextractor_flag && sextractor_flag <= 7 ) {
+   counter_rejected_seflags_gt_user_spec_threshold++;
+   // We don't drop such objects here to keep 'em in STAR structure,
+   // they will be rejected later when saving the observations.
+  }
+  // just in case we mark objects with really bad SExtractor flags
+  // sextractor_flag != 20 -- accept a super-bright saturated object
+  if ( sextractor_flag > 7 && sextractor_flag != 20 ) {
+   counter_rejected_seflags_gt7++;
+   continue;
+  }
+  //
+  NUMBER2++;
+  STAR2[NUMBER2 - 1].vast_flag= 0;
+  // It is OK for a very bright saturated object to be big
+  // if ( a_a > 5*aperture && sextractor_flag < 4 ) {
+  if ( a_a > aperture && sextractor_flag < 4 && 0 == param_nodiscardlargesrc ) {
+   counter_rejected_too_large++;
+   STAR2[NUMBER2 - 1].vast_flag= 1;
+  }
+
+  STAR2[NUMBER2 - 1].n= star_number_in_sextractor_catalog;
+  STAR2[NUMBER2 - 1].x= (float)position_x_pix;
+  STAR2[NUMBER2 - 1].y= (float)position_y_pix;
+  STAR2[NUMBER2 - 1].flux= flux_adu;
+  STAR2[NUMBER2 - 1].flux_err= flux_adu_err;
+  // Теперь считаем ошибки правильно, а не как трактор ;)
+  STAR2[NUMBER2 - 1].mag= (float)mag;
+  STAR2[NUMBER2 - 1].sigma_mag= (float)sigma_mag;
+  STAR2[NUMBER2 - 1].JD= JD;
+  STAR2[NUMBER2 - 1].x_frame= STAR2[NUMBER2 - 1].x;
+  STAR2[NUMBER2 - 1].y_frame= STAR2[NUMBER2 - 1].y;
+  // for moving object match
+  STAR2[NUMBER2 - 1].moving_object= 0;
+  if ( moving_object == 1 ) {
+   if ( 0.0 < position_x_pix && position_x_pix < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
+    if ( 0.0 < position_y_pix && position_y_pix < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
+     if ( 0.0 < moving_object__user_array_x[image_index] && moving_object__user_array_x[image_index] < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
+      if ( 0.0 < moving_object__user_array_y[image_index] && moving_object__user_array_y[image_index] < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
+       if ( ( position_x_pix - moving_object__user_array_x[image_index] ) * ( position_x_pix - moving_object__user_array_x[image_index] ) + ( position_y_pix - moving_object__user_array_y[image_index] ) * ( position_y_pix - moving_object__user_array_y[image_index] ) < 1.0 ) {
+        STAR2[NUMBER2 - 1].moving_object= 1;
+        // fprintf(stderr,"\x1B[01;31mDEBUG: here is the moving object on %s !!!\x1B[33;00m\n", input_image);
+       }
+      } // if( 0.0 < moving_object__user_array_y[image_index]  &&  moving_object__user_array_y[image_index] < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
+     } // if( 0.0 < moving_object__user_array_x[image_index]  &&  moving_object__user_array_x[image_index] < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
+    } // if( 0.0 < position_y_pix  &&  position_y_pix < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
+   } // if( 0.0 < position_x_pix  && position_x_pix < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
+  }
+  //
+  STAR2[NUMBER2 - 1].detected_on_ref_frame= 0;               // Mark the star that it is not on the reference frame
+  STAR2[NUMBER2 - 1].sextractor_flag= (char)sextractor_flag; // SExtractor flag
+  // STAR2[NUMBER2-1].distance_to_neighbor_squared=4*a_a*a_a; // EXPERIMENTAL !!!
+  STAR2[NUMBER2 - 1].star_size= (float)a_a;
+  //
+  STAR2[NUMBER2 - 1].star_psf_chi2= (float)psf_chi2;
+  //
+  for ( float_parameters_counter= NUMBER_OF_FLOAT_PARAMETERS; float_parameters_counter--; ) {
+   STAR2[NUMBER2 - 1].float_parameters[float_parameters_counter]= float_parameters[float_parameters_counter];
+  }
+  //
+
+  /// !!! Debug !!!
+  // float debug_x=586.696;
+  // float debug_y=438.463;
+  /// float debug_d=sqrt((STAR2[NUMBER2-1].x_frame-debug_x)*(STAR2[NUMBER2-1].x_frame-debug_x)+(STAR2[NUMBER2-1].y_frame-debug_y)*(STAR2[NUMBER2-1].y_frame-debug_y));
+  /// if( debug_d<aperture ){
+  // fprintf(stderr,"READING SEXTRACTOR CAT: %d  %.3f %.3f  (%f)  s=%d v=%6d\n",STAR2[NUMBER2-1].n,STAR2[NUMBER2-1].x_frame,STAR2[NUMBER2-1].y_frame,STAR2[NUMBER2-1].star_size,STAR2[NUMBER2-1].sextractor_flag,STAR2[NUMBER2-1].vast_flag);
+  //}
+
+  /// !!! Debug !!!
+  debug_x= 2535.0;
+  debug_y= 1901.5;
+  debug_d= sqrt( ( STAR2[NUMBER2 - 1].x_frame - debug_x ) * ( STAR2[NUMBER2 - 1].x_frame - debug_x ) + ( STAR2[NUMBER2 - 1].y_frame - debug_y ) * ( STAR2[NUMBER2 - 1].y_frame - debug_y ) );
+  if ( debug_d < aperture ) {
+   fprintf( stderr, "READING SEXTRACTOR CAT: %d  %.3f %.3f  (%f)  s=%d v=%6d\n", STAR2[NUMBER2 - 1].n, STAR2[NUMBER2 - 1].x_frame, STAR2[NUMBER2 - 1].y_frame, STAR2[NUMBER2 - 1].star_size, STAR2[NUMBER2 - 1].sextractor_flag, STAR2[NUMBER2 - 1].vast_flag );
+  }
+
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: Reading test.cat NUMBER2=%d OK\n", NUMBER2 );
+ }
+ fclose( file );
+ if ( debug != 0 )
+  fprintf( stderr, "DEBUG MSG: Finished reading cat file for %s\n", input_image );
+ /* end of Read_sex_cat2 */
+
+ if ( param_P == 1 ) {
+  fprintf( stderr, "Filtering-out stars with bad PSF fit... " );
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: filter_MagPSFchi2()\n" );
+  if ( param_filterout_magsize_outliers == 1 )
+   /// !!! Disable PSF fit quality filter - it never works well (see also above) !!!
+   //      counter_rejected_bad_psf_fit= filter_on_float_parameters(STAR2, NUMBER2, sextractor_catalog, -2); // psfchi2
+   counter_rejected_bad_psf_fit= 0;
+  /*
+if ( param_filterout_magsize_outliers != 1 ) {
+if ( debug != 0 )
+fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(2)\n" );
+counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 2 ); // magpsf-magaper
+}
+*/
+  fprintf( stderr, "done!\n" );
+ } else {
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: NOT RUNNING filter_MagPSFchi2()\n" );
+  counter_rejected_bad_psf_fit= 0; // no PSF-fitting (and filtering)
+ }
+
+ // Flag outliers in the magnitude-size plot
+ if ( param_filterout_magsize_outliers == 1 ) {
+  fprintf( stderr, "Filtering-out outliers in the mag-size plot... " );
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(-1)\n" );
+  counter_rejected_MagSize= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, -1 );
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(0)\n" );
+  counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 0 );
+  // OK, let's count these filters as size-filters too for now
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(1)\n" );
+  counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 1 );
+  //
+  /*
+  if ( param_P == 1 ) {
+   if ( debug != 0 )
+    fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(2)\n" );
+   counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 2 ); // magpsf-magaper
+  }
+  */
+  //
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(4)\n" );
+  counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 4 );
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(6)\n" );
+  counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 6 );
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(8)\n" );
+  counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 8 );
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(10)\n" );
+  counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 10 );
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(12)\n" );
+  counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 12 );
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: DONE WITH filter_on_float_parameters()\n" );
+  fprintf( stderr, "done!\n" );
+ } else {
+  if ( debug != 0 )
+   fprintf( stderr, "DEBUG MSG: filter_on_float_parameters()\n" );
+  counter_rejected_MagSize= 0; // no mag-size filtering
+ }
+
+ image_catalog->STAR2= STAR2;
+ image_catalog->NUMBER2= NUMBER2;
+ image_catalog->counter_rejected_bad_flux= counter_rejected_bad_flux;
+ image_catalog->counter_rejected_low_snr= counter_rejected_low_snr;
+ image_catalog->counter_rejected_bad_region= counter_rejected_bad_region;
+ image_catalog->counter_rejected_frame_edge= counter_rejected_frame_edge;
+ image_catalog->counter_rejected_too_small= counter_rejected_too_small;
+ image_catalog->counter_rejected_too_large= counter_rejected_too_large;
+ image_catalog->counter_rejected_external_flag= counter_rejected_external_flag;
+ image_catalog->counter_rejected_bad_psf_fit= counter_rejected_bad_psf_fit;
+ image_catalog->counter_rejected_seflags_gt7= counter_rejected_seflags_gt7;
+ image_catalog->counter_rejected_MagSize= counter_rejected_MagSize;
+ image_catalog->counter_rejected_seflags_gt_user_spec_threshold= counter_rejected_seflags_gt_user_spec_threshold;
+
+ return 0;
+}
+
+// Append mode: the reference star lists and the star position averaging state are saved at the end of each run,
+// so images acquired later may be matched and added to the existing lightcurves with 'vast --append'.
+#define VAST_APPEND_STATE_FILENAME "vast_append_state.bin"
+#define VAST_APPEND_STATE_MAGIC "VaST append state"
+#define VAST_APPEND_STATE_FORMAT_VERSION 2
+#define VAST_APPEND_STATE_LAYOUT_SIZE 27
+// Names of the lightcurve files deleted by lib/postprocess_lightcurves in this and the previous runs
+#define VAST_APPEND_REMOVED_LIGHTCURVES_FILENAME "vast_append_removed_lightcurves.log"
+
+// The star lists are saved as raw struct Star records, so the state file may only be read by a VaST binary
+// with the same structure layout and the same compile-time limits. They are all recorded in the file header.
+static void get_append_state_layout( int *layout ) {
+ layout[0]= VAST_APPEND_STATE_FORMAT_VERSION;
+ layout[1]= 0x01020304; // byte order
+ layout[2]= (int)sizeof( struct Star );
+ layout[3]= MAX_NUMBER_OF_STARS;
+ layout[4]= NUMBER_OF_FLOAT_PARAMETERS;
+ layout[5]= FILENAME_LENGTH;
+ layout[6]= MAX_N_IMAGES_USED_TO_DETERMINE_STAR_COORDINATES;
+ layout[7]= (int)offsetof( struct Star, n );
+ layout[8]= (int)offsetof( struct Star, x );
+ layout[9]= (int)offsetof( struct Star, y );
+ layout[10]= (int)offsetof( struct Star, flux );
+ layout[11]= (int)offsetof( struct Star, flux_err );
+ layout[12]= (int)offsetof( struct Star, mag );
+ layout[13]= (int)offsetof( struct Star, sigma_mag );
+ layout[14]= (int)offsetof( struct Star, JD );
+ layout[15]= (int)offsetof( struct Star, x_frame );
+ layout[16]= (int)offsetof( struct Star, y_frame );
+ layout[17]= (int)offsetof( struct Star, detected_on_ref_frame );
+ layout[18]= (int)offsetof( struct Star, sextractor_flag );
+ layout[19]= (int)offsetof( struct Star, vast_flag );
+ layout[20]= (int)offsetof( struct Star, star_size );
+ layout[21]= (int)offsetof( struct Star, star_psf_chi2 );
+ layout[22]= (int)offsetof( struct Star, float_parameters );
+ layout[23]= (int)offsetof( struct Star, n_detected );
+ layout[24]= (int)offsetof( struct Star, n_rejected );
+ layout[25]= (int)offsetof( struct Star, moving_object );
+ layout[26]= (int)sizeof( float );
+ return;
+}
+
+static int save_append_state( char *reference_image, int max_number, struct Star *STAR1, int NUMBER1, struct Star *STAR3, int NUMBER3, int coordinate_array_counter, int *star_numbers_for_coordinate_arrays, int *number_of_coordinate_measurements_for_star, float **coordinate_array_x, float **coordinate_array_y ) {
+ FILE *statefile;
+ char magic[32];
+ char reference_image_name[FILENAME_LENGTH];
+ int layout[VAST_APPEND_STATE_LAYOUT_SIZE];
+ int header[4];
+ int i;
+ int write_error= 0;
+
+ statefile= fopen( VAST_APPEND_STATE_FILENAME ".tmp", "wb" );
+ if ( NULL == statefile ) {
+  fprintf( stderr, "WARNING: cannot open %s for writing, it will not be possible to --append images to this run\n", VAST_APPEND_STATE_FILENAME ".tmp" );
+  return 1;
+ }
+ memset( magic, 0, sizeof( magic ) );
+ strncpy( magic, VAST_APPEND_STATE_MAGIC, sizeof( magic ) - 1 );
+ memset( reference_image_name, 0, FILENAME_LENGTH );
+ strncpy( reference_image_name, reference_image, FILENAME_LENGTH - 1 );
+ get_append_state_layout( layout );
+ header[0]= max_number;
+ header[1]= NUMBER1;
+ header[2]= NUMBER3;
+ header[3]= coordinate_array_counter;
+ if ( 1 != fwrite( magic, sizeof( magic ), 1, statefile ) )
+  write_error= 1;
+ if ( 1 != fwrite( layout, sizeof( layout ), 1, statefile ) )
+  write_error= 1;
+ if ( 1 != fwrite( reference_image_name, FILENAME_LENGTH, 1, statefile ) )
+  write_error= 1;
+ if ( 1 != fwrite( header, sizeof( header ), 1, statefile ) )
+  write_error= 1;
+ if ( (size_t)NUMBER1 != fwrite( STAR1, sizeof( struct Star ), (size_t)NUMBER1, statefile ) )
+  write_error= 1;
+ if ( (size_t)NUMBER3 != fwrite( STAR3, sizeof( struct Star ), (size_t)NUMBER3, statefile ) )
+  write_error= 1;
+ for ( i= 0; i < coordinate_array_counter && write_error == 0; i++ ) {
+  if ( 1 != fwrite( &star_numbers_for_coordinate_arrays[i], sizeof( int ), 1, statefile ) )
+   write_error= 1;
+  if ( 1 != fwrite( &number_of_coordinate_measurements_for_star[i], sizeof( int ), 1, statefile ) )
+   write_error= 1;
+  if ( (size_t)number_of_coordinate_measurements_for_star[i] != fwrite( coordinate_array_x[i], sizeof( float ), (size_t)number_of_coordinate_measurements_for_star[i], statefile ) )
+   write_error= 1;
+  if ( (size_t)number_of_coordinate_measurements_for_star[i] != fwrite( coordinate_array_y[i], sizeof( float ), (size_t)number_of_coordinate_measurements_for_star[i], statefile ) )
+   write_error= 1;
+ }
+ if ( 0 != fclose( statefile ) )
+  write_error= 1;
+ if ( write_error != 0 || 0 != rename( VAST_APPEND_STATE_FILENAME ".tmp", VAST_APPEND_STATE_FILENAME ) ) {
+  fprintf( stderr, "WARNING: error writing %s, it will not be possible to --append images to this run\n", VAST_APPEND_STATE_FILENAME );
+  unlink( VAST_APPEND_STATE_FILENAME ".tmp" );
+  return 1;
+ }
+ return 0;
+}
+
+// Open the append state file and read its header. Returns NULL on error.
+static FILE *open_append_state( char *reference_image, int *header ) {
+ FILE *statefile;
+ char magic[32];
+ int layout[VAST_APPEND_STATE_LAYOUT_SIZE];
+ int expected_layout[VAST_APPEND_STATE_LAYOUT_SIZE];
+ statefile= fopen( VAST_APPEND_STATE_FILENAME, "rb" );
+ if ( NULL == statefile ) {
+  fprintf( stderr, "ERROR: cannot open %s - was the previous VaST run performed in this directory?\n", VAST_APPEND_STATE_FILENAME );
+  return NULL;
+ }
+ if ( 1 != fread( magic, sizeof( magic ), 1, statefile ) ) {
+  fprintf( stderr, "ERROR: cannot read %s\n", VAST_APPEND_STATE_FILENAME );
+  fclose( statefile );
+  return NULL;
+ }
+ magic[sizeof( magic ) - 1]= '\0';
+ get_append_state_layout( expected_layout );
+ // Check the format and the layout before reading anything with the size depending on them
+ if ( 0 != strcmp( magic, VAST_APPEND_STATE_MAGIC ) || 1 != fread( layout, sizeof( layout ), 1, statefile ) || 0 != memcmp( layout, expected_layout, sizeof( layout ) ) ) {
+  fprintf( stderr, "ERROR: %s was written by an incompatible version of VaST (or VaST compiled with different settings in src/vast_limits.h)\n", VAST_APPEND_STATE_FILENAME );
+  fclose( statefile );
+  return NULL;
+ }
+ if ( 1 != fread( reference_image, FILENAME_LENGTH, 1, statefile ) || 1 != fread( header, 4 * sizeof( int ), 1, statefile ) ) {
+  fprintf( stderr, "ERROR: cannot read %s\n", VAST_APPEND_STATE_FILENAME );
+  fclose( statefile );
+  return NULL;
+ }
+ reference_image[FILENAME_LENGTH - 1]= '\0';
+ return statefile;
+}
+
+static int load_append_state( char *reference_image, int *max_number, struct Star *STAR1, int *NUMBER1, struct Star *STAR3, int max_NUMBER3, int *NUMBER3, int *star_num_to_star3_idx, int *coordinate_array_counter, int *star_numbers_for_coordinate_arrays, int *star_num_to_coord_array_idx, int *number_of_coordinate_measurements_for_star, float **coordinate_array_x, float **coordinate_array_y ) {
+ FILE *statefile;
+ char reference_image_from_state[FILENAME_LENGTH];
+ int header[4];
+ int i;
+
+ statefile= open_append_state( reference_image_from_state, header );
+ if ( NULL == statefile ) {
+  return 1;
+ }
+ if ( 0 != strcmp( reference_image_from_state, reference_image ) ) {
+  fprintf( stderr, "ERROR: the reference image %s does not match the one from %s: %s\n", reference_image, VAST_APPEND_STATE_FILENAME, reference_image_from_state );
+  fclose( statefile );
+  return 1;
+ }
+ if ( header[1] < 1 || header[1] > MAX_NUMBER_OF_STARS || header[2] < 1 || header[2] > max_NUMBER3 || header[3] < 0 || header[3] > MAX_NUMBER_OF_STARS ) {
+  fprintf( stderr, "ERROR: unexpected number of stars in %s\n", VAST_APPEND_STATE_FILENAME );
+  fclose( statefile );
+  return 1;
+ }
+ ( *max_number )= header[0];
+ ( *NUMBER1 )= header[1];
+ ( *NUMBER3 )= header[2];
+ ( *coordinate_array_counter )= header[3];
+ if ( (size_t)( *NUMBER1 ) != fread( STAR1, sizeof( struct Star ), (size_t)( *NUMBER1 ), statefile ) || (size_t)( *NUMBER3 ) != fread( STAR3, sizeof( struct Star ), (size_t)( *NUMBER3 ), statefile ) ) {
+  fprintf( stderr, "ERROR: cannot read the star lists from %s\n", VAST_APPEND_STATE_FILENAME );
+  fclose( statefile );
+  return 1;
+ }
+ for ( i= 0; i <= MAX_NUMBER_OF_STARS; i++ ) {
+  star_num_to_star3_idx[i]= -1;
+  star_num_to_coord_array_idx[i]= -1;
+ }
+ for ( i= 0; i < ( *NUMBER3 ); i++ ) {
+  star_num_to_star3_idx[STAR3[i].n]= i;
+ }
+ for ( i= 0; i < ( *coordinate_array_counter ); i++ ) {
+  if ( 1 != fread( &star_numbers_for_coordinate_arrays[i], sizeof( int ), 1, statefile ) || 1 != fread( &number_of_coordinate_measurements_for_star[i], sizeof( int ), 1, statefile ) || star_numbers_for_coordinate_arrays[i] < 0 || star_numbers_for_coordinate_arrays[i] > MAX_NUMBER_OF_STARS || number_of_coordinate_measurements_for_star[i] < 1 || number_of_coordinate_measurements_for_star[i] > MAX_N_IMAGES_USED_TO_DETERMINE_STAR_COORDINATES ) {
+   fprintf( stderr, "ERROR: cannot read the star position measurements from %s\n", VAST_APPEND_STATE_FILENAME );
+   fclose( statefile );
+   return 1;
+  }
+  coordinate_array_x[i]= malloc( (size_t)number_of_coordinate_measurements_for_star[i] * sizeof( float ) );
+  coordinate_array_y[i]= malloc( (size_t)number_of_coordinate_measurements_for_star[i] * sizeof( float ) );
+  if ( coordinate_array_x[i] == NULL || coordinate_array_y[i] == NULL ) {
+   fprintf( stderr, "ERROR: can't allocate memory for coordinate_array_x[i]\n" );
+   vast_report_memory_error();
+   fclose( statefile );
+   return 1;
+  }
+  if ( (size_t)number_of_coordinate_measurements_for_star[i] != fread( coordinate_array_x[i], sizeof( float ), (size_t)number_of_coordinate_measurements_for_star[i], statefile ) || (size_t)number_of_coordinate_measurements_for_star[i] != fread( coordinate_array_y[i], sizeof( float ), (size_t)number_of_coordinate_measurements_for_star[i], statefile ) ) {
+   fprintf( stderr, "ERROR: cannot read the star position measurements from %s\n", VAST_APPEND_STATE_FILENAME );
+   fclose( statefile );
+   return 1;
+  }
+  star_num_to_coord_array_idx[star_numbers_for_coordinate_arrays[i]]= i;
+ }
+ fclose( statefile );
+ fprintf( stderr, "Loaded %d stars (%d used for image matching) from %s\n", ( *NUMBER1 ), ( *NUMBER3 ), VAST_APPEND_STATE_FILENAME );
+ return 0;
+}
+
+// The previous runs have deleted some lightcurves as having too few points. If these stars were detected
+// on the new images, their lightcurves were re-created holding only the new points - delete them again.
+static void remove_lightcurves_deleted_by_previous_runs( void ) {
+ FILE *f;
+ char lightcurve_filename[FILENAME_LENGTH];
+ int n_removed= 0;
+ f= fopen( VAST_APPEND_REMOVED_LIGHTCURVES_FILENAME, "r" );
+ if ( NULL == f ) {
+  return;
+ }
+ while ( NULL != fgets( lightcurve_filename, FILENAME_LENGTH, f ) ) {
+  lightcurve_filename[strcspn( lightcurve_filename, "\r\n" )]= '\0';
+  if ( 0 == unlink( lightcurve_filename ) ) {
+   n_removed++;
+  }
+ }
+ fclose( f );
+ if ( n_removed > 0 ) {
+  fprintf( stderr, "append mode: removed %d lightcurves deleted by the previous runs\n", n_removed );
+ }
+ return;
+}
+
+static int compare_strings_for_qsort( const void *a, const void *b ) {
+ return strcmp( *(char *const *)a, *(char *const *)b );
+}
+
+// Replace the input image list with the reference image of the previous run followed by
+// the images that are not listed in vast_images_catalogs.log (i.e. were not processed before).
+static int select_new_images_for_append_mode( char ***input_images, int *Num, int *number_of_previously_processed_images ) {
+ FILE *f;
+ char str[2 * FILENAME_LENGTH];
+ char reference_image[FILENAME_LENGTH];
+ int header[4];
+ char **previous_images= NULL;
+ char **new_input_images;
+ char *image_name;
+ char *key;
+ int n_previous= 0;
+ int new_Num;
+ int i;
+
+ f= open_append_state( reference_image, header );
+ if ( NULL == f ) {
+  return 1;
+ }
+ fclose( f );
+
+ f= fopen( "vast_images_catalogs.log", "r" );
+ if ( NULL == f ) {
+  fprintf( stderr, "ERROR: cannot open vast_images_catalogs.log from the previous run\n" );
+  return 1;
+ }
+ while ( NULL != fgets( str, 2 * FILENAME_LENGTH, f ) ) {
+  str[strcspn( str, "\r\n" )]= '\0';
+  image_name= strchr( str, ' ' );
+  if ( NULL == image_name ) {
+   continue;
+  }
+  image_name++;
+  previous_images= realloc( previous_images, sizeof( char * ) * ( n_previous + 1 ) );
+  if ( NULL == previous_images ) {
+   fprintf( stderr, "ERROR: can't allocate memory for the list of previously processed images\n" );
+   fclose( f );
+   return 1;
+  }
+  previous_images[n_previous]= malloc( strlen( image_name ) + 1 );
+  if ( NULL == previous_images[n_previous] ) {
+   fprintf( stderr, "ERROR: can't allocate memory for the list of previously processed images\n" );
+   fclose( f );
+   return 1;
+  }
+  strcpy( previous_images[n_previous], image_name );
+  n_previous++;
+ }
+ fclose( f );
+ if ( n_previous < 1 ) {
+  fprintf( stderr, "ERROR: no images are listed in vast_images_catalogs.log from the previous run\n" );
+  return 1;
+ }
+ qsort( previous_images, (size_t)n_previous, sizeof( char * ), compare_strings_for_qsort );
+
+ new_input_images= malloc( sizeof( char * ) * ( ( *Num ) + 1 ) );
+ if ( NULL == new_input_images ) {
+  fprintf( stderr, "ERROR: can't allocate memory for the new list of input images\n" );
+  return 1;
+ }
+ new_input_images[0]= malloc( strlen( reference_image ) + 1 );
+ if ( NULL == new_input_images[0] ) {
+  fprintf( stderr, "ERROR: can't allocate memory for the new list of input images\n" );
+  return 1;
+ }
+ strcpy( new_input_images[0], reference_image );
+ new_Num= 1;
+ for ( i= 0; i < ( *Num ); i++ ) {
+  key= ( *input_images )[i];
+  if ( NULL != bsearch( &key, previous_images, (size_t)n_previous, sizeof( char * ), compare_strings_for_qsort ) ) {
+   free( ( *input_images )[i] );
+   continue;
+  }
+  new_input_images[new_Num]= ( *input_images )[i];
+  new_Num++;
+ }
+ fprintf( stderr, "Append mode: %d of %d input images were not processed before, the reference image is %s\n", new_Num - 1, ( *Num ), reference_image );
+
+ for ( i= 0; i < n_previous; i++ ) {
+  free( previous_images[i] );
+ }
+ free( previous_images );
+ free( ( *input_images ) );
+ ( *input_images )= new_input_images;
+ ( *Num )= new_Num;
+ ( *number_of_previously_processed_images )= n_previous;
+ return 0;
+}
+
 int main( int argc, char **argv ) {
 
  FILE *file;
@@ -852,7 +1667,7 @@ int main( int argc, char **argv ) {
 
  struct PixCoordinateTransformation *struct_pixel_coordinate_transformation= NULL;
 
- int number_of_lines_reference_image_cat, number_of_lines_current_image_cat;
+ int number_of_lines_reference_image_cat;
 
  struct Star *STAR1= NULL, *STAR2= NULL, *STAR3= NULL; // STAR1 - structure with all stars we can match
                                                        //         new stars are added to STAR1
@@ -875,6 +1690,7 @@ int main( int argc, char **argv ) {
  long TOTAL_OBS= 0;                            // Total number of measurements
  long obs_in_RAM= 0;                           // Number of observations which were not written to disk
  long Max_obs_in_RAM= MAX_MEASUREMENTS_IN_RAM; // maximum number of observations in RAM
+ long obs_capacity= 0;                         // number of observations that fit in the memory allocated for ptr_struct_Obs
  int N_good_stars= 0;
  //
  int N_bad_stars= 0;
@@ -1176,6 +1992,8 @@ int main( int argc, char **argv ) {
      { "autoselectrefimage", 0, NULL, '7' },
      { "excluderefimage", 0, NULL, '8' },
      { "movingobject", 0, NULL, 'z' },
+     { "parallelcatalogs", 0, NULL, 'C' },
+     { "append", 0, NULL, 'Y' },
      { NULL, 0, NULL, 0 } }; // NULL string must be in the end
  int nextopt;
 
@@ -1198,13 +2016,31 @@ int main( int argc, char **argv ) {
  int pid_of_child_that_finished;
  int pid_status;
  int *child_pids;
+ int *child_image_index; // which image is processed by the child with child_pids[j_fork]
+
+ // Pipelined source extraction
+ int param_pipelined_source_extraction= 0;
+ int source_extraction_pipe[2]= { -1, -1 };
+ int is_source_extraction_dispatcher= 0;
+ pid_t source_extraction_dispatcher_pid= 0;
+ char *is_source_extraction_done= NULL;
+
+ // Parallel reading and filtering of the catalogs of upcoming images
+ int param_parallel_catalogs= 0;
+
+ // Appending new images to the results of the previous run
+ int param_append_mode= 0;
+ int number_of_previously_processed_images= 0;
+ int image_index_offset= 0; // index of the image in this run + image_index_offset = index of the image in the whole series
+ struct Image_catalog_for_matching *image_catalogs= NULL;
+ struct Image_catalog_for_matching *image_catalog;
+ int image_catalogs_max_batch_size= 1;
+ int image_catalogs_batch_start= 0;
+ int image_catalogs_batch_size= 0;
 
  // Block-scoped variables moved to function top
  pid_t wpid;
  int waitstatus;
- float debug_x;
- float debug_y;
- float debug_d;
  int outliers_removed_this_iteration;
  double raw_limiting_mag;
  double transformed_limiting_mag;
@@ -1423,6 +2259,14 @@ int main( int argc, char **argv ) {
    param_exclude_reference_image= 1;
    fprintf( stderr, "opt '8': the reference image will not be used for photometry!\n" );
    break;
+  case 'C':
+   param_parallel_catalogs= 1;
+   fprintf( stderr, "opt 'C': catalogs of the upcoming images will be read and filtered in parallel with matching the current one\n" );
+   break;
+  case 'Y':
+   param_append_mode= 1;
+   fprintf( stderr, "opt 'Y': new images will be appended to the results of the previous run\n" );
+   break;
   case 'P':
    // param_nodiscardell= 1; // incompatible with PSF photometry and I'm not sure why - probably a bug
    param_P= 1;
@@ -1942,13 +2786,47 @@ int main( int argc, char **argv ) {
   fprintf( stderr, "WARNING: an error occured while trying to update lib/tai-utc.dat\nNo internet connection?\n" );
  }
 
- // Destroy files created by previous session
- fprintf( stderr, "Cleaning old outNNNNN.dat files.\n" );
- if ( 0 != system( "util/clean_data.sh all >/dev/null" ) ) {
-  fprintf( stderr, "Error while cleaning old files. Aborting further computations...\n" );
-  return EXIT_FAILURE;
+ if ( param_append_mode == 1 ) {
+  // Keep the files created by the previous session and process only the new images
+  if ( param_automatically_select_reference_image == 1 ) {
+   fprintf( stderr, "append mode: the reference image of the previous run will be used, disabling the automatic reference image selection\n" );
+   param_automatically_select_reference_image= 0;
+  }
+  if ( moving_object == 1 ) {
+   fprintf( stderr, "ERROR: --append cannot be combined with --movingobject\n" );
+   return EXIT_FAILURE;
+  }
+  if ( param_select_best_aperture_for_each_source == 1 || param_rescale_photometric_errors == 1 ) {
+   fprintf( stderr, "append mode: disabling the best aperture selection and photometric error rescaling as they have already modified the existing lightcurves\n" );
+   param_select_best_aperture_for_each_source= 0;
+   param_rescale_photometric_errors= 0;
+  }
+  if ( 0 != select_new_images_for_append_mode( &input_images, &Num, &number_of_previously_processed_images ) ) {
+   fprintf( stderr, "ERROR: cannot append images to the previous run. Please re-run VaST without --append\n" );
+   return EXIT_FAILURE;
+  }
+  if ( Num < 2 ) {
+   fprintf( stderr, "No new images to process.\n" );
+   return EXIT_SUCCESS;
+  }
+  // The previous image index starts from 1 for the first image after the reference one (catalog image00002.cat)
+  image_index_offset= number_of_previously_processed_images - 1;
+  // lib/create_vast_image_details_log.sh will concatenate the old log with the image*.log files of the new images
+  if ( 0 != rename( "vast_image_details.log", "image00000.log" ) ) {
+   fprintf( stderr, "WARNING: cannot find vast_image_details.log from the previous run\n" );
+  }
+  // The lightcurve statistics will be recomputed for the extended lightcurves
+  unlink( "data" );
+  unlink( "data.m_sigma" );
+ } else {
+  // Destroy files created by previous session
+  fprintf( stderr, "Cleaning old outNNNNN.dat files.\n" );
+  if ( 0 != system( "util/clean_data.sh all >/dev/null" ) ) {
+   fprintf( stderr, "Error while cleaning old files. Aborting further computations...\n" );
+   return EXIT_FAILURE;
+  }
+  fprintf( stderr, "Done with cleaning!\n" );
  }
- fprintf( stderr, "Done with cleaning!\n" );
 
  // Save command line arguments to the log file vast_command_line.log
  save_command_line_to_log_file( argc, argv );
@@ -2020,7 +2898,7 @@ int main( int argc, char **argv ) {
 
  fprintf( stderr, "\nPreparing to process %d input FITS images...\n", Num );
 
- if ( Num < HARD_MIN_NUMBER_OF_POINTS && Num != 3 ) {
+ if ( Num < HARD_MIN_NUMBER_OF_POINTS && Num != 3 && param_append_mode == 0 ) {
   fprintf( stderr, "ERROR: At least %d images are needed for correct processing (much more is much better)!\nYou have supplied only %d images. :(\n", HARD_MIN_NUMBER_OF_POINTS, Num );
   fprintf( stderr, "\nThis error message often appears if there is a TYPO IN THE COMMAND LINE argument(s) specifying path to the images.\nPlease double-check the command you type in the terminal.\n\n" );
   // moved up
@@ -2029,7 +2907,7 @@ int main( int argc, char **argv ) {
  }
 
  // Special settings that are forced for the 4-image transient detection mode
- if ( Num == 4 ) {
+ if ( Num == 4 && param_append_mode == 0 ) {
   fprintf( stderr, "\n\n######## Forcing special settings for the transient detection ########\n" );
   fprintf( stderr, "transient search mode: disabling the mag-size filter as it should be switched off when running a transient search!\n" );
   param_filterout_magsize_outliers= 0;
@@ -2115,7 +2993,7 @@ int main( int argc, char **argv ) {
  }
 
  // Num==3, 4, or 5 - is likely the triplet mode for transient detection, we'll skip the usual stupid warnings
- if ( Num > HARD_MIN_NUMBER_OF_POINTS && Num < SOFT_MIN_NUMBER_OF_POINTS && Num != 3 && Num != 4 && Num != 5 && debug == 0 && convert_timesys_to_TT != 0 ) {
+ if ( Num > HARD_MIN_NUMBER_OF_POINTS && Num < SOFT_MIN_NUMBER_OF_POINTS && Num != 3 && Num != 4 && Num != 5 && debug == 0 && convert_timesys_to_TT != 0 && param_append_mode == 0 ) {
   fprintf( stderr, "WARNING: It is recommended to use VaST with more than %d images (much more is much better)!\nYou have supplied only %d images. :(\n", SOFT_MIN_NUMBER_OF_POINTS, Num );
   fprintf( stderr, "\n" );
   fprintf( stderr, "This warning message will disappear in...   " );
@@ -2245,6 +3123,7 @@ int main( int argc, char **argv ) {
 
  ///// Start timer /////
  start_time= time( NULL );
+ vast_profiling_init();
 
  // Allocate memory for moving object coordinates
  // we only need it for user-specified moving object (moving_object==1)
@@ -2324,13 +3203,17 @@ int main( int argc, char **argv ) {
  // fprintf(stderr,"%s\n",input_images[i]);
 
  // Create vast_images_catalogs.log
- write_images_catalogs_logfile( input_images, Num );
+ if ( param_append_mode == 1 ) {
+  append_images_catalogs_logfile( input_images, Num, number_of_previously_processed_images + 1 );
+ } else {
+  write_images_catalogs_logfile( input_images, Num );
+ }
 
  // Restore cached SExtractor catalogs if VAST_SEXTRACTOR_CACHE_DIR is set.
  // This must run after clean_data.sh (which deletes old .cat files) and after
  // write_images_catalogs_logfile (which creates the image-to-catalog mapping),
  // but before the fork() loop that runs autodetect_aperture() on each image.
- system( "lib/restore_cached_sextractor_catalogs.sh" );
+ vast_profiled_system( "lib/restore_cached_sextractor_catalogs.sh" );
 
  // Set the desired number of threads
  i_fork= 0;
@@ -2355,113 +3238,208 @@ int main( int argc, char **argv ) {
   vast_report_memory_error();
   return EXIT_FAILURE;
  }
-
- timing_sextractor_start= time( NULL );
- fprintf( stderr, "Running SExtractor in %d parallel threads...\n", MIN( n_fork, Num ) );
- // Initialize child_pids
- for ( j_fork= 0; j_fork < n_fork; j_fork++ ) {
-  child_pids[j_fork]= 0;
+ child_image_index= malloc( (size_t)malloc_size );
+ if ( child_image_index == NULL ) {
+  fprintf( stderr, "ERROR: can't allocate memory!\n child_image_index=malloc(n_fork*sizeof(int)); - failed!\n" );
+  vast_report_memory_error();
+  return EXIT_FAILURE;
  }
- //
- for ( i= 0; i < Num; i++ ) {
-  fitsfile_read_error= gettime( input_images[i], &JD, &timesys, convert_timesys_to_TT, &X_im_size, &Y_im_size, stderr_output, log_output, param_nojdkeyword, 0, NULL );
-  if ( fitsfile_read_error != 0 && i == 0 ) {
-   fprintf( stderr, "Error reading reference file: code %d\nI'll die :(\n", fitsfile_read_error );
-   fits_report_error( stderr, fitsfile_read_error );
-   exit( fitsfile_read_error );
+
+ // Elongated image star mark and automatic reference image selection
+ // need all the image catalogs to be present before star matching may start.
+ // Otherwise, SExtractor runs are handled by a separate dispatcher process
+ // and star matching starts as soon as the catalog of the reference image is ready.
+ // This is done only for the long image series on a machine with a moderate number of cores
+ // (the same conditions as for the old 'fast processing hack' this mode replaces):
+ // for a short series there is little to overlap, while on a highly multi-core system
+ // matching would compete for the cores with the SExtractor runs.
+ if ( param_automatically_select_reference_image == 0 && moving_object == 0 && param_nodiscardell == 1 && Num >= 100 && n_fork <= 16 ) {
+  is_source_extraction_done= malloc( Num * sizeof( char ) );
+  if ( is_source_extraction_done == NULL ) {
+   fprintf( stderr, "ERROR: can't allocate memory for is_source_extraction_done\n" );
+   vast_report_memory_error();
+   return EXIT_FAILURE;
+  }
+  memset( is_source_extraction_done, 0, Num * sizeof( char ) );
+  if ( 0 != pipe( source_extraction_pipe ) ) {
+   fprintf( stderr, "WARNING: cannot create a pipe, SExtractor and star matching will run one after the other\n" );
+   free( is_source_extraction_done );
+   is_source_extraction_done= NULL;
   } else {
-   //////////////////////////////////////////////////////////////
-   i_fork++;
-   pid= fork();
-   if ( pid == 0 || pid == -1 ) {
-    if ( pid == -1 ) {
-     fprintf( stderr, "WARNING: cannot fork()! Continuing in the streamline mode...\n" );
+   param_pipelined_source_extraction= 1;
+   // Make sure the buffered output is not written twice by the two processes
+   fflush( NULL );
+   source_extraction_dispatcher_pid= fork();
+   if ( source_extraction_dispatcher_pid == -1 ) {
+    fprintf( stderr, "WARNING: cannot fork() the SExtractor dispatcher process, SExtractor and star matching will run one after the other\n" );
+    close( source_extraction_pipe[0] );
+    close( source_extraction_pipe[1] );
+    source_extraction_pipe[0]= source_extraction_pipe[1]= -1;
+    free( is_source_extraction_done );
+    is_source_extraction_done= NULL;
+    param_pipelined_source_extraction= 0;
+   } else if ( source_extraction_dispatcher_pid == 0 ) {
+    // This is the dispatcher
+    is_source_extraction_dispatcher= 1;
+    // If the main process stops reading the pipe, we still want to collect all the children
+    signal( SIGPIPE, SIG_IGN );
+    close( source_extraction_pipe[0] );
+    source_extraction_pipe[0]= -1;
+   } else {
+    // This is the main process
+    close( source_extraction_pipe[1] );
+    source_extraction_pipe[1]= -1;
+    source_extraction_main_process_pid= getpid();
+    source_extraction_dispatcher_pid_to_stop= source_extraction_dispatcher_pid;
+    if ( 0 != atexit( stop_source_extraction_dispatcher ) ) {
+     fprintf( stderr, "WARNING: cannot register the atexit() handler for the SExtractor dispatcher process\n" );
     }
-    autodetect_aperture( input_images[i], sextractor_catalog, 0, param_P, fixed_aperture, X_im_size, Y_im_size, guess_saturation_limit_operation_mode, flag_image_use_mode );
-    if ( pid == 0 ) {
-     ///// If this is a child /////
-     // free-up memory
-     if ( debug != 0 ) {
-      fprintf( stderr, "DEBUG MSG %d: CHILD free();\n", getpid() );
-     }
-     free( child_pids );
-     free( ptr_struct_Obs );
-     free( STAR3 ); // I don't think these are allocated at this point. Are they?
-     free( STAR1 ); // I don't think these are allocated at this point. Are they?
-     free( bad_stars_X );
-     free( bad_stars_Y );
-     if ( debug != 0 ) {
-      fprintf( stderr, "DEBUG MSG %d: for(n = 0; n < Num; n++)free(input_images[n]);\n", getpid() );
-     }
-     for ( n= Num; n--; ) {
-      free( input_images[n] );
-     }
-     if ( debug != 0 ) {
-      fprintf( stderr, "DEBUG MSG %d: free(input_images);\n", getpid() );
+   }
+  }
+ }
+
+ // In the pipelined mode, the main process skips this loop: it is executed by the dispatcher
+ if ( param_pipelined_source_extraction == 0 || is_source_extraction_dispatcher == 1 ) {
+  timing_sextractor_start= time( NULL );
+  vast_profiling_start( "sextractor" );
+  fprintf( stderr, "Running SExtractor in %d parallel threads...\n", MIN( n_fork, Num ) );
+  // Initialize child_pids
+  for ( j_fork= 0; j_fork < n_fork; j_fork++ ) {
+   child_pids[j_fork]= 0;
+  }
+  //
+  for ( i= 0; i < Num; i++ ) {
+   fitsfile_read_error= gettime( input_images[i], &JD, &timesys, convert_timesys_to_TT, &X_im_size, &Y_im_size, stderr_output, log_output, param_nojdkeyword, 0, NULL );
+   if ( fitsfile_read_error != 0 && i == 0 ) {
+    fprintf( stderr, "Error reading reference file: code %d\nI'll die :(\n", fitsfile_read_error );
+    fits_report_error( stderr, fitsfile_read_error );
+    exit( fitsfile_read_error );
+   } else {
+    //////////////////////////////////////////////////////////////
+    i_fork++;
+    pid= fork();
+    if ( pid == 0 || pid == -1 ) {
+     if ( pid == -1 ) {
+      fprintf( stderr, "WARNING: cannot fork()! Continuing in the streamline mode...\n" );
      }
-     free( input_images );
-     //
-     for ( n= Num; n--; ) {
-      free( str_with_fits_keywords_to_capture_from_input_images[n] );
+     // SExtractor may filter the image in parallel threads, but here the cores are already busy
+     // with SExtractor runs on other images, so the child process should use a single thread
+     if ( pid == 0 && MIN( n_fork, Num ) > 1 ) {
+      setenv( "OMP_NUM_THREADS", "1", 1 );
      }
-     free( str_with_fits_keywords_to_capture_from_input_images );
-     if ( debug != 0 ) {
-      fprintf( stderr, "DEBUG MSG %d: Delete_PixCoordinateTransformation(struct_pixel_coordinate_transformation);\n", getpid() );
+     autodetect_aperture( input_images[i], sextractor_catalog, 0, param_P, fixed_aperture, X_im_size, Y_im_size, guess_saturation_limit_operation_mode, flag_image_use_mode );
+     if ( pid == -1 ) {
+      report_source_extraction_done( source_extraction_pipe[1], i );
      }
-     Delete_PixCoordinateTransformation( struct_pixel_coordinate_transformation );
-     if ( debug != 0 ) {
-      fprintf( stderr, "DEBUG MSG %d: CHILD free() -- still alive\n", getpid() );
+     if ( pid == 0 ) {
+      ///// If this is a child /////
+      // free-up memory
+      if ( debug != 0 ) {
+       fprintf( stderr, "DEBUG MSG %d: CHILD free();\n", getpid() );
+      }
+      free( child_pids );
+      free( child_image_index );
+      free( is_source_extraction_done );
+      free( ptr_struct_Obs );
+      free( STAR3 ); // I don't think these are allocated at this point. Are they?
+      free( STAR1 ); // I don't think these are allocated at this point. Are they?
+      free( bad_stars_X );
+      free( bad_stars_Y );
+      if ( debug != 0 ) {
+       fprintf( stderr, "DEBUG MSG %d: for(n = 0; n < Num; n++)free(input_images[n]);\n", getpid() );
+      }
+      for ( n= Num; n--; ) {
+       free( input_images[n] );
+      }
+      if ( debug != 0 ) {
+       fprintf( stderr, "DEBUG MSG %d: free(input_images);\n", getpid() );
+      }
+      free( input_images );
+      //
+      for ( n= Num; n--; ) {
+       free( str_with_fits_keywords_to_capture_from_input_images[n] );
+      }
+      free( str_with_fits_keywords_to_capture_from_input_images );
+      if ( debug != 0 ) {
+       fprintf( stderr, "DEBUG MSG %d: Delete_PixCoordinateTransformation(struct_pixel_coordinate_transformation);\n", getpid() );
+      }
+      Delete_PixCoordinateTransformation( struct_pixel_coordinate_transformation );
+      if ( debug != 0 ) {
+       fprintf( stderr, "DEBUG MSG %d: CHILD free() -- still alive\n", getpid() );
+      }
+      //
+      exit( EXIT_SUCCESS ); // exit only if this is actually a child
+     } // if ( pid == 0 ) {
+     // the other possibility is that this is a parent that could not fork - no exit in this case
+    } else {
+     // child_pids[i_fork-1]=pid;
+     for ( fork_found_empty_slot= 0, j_fork= 0; j_fork < n_fork; j_fork++ ) {
+      if ( child_pids[j_fork] == 0 ) {
+       child_pids[j_fork]= pid;
+       child_image_index[j_fork]= i;
+       fork_found_empty_slot= 1;
+       break;
+      }
      }
-     //
-     exit( EXIT_SUCCESS ); // exit only if this is actually a child
-    } // if ( pid == 0 ) {
-    // the other possibility is that this is a parent that could not fork - no exit in this case
-   } else {
-    // child_pids[i_fork-1]=pid;
-    for ( fork_found_empty_slot= 0, j_fork= 0; j_fork < n_fork; j_fork++ ) {
-     if ( child_pids[j_fork] == 0 ) {
-      child_pids[j_fork]= pid;
-      fork_found_empty_slot= 1;
-      break;
+     if ( fork_found_empty_slot != 1 ) {
+      fprintf( stderr, "FATAL ERROR 11\n" );
+      return EXIT_FAILURE;
      }
-    }
-    if ( fork_found_empty_slot != 1 ) {
-     fprintf( stderr, "FATAL ERROR 11\n" );
-     return EXIT_FAILURE;
-    }
-    ///// #####################################
-    if ( i_fork == MIN( n_fork, Num ) ) {
-     // Wait for any child process to finish
-     pid_of_child_that_finished= waitpid( -1, &pid_status, 0 );
-     for ( j_fork= 0; j_fork < i_fork; j_fork++ ) {
-      if ( pid_of_child_that_finished == child_pids[j_fork] ) {
-       child_pids[j_fork]= 0;
-       i_fork--;
-       break;
+     // Report the runs that are already done without waiting for a free slot,
+     // so the main process does not wait for a catalog that is already there
+     i_fork-= collect_finished_source_extraction_runs( child_pids, child_image_index, n_fork, source_extraction_pipe[1] );
+     ///// #####################################
+     if ( i_fork == MIN( n_fork, Num ) ) {
+      // Wait for any child process to finish
+      pid_of_child_that_finished= waitpid( -1, &pid_status, 0 );
+      for ( j_fork= 0; j_fork < i_fork; j_fork++ ) {
+       if ( pid_of_child_that_finished == child_pids[j_fork] ) {
+        report_source_extraction_done( source_extraction_pipe[1], child_image_index[j_fork] );
+        child_pids[j_fork]= 0;
+        i_fork--;
+        break;
+       }
       }
+      // i_fork--;
+      /// Seems to work, but pid_status array gets corrupted
+      // Check if any of the children is done
+      // for(j_fork=0;j_fork<i_fork;j_fork++){
+      // waitpid(child_pids[j_fork],&pid_status,WNOHANG);
+      //}
      }
-     // i_fork--;
-     /// Seems to work, but pid_status array gets corrupted
-     // Check if any of the children is done
-     // for(j_fork=0;j_fork<i_fork;j_fork++){
-     // waitpid(child_pids[j_fork],&pid_status,WNOHANG);
-     //}
+     ///// #####################################
+    } // else // if( pid==0 || pid==-1 ){
+    //////////////////////////////////////////////////////////////
+   } // else // if (fitsfile_read_error != 0 && i==0 ) {
+  } // for(i=0;i<Num;i++){
+ } // if ( param_pipelined_source_extraction == 0 || is_source_extraction_dispatcher == 1 ) {
+
+ if ( is_source_extraction_dispatcher == 1 ) {
+  // Wait for the remaining SExtractor runs and report them as they finish
+  while ( ( pid_of_child_that_finished= wait( &pid_status ) ) > 0 ) {
+   for ( j_fork= 0; j_fork < n_fork; j_fork++ ) {
+    if ( pid_of_child_that_finished == child_pids[j_fork] ) {
+     report_source_extraction_done( source_extraction_pipe[1], child_image_index[j_fork] );
+     child_pids[j_fork]= 0;
+     break;
     }
-    ///// #####################################
-   } // else // if( pid==0 || pid==-1 ){
-   //////////////////////////////////////////////////////////////
-  } // else // if (fitsfile_read_error != 0 && i==0 ) {
- } // for(i=0;i<Num;i++){
+   }
+  }
+  vast_profiling_stop( "sextractor", Num, 0 );
+  report_source_extraction_profiling( source_extraction_pipe[1] );
+  close( source_extraction_pipe[1] );
+  timing_sextractor_end= time( NULL );
+  fprintf( stderr, "\n\nDone with SExtractor!\n\n" );
+  fprintf( stderr, "TIMING SExtractor: %.0lf seconds\n", difftime( timing_sextractor_end, timing_sextractor_start ) );
+  exit( EXIT_SUCCESS );
+ }
 
  fprintf( stderr, "Parent process says: we are done fork()ing.\n" );
 
- // Here is a wild assumption: if we have more than 100 images,
- // the remaining few will be processed while we are starting
- // to match star lists corresponding to the first few images.
- //
- // n_fork>16 condition is here because the above wild assumption will not
- // work on a highly multi-core system!
- if ( Num < 100 || param_automatically_select_reference_image == 1 || moving_object == 1 || n_fork > 16 || param_nodiscardell == 0 ) {
+ // If the catalogs are produced by the dispatcher process, we may start matching stars
+ // as soon as the catalog of the reference image is ready (see wait_for_source_extraction_to_finish()).
+ // Otherwise, wait for all the SExtractor runs to finish.
+ if ( param_pipelined_source_extraction == 0 ) {
   for ( ; i_fork--; ) {
    fprintf( stderr, "Waiting for thread %d to finish...\n", i_fork + 1 );
    if ( i_fork < 0 )
@@ -2485,6 +3463,7 @@ int main( int argc, char **argv ) {
   timing_sextractor_end= time( NULL );
   fprintf( stderr, "\n\nDone with SExtractor!\n\n" );
   fprintf( stderr, "TIMING SExtractor: %.0lf seconds\n", difftime( timing_sextractor_end, timing_sextractor_start ) );
+  vast_profiling_stop( "sextractor", Num, 0 );
 
   // Elongated image star mark and automatic reference image selection cannot work with
   // the fast processing hack: they need all the image catalogs to be present.
@@ -2508,7 +3487,7 @@ int main( int argc, char **argv ) {
   }
 
  } else {
-  fprintf( stderr, "Fast processing hack: continue to star matching while SExtractor is still computing!\n" );
+  fprintf( stderr, "Pipelined processing: star matching will start while SExtractor is still running on the remaining images\n" );
  }
 
  fprintf( stderr, "\n\nMatching stars between images!\n\n" );
@@ -2650,6 +3629,7 @@ int main( int argc, char **argv ) {
 
  if ( debug != 0 )
   fprintf( stderr, "DEBUG MSG: (ref) autodetect_aperture(input_images[0])\n" );
+ wait_for_source_extraction_to_finish( source_extraction_pipe[0], is_source_extraction_done, Num, 0 );
  aperture= autodetect_aperture( input_images[0], sextractor_catalog, 0, param_P, fixed_aperture, X_im_size, Y_im_size, guess_saturation_limit_operation_mode, flag_image_use_mode );
  if ( aperture > 75 || aperture < 1.0 ) {
   // TBA: wait so the error message doesn't get swamped
@@ -2665,7 +3645,10 @@ int main( int argc, char **argv ) {
 
  fprintf( stderr, "%s", stderr_output );
  // fprintf(stderr,"----------------%s----------------\n",sextractor_catalog);
- write_string_to_log_file( log_output, sextractor_catalog );
+ // In the append mode the reference image is already in the log from the previous run
+ if ( param_append_mode == 0 ) {
+  write_string_to_log_file( log_output, sextractor_catalog );
+ }
 
  if ( debug != 0 )
   fprintf( stderr, "DEBUG MSG: (ref) Read_sex_cat(%s and other stuff)\n", sextractor_catalog );
@@ -3114,11 +4097,29 @@ int main( int argc, char **argv ) {
   fprintf( stderr, "DEBUG MSG: set_transient_search_boundaries()\n" );
  set_transient_search_boundaries( search_area_boundaries, STAR3, NUMBER3, X_im_size, Y_im_size, &snr_detection_limit );
 
+ if ( param_append_mode == 1 ) {
+  // Continue from the star lists and star positions saved at the end of the previous run
+  // instead of the ones derived from the reference image catalog
+  if ( 0 != load_append_state( input_images[0], &max_number, STAR1, &NUMBER1, STAR3, number_of_lines_reference_image_cat, &NUMBER3, star_num_to_star3_idx, &coordinate_array_counter, star_numbers_for_coordinate_arrays, star_num_to_coord_array_idx, number_of_coordinate_measurements_for_star, coordinate_array_x, coordinate_array_y ) ) {
+   return EXIT_FAILURE;
+  }
+  Pos1= realloc( Pos1, sizeof( int ) * NUMBER1 );
+  if ( Pos1 == NULL ) {
+   fprintf( stderr, "ERROR: can't allocate memory!\n Pos1 = realloc(Pos1, sizeof(int) * NUMBER1); - failed!\n" );
+   vast_report_memory_error();
+   return EXIT_FAILURE;
+  }
+ }
+
  // Open vast_limiting_magnitude.log and write header + reference image entry
- vast_limiting_mag_log= fopen( "vast_limiting_magnitude.log", "w" );
+ if ( param_append_mode == 1 ) {
+  vast_limiting_mag_log= fopen( "vast_limiting_magnitude.log", "a" );
+ } else {
+  vast_limiting_mag_log= fopen( "vast_limiting_magnitude.log", "w" );
+ }
  if ( vast_limiting_mag_log == NULL ) {
   fprintf( stderr, "ERROR: cannot open vast_limiting_magnitude.log for writing!\n" );
- } else {
+ } else if ( param_append_mode == 0 ) {
   fprintf( vast_limiting_mag_log, "# Limiting magnitudes log\n" );
   fprintf( vast_limiting_mag_log, "# image_path  raw_lim_mag  lim_mag_ref_frame\n" );
   // Write reference image entry (same value for both columns since it's the reference frame)
@@ -3162,6 +4163,7 @@ int main( int argc, char **argv ) {
   fprintf( stderr, "ERROR: can't allocate memory for observations!\n ptr_struct_Obs = malloc(sizeof(struct Observation) * Max_obs_in_RAM);\n" );
   return EXIT_FAILURE;
  }
+ obs_capacity= Max_obs_in_RAM;
  if ( debug != 0 )
   fprintf( stderr, "\n\nDEBUG: allocated %.3lf Gb for %ld observations (%ld bytes each) in RAM\n\n", (double)sizeof( struct Observation ) * (double)Max_obs_in_RAM / (double)( 1024 * 1024 * 1024 ), Max_obs_in_RAM, sizeof( struct Observation ) );
 
@@ -3189,7 +4191,8 @@ int main( int argc, char **argv ) {
 
   ///////////////////////////////////////////////////////////////////////////////
   // Do not add observations from the reference image if we want to exclude it //
-  if ( param_exclude_reference_image == 1 ) {
+  // (in the append mode they are already in the lightcurves)                  //
+  if ( param_exclude_reference_image == 1 || param_append_mode == 1 ) {
    continue;
   }
   ///////////////////////////////////////////////////////////////////////////////
@@ -3242,10 +4245,9 @@ int main( int argc, char **argv ) {
   coordinate_array_y[coordinate_array_counter][0]= STAR1[i].y;
   coordinate_array_counter++;
 
-  if ( obs_in_RAM > Max_obs_in_RAM ) {
-   ptr_struct_Obs= realloc( ptr_struct_Obs, sizeof( struct Observation ) * obs_in_RAM );
-   if ( ptr_struct_Obs == NULL ) {
-    fprintf( stderr, "ERROR: cannot re-allocate memory for a new observation (from reference image)!\n ptr_struct_Obs = realloc(ptr_struct_Obs, sizeof(struct Observation) * obs_in_RAM); - failed!\n" );
+  if ( obs_in_RAM > obs_capacity ) {
+   if ( 0 != grow_observation_buffer( &ptr_struct_Obs, &obs_capacity, obs_in_RAM ) ) {
+    fprintf( stderr, "ERROR: cannot re-allocate memory for a new observation (from reference image)!\n grow_observation_buffer( &ptr_struct_Obs, &obs_capacity, obs_in_RAM ) - failed!\n" );
     return EXIT_FAILURE;
    }
   }
@@ -3290,45 +4292,107 @@ int main( int argc, char **argv ) {
 
  // log first observation
  // sprintf( log_output, "JD= %13.5lf  ap= %4.1lf  rotation= %7.3lf  *detected= %5d  *matched= %5d  status=OK     %s\n", JD, aperture, 0.0, NUMBER1, NUMBER1, input_images[0] );
- sprintf( log_output, "JD= %16.8lf  ap= %4.1lf  rotation= %7.3lf  *detected= %5d  *matched= %5d  status=OK     %s\n", JD, aperture, 0.0, NUMBER1, NUMBER1, input_images[0] );
- write_string_to_log_file( log_output, sextractor_catalog );
+ if ( param_append_mode == 0 ) {
+  sprintf( log_output, "JD= %16.8lf  ap= %4.1lf  rotation= %7.3lf  *detected= %5d  *matched= %5d  status=OK     %s\n", JD, aperture, 0.0, NUMBER1, NUMBER1, input_images[0] );
+  write_string_to_log_file( log_output, sextractor_catalog );
+ }
 
  ////// Process other images //////
  timing_matching_start= time( NULL );
+ vast_profiling_start( "matching_and_photometry" );
+ if ( param_parallel_catalogs == 1 ) {
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+  image_catalogs_max_batch_size= MAX( 1, get_number_of_cpu_cores() );
+#endif
+#endif
+  fprintf( stderr, "Reading and filtering catalogs of up to %d images in parallel\n", image_catalogs_max_batch_size );
+ }
+ image_catalogs= malloc( (size_t)image_catalogs_max_batch_size * sizeof( struct Image_catalog_for_matching ) );
+ if ( image_catalogs == NULL ) {
+  fprintf( stderr, "ERROR: cannot allocate memory for image_catalogs\n" );
+  vast_report_memory_error();
+  return EXIT_FAILURE;
+ }
  for ( n= n_start; n < Num; n++ ) {
   fprintf( stderr, "\n\n\n" );
 
-  if ( debug != 0 )
-   fprintf( stderr, "DEBUG MSG: gettime() - " );
-  fitsfile_read_error= gettime( input_images[n], &JD, &timesys, convert_timesys_to_TT, &X_im_size, &Y_im_size, stderr_output, log_output, param_nojdkeyword, 1, NULL ); // Вот этот код дублирован выше! Зачем?
-  if ( fitsfile_read_error == 0 ) {
-   if ( debug != 0 )
-    fprintf( stderr, "OK\n" );
-   if ( debug != 0 )
-    fprintf( stderr, "DEBUG MSG: autodetect_aperture() - " );
-   aperture= autodetect_aperture( input_images[n], sextractor_catalog, 0, param_P, fixed_aperture, X_im_size, Y_im_size, guess_saturation_limit_operation_mode, flag_image_use_mode );
-   if ( debug != 0 )
-    fprintf( stderr, "OK\n" );
-
-   // Check if the image is marked as bad
-   // if it is, set the aperture to an unrealistic value
-   // this will allow the existing mechanism to handle and log the bad image properly
-   if ( vast_bad_image_flag[n] != 0 ) {
-    fprintf( stderr, "WARNING: image marked as bad with flag %d %s (indicating this by setting APERTURE=0.0)\n", vast_bad_image_flag[n], input_images[n] );
-    aperture= 0.0;
-    vast_bad_image_flag_counter++;
-   }
-   //
+  // Prepare the catalogs for the next batch of images (the batch is just this one image unless --parallelcatalogs is set).
+  // The FITS header is read and the aperture is determined serially; the catalogs are read and filtered in parallel.
+  if ( n >= image_catalogs_batch_start + image_catalogs_batch_size ) {
+   image_catalogs_batch_start= n;
+   image_catalogs_batch_size= MIN( image_catalogs_max_batch_size, Num - n );
+   vast_profiling_start( "catalog_reading" );
+   for ( i= 0; i < image_catalogs_batch_size; i++ ) {
+    image_catalog= &image_catalogs[i];
+    image_catalog->catalog_read_error= 0;
+    image_catalog->STAR2= NULL;
+    image_catalog->NUMBER2= 0;
+    if ( debug != 0 )
+     fprintf( stderr, "DEBUG MSG: gettime() - " );
+    image_catalog->fitsfile_read_error= gettime( input_images[n + i], &image_catalog->JD, &image_catalog->timesys, convert_timesys_to_TT, &image_catalog->X_im_size, &image_catalog->Y_im_size, stderr_output, image_catalog->log_output, param_nojdkeyword, 1, NULL ); // Вот этот код дублирован выше! Зачем?
+    if ( image_catalog->fitsfile_read_error != 0 )
+     continue;
+    if ( debug != 0 )
+     fprintf( stderr, "OK\n" );
+    if ( debug != 0 )
+     fprintf( stderr, "DEBUG MSG: autodetect_aperture() - " );
+    wait_for_source_extraction_to_finish( source_extraction_pipe[0], is_source_extraction_done, Num, n + i );
+    image_catalog->aperture= autodetect_aperture( input_images[n + i], image_catalog->sextractor_catalog, 0, param_P, fixed_aperture, image_catalog->X_im_size, image_catalog->Y_im_size, guess_saturation_limit_operation_mode, flag_image_use_mode );
+    if ( debug != 0 )
+     fprintf( stderr, "OK\n" );
 
-   // Write the logfile
-   if ( aperture < 0.0 ) {
-    fprintf( stderr, "WARNING: the derivedimae apture is unrealistically small %lf %s\n", aperture, input_images[n] );
-    aperture= 0.0; // Do not corrupt the log file with bad apertures
+    // Check if the image is marked as bad
+    // if it is, set the aperture to an unrealistic value
+    // this will allow the existing mechanism to handle and log the bad image properly
+    if ( vast_bad_image_flag[n + i] != 0 ) {
+     fprintf( stderr, "WARNING: image marked as bad with flag %d %s (indicating this by setting APERTURE=0.0)\n", vast_bad_image_flag[n + i], input_images[n + i] );
+     image_catalog->aperture= 0.0;
+     vast_bad_image_flag_counter++;
+    }
+    //
+
+    if ( image_catalog->aperture < 0.0 ) {
+     fprintf( stderr, "WARNING: the derivedimae apture is unrealistically small %lf %s\n", image_catalog->aperture, input_images[n + i] );
+     image_catalog->aperture= 0.0; // Do not corrupt the log file with bad apertures
+    }
+    if ( image_catalog->aperture > 99.9 ) {
+     fprintf( stderr, "WARNING: the derivedimae apture is unrealistically large %lf %s\n", image_catalog->aperture, input_images[n + i] );
+     image_catalog->aperture= 99.9; // Do not corrupt the log file with bad apertures
+    }
+   }
+#ifdef VAST_ENABLE_OPENMP
+#ifdef _OPENMP
+#pragma omp parallel for private( image_catalog ) schedule( dynamic )
+#endif
+#endif
+   for ( i= 0; i < image_catalogs_batch_size; i++ ) {
+    image_catalog= &image_catalogs[i];
+    // WARNING!!! Hardcoded aperture limits here!
+    if ( image_catalog->fitsfile_read_error == 0 && image_catalog->aperture < BELIEVABLE_APERTURE_MAX_PIX && image_catalog->aperture > BELIEVABLE_APERTURE_MIN_PIX ) {
+     image_catalog->catalog_read_error= read_and_filter_sextractor_catalog( image_catalog, input_images[n + i], n + i, X1, Y1, X2, Y2, N_bad_regions, maxsextractorflag, param_nodiscardlargesrc, param_P, param_filterout_magsize_outliers, moving_object, moving_object__user_array_x, moving_object__user_array_y, debug );
+    }
    }
-   if ( aperture > 99.9 ) {
-    fprintf( stderr, "WARNING: the derivedimae apture is unrealistically large %lf %s\n", aperture, input_images[n] );
-    aperture= 99.9; // Do not corrupt the log file with bad apertures
+   vast_profiling_stop( "catalog_reading", image_catalogs_batch_size, 0 );
+   for ( i= 0; i < image_catalogs_batch_size; i++ ) {
+    if ( image_catalogs[i].catalog_read_error != 0 ) {
+     return EXIT_FAILURE;
+    }
    }
+  }
+  image_catalog= &image_catalogs[n - image_catalogs_batch_start];
+
+  fitsfile_read_error= image_catalog->fitsfile_read_error;
+  JD= image_catalog->JD;
+  timesys= image_catalog->timesys;
+  X_im_size= image_catalog->X_im_size;
+  Y_im_size= image_catalog->Y_im_size;
+  strncpy( log_output, image_catalog->log_output, 1024 );
+  if ( fitsfile_read_error == 0 ) {
+   aperture= image_catalog->aperture;
+   strncpy( sextractor_catalog, image_catalog->sextractor_catalog, FILENAME_LENGTH );
+
+   // Write the logfile
    write_string_to_log_file( log_output, sextractor_catalog );
    // sprintf( log_output, "JD= %13.5lf  ap= %4.1lf  ", JD, aperture );
    sprintf( log_output, "JD= %16.8lf  ap= %4.1lf  ", JD, aperture );
@@ -3336,7 +4400,20 @@ int main( int argc, char **argv ) {
 
    // WARNING!!! Hardcoded aperture limits here!
    if ( aperture < BELIEVABLE_APERTURE_MAX_PIX && aperture > BELIEVABLE_APERTURE_MIN_PIX ) {
-    // STAR2 gets allocated in this block...
+    // STAR2 was allocated by read_and_filter_sextractor_catalog()
+    STAR2= image_catalog->STAR2;
+    NUMBER2= image_catalog->NUMBER2;
+    counter_rejected_bad_flux= image_catalog->counter_rejected_bad_flux;
+    counter_rejected_low_snr= image_catalog->counter_rejected_low_snr;
+    counter_rejected_bad_region= image_catalog->counter_rejected_bad_region;
+    counter_rejected_frame_edge= image_catalog->counter_rejected_frame_edge;
+    counter_rejected_too_small= image_catalog->counter_rejected_too_small;
+    counter_rejected_too_large= image_catalog->counter_rejected_too_large;
+    counter_rejected_external_flag= image_catalog->counter_rejected_external_flag;
+    counter_rejected_bad_psf_fit= image_catalog->counter_rejected_bad_psf_fit;
+    counter_rejected_seflags_gt7= image_catalog->counter_rejected_seflags_gt7;
+    counter_rejected_MagSize= image_catalog->counter_rejected_MagSize;
+    counter_rejected_seflags_gt_user_spec_threshold= image_catalog->counter_rejected_seflags_gt_user_spec_threshold;
 
     //
     // Make sure we record the largest image size
@@ -3350,303 +4427,6 @@ int main( int argc, char **argv ) {
      struct_pixel_coordinate_transformation->sigma_popadaniya= AUTO_SIGMA_POPADANIYA_COEF * MAX( aperture, reference_image_aperture );
      fprintf( stderr, "Setting the star matching radius to %.2lf pix\n", struct_pixel_coordinate_transformation->sigma_popadaniya );
     }
-    if ( debug != 0 )
-     fprintf( stderr, "DEBUG MSG: Read_sex_cat() - " );
-    /* Read_sex_cat2 */
-    number_of_lines_current_image_cat= count_lines_in_ASCII_file( sextractor_catalog );
-    if ( number_of_lines_current_image_cat <= 0 ) {
-     fprintf( stderr, "ERROR: %d lines in the file %s\n", number_of_lines_current_image_cat, sextractor_catalog );
-     return EXIT_FAILURE;
-    }
-    // malloc_size= MAX_NUMBER_OF_STARS * sizeof( struct Star );
-    malloc_size= number_of_lines_current_image_cat * sizeof( struct Star );
-    if ( malloc_size <= 0 ) {
-     fprintf( stderr, "ERROR017 - trying to allocate zero or negative number of bytes!\n" );
-     return EXIT_FAILURE;
-    }
-    STAR2= malloc( (size_t)malloc_size );
-    if ( STAR2 == NULL ) {
-     fprintf( stderr, "ERROR: No memory (STAR2)\n" );
-     vast_report_memory_error();
-     return EXIT_FAILURE;
-    }
-    file= fopen( sextractor_catalog, "r" );
-    if ( file == NULL ) {
-     fprintf( stderr, "Can't open file %s\n", sextractor_catalog );
-     return EXIT_FAILURE;
-    }
-    NUMBER2= 0;
-    counter_rejected_bad_flux= counter_rejected_low_snr= counter_rejected_bad_region= counter_rejected_frame_edge= counter_rejected_too_small= counter_rejected_too_large= counter_rejected_external_flag= counter_rejected_seflags_gt7= counter_rejected_seflags_gt_user_spec_threshold= 0; // reset bad star counters
-    previous_star_number_in_sextractor_catalog= 0;
-    while ( NULL != fgets( sextractor_catalog_string, MAX_STRING_LENGTH_IN_SEXTARCTOR_CAT, file ) ) {
-     sextractor_catalog_string[MAX_STRING_LENGTH_IN_SEXTARCTOR_CAT - 1]= '\0'; // just in case
-     external_flag= 0;
-     // external_flag_string[0]='\0';
-     if ( 0 != parse_sextractor_catalog_string( sextractor_catalog_string, &star_number_in_sextractor_catalog, &flux_adu, &flux_adu_err, &mag, &sigma_mag, &position_x_pix, &position_y_pix, &a_a, &a_a_err, &a_b, &a_b_err, &sextractor_flag, &external_flag, &psf_chi2, float_parameters ) ) {
-      fprintf( stderr, "WARNING: problem occurred while parsing SExtractor catalog %s\nThe offending line is:\n%s\n", sextractor_catalog, sextractor_catalog_string );
-      continue;
-     }
-     // if( 12>sscanf(sextractor_catalog_string, "%d %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %d %[^\t\n]", &star_number_in_sextractor_catalog, &flux_adu, &flux_adu_err, &mag, &sigma_mag, &position_x_pix, &position_y_pix, &a_a, &a_a_err, &a_b, &a_b_err, &sextractor_flag, external_flag_string) ){
-     //  fprintf(stderr,"WARNING: problem occurred while parsing SExtractor catalog %s\nThe offending line is:\n%s\n",sextractor_catalog,sextractor_catalog_string);
-     //  continue;
-     // }
-     //  Read only stars detected at the first FITS image extension.
-     //  The start of the second image extension will be signified by a jump in star numbering
-     if ( star_number_in_sextractor_catalog < previous_star_number_in_sextractor_catalog ) {
-      fprintf( stderr, "WARNING: the input SExtractor catalog is not sorted. Was this catalog created from a multi-extension FITS? In this case, only sources detected on the first image extension will be processed!\n" );
-      break;
-     } else {
-      previous_star_number_in_sextractor_catalog= star_number_in_sextractor_catalog;
-     }
-     // Check if the catalog line is a really band one
-     if ( flux_adu <= 0 ) {
-      counter_rejected_bad_flux++;
-      continue;
-     }
-     if ( flux_adu_err == 999999 ) {
-      counter_rejected_bad_flux++;
-      continue;
-     }
-     if ( mag == 99.0000 ) {
-      counter_rejected_bad_flux++;
-      continue;
-     }
-     if ( sigma_mag == 99.0000 ) {
-      counter_rejected_bad_flux++;
-      continue;
-     }
-     // If we have no error estimates in at least one aperture - assume things are bad with this object
-     if ( float_parameters[3] == 99.0000 ) {
-      counter_rejected_bad_flux++;
-      continue;
-     }
-     if ( float_parameters[5] == 99.0000 ) {
-      counter_rejected_bad_flux++;
-      continue;
-     }
-     if ( float_parameters[7] == 99.0000 ) {
-      counter_rejected_bad_flux++;
-      continue;
-     }
-     if ( float_parameters[9] == 99.0000 ) {
-      counter_rejected_bad_flux++;
-      continue;
-     }
-     if ( float_parameters[11] == 99.0000 ) {
-      counter_rejected_bad_flux++;
-      continue;
-     }
-//
-#ifdef STRICT_CHECK_OF_JD_AND_MAG_RANGE
-     if ( mag < BRIGHTEST_STARS ) {
-      counter_rejected_bad_flux++;
-      continue;
-     }
-     if ( mag > FAINTEST_STARS_ANYMAG ) {
-      counter_rejected_bad_flux++;
-      continue;
-     }
-     if ( sigma_mag > MAX_MAG_ERROR ) {
-      counter_rejected_low_snr++;
-      continue;
-     }
-#endif
-     //
-     if ( flux_adu < MIN_SNR * flux_adu_err ) {
-      counter_rejected_low_snr++;
-      continue;
-     }
-     if ( 0 != exclude_region( X1, Y1, X2, Y2, N_bad_regions, position_x_pix, position_y_pix, aperture ) ) {
-      if ( counter_rejected_bad_region < 10 ) {
-       fprintf( stderr, "The star %9.3lf %9.3lf is rejected, see bad_region.lst\n", position_x_pix, position_y_pix );
-      }
-      if ( counter_rejected_bad_region == 10 ) {
-       fprintf( stderr, "Excluding more stars falling at bad regions!.. (will not print them all)\n" );
-      }
-      counter_rejected_bad_region++;
-      continue;
-     }
-     if ( 1 == is_point_close_or_off_the_frame_edge( position_x_pix, position_y_pix, X_im_size, Y_im_size, FRAME_EDGE_INDENT_PIXELS ) ) {
-      counter_rejected_frame_edge++;
-      continue;
-     }
-     //
-     if ( CONST * ( a_a + a_a_err ) < MIN_SOURCE_SIZE_APERTURE_FRACTION * aperture ) {
-      counter_rejected_too_small++;
-      continue;
-     }
-     //
-     if ( SIGMA_TO_FWHM_CONVERSION_FACTOR * ( a_a + a_a_err ) < FWHM_MIN ) {
-      counter_rejected_too_small++;
-      continue;
-     }
-     if ( SIGMA_TO_FWHM_CONVERSION_FACTOR * ( a_b + a_b_err ) < FWHM_MIN ) {
-      counter_rejected_too_small++;
-      continue;
-     }
-     // if ( float_parameters[0] < FWHM_MIN ) {
-     if ( MAX( float_parameters[0], SIGMA_TO_FWHM_CONVERSION_FACTOR * a_a ) < FWHM_MIN ) {
-      counter_rejected_too_small++;
-      continue;
-     }
-     //
-     if ( external_flag != 0 ) {
-      counter_rejected_external_flag++;
-      continue;
-     }
-     //
-     if ( maxsextractorflag < sextractor_flag && sextractor_flag <= 7 ) {
-      counter_rejected_seflags_gt_user_spec_threshold++;
-      // We don't drop such objects here to keep 'em in STAR structure,
-      // they will be rejected later when saving the observations.
-     }
-     // just in case we mark objects with really bad SExtractor flags
-     // sextractor_flag != 20 -- accept a super-bright saturated object
-     if ( sextractor_flag > 7 && sextractor_flag != 20 ) {
-      counter_rejected_seflags_gt7++;
-      continue;
-     }
-     //
-     NUMBER2++;
-     STAR2[NUMBER2 - 1].vast_flag= 0;
-     // It is OK for a very bright saturated object to be big
-     // if ( a_a > 5*aperture && sextractor_flag < 4 ) {
-     if ( a_a > aperture && sextractor_flag < 4 && 0 == param_nodiscardlargesrc ) {
-      counter_rejected_too_large++;
-      STAR2[NUMBER2 - 1].vast_flag= 1;
-     }
-
-     STAR2[NUMBER2 - 1].n= star_number_in_sextractor_catalog;
-     STAR2[NUMBER2 - 1].x= (float)position_x_pix;
-     STAR2[NUMBER2 - 1].y= (float)position_y_pix;
-     STAR2[NUMBER2 - 1].flux= flux_adu;
-     STAR2[NUMBER2 - 1].flux_err= flux_adu_err;
-     // Теперь считаем ошибки правильно, а не как трактор ;)
-     STAR2[NUMBER2 - 1].mag= (float)mag;
-     STAR2[NUMBER2 - 1].sigma_mag= (float)sigma_mag;
-     STAR2[NUMBER2 - 1].JD= JD;
-     STAR2[NUMBER2 - 1].x_frame= STAR2[NUMBER2 - 1].x;
-     STAR2[NUMBER2 - 1].y_frame= STAR2[NUMBER2 - 1].y;
-     // for moving object match
-     STAR2[NUMBER2 - 1].moving_object= 0;
-     if ( moving_object == 1 ) {
-      if ( 0.0 < position_x_pix && position_x_pix < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
-       if ( 0.0 < position_y_pix && position_y_pix < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
-        if ( 0.0 < moving_object__user_array_x[n] && moving_object__user_array_x[n] < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
-         if ( 0.0 < moving_object__user_array_y[n] && moving_object__user_array_y[n] < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
-          if ( ( position_x_pix - moving_object__user_array_x[n] ) * ( position_x_pix - moving_object__user_array_x[n] ) + ( position_y_pix - moving_object__user_array_y[n] ) * ( position_y_pix - moving_object__user_array_y[n] ) < 1.0 ) {
-           STAR2[NUMBER2 - 1].moving_object= 1;
-           // fprintf(stderr,"\x1B[01;31mDEBUG: here is the moving object on %s !!!\x1B[33;00m\n", input_images[n]);
-          }
-         } // if( 0.0 < moving_object__user_array_y[n]  &&  moving_object__user_array_y[n] < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
-        } // if( 0.0 < moving_object__user_array_x[n]  &&  moving_object__user_array_x[n] < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
-       } // if( 0.0 < position_y_pix  &&  position_y_pix < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
-      } // if( 0.0 < position_x_pix  && position_x_pix < MAX_IMAGE_SIDE_PIX_FOR_SANITY_CHECK ) {
-     }
-     //
-     STAR2[NUMBER2 - 1].detected_on_ref_frame= 0;               // Mark the star that it is not on the reference frame
-     STAR2[NUMBER2 - 1].sextractor_flag= (char)sextractor_flag; // SExtractor flag
-     // STAR2[NUMBER2-1].distance_to_neighbor_squared=4*a_a*a_a; // EXPERIMENTAL !!!
-     STAR2[NUMBER2 - 1].star_size= (float)a_a;
-     //
-     STAR2[NUMBER2 - 1].star_psf_chi2= (float)psf_chi2;
-     //
-     for ( float_parameters_counter= NUMBER_OF_FLOAT_PARAMETERS; float_parameters_counter--; ) {
-      STAR2[NUMBER2 - 1].float_parameters[float_parameters_counter]= float_parameters[float_parameters_counter];
-     }
-     //
-
-     /// !!! Debug !!!
-     // float debug_x=586.696;
-     // float debug_y=438.463;
-     /// float debug_d=sqrt((STAR2[NUMBER2-1].x_frame-debug_x)*(STAR2[NUMBER2-1].x_frame-debug_x)+(STAR2[NUMBER2-1].y_frame-debug_y)*(STAR2[NUMBER2-1].y_frame-debug_y));
-     /// if( debug_d<aperture ){
-     // fprintf(stderr,"READING SEXTRACTOR CAT: %d  %.3f %.3f  (%f)  s=%d v=%6d\n",STAR2[NUMBER2-1].n,STAR2[NUMBER2-1].x_frame,STAR2[NUMBER2-1].y_frame,STAR2[NUMBER2-1].star_size,STAR2[NUMBER2-1].sextractor_flag,STAR2[NUMBER2-1].vast_flag);
-     //}
-
-     /// !!! Debug !!!
-     debug_x= 2535.0;
-     debug_y= 1901.5;
-     debug_d= sqrt( ( STAR2[NUMBER2 - 1].x_frame - debug_x ) * ( STAR2[NUMBER2 - 1].x_frame - debug_x ) + ( STAR2[NUMBER2 - 1].y_frame - debug_y ) * ( STAR2[NUMBER2 - 1].y_frame - debug_y ) );
-     if ( debug_d < aperture ) {
-      fprintf( stderr, "READING SEXTRACTOR CAT: %d  %.3f %.3f  (%f)  s=%d v=%6d\n", STAR2[NUMBER2 - 1].n, STAR2[NUMBER2 - 1].x_frame, STAR2[NUMBER2 - 1].y_frame, STAR2[NUMBER2 - 1].star_size, STAR2[NUMBER2 - 1].sextractor_flag, STAR2[NUMBER2 - 1].vast_flag );
-     }
-
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: Reading test.cat NUMBER2=%d OK\n", NUMBER2 );
-    }
-    fclose( file );
-    if ( debug != 0 )
-     fprintf( stderr, "DEBUG MSG: Finished reading cat file for %s\n", input_images[n] );
-    /* end of Read_sex_cat2 */
-
-    if ( param_P == 1 ) {
-     fprintf( stderr, "Filtering-out stars with bad PSF fit... " );
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: filter_MagPSFchi2()\n" );
-     if ( param_filterout_magsize_outliers == 1 )
-      /// !!! Disable PSF fit quality filter - it never works well (see also above) !!!
-      //      counter_rejected_bad_psf_fit= filter_on_float_parameters(STAR2, NUMBER2, sextractor_catalog, -2); // psfchi2
-      counter_rejected_bad_psf_fit= 0;
-     /*
-if ( param_filterout_magsize_outliers != 1 ) {
-if ( debug != 0 )
-fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(2)\n" );
-counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 2 ); // magpsf-magaper
-}
-*/
-     fprintf( stderr, "done!\n" );
-    } else {
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: NOT RUNNING filter_MagPSFchi2()\n" );
-     counter_rejected_bad_psf_fit= 0; // no PSF-fitting (and filtering)
-    }
-
-    // Flag outliers in the magnitude-size plot
-    if ( param_filterout_magsize_outliers == 1 ) {
-     fprintf( stderr, "Filtering-out outliers in the mag-size plot... " );
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(-1)\n" );
-     counter_rejected_MagSize= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, -1 );
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(0)\n" );
-     counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 0 );
-     // OK, let's count these filters as size-filters too for now
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(1)\n" );
-     counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 1 );
-     //
-     /*
-     if ( param_P == 1 ) {
-      if ( debug != 0 )
-       fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(2)\n" );
-      counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 2 ); // magpsf-magaper
-     }
-     */
-     //
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(4)\n" );
-     counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 4 );
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(6)\n" );
-     counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 6 );
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(8)\n" );
-     counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 8 );
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(10)\n" );
-     counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 10 );
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: filter_on_float_parameters(12)\n" );
-     counter_rejected_MagSize+= filter_on_float_parameters( STAR2, NUMBER2, sextractor_catalog, 12 );
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: DONE WITH filter_on_float_parameters()\n" );
-     fprintf( stderr, "done!\n" );
-    } else {
-     if ( debug != 0 )
-      fprintf( stderr, "DEBUG MSG: filter_on_float_parameters()\n" );
-     counter_rejected_MagSize= 0; // no mag-size filtering
-    }
 
     // Print out input catalog filtering stats
     sprintf( sextractor_catalog_filtering_results_string, "SExtractor output filtering results:\n * passed selection: %d\n * rejected as having no flux measurement: %d\n * rejected as having SNR<%.1lf: %d\n * rejected inside rectangles defined in bad_region.lst: %d\n * rejected close to frame edge: %d\n * rejected as being too small (<%.1lf pix): %d\n * rejected as being too large (>%.1lf pix): %d\n * rejected as outliers in mag-size plot: %d\n * rejected as having SExtractor flags > %d and <= 7: %d\n * rejected as having hopelessly bad SExtractor flags (>7): %d\n * rejected due to an external image flag: %d\n * rejected as having bad PSF fit: %d\n---\n",
@@ -3700,6 +4480,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
 
      // set_distance_to_neighbor_in_struct_Star(STAR2, NUMBER2, aperture, X_im_size, Y_im_size); // set distance to the closest neighbor for each star.
 
+     vast_profiling_start( "star_matching" );
      Sort_in_mag_of_stars( STAR2, NUMBER2 );
      best_number_of_matched_stars= 0;
      best_number_of_matched_stars= 0;
@@ -4038,6 +4819,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
       }
      }
 
+     vast_profiling_stop( "star_matching", 1, 0 );
      /*----------------------------------------------------------------------------------*/
      if ( debug != 0 )
       fprintf( stderr, "OK\n" );
@@ -4125,6 +4907,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
     // MATCH_SUCESS++;
 
     /* Magnitude calibration. */
+    vast_profiling_start( "magnitude_calibration" );
     // if (param_nocalib != 1) {
 
     if ( debug != 0 )
@@ -4304,7 +5087,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
     } else {
 
      // Write data to log
-     sprintf( filename_for_magnitude_calibration_log, "image%05d__%s", n, basename( input_images[n] ) );
+     sprintf( filename_for_magnitude_calibration_log, "image%05d__%s", n + image_index_offset, basename( input_images[n] ) );
      // write_magnitude_calibration_log( poly_x, poly_y, poly_err, N_good_stars, input_images[n] );
      write_magnitude_calibration_log( poly_x, poly_y, poly_err, N_good_stars, filename_for_magnitude_calibration_log );
 
@@ -4734,6 +5517,8 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
     }
     //} // nocalib ??
 
+    vast_profiling_stop( "magnitude_calibration", 1, 0 );
+
     /* Write to log file if everything whent well or not */
     if ( wpolyfit_exit_code == 0 ) {
      sprintf( log_output, "status=OK     %s\n", input_images[n] );
@@ -4905,7 +5690,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
       coordinate_array_index= star_num_to_coord_array_idx[STAR1[Pos1[i]].n];
       if ( coordinate_array_index != -1 ) {
        // Skip if we already have enough measurements
-       if ( !( n >= MAX_N_IMAGES_USED_TO_DETERMINE_STAR_COORDINATES && number_of_coordinate_measurements_for_star[coordinate_array_index] >= MAX_N_IMAGES_USED_TO_DETERMINE_STAR_COORDINATES ) ) {
+       if ( !( n + image_index_offset >= MAX_N_IMAGES_USED_TO_DETERMINE_STAR_COORDINATES && number_of_coordinate_measurements_for_star[coordinate_array_index] >= MAX_N_IMAGES_USED_TO_DETERMINE_STAR_COORDINATES ) ) {
         // maybe we don't want to do it if number_of_coordinate_measurements_for_star[coordinate_array_index] > something ?
         if ( number_of_coordinate_measurements_for_star[coordinate_array_index] < MAX_N_IMAGES_USED_TO_DETERMINE_STAR_COORDINATES ) {
          number_of_coordinate_measurements_for_star[coordinate_array_index]++;
@@ -4934,7 +5719,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
        } // skip if we already have enough measurements
       } // if( coordinate_array_index != -1 )
       // Update coordinates in STAR3 (reference structure for image matching) - use O(1) lookup instead of O(n) linear search
-      if ( n > MIN_N_IMAGES_USED_TO_DETERMINE_STAR_COORDINATES ) { // this step makes sense only if coordinates in STAR1 have (or could have) been updated
+      if ( n + image_index_offset > MIN_N_IMAGES_USED_TO_DETERMINE_STAR_COORDINATES ) { // this step makes sense only if coordinates in STAR1 have (or could have) been updated
        i_update_coordinates_STAR3= star_num_to_star3_idx[STAR1[Pos1[i]].n];
        if ( i_update_coordinates_STAR3 != -1 ) {
         // never update for a moving object
@@ -4947,10 +5732,10 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
       // Done with avaraging the coordinates
       ////////////////////////////////////////////////////////////////////
 
-      if ( obs_in_RAM > Max_obs_in_RAM ) {
-       ptr_struct_Obs= realloc( ptr_struct_Obs, sizeof( struct Observation ) * obs_in_RAM );
-       if ( ptr_struct_Obs == NULL ) {
-        fprintf( stderr, "ERROR: can't allocate memory for a new observation!\n ptr_struct_Obs = realloc(ptr_struct_Obs, sizeof(struct Observation) * obs_in_RAM); - failed!\n" );
+      // The observations of the current image may not fit in the buffer before it is flushed to disk
+      if ( obs_in_RAM > obs_capacity ) {
+       if ( 0 != grow_observation_buffer( &ptr_struct_Obs, &obs_capacity, obs_in_RAM ) ) {
+        fprintf( stderr, "ERROR: can't allocate memory for a new observation!\n grow_observation_buffer( &ptr_struct_Obs, &obs_capacity, obs_in_RAM ) - failed!\n" );
         return EXIT_FAILURE;
        }
       }
@@ -5009,7 +5794,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
     if ( debug != 0 )
      fprintf( stderr, "DEBUG MSG: 00002 " );
     // Do this only for the second image in the transientdetection mode !!
-    if ( n == 2 && Num == 4 ) {
+    if ( n == 2 && Num == 4 && param_append_mode == 0 ) {
      // We do not care about transient candidates in failsafe mode OR if all stars on the frame were matched
      if ( param_failsafe == 0 && Number_of_ecv_star < NUMBER2 ) {
       // Make sure the potential transients are not suspiciously fast
@@ -5034,6 +5819,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
      Max_obs_in_RAM= Max_obs_in_RAM / 2;
     }
     if ( obs_in_RAM > Max_obs_in_RAM ) {
+     vast_profiling_start( "lightcurve_flush" );
      fprintf( stderr, "Total number of measurements %ld (%ld measurements stored in RAM)\n", TOTAL_OBS, obs_in_RAM );
      fprintf( stderr, "sorting the measurements cached in memory,\n" );
      qsort( ptr_struct_Obs, obs_in_RAM, sizeof( struct Observation ), compare_star_num );
@@ -5181,19 +5967,24 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
       }
      } // for(i = 0; i < NUMBER1; i++) {
 #endif
+     vast_profiling_stop( "lightcurve_flush", 0, obs_in_RAM );
      obs_in_RAM= 0;
      // !!! Experimental stuff !!!
-     // Max_obs_in_RAM may have changed, so we need to re-allocate the memory
-     free( ptr_struct_Obs );
-     malloc_size= sizeof( struct Observation ) * Max_obs_in_RAM;
-     if ( malloc_size <= 0 ) {
-      fprintf( stderr, "ERROR019 - trying to allocate zero or negative number of bytes!\n" );
-      return EXIT_FAILURE;
-     }
-     ptr_struct_Obs= malloc( (size_t)malloc_size );
-     if ( ptr_struct_Obs == NULL ) {
-      fprintf( stderr, "ERROR: couldn't allocate ptr_struct_Obs\n" );
-      return EXIT_FAILURE;
+     // Re-use the buffer for the next images unless it became much larger than Max_obs_in_RAM
+     // (for example, because Max_obs_in_RAM was reduced as the system is running low on memory)
+     if ( obs_capacity >= 2 * Max_obs_in_RAM ) {
+      free( ptr_struct_Obs );
+      malloc_size= sizeof( struct Observation ) * Max_obs_in_RAM;
+      if ( malloc_size <= 0 ) {
+       fprintf( stderr, "ERROR019 - trying to allocate zero or negative number of bytes!\n" );
+       return EXIT_FAILURE;
+      }
+      ptr_struct_Obs= malloc( (size_t)malloc_size );
+      if ( ptr_struct_Obs == NULL ) {
+       fprintf( stderr, "ERROR: couldn't allocate ptr_struct_Obs\n" );
+       return EXIT_FAILURE;
+      }
+      obs_capacity= Max_obs_in_RAM;
      }
     } // if( obs_in_RAM>Max_obs_in_RAM ){
 
@@ -5232,8 +6023,26 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
  }
 
  timing_matching_end= time( NULL );
+ vast_profiling_stop( "matching_and_photometry", Num - n_start, TOTAL_OBS );
  fprintf( stderr, "TIMING matching_and_photometry: %.0lf seconds\n", difftime( timing_matching_end, timing_matching_start ) );
 
+ free( image_catalogs );
+
+ // Save the star lists so new images may be added to this run later with --append
+ save_append_state( input_images[0], max_number, STAR1, NUMBER1, STAR3, NUMBER3, coordinate_array_counter, star_numbers_for_coordinate_arrays, number_of_coordinate_measurements_for_star, coordinate_array_x, coordinate_array_y );
+
+ // Collect the SExtractor dispatcher process (it should be done by now unless we stopped early)
+ if ( param_pipelined_source_extraction == 1 ) {
+  // read the rest of the messages including the SExtractor timing sent by the dispatcher before it exits
+  while ( 0 == read_source_extraction_report( source_extraction_pipe[0], is_source_extraction_done, Num ) )
+   ;
+  close( source_extraction_pipe[0] );
+  waitpid( source_extraction_dispatcher_pid, &pid_status, 0 );
+  source_extraction_dispatcher_pid_to_stop= 0;
+  free( is_source_extraction_done );
+  is_source_extraction_done= NULL;
+ }
+
  // Close vast_limiting_magnitude.log
  if ( vast_limiting_mag_log != NULL ) {
   fclose( vast_limiting_mag_log );
@@ -5343,6 +6152,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
 
  //
  timing_lightcurve_write_start= time( NULL );
+ vast_profiling_start( "lightcurve_write" );
  fprintf( stderr, "Sorting the measurements cached in memory...\n" );
  qsort( ptr_struct_Obs, obs_in_RAM, sizeof( struct Observation ), compare_star_num );
 
@@ -5445,9 +6255,11 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
  } // for(i = 0; i < NUMBER1; i++) {
 #endif
  timing_lightcurve_write_end= time( NULL );
+ vast_profiling_stop( "lightcurve_write", 0, obs_in_RAM );
  fprintf( stderr, "TIMING lightcurve_write: %.0lf seconds\n", difftime( timing_lightcurve_write_end, timing_lightcurve_write_start ) );
 
  free( child_pids );
+ free( child_image_index );
 
  // Get filter value from the reference image before freeing input_images
  get_filter_from_fits_header( input_images[0], filter_value );
@@ -5598,59 +6410,49 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
   fprintf( stderr, "DEBUG MSG: vast.c is starting lib/save_magnitude_calibration_details.sh\n" );
  }
 
- if ( 0 != system( "lib/save_magnitude_calibration_details.sh" ) ) {
+ if ( 0 != vast_profiled_system( "lib/save_magnitude_calibration_details.sh" ) ) {
   fprintf( stderr, "ERROR running  lib/save_magnitude_calibration_details.sh\n" );
  }
 
  // Create vast_image_details.log
- if ( 0 != system( "lib/create_vast_image_details_log.sh" ) ) {
+ if ( 0 != vast_profiled_system( "lib/create_vast_image_details_log.sh" ) ) {
   fprintf( stderr, "ERROR running  lib/create_vast_image_details_log.sh\n" );
   return EXIT_FAILURE;
  }
 
- // Sort all lightcurve files in JD
- if ( 0 != system( "lib/sort_all_lightcurve_files_in_jd" ) ) {
-  fprintf( stderr, "ERROR running  lib/sort_all_lightcurve_files_in_jd\n" );
-  return EXIT_FAILURE;
- }
-
  // Generate summary log
  if ( debug != 0 ) {
   fprintf( stderr, "DEBUG MSG: vast.c is starting echo and lib/vast_image_details_log_parser.sh > vast_summary.log && echo OK\n" );
  }
  fprintf( stderr, "\nWriting summary file: vast_summary.log ...  " );
  // system("lib/vast_image_details_log_parser.sh > vast_summary.log && echo OK ");
- if ( 0 == system( "lib/vast_image_details_log_parser.sh > vast_summary.log" ) ) {
+ if ( 0 == vast_profiled_system( "lib/vast_image_details_log_parser.sh > vast_summary.log" ) ) {
   fprintf( stderr, "OK\n" );
  }
 
- /* We don't need it if vast_source_detection_rejection_statistics.log stuff works
- // Remove single-epoch detections to exclude them from bad image search speed-up the following steps
- if ( 0 != system( "lib/remove_lightcurves_with_small_number_of_points" ) ) {
-  fprintf( stderr, "ERROR running  lib/remove_lightcurves_with_small_number_of_points\n" );
- }
- */
-
- // Filter-out bad images
+ // Sort all lightcurve files in JD, filter-out bad images and remove lightcurves with too few points.
+ // All these stages are performed by lib/postprocess_lightcurves in one run, so each lightcurve
+ // is read and written only once instead of being re-written by a chain of separate tools.
+ // The sigma filter stage is not enabled here: lib/new_lightcurve_sigma_filter that used to be
+ // started at this point was called without the SIGMA argument, so it did not change the lightcurves.
+ sprintf( stderr_output, "lib/postprocess_lightcurves" );
  if ( param_remove_bad_images == 1 ) {
-  if ( 0 != system( "lib/remove_bad_images" ) ) {
-   fprintf( stderr, "ERROR running  lib/remove_bad_images\n" );
-  }
-  if ( 0 != system( "lib/remove_lightcurves_with_small_number_of_points" ) ) {
-   fprintf( stderr, "ERROR running  lib/remove_lightcurves_with_small_number_of_points\n" );
-  }
+  sprintf( stderr_output + strlen( stderr_output ), " --remove-bad-images" );
  }
-
- // Apply sigma filter if we want...
- if ( param_nofilter != 1 && Num > 2 * HARD_MIN_NUMBER_OF_POINTS ) {
-  if ( debug != 0 )
-   fprintf( stderr, "DEBUG MSG: vast.c is starting lib/new_lightcurve_sigma_filter\n" );
-  if ( 0 != system( "lib/new_lightcurve_sigma_filter" ) ) {
-   fprintf( stderr, "ERROR running  lib/new_lightcurve_sigma_filter\n" );
-  }
-  if ( 0 != system( "lib/remove_lightcurves_with_small_number_of_points" ) ) {
-   fprintf( stderr, "ERROR running  lib/remove_lightcurves_with_small_number_of_points\n" );
-  }
+ if ( param_remove_bad_images == 1 || ( param_nofilter != 1 && Num + image_index_offset > 2 * HARD_MIN_NUMBER_OF_POINTS ) ) {
+  sprintf( stderr_output + strlen( stderr_output ), " --min-points %d --removed-list %s", HARD_MIN_NUMBER_OF_POINTS, VAST_APPEND_REMOVED_LIGHTCURVES_FILENAME );
+ }
+ if ( param_append_mode == 1 ) {
+  remove_lightcurves_deleted_by_previous_runs();
+ } else {
+  unlink( VAST_APPEND_REMOVED_LIGHTCURVES_FILENAME );
+ }
+ if ( debug != 0 ) {
+  fprintf( stderr, "DEBUG MSG: vast.c is starting %s\n", stderr_output );
+ }
+ // As with lib/remove_bad_images that used to be started here, an error is reported but does not stop VaST
+ if ( 0 != vast_profiled_system( stderr_output ) ) {
+  fprintf( stderr, "ERROR running  %s\n", stderr_output );
  }
 
  // Choose string to describe time system
@@ -5688,7 +6490,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
  if ( param_select_best_aperture_for_each_source == 1 ) {
   timing_select_aperture_start= time( NULL );
   fprintf( stderr, "Selecting the best aperture for each source\n" );
-  if ( 0 != system( "lib/select_aperture_with_smallest_scatter_for_each_object" ) ) {
+  if ( 0 != vast_profiled_system( "lib/select_aperture_with_smallest_scatter_for_each_object" ) ) {
    fprintf( stderr, "ERROR running  lib/select_aperture_with_smallest_scatter_for_each_object\n" );
    return EXIT_FAILURE;
   }
@@ -5699,14 +6501,14 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
  if ( number_of_sysrem_iterations > 0 || param_rescale_photometric_errors == 1 ) {
   // if( Num!=4 ){
   //  Compute lightcurve statistics!
-  if ( 0 != system( "util/nopgplot.sh -q" ) ) {
+  if ( 0 != vast_profiled_system( "util/nopgplot.sh -q" ) ) {
    fprintf( stderr, "ERROR running  util/nopgplot.sh -q\n" );
   }
   //}
  }
 
  if ( param_rescale_photometric_errors == 1 ) {
-  if ( 0 != system( "util/rescale_photometric_errors" ) ) {
+  if ( 0 != vast_profiled_system( "util/rescale_photometric_errors" ) ) {
    fprintf( stderr, "ERROR running  util/rescale_photometric_errors\n" );
   } // will use the list of constant stars
   // Some measurements may be rejected here due to large errors
@@ -5714,7 +6516,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
   // So we remove lightcurves which have too small number of points after rejecting high-error measurements
   if ( debug != 0 )
    fprintf( stderr, "DEBUG MSG: vast.c is starting lib/remove_lightcurves_with_small_number_of_points\n" );
-  if ( 0 != system( "lib/remove_lightcurves_with_small_number_of_points" ) ) {
+  if ( 0 != vast_profiled_system( "lib/remove_lightcurves_with_small_number_of_points" ) ) {
    fprintf( stderr, "ERROR running  lib/remove_lightcurves_with_small_number_of_points\n" );
   }
  }
@@ -5723,7 +6525,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
  timing_sysrem_start= time( NULL );
  for ( n= 0; n < number_of_sysrem_iterations; n++ ) {
   fprintf( stderr, "Starting SysRem iteration %d...\n", number_of_sysrem_iterations );
-  if ( 0 != system( "util/sysrem2" ) ) {
+  if ( 0 != vast_profiled_system( "util/sysrem2" ) ) {
    fprintf( stderr, "ERROR running  util/sysrem2\n" );
    return EXIT_FAILURE; // if we were asked to run SysRem but failed - abort
   }
@@ -5735,7 +6537,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
 
  /* Prepare list of possible transients */
  if ( param_failsafe == 0 ) {
-  if ( 0 != system( "lib/create_list_of_candidate_transients.sh" ) ) {
+  if ( 0 != vast_profiled_system( "lib/create_list_of_candidate_transients.sh" ) ) {
    fprintf( stderr, "ERROR running  lib/create_list_of_candidate_transients.sh\n" );
   }
   /*
@@ -5866,7 +6668,7 @@ counter_rejected_bad_psf_fit+= filter_on_float_parameters( STAR2, NUMBER2, sextr
   fprintf( stderr, "ERROR_SYSTEM004\n" );
  } // write date to the log file
 
- if ( Num <= SOFT_MIN_NUMBER_OF_POINTS && Num != 4 ) {
+ if ( Num + image_index_offset <= SOFT_MIN_NUMBER_OF_POINTS && Num != 4 ) {
   // if( 0 != strcmp("diffphot", basename(argv[0])) ) {
   if ( diffphot_flag != 1 ) {
    // suppress the message if we are in the manual differential photometry mode
@@ -5892,7 +6694,7 @@ the comparison stars and the variable star you want to measure.\n\n\n\n",
 
  // Perform manitude calibration if the calibration file is supplied and non-empty
  if ( count_lines_in_ASCII_file( "calib.txt" ) > 0 && N_manually_selected_comparison_stars > 0 ) {
-  if ( 0 != system( "util/calibrate_magnitude_scale `lib/fit_zeropoint`" ) ) {
+  if ( 0 != vast_profiled_system( "util/calibrate_magnitude_scale `lib/fit_zeropoint`" ) ) {
    fprintf( stderr, "ERROR running the magnitude calibration!" );
   }
  }
@@ -5905,15 +6707,20 @@ the comparison stars and the variable star you want to measure.\n\n\n\n",
 
  if ( Num != 4 ) {
   // Compute lightcurve statistics!
-  if ( 0 != system( "util/nopgplot.sh" ) ) {
+  if ( 0 != vast_profiled_system( "util/nopgplot.sh" ) ) {
    fprintf( stderr, "ERROR running util/nopgplot.sh\n" );
   }
   // Warn the user if the reference image does not look good
-  if ( 0 != system( "lib/evaluate_vast_image_details_log.sh" ) ) {
+  if ( 0 != vast_profiled_system( "lib/evaluate_vast_image_details_log.sh" ) ) {
    fprintf( stderr, "ERROR running lib/evaluate_vast_image_details_log.sh\n" );
   }
  }
 
+ // Write the per-stage timing and memory statistics next to vast_summary.log
+ if ( 0 == vast_profiling_write_json( VAST_PROFILING_JSON_FILENAME, Num, MATCH_SUCESS, TOTAL_OBS ) ) {
+  fprintf( stderr, "Per-stage timing and memory statistics are written to %s\n", VAST_PROFILING_JSON_FILENAME );
+ }
+
  /// Special mode for manual comparison star selection
  // if( 0 == strcmp("diffphot", basename(argv[0])) ) {
  if ( diffphot_flag == 1 ) {
@@ -379,14 +379,17 @@
 #define ANOVA_MAX_PERIOD 30.0 // days
 
 //// BLS/bls.c ////
-#define BLS_SIGMA 0.05 // assume all points have the same sigma
 #define BLS_CUT 7.3    // consider as real 
-                       // periods with snr>BLS_CUT
-#define BLS_MIN_FREQ 0.2
-#define BLS_MAX_FREQ 3.0
-#define BLS_FREQ_STEP 0.00002
-#define BLS_DI_MAX 24 // max. eclipse duration
-#define BLS_DI_MIN 8  // min. eclipse duration
+                       // periods with SDE>BLS_CUT
+#define BLS_MIN_FREQ 0.2 // 1/day, default lowest trial frequency
+#define BLS_MAX_FREQ 3.0 // 1/day, default highest trial frequency
+#define BLS_MIN_FRACTIONAL_DURATION 0.01 // shortest transit as a fraction of the period
+#define BLS_MAX_FRACTIONAL_DURATION 0.1  // longest transit as a fraction of the period
+#define BLS_NUMBER_OF_PHASE_BINS 200
+#define BLS_FREQUENCY_OVERSAMPLING 3.0 // the phase of the last point shifts by BLS_MIN_FRACTIONAL_DURATION/BLS_FREQUENCY_OVERSAMPLING between trial frequencies
+#define BLS_MAX_NUMBER_OF_FREQUENCIES 200000
+#define BLS_MIN_NUMBER_OF_POINTS 20 // do not search lightcurves with fewer points
+#define BLS_MIN_POINTS_IN_TRANSIT 3 // ignore boxes containing fewer points
 
 //// src/vast_math.c (stat) ////
 // This affects only the legacy sigma plot (2nd column in data.m_sigma and vast_lightcurve_statistics.log )
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/time.h>     // for gettimeofday()
+#include <sys/resource.h> // for getrusage()
+
+#include "vast_profiling.h"
+#include "get_number_of_cpu_cores.h"
+
+#define VAST_PROFILING_MAX_NUMBER_OF_STAGES 64
+
+struct Vast_profiling_snapshot {
+ double wall;
+ double cpu_user;
+ double cpu_system;
+ double children_cpu_user;
+ double children_cpu_system;
+ long long bytes_read;
+ long long bytes_written;
+};
+
+struct Vast_profiling_stage {
+ char name[VAST_PROFILING_STAGE_NAME_LENGTH];
+ char process[VAST_PROFILING_STAGE_NAME_LENGTH]; // the process that executed the stage
+ int is_running;
+ struct Vast_profiling_snapshot start;
+ long calls;
+ double wall;
+ double cpu_user;
+ double cpu_system;
+ double children_cpu_user;
+ double children_cpu_system;
+ long long bytes_read;
+ long long bytes_written;
+ long peak_rss_kb;
+ long number_of_images;
+ long number_of_points;
+};
+
+static struct Vast_profiling_stage vast_profiling_stages[VAST_PROFILING_MAX_NUMBER_OF_STAGES];
+static int vast_profiling_number_of_stages= 0;
+static struct Vast_profiling_snapshot vast_profiling_program_start;
+
+static double timeval_to_seconds( struct timeval tv ) {
+ return (double)tv.tv_sec + 1.0e-6 * (double)tv.tv_usec;
+}
+
+// ru_maxrss is in kilobytes on Linux and BSD, but in bytes on macOS
+static long maxrss_to_kb( long maxrss ) {
+#ifdef __APPLE__
+ return maxrss / 1024;
+#else
+ return maxrss;
+#endif
+}
+
+// Characters read and written by this process and its waited-for children.
+// This information is available only on Linux, elsewhere the counters stay at zero.
+static void read_proc_self_io( long long *bytes_read, long long *bytes_written ) {
+ FILE *procfile;
+ char string[256];
+ long long value;
+
+ ( *bytes_read )= 0;
+ ( *bytes_written )= 0;
+ procfile= fopen( "/proc/self/io", "r" );
+ if ( NULL == procfile ) {
+  return;
+ }
+ while ( NULL != fgets( string, 256, procfile ) ) {
+  if ( 1 == sscanf( string, "rchar: %lld", &value ) ) {
+   ( *bytes_read )= value;
+  } else if ( 1 == sscanf( string, "wchar: %lld", &value ) ) {
+   ( *bytes_written )= value;
+  }
+ }
+ fclose( procfile );
+ return;
+}
+
+static void take_snapshot( struct Vast_profiling_snapshot *snapshot ) {
+ struct timeval tv;
+ struct rusage usage;
+
+ gettimeofday( &tv, NULL );
+ snapshot->wall= timeval_to_seconds( tv );
+
+ getrusage( RUSAGE_SELF, &usage );
+ snapshot->cpu_user= timeval_to_seconds( usage.ru_utime );
+ snapshot->cpu_system= timeval_to_seconds( usage.ru_stime );
+
+ getrusage( RUSAGE_CHILDREN, &usage );
+ snapshot->children_cpu_user= timeval_to_seconds( usage.ru_utime );
+ snapshot->children_cpu_system= timeval_to_seconds( usage.ru_stime );
+
+ read_proc_self_io( &snapshot->bytes_read, &snapshot->bytes_written );
+ return;
+}
+
+static long get_peak_rss_kb( int who ) {
+ struct rusage usage;
+ if ( 0 != getrusage( who, &usage ) ) {
+  return 0;
+ }
+ return maxrss_to_kb( usage.ru_maxrss );
+}
+
+// Returns the stage with the given name, creating it if needed, or NULL if there are too many stages
+static struct Vast_profiling_stage *find_stage( const char *stage_name ) {
+ int i;
+ for ( i= 0; i < vast_profiling_number_of_stages; i++ ) {
+  if ( 0 == strncmp( vast_profiling_stages[i].name, stage_name, VAST_PROFILING_STAGE_NAME_LENGTH - 1 ) ) {
+   return &vast_profiling_stages[i];
+  }
+ }
+ if ( vast_profiling_number_of_stages == VAST_PROFILING_MAX_NUMBER_OF_STAGES ) {
+  return NULL;
+ }
+ memset( &vast_profiling_stages[vast_profiling_number_of_stages], 0, sizeof( struct Vast_profiling_stage ) );
+ strncpy( vast_profiling_stages[vast_profiling_number_of_stages].name, stage_name, VAST_PROFILING_STAGE_NAME_LENGTH - 1 );
+ vast_profiling_stages[vast_profiling_number_of_stages].name[VAST_PROFILING_STAGE_NAME_LENGTH - 1]= '\0';
+ strncpy( vast_profiling_stages[vast_profiling_number_of_stages].process, "main", VAST_PROFILING_STAGE_NAME_LENGTH - 1 );
+ vast_profiling_number_of_stages++;
+ return &vast_profiling_stages[vast_profiling_number_of_stages - 1];
+}
+
+void vast_profiling_init() {
+ vast_profiling_number_of_stages= 0;
+ take_snapshot( &vast_profiling_program_start );
+ return;
+}
+
+void vast_profiling_start( const char *stage_name ) {
+ struct Vast_profiling_stage *stage;
+ stage= find_stage( stage_name );
+ if ( NULL == stage ) {
+  return;
+ }
+ take_snapshot( &stage->start );
+ stage->is_running= 1;
+ return;
+}
+
+void vast_profiling_stop( const char *stage_name, long number_of_images, long number_of_points ) {
+ struct Vast_profiling_stage *stage;
+ struct Vast_profiling_snapshot now;
+ long peak_rss_kb;
+
+ stage= find_stage( stage_name );
+ if ( NULL == stage ) {
+  return;
+ }
+ if ( stage->is_running == 0 ) {
+  return;
+ }
+ take_snapshot( &now );
+ stage->is_running= 0;
+ stage->calls++;
+ stage->wall+= now.wall - stage->start.wall;
+ stage->cpu_user+= now.cpu_user - stage->start.cpu_user;
+ stage->cpu_system+= now.cpu_system - stage->start.cpu_system;
+ stage->children_cpu_user+= now.children_cpu_user - stage->start.children_cpu_user;
+ stage->children_cpu_system+= now.children_cpu_system - stage->start.children_cpu_system;
+ stage->bytes_read+= now.bytes_read - stage->start.bytes_read;
+ stage->bytes_written+= now.bytes_written - stage->start.bytes_written;
+ stage->number_of_images+= number_of_images;
+ stage->number_of_points+= number_of_points;
+ // The peak RSS is the maximum over the whole process run up to the end of this stage,
+ // not the memory used by this stage alone
+ peak_rss_kb= get_peak_rss_kb( RUSAGE_SELF );
+ if ( peak_rss_kb > stage->peak_rss_kb ) {
+  stage->peak_rss_kb= peak_rss_kb;
+ }
+ return;
+}
+
+// Run the command with system() and account for it as a stage named after the executable,
+// so "lib/remove_bad_images" becomes "remove_bad_images"
+int vast_profiled_system( const char *command ) {
+ char stage_name[VAST_PROFILING_STAGE_NAME_LENGTH];
+ const char *name_start;
+ const char *c;
+ int name_length;
+ int system_exit_code;
+
+ name_start= command;
+ while ( *name_start == ' ' ) {
+  name_start++;
+ }
+ for ( c= name_start; *c != '\0' && *c != ' '; c++ ) {
+  if ( *c == '/' ) {
+   name_start= c + 1;
+  }
+ }
+ name_length= (int)( c - name_start );
+ if ( name_length > VAST_PROFILING_STAGE_NAME_LENGTH - 1 ) {
+  name_length= VAST_PROFILING_STAGE_NAME_LENGTH - 1;
+ }
+ memcpy( stage_name, name_start, name_length );
+ stage_name[name_length]= '\0';
+
+ vast_profiling_start( stage_name );
+ system_exit_code= system( command );
+ vast_profiling_stop( stage_name, 0, 0 );
+
+ return system_exit_code;
+}
+
+// Copy the statistics of a finished stage; returns 1 if there is no such stage
+int vast_profiling_get_stage_report( const char *stage_name, struct Vast_profiling_stage_report *report ) {
+ struct Vast_profiling_stage *stage;
+ memset( report, 0, sizeof( struct Vast_profiling_stage_report ) );
+ stage= find_stage( stage_name );
+ if ( NULL == stage || stage->calls == 0 ) {
+  return 1;
+ }
+ memcpy( report->name, stage->name, VAST_PROFILING_STAGE_NAME_LENGTH );
+ report->name[VAST_PROFILING_STAGE_NAME_LENGTH - 1]= '\0';
+ report->calls= stage->calls;
+ report->wall= stage->wall;
+ report->cpu_user= stage->cpu_user;
+ report->cpu_system= stage->cpu_system;
+ report->children_cpu_user= stage->children_cpu_user;
+ report->children_cpu_system= stage->children_cpu_system;
+ report->bytes_read= stage->bytes_read;
+ report->bytes_written= stage->bytes_written;
+ report->peak_rss_kb= stage->peak_rss_kb;
+ report->number_of_images= stage->number_of_images;
+ report->number_of_points= stage->number_of_points;
+ return 0;
+}
+
+// Add the statistics of a stage executed by another process
+void vast_profiling_add_stage_report( const struct Vast_profiling_stage_report *report, const char *process_name ) {
+ struct Vast_profiling_stage *stage;
+ char stage_name[VAST_PROFILING_STAGE_NAME_LENGTH];
+ memcpy( stage_name, report->name, VAST_PROFILING_STAGE_NAME_LENGTH );
+ stage_name[VAST_PROFILING_STAGE_NAME_LENGTH - 1]= '\0';
+ stage= find_stage( stage_name );
+ if ( NULL == stage ) {
+  return;
+ }
+ strncpy( stage->process, process_name, VAST_PROFILING_STAGE_NAME_LENGTH - 1 );
+ stage->process[VAST_PROFILING_STAGE_NAME_LENGTH - 1]= '\0';
+ stage->calls+= report->calls;
+ stage->wall+= report->wall;
+ stage->cpu_user+= report->cpu_user;
+ stage->cpu_system+= report->cpu_system;
+ stage->children_cpu_user+= report->children_cpu_user;
+ stage->children_cpu_system+= report->children_cpu_system;
+ stage->bytes_read+= report->bytes_read;
+ stage->bytes_written+= report->bytes_written;
+ if ( report->peak_rss_kb > stage->peak_rss_kb ) {
+  stage->peak_rss_kb= report->peak_rss_kb;
+ }
+ stage->number_of_images+= report->number_of_images;
+ stage->number_of_points+= report->number_of_points;
+ return;
+}
+
+static double rate_per_second( long count, double seconds ) {
+ if ( count <= 0 || seconds <= 0.0 ) {
+  return 0.0;
+ }
+ return (double)count / seconds;
+}
+
+static void write_json_stage( FILE *jsonfile, const struct Vast_profiling_stage *stage, int is_last ) {
+ const char *c;
+ fprintf( jsonfile, "  {\"name\": \"" );
+ // The stage names come from the code and the command lines, escape just in case
+ for ( c= stage->name; *c != '\0'; c++ ) {
+  if ( *c == '"' || *c == '\\' ) {
+   fputc( '\\', jsonfile );
+  }
+  fputc( *c, jsonfile );
+ }
+ fprintf( jsonfile, "\", \"process\": \"%s\", \"calls\": %ld, \"wall_time_sec\": %.6lf, \"cpu_user_sec\": %.6lf, \"cpu_system_sec\": %.6lf, \"children_cpu_user_sec\": %.6lf, \"children_cpu_system_sec\": %.6lf, ",
+          stage->process, stage->calls, stage->wall, stage->cpu_user, stage->cpu_system, stage->children_cpu_user, stage->children_cpu_system );
+ fprintf( jsonfile, "\"bytes_read\": %lld, \"bytes_written\": %lld, \"process_peak_rss_kb\": %ld, \"images\": %ld, \"points\": %ld, \"images_per_sec\": %.3lf, \"points_per_sec\": %.3lf}%s\n",
+          stage->bytes_read, stage->bytes_written, stage->peak_rss_kb, stage->number_of_images, stage->number_of_points,
+          rate_per_second( stage->number_of_images, stage->wall ), rate_per_second( stage->number_of_points, stage->wall ), ( is_last ? "" : "," ) );
+ return;
+}
+
+// Write the accumulated statistics together with the whole-run totals
+int vast_profiling_write_json( const char *json_filename, long number_of_images, long number_of_matched_images, long number_of_points ) {
+ FILE *jsonfile;
+ struct Vast_profiling_stage total;
+ struct Vast_profiling_snapshot now;
+ int i;
+
+ take_snapshot( &now );
+ memset( &total, 0, sizeof( struct Vast_profiling_stage ) );
+ strncpy( total.name, "total", VAST_PROFILING_STAGE_NAME_LENGTH - 1 );
+ strncpy( total.process, "main", VAST_PROFILING_STAGE_NAME_LENGTH - 1 );
+ total.calls= 1;
+ total.wall= now.wall - vast_profiling_program_start.wall;
+ total.cpu_user= now.cpu_user - vast_profiling_program_start.cpu_user;
+ total.cpu_system= now.cpu_system - vast_profiling_program_start.cpu_system;
+ total.children_cpu_user= now.children_cpu_user - vast_profiling_program_start.children_cpu_user;
+ total.children_cpu_system= now.children_cpu_system - vast_profiling_program_start.children_cpu_system;
+ total.bytes_read= now.bytes_read - vast_profiling_program_start.bytes_read;
+ total.bytes_written= now.bytes_written - vast_profiling_program_start.bytes_written;
+ total.peak_rss_kb= get_peak_rss_kb( RUSAGE_SELF );
+ total.number_of_images= number_of_images;
+ total.number_of_points= number_of_points;
+
+ jsonfile= fopen( json_filename, "w" );
+ if ( NULL == jsonfile ) {
+  fprintf( stderr, "ERROR: cannot open %s for writing!\n", json_filename );
+  return 1;
+ }
+ fprintf( jsonfile, "{\n" );
+ fprintf( jsonfile, " \"number_of_cpu_cores\": %d,\n", get_number_of_cpu_cores() );
+ fprintf( jsonfile, " \"images\": %ld,\n", number_of_images );
+ fprintf( jsonfile, " \"matched_images\": %ld,\n", number_of_matched_images );
+ fprintf( jsonfile, " \"points\": %ld,\n", number_of_points );
+ fprintf( jsonfile, " \"peak_rss_kb\": %ld,\n", total.peak_rss_kb );
+ fprintf( jsonfile, " \"children_peak_rss_kb\": %ld,\n", get_peak_rss_kb( RUSAGE_CHILDREN ) );
+ fprintf( jsonfile, " \"stages\": [\n" );
+ for ( i= 0; i < vast_profiling_number_of_stages; i++ ) {
+  write_json_stage( jsonfile, &vast_profiling_stages[i], 0 );
+ }
+ write_json_stage( jsonfile, &total, 1 );
+ fprintf( jsonfile, " ]\n" );
+ fprintf( jsonfile, "}\n" );
+ fclose( jsonfile );
+
+ return 0;
+}
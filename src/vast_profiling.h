@@ -0,0 +1,42 @@
+// The following line is just to make sure this file is not included twice in the code
+#ifndef VAST_PROFILING_INCLUDE_FILE
+
+// Per-stage wall-clock/CPU time, peak memory and I/O accounting for the main VaST program.
+// Stages are identified by name; starting and stopping a stage with the same name
+// many times (e.g. once per image) accumulates the statistics.
+// The functions are not thread-safe and should be called from the main thread only.
+// The peak memory reported for a stage is the peak RSS of the whole process up to the end of that stage,
+// so it is named process_peak_rss_kb in the JSON file.
+
+#define VAST_PROFILING_JSON_FILENAME "vast_profiling.json"
+#define VAST_PROFILING_STAGE_NAME_LENGTH 64
+
+// Statistics of a stage, used to pass them from another process (the SExtractor dispatcher) through a pipe
+struct Vast_profiling_stage_report {
+ char name[VAST_PROFILING_STAGE_NAME_LENGTH];
+ long calls;
+ double wall;
+ double cpu_user;
+ double cpu_system;
+ double children_cpu_user;
+ double children_cpu_system;
+ long long bytes_read;
+ long long bytes_written;
+ long peak_rss_kb;
+ long number_of_images;
+ long number_of_points;
+};
+
+void vast_profiling_init();
+void vast_profiling_start( const char *stage_name );
+void vast_profiling_stop( const char *stage_name, long number_of_images, long number_of_points );
+int vast_profiled_system( const char *command );
+int vast_profiling_get_stage_report( const char *stage_name, struct Vast_profiling_stage_report *report );
+void vast_profiling_add_stage_report( const struct Vast_profiling_stage_report *report, const char *process_name );
+int vast_profiling_write_json( const char *json_filename, long number_of_images, long number_of_matched_images, long number_of_points );
+
+// The macro below will tell the pre-processor that this header file is already included
+#define VAST_PROFILING_INCLUDE_FILE
+
+#endif
+// VAST_PROFILING_INCLUDE_FILE
@@ -695,6 +695,34 @@ size_t binary_search_first( struct Observation *arr, size_t size, int target ) {
  return left;
 }
 
+// Make sure the observation buffer has room for at least required_number_of_observations.
+// The buffer grows geometrically, so adding observations one by one does not call realloc() for each of them.
+// On failure the old buffer and its capacity are left untouched.
+int grow_observation_buffer( struct Observation **observations, long *capacity, long required_number_of_observations ) {
+ struct Observation *new_observations;
+ long new_capacity;
+
+ if ( required_number_of_observations <= ( *capacity ) ) {
+  return 0;
+ }
+ new_capacity= ( *capacity ) + ( *capacity ) / 2;
+ if ( new_capacity < required_number_of_observations ) {
+  new_capacity= required_number_of_observations;
+ }
+ new_observations= realloc( ( *observations ), sizeof( struct Observation ) * (size_t)new_capacity );
+ if ( NULL == new_observations ) {
+  // Try to get just as much memory as we need right now
+  new_capacity= required_number_of_observations;
+  new_observations= realloc( ( *observations ), sizeof( struct Observation ) * (size_t)new_capacity );
+  if ( NULL == new_observations ) {
+   return 1;
+  }
+ }
+ ( *observations )= new_observations;
+ ( *capacity )= new_capacity;
+ return 0;
+}
+
 void write_images_catalogs_logfile( char **filelist, int n ) {
  FILE *f;
  int i;
@@ -710,6 +738,24 @@ void write_images_catalogs_logfile( char **filelist, int n ) {
  return;
 }
 
+// Append the new images to vast_images_catalogs.log of the previous run, numbering their catalogs
+// starting from first_image_number. The first element of filelist (the reference image) is skipped
+// as it is already listed in the log.
+void append_images_catalogs_logfile( char **filelist, int n, int first_image_number ) {
+ FILE *f;
+ int i;
+ f= fopen( "vast_images_catalogs.log", "a" );
+ if ( NULL == f ) {
+  fprintf( stderr, "ERROR in append_images_catalogs_logfile() while opening file %s for writing\n", "vast_images_catalogs.log" );
+  return;
+ }
+ for ( i= 1; i < n; i++ ) {
+  fprintf( f, "image%05d.cat %s\n", first_image_number + i - 1, filelist[i] );
+ }
+ fclose( f );
+ return;
+}
+
 /* Write data on magnitude calibration to the log file */
 void write_magnitude_calibration_log( double *mag1, double *mag2, double *mag_err, int N, char *fitsimagename ) {
  char logfilename[FILENAME_LENGTH];
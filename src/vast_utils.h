@@ -30,7 +30,9 @@ int find_catalog_in_vast_images_catalogs_log( char *fitsfilename, char *catalogf
 void extract_mag_and_snr_from_structStar( const struct Star *stars, size_t n_stars, double *mag_array, double *snr_array );
 int compare_star_num( const void *a, const void *b );
 size_t binary_search_first( struct Observation *arr, size_t size, int target );
+int grow_observation_buffer( struct Observation **observations, long *capacity, long required_number_of_observations );
 void write_images_catalogs_logfile( char **filelist, int n );
+void append_images_catalogs_logfile( char **filelist, int n, int first_image_number );
 void write_magnitude_calibration_log( double *mag1, double *mag2, double *mag_err, int N, char *fitsimagename );
 void write_magnitude_calibration_log2( double *mag1, double *mag2, double *mag_err, int N, char *fitsimagename );
 void write_magnitude_calibration_log_plane( double *mag1, double *mag2, double *mag_err, int N, char *fitsimagename, double A, double B, double C );
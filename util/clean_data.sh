@@ -47,7 +47,7 @@ if [ -x lib/fast_clean_data ];then
  lib/fast_clean_data # This will quickly remove out*dat files
 fi
 # Remember! We are removing WCS-calibrated images too!
-for i in out*dat* aavso_out*.dat* out*.dat_hjd wcs_* resample_* coadd.* *.chk image*.cat* image*.log image*.calib* ;do
+for i in out*dat* aavso_out*.dat* vast_append_state.bin* vast_append_removed_lightcurves.log out*.dat_hjd wcs_* resample_* coadd.* *.chk image*.cat* image*.log image*.calib* ;do
  rm -f $i
 done
 # Remove possible leftovers from WCS calibration process
@@ -75,7 +75,7 @@ done
 if [ -d selected ];then
  rm -rf selected/
 fi
-for i in vast*.log ucac5_server_status.log gaia_dr2_test_output.log vast_list_of_all_stars.ds9 vast_list_of_all_stars.ds9.reg wcs.fit m_sigma_bin.tmp sysrem_input_star_list.lst* ref_frame_sextractor.cat util/convert/*~ bright_star_blend_check_*.sex ;do
+for i in vast*.log vast_profiling.json ucac5_server_status.log gaia_dr2_test_output.log vast_list_of_all_stars.ds9 vast_list_of_all_stars.ds9.reg wcs.fit m_sigma_bin.tmp sysrem_input_star_list.lst* ref_frame_sextractor.cat util/convert/*~ bright_star_blend_check_*.sex ;do
  if [ -f "$i" ];then
   rm -f "$i"
  fi
@@ -0,0 +1,187 @@
+#!/usr/bin/env bash
+#
+# End-to-end throughput benchmark of VaST on reproducible synthetic image series.
+# For each benchmark configuration the script simulates a star field with
+# lib/make_synthetic_image_series, runs the full VaST pipeline on it (source extraction,
+# matching, magnitude calibration and lightcurve post-processing) and prints
+# the per-stage timing from vast_profiling.json against the stored baseline.
+#
+# Usage:
+#  util/examples/benchmark_vast.sh [--update-baseline] [--force] [CONFIG_NAME ...]
+#
+# CONFIG_NAME is one of the configurations listed below (default: small).
+# A custom configuration may be specified with the environment variable
+#  BENCHMARK_CUSTOM="NX NY NUMBER_OF_STARS NUMBER_OF_FRAMES ROTATION_DEG_PER_FRAME SHIFT_PIX"
+# and the configuration name "custom".
+# --update-baseline  replace the stored baseline of the benchmarked configurations with the new results
+# --force            run even if there are VaST results in the current directory (they will be deleted!)
+# BENCHMARK_TOLERANCE (default 1.25) sets the slowdown factor reported as a regression;
+# the script exits with code 1 if any stage taking longer than 0.1 sec regressed.
+#
+# The script should be started from the VaST directory.
+#
+
+#################################
+# Set the safe locale that should be available on any POSIX system
+LC_ALL=C
+LANGUAGE=C
+export LANGUAGE LC_ALL
+#################################
+
+BENCHMARK_DATA_DIR="benchmark_data"
+BENCHMARK_BASELINE_FILE="util/examples/benchmark_vast_baselines.txt"
+BENCHMARK_VAST_OPTIONS="-u -f"
+if [ -z "$BENCHMARK_TOLERANCE" ];then
+ BENCHMARK_TOLERANCE=1.25
+fi
+
+# name  NX  NY  number_of_stars  number_of_frames  rotation(deg/frame)  shift(pix)
+function benchmark_configuration {
+ case "$1" in
+ "small")
+  echo "1024 1024 1000 20 0.0 3.0"
+  ;;
+ "medium")
+  echo "2048 2048 4000 50 0.02 5.0"
+  ;;
+ "large")
+  echo "4096 4096 16000 100 0.01 10.0"
+  ;;
+ "custom")
+  echo "$BENCHMARK_CUSTOM"
+  ;;
+ *)
+  echo ""
+  ;;
+ esac
+}
+
+UPDATE_BASELINE=0
+FORCE=0
+CONFIGS=""
+for ARG in "$@" ;do
+ case "$ARG" in
+ "--update-baseline")
+  UPDATE_BASELINE=1
+  ;;
+ "--force")
+  FORCE=1
+  ;;
+ *)
+  CONFIGS="$CONFIGS $ARG"
+  ;;
+ esac
+done
+if [ -z "$CONFIGS" ];then
+ CONFIGS="small"
+fi
+
+for REQUIRED_FILE in vast lib/make_synthetic_image_series util/clean_data.sh ;do
+ if [ ! -x "$REQUIRED_FILE" ];then
+  echo "ERROR: cannot find $REQUIRED_FILE -- please run this script from the VaST directory after compiling VaST"
+  exit 1
+ fi
+done
+
+if [ $FORCE -eq 0 ];then
+ for i in out*.dat ;do
+  if [ -f "$i" ];then
+   echo "ERROR: the current directory contains VaST results that will be deleted by the benchmark!
+Save them with util/save.sh or re-run the benchmark with --force"
+   exit 1
+  fi
+  break
+ done
+fi
+
+if [ ! -d "$BENCHMARK_DATA_DIR" ];then
+ mkdir "$BENCHMARK_DATA_DIR" || exit 1
+fi
+
+REGRESSION=0
+for CONFIG in $CONFIGS ;do
+ PARAMETERS=$(benchmark_configuration "$CONFIG")
+ if [ $(echo "$PARAMETERS" | wc -w) -ne 6 ];then
+  echo "ERROR: unknown benchmark configuration '$CONFIG' (or BENCHMARK_CUSTOM is not set properly)"
+  exit 1
+ fi
+ read NX NY NSTARS NFRAMES ROTATION SHIFT <<< "$PARAMETERS"
+ # The configuration key includes all the parameters, so the baseline is never compared
+ # against the results obtained with a different custom configuration
+ CONFIG_KEY="${CONFIG}_${NX}x${NY}_${NSTARS}stars_${NFRAMES}frames_rot${ROTATION}_shift${SHIFT}"
+
+ # The images are reproducible, so re-use them if they were already simulated
+ IMAGE_DIR="$BENCHMARK_DATA_DIR/$CONFIG_KEY"
+ if [ $(ls "$IMAGE_DIR"/synthetic*.fit 2>/dev/null | wc -l) -ne $NFRAMES ];then
+  echo "Simulating $NFRAMES ${NX}x${NY} images with $NSTARS stars in $IMAGE_DIR"
+  rm -rf "$IMAGE_DIR"
+  lib/make_synthetic_image_series --nx $NX --ny $NY --stars $NSTARS --frames $NFRAMES --rotation $ROTATION --shift $SHIFT --output "$IMAGE_DIR" 2>/dev/null
+  if [ $? -ne 0 ];then
+   echo "ERROR simulating images for the benchmark configuration $CONFIG"
+   exit 1
+  fi
+ fi
+
+ echo "Running VaST on the benchmark configuration $CONFIG_KEY"
+ util/clean_data.sh all > /dev/null 2>&1
+ ./vast $BENCHMARK_VAST_OPTIONS "$IMAGE_DIR"/synthetic*.fit > "$BENCHMARK_DATA_DIR/$CONFIG_KEY.log" 2>&1
+ if [ $? -ne 0 ];then
+  echo "ERROR running VaST, see $BENCHMARK_DATA_DIR/$CONFIG_KEY.log"
+  exit 1
+ fi
+ if [ ! -s vast_profiling.json ];then
+  echo "ERROR: vast_profiling.json was not created"
+  exit 1
+ fi
+ cp vast_profiling.json "$BENCHMARK_DATA_DIR/$CONFIG_KEY.json"
+
+ # vast_profiling.json has one line per stage: extract name, wall time and throughput
+ grep '"name":' vast_profiling.json | sed -e 's/[{}",]/ /g' -e 's/: / /g' | awk -v key="$CONFIG_KEY" '{
+  name=""; wall=0; ips=0; pps=0
+  for(i=1;i<NF;i++){
+   if($i=="name") name=$(i+1)
+   if($i=="wall_time_sec") wall=$(i+1)
+   if($i=="images_per_sec") ips=$(i+1)
+   if($i=="points_per_sec") pps=$(i+1)
+  }
+  printf "%s %s %.6f %.3f %.3f\n", key, name, wall, ips, pps
+ }' > "$BENCHMARK_DATA_DIR/$CONFIG_KEY.results"
+
+ echo "
+Benchmark $CONFIG_KEY (tolerance $BENCHMARK_TOLERANCE)"
+ printf "%-45s %10s %10s %12s %10s %8s\n" "stage" "wall(s)" "images/s" "points/s" "base(s)" "ratio"
+ while read KEY STAGE WALL IPS PPS ;do
+  BASELINE_WALL=""
+  if [ -f "$BENCHMARK_BASELINE_FILE" ];then
+   BASELINE_WALL=$(awk -v key="$KEY" -v stage="$STAGE" '$1==key && $2==stage {print $3}' "$BENCHMARK_BASELINE_FILE" | tail -n1)
+  fi
+  if [ -z "$BASELINE_WALL" ];then
+   printf "%-45s %10.3f %10.3f %12.1f %10s %8s\n" "$STAGE" $WALL $IPS $PPS "-" "-"
+   continue
+  fi
+  STATUS=$(echo "$WALL $BASELINE_WALL $BENCHMARK_TOLERANCE" | awk '{ratio=($2>0)?$1/$2:0; flag=""; if($1>0.1 && $1>$2*$3) flag=" SLOWER"; printf "%8.2f%s", ratio, flag}')
+  printf "%-45s %10.3f %10.3f %12.1f %10.3f %s\n" "$STAGE" $WALL $IPS $PPS $BASELINE_WALL "$STATUS"
+  if echo "$STATUS" | grep --quiet 'SLOWER' ;then
+   REGRESSION=1
+  fi
+ done < "$BENCHMARK_DATA_DIR/$CONFIG_KEY.results"
+
+ if [ $UPDATE_BASELINE -eq 1 ];then
+  if [ -f "$BENCHMARK_BASELINE_FILE" ];then
+   grep -v "^$CONFIG_KEY " "$BENCHMARK_BASELINE_FILE" > "$BENCHMARK_BASELINE_FILE.tmp"
+  else
+   echo "# config_key stage wall_time_sec images_per_sec points_per_sec" > "$BENCHMARK_BASELINE_FILE.tmp"
+  fi
+  cat "$BENCHMARK_DATA_DIR/$CONFIG_KEY.results" >> "$BENCHMARK_BASELINE_FILE.tmp"
+  mv "$BENCHMARK_BASELINE_FILE.tmp" "$BENCHMARK_BASELINE_FILE"
+  echo "Updated the baseline for $CONFIG_KEY in $BENCHMARK_BASELINE_FILE"
+ fi
+done
+
+if [ $REGRESSION -ne 0 ];then
+ echo "
+Some stages are slower than the baseline by more than a factor of $BENCHMARK_TOLERANCE"
+ exit 1
+fi
+
+exit 0